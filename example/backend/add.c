@@ -1,35 +1,44 @@
-#include "onnx.h"
+#include "onnx-runtime.h"
 
 void add(const float *input,              // pointer to vector
          const float *bias,             // pointer to matrix
-         const uint16_t dim_vec,         // length of the vector
+         const uint32_t dim_vec,         // length of the vector
          float *output)
 {
-    for (int i = 0; i < dim_vec; i++)
+    for (uint32_t i = 0; i < dim_vec; i++)
     {
         output[i] = input[i] + bias[i];
     }
 }
 
-float* add_layer(Onnx__GraphProto* graph, const float *input, int64_t* shapeInput, int64_t* shapeOutput, const char* layer_name)
+// Items are elements of the whole batch
+static void add_task(void* arg, int64_t begin, int64_t end)
 {
-    assert(graph != NULL && input != NULL && layer_name != "" );
+    const onnx_plan_step* step = ((onnx_step_task*) arg)->step;
+    float** slots = ((onnx_step_task*) arg)->slots;
+    int64_t len = onnx_tensor_sample(&step->in);
+    const onnx_kernels* kernels = onnx_kernels_active;
 
-    Onnx__NodeProto* node = onnx_graph_get_node_by_name(graph, layer_name);
-    const char* bias = node->input[1];
-
-    float* B = onnx_graph_get_weights_by_name(graph, bias);
-    int64_t* shapeB =  onnx_graph_get_dims_by_name(graph, bias);
-    if(shapeB == NULL)
+    if(step->input[1] >= 0)
     {
-        return NULL;
+        kernels->add(slots[step->input[0]] + begin, slots[step->input[1]] + begin, end - begin, slots[step->output] + begin);
+        return;
     }
 
-    float* output = (float*) malloc(sizeof(float)*shapeB[0]);
-    memset(output, 0, sizeof(sizeof(float)*shapeB[0]));
-    add(input, B, shapeB[0], output);
+    // The bias is broadcast over the batch
+    while(begin < end)
+    {
+        int64_t i = begin % len;
+        int64_t n = len - i < end - begin ? len - i : end - begin;
+        kernels->add(slots[step->input[0]] + begin, step->bias + i, n, slots[step->output] + begin);
+        begin += n;
+    }
+}
 
-    memcpy(shapeInput, shapeOutput, sizeof(int64_t)*3);
+void add_step(const onnx_plan_step* step, float** slots, onnx_pool* pool)
+{
+    onnx_step_task task = { step, slots };
+    int64_t len = onnx_tensor_numel(&step->in);
 
-    return output;
+    onnx_pool_parallel_for(pool, len, ONNX_POOL_GRAIN, add_task, &task);
 }
@@ -0,0 +1,53 @@
+#include "onnx.h"
+
+// The bias is broadcast over the input, batch included
+int add_layer(onnx_graph_index* index, const onnx_tensor* input, onnx_tensor* output, const char* layer_name)
+{
+    assert(index != NULL && input != NULL && input->data != NULL && layer_name != "" );
+
+    Onnx__NodeProto* node = onnx_graph_index_get_node_by_name(index, layer_name);
+    if(node == NULL || node->n_input < 2)
+    {
+        return -1;
+    }
+    const onnx_tensor_view* view = onnx_graph_index_get_view_by_name(index, node->input[1]);
+    onnx_tensor bias;
+    if(view == NULL || onnx_tensor_from_view(view, &bias) != 0 ||
+       onnx_tensor_broadcast(&bias, input->rank, input->dims, &bias) != 0)
+    {
+        printf("Add %s: bias does not broadcast to the input\n", node->name);
+        return -1;
+    }
+
+    *output = *input;
+    if(onnx_tensor_alloc(output, NULL) != 0 || onnx_tensor_copy(&bias, output) != 0)
+    {
+        onnx_tensor_release(output);
+        return -1;
+    }
+    add((const float*) input->data, (const float*) output->data, onnx_tensor_numel(input), (float*) output->data);
+
+    return 0;
+}
+
+int add_plan(onnx_plan* plan, Onnx__NodeProto* node, onnx_plan_step* step)
+{
+    // The second operand is either a bound bias or another activation slot.
+    // A bias smaller than a sample is broadcast once, into a pack.
+    if(step->input[1] < 0)
+    {
+        onnx_tensor sample = step->in;
+        sample.dims[0] = 1;
+        step->bias = onnx_plan_broadcast_weights(plan, node->input[1], &sample);
+        if(step->bias == NULL)
+        {
+            printf("Add %s: bias does not broadcast to a sample\n", node->name);
+            return -1;
+        }
+    }
+
+    step->out = step->in;
+    step->kernel = add_step;
+
+    return 0;
+}
@@ -1,113 +1,472 @@
-#include "onnx.h"
+#include "onnx-runtime.h"
 
-void conv2D(const float *input,                                                // input image
-            const uint16_t dim_im_in_x,                                        // input image dimention x
-            const uint16_t dim_im_in_y,                                        // input image dimention y
-            const uint16_t ch_im_in,                                           // number of input image channels
-            const float *weight,                                               // kernel weights
-            const uint16_t ch_im_out,                                          // number of filters, i.e., output image channels
-            const uint16_t dim_kernel_x,                                       // filter kernel size x
-            const uint16_t dim_kernel_y,                                       // filter kernel size y
-            const uint16_t padding_x,                                          // padding sizes x
-            const uint16_t padding_y,                                          // padding sizes y
-            const uint16_t stride_x,                                           // stride x
-            const uint16_t stride_y,                                           // stride y
-            const float *bias,                                                 // bias
-            float *output,                                                     // output image
-            const uint16_t dim_im_out_x,                                       // output image dimension x
-            const uint16_t dim_im_out_y                                        // output image dimension y
-)
+// Filter i at output pixel (j, k), bias included
+static inline float conv2D_pixel(const float *input,
+                                 const int64_t dim_im_in_x,
+                                 const int64_t dim_im_in_y,
+                                 const int64_t ch_im_in,
+                                 const float *weight,
+                                 const int64_t dim_kernel_x,
+                                 const int64_t dim_kernel_y,
+                                 const int64_t padding_x,
+                                 const int64_t padding_y,
+                                 const int64_t stride_x,
+                                 const int64_t stride_y,
+                                 const float *bias,
+                                 int i, int j, int k,
+                                 const onnx_kernels *kernels)
 {
-    int i, j, k, l, m, n;
-    float conv_out = 0.0f;
-    int in_row, in_col;
+    float conv_out = bias[i];
+    int m, in_row, n_begin, n_end;
 
-    // For each filter
-    for (i = 0; i < ch_im_out; i++)
+    // For each kernel row
+    for (m = 0; m < dim_kernel_y; m++)
     {
-        // For each image dimension
-        for (j = 0; j < dim_im_out_y; j++)
+        in_row = stride_y * j + m - padding_y;
+        if (in_row < 0 || in_row >= dim_im_in_y)
+        {
+            continue;
+        }
+        // The taps of a kernel row that fall inside the image are one
+        // contiguous run in both the NWHC image and the OHWI filter
+        n_begin = padding_x - stride_x * k > 0 ? padding_x - stride_x * k : 0;
+        n_end = dim_im_in_x + padding_x - stride_x * k < dim_kernel_x ? dim_im_in_x + padding_x - stride_x * k : dim_kernel_x;
+        if (n_begin < n_end)
         {
-            for (k = 0; k < dim_im_out_x; k++)
+            conv_out += kernels->dot(&input[(in_row * dim_im_in_x + stride_x * k + n_begin - padding_x) * ch_im_in],
+                                     &weight[i * ch_im_in * dim_kernel_y * dim_kernel_x + (m * dim_kernel_x + n_begin) * ch_im_in],
+                                     (n_end - n_begin) * ch_im_in);
+        }
+    }
+    return conv_out;
+}
+
+// Output rows [out_y_begin, out_y_end) of conv2D; output points at row out_y_begin
+static void conv2D_rows(const float *input,
+                        const int64_t dim_im_in_x,
+                        const int64_t dim_im_in_y,
+                        const int64_t ch_im_in,
+                        const float *weight,
+                        const int64_t ch_im_out,
+                        const int64_t dim_kernel_x,
+                        const int64_t dim_kernel_y,
+                        const int64_t padding_x,
+                        const int64_t padding_y,
+                        const int64_t stride_x,
+                        const int64_t stride_y,
+                        const float *bias,
+                        float *output,
+                        const int64_t dim_im_out_x,
+                        const int64_t out_y_begin,
+                        const int64_t out_y_end,
+                        const int relu,
+                        const onnx_kernels *kernels)
+{
+    int i, j, k;
+    float conv_out;
+
+    // For each output pixel; its filters write one contiguous run of channels
+    for (j = out_y_begin; j < out_y_end; j++)
+    {
+        for (k = 0; k < dim_im_out_x; k++)
+        {
+            float* out = output + ((j - out_y_begin) * dim_im_out_x + k) * ch_im_out;
+            for (i = 0; i < ch_im_out; i++)
+            {
+                conv_out = conv2D_pixel(input, dim_im_in_x, dim_im_in_y, ch_im_in, weight, dim_kernel_x, dim_kernel_y,
+                                        padding_x, padding_y, stride_x, stride_y, bias, i, j, k, kernels);
+                out[i] = relu && conv_out < 0 ? 0 : conv_out;
+            }
+        }
+    }
+}
+
+// Pooled rows [pool_y_begin, pool_y_end) of a direct conv2D followed by a
+// max pool whose windows do not overlap. Every conv value is computed once
+// and maxed straight into its pooled pixel, so only pooled results are stored.
+static void conv2D_pool_rows(const float *input,
+                             const int64_t dim_im_in_x,
+                             const int64_t dim_im_in_y,
+                             const int64_t ch_im_in,
+                             const float *weight,
+                             const int64_t ch_im_out,
+                             const onnx_plan_attr *conv,
+                             const float *bias,
+                             const int64_t dim_conv_x,
+                             const int64_t dim_conv_y,
+                             const onnx_plan_attr *pool,
+                             float *output,
+                             const int64_t dim_pool_x,
+                             const int64_t pool_y_begin,
+                             const int64_t pool_y_end,
+                             const int relu,
+                             const onnx_kernels *kernels)
+{
+    // Locals, so they are not reloaded around every indirect dot call
+    const int64_t kernel_x = conv->kernel_x, kernel_y = conv->kernel_y;
+    const int64_t padding_x = conv->padding_x, padding_y = conv->padding_y;
+    const int64_t stride_x = conv->stride_x, stride_y = conv->stride_y;
+
+    for (int y = pool_y_begin; y < pool_y_end; y++)
+    {
+        int j_begin = y * pool->stride_y - pool->padding_y;
+        int j_end = j_begin + pool->kernel_y < dim_conv_y ? j_begin + pool->kernel_y : dim_conv_y;
+        j_begin = j_begin > 0 ? j_begin : 0;
+        for (int x = 0; x < dim_pool_x; x++)
+        {
+            int k_begin = x * pool->stride_x - pool->padding_x;
+            int k_end = k_begin + pool->kernel_x < dim_conv_x ? k_begin + pool->kernel_x : dim_conv_x;
+            k_begin = k_begin > 0 ? k_begin : 0;
+            // Same pixel-major order as conv2D_rows, maxing into the pooled pixel
+            float* out = output + (y * dim_pool_x + x) * ch_im_out;
+            for (int i = 0; i < ch_im_out; i++)
+            {
+                out[i] = -FLT_MAX;
+            }
+            for (int j = j_begin; j < j_end; j++)
             {
-                conv_out = bias[i];
-                // For each kernel dimension
-                for (m = 0; m < dim_kernel_y; m++)
+                for (int k = k_begin; k < k_end; k++)
                 {
-                    for (n = 0; n < dim_kernel_x; n++)
+                    for (int i = 0; i < ch_im_out; i++)
                     {
-                        // if-for implementation
-                        in_row = stride_y * j + m - padding_y;
-                        in_col = stride_x * k + n - padding_x;
-                        if (in_row >= 0 && in_col >= 0 && in_row < dim_im_in_y && in_col < dim_im_in_x)
-                        {
-                            // For each input channel
-                            for (l = 0; l < ch_im_in; l++)
-                            {
-                                conv_out += input[(in_row * dim_im_in_x + in_col) * ch_im_in + l] *
-                                            weight[i * ch_im_in * dim_kernel_y * dim_kernel_x + (m * dim_kernel_x + n) * ch_im_in +
-                                               l];
-                            }
-                        }
+                        float v = conv2D_pixel(input, dim_im_in_x, dim_im_in_y, ch_im_in, weight, kernel_x, kernel_y,
+                                               padding_x, padding_y, stride_x, stride_y, bias, i, j, k, kernels);
+                        out[i] = v > out[i] ? v : out[i];
                     }
                 }
-                output[i + (j * dim_im_out_x + k) * ch_im_out] = conv_out;
+            }
+            // Relu commutes with max; a window entirely in the padding stays -FLT_MAX like maxpool
+            for (int i = 0; relu && i < ch_im_out; i++)
+            {
+                out[i] = out[i] < 0 && out[i] != -FLT_MAX ? 0 : out[i];
+            }
+        }
+    }
+}
+
+// Packs output pixels [p0, p0 + mc) x reduction [k0, k0 + kc) of the virtual
+// im2col matrix into MR-row panels. The reduction index runs over (ky, kx, c)
+// like the OHWI filters, so every kernel tap is one contiguous channel run.
+static void conv2D_im2col(const float *input,
+                          const int64_t dim_im_in_x,
+                          const int64_t dim_im_in_y,
+                          const int64_t ch_im_in,
+                          const int64_t dim_kernel_x,
+                          const int64_t padding_x,
+                          const int64_t padding_y,
+                          const int64_t stride_x,
+                          const int64_t stride_y,
+                          const int64_t dim_im_out_x,
+                          int64_t p0, int64_t mc, int64_t k0, int64_t kc,
+                          float *panel)
+{
+    int64_t m_pad = (mc + ONNX_GEMM_MR - 1) / ONNX_GEMM_MR * ONNX_GEMM_MR;
+    for (int64_t i = 0; i < m_pad; i++)
+    {
+        float* dst = panel + (i / ONNX_GEMM_MR) * ONNX_GEMM_MR * kc + i % ONNX_GEMM_MR;
+        if (i >= mc)
+        {
+            for (int64_t p = 0; p < kc; p++)
+            {
+                dst[p * ONNX_GEMM_MR] = 0.0f;
+            }
+            continue;
+        }
+
+        int64_t y = (p0 + i) / dim_im_out_x;
+        int64_t x = (p0 + i) % dim_im_out_x;
+        int64_t p = 0;
+        while (p < kc)
+        {
+            int64_t k = k0 + p;
+            int64_t tap = k / ch_im_in;
+            int64_t l = k % ch_im_in;
+            int64_t run = ch_im_in - l < kc - p ? ch_im_in - l : kc - p;
+            int64_t in_row = stride_y * y + tap / dim_kernel_x - padding_y;
+            int64_t in_col = stride_x * x + tap % dim_kernel_x - padding_x;
+
+            if (in_row >= 0 && in_col >= 0 && in_row < dim_im_in_y && in_col < dim_im_in_x)
+            {
+                const float* src = input + (in_row * dim_im_in_x + in_col) * ch_im_in + l;
+                for (int64_t t = 0; t < run; t++)
+                {
+                    dst[(p + t) * ONNX_GEMM_MR] = src[t];
+                }
+            }
+            else
+            {
+                for (int64_t t = 0; t < run; t++)
+                {
+                    dst[(p + t) * ONNX_GEMM_MR] = 0.0f;
+                }
+            }
+            p += run;
+        }
+    }
+}
+
+// Output rows [out_y_begin, out_y_end) of conv2D as a GEMM: pixels x taps
+// (im2col, packed block by block) times taps x filters (panels from
+// sgemm_pack_b). The output is NWHC, i.e. already row-major pixels x filters,
+// and starts at row out_y_begin. Bias and relu are applied in the microkernel.
+static void conv2D_gemm_rows(const float *input,
+                             const int64_t dim_im_in_x,
+                             const int64_t dim_im_in_y,
+                             const int64_t ch_im_in,
+                             const float *panels,
+                             const int64_t ch_im_out,
+                             const int64_t dim_kernel_x,
+                             const int64_t dim_kernel_y,
+                             const int64_t padding_x,
+                             const int64_t padding_y,
+                             const int64_t stride_x,
+                             const int64_t stride_y,
+                             const float *bias,
+                             float *output,
+                             const int64_t dim_im_out_x,
+                             const int64_t out_y_begin,
+                             const int64_t out_y_end,
+                             const int relu,
+                             const onnx_kernels *kernels)
+{
+    float panel[ONNX_GEMM_MC * ONNX_GEMM_KC];
+    int64_t k = (int64_t) dim_kernel_x * dim_kernel_y * ch_im_in;
+    int64_t p_begin = (int64_t) out_y_begin * dim_im_out_x;
+    int64_t p_end = (int64_t) out_y_end * dim_im_out_x;
+
+    for (int64_t k0 = 0; k0 < k; k0 += ONNX_GEMM_KC)
+    {
+        int64_t kc = k - k0 < ONNX_GEMM_KC ? k - k0 : ONNX_GEMM_KC;
+        for (int64_t p0 = p_begin; p0 < p_end; p0 += ONNX_GEMM_MC)
+        {
+            int64_t mc = p_end - p0 < ONNX_GEMM_MC ? p_end - p0 : ONNX_GEMM_MC;
+            conv2D_im2col(input, dim_im_in_x, dim_im_in_y, ch_im_in, dim_kernel_x, padding_x, padding_y,
+                          stride_x, stride_y, dim_im_out_x, p0, mc, k0, kc, panel);
+
+            // The A block stays in cache while every filter panel streams past it
+            for (int64_t j0 = 0; j0 < ch_im_out; j0 += ONNX_GEMM_NR)
+            {
+                int n = ch_im_out - j0 < ONNX_GEMM_NR ? ch_im_out - j0 : ONNX_GEMM_NR;
+                const float* b = panels + j0 * k + k0 * ONNX_GEMM_NR;
+                for (int64_t i0 = 0; i0 < mc; i0 += ONNX_GEMM_MR)
+                {
+                    int m = mc - i0 < ONNX_GEMM_MR ? mc - i0 : ONNX_GEMM_MR;
+                    kernels->sgemm_micro(kc, panel + i0 * kc, b, output + (p0 - p_begin + i0) * ch_im_out + j0, ch_im_out,
+                                m, n, k0 == 0 ? bias + j0 : NULL, relu && k0 + kc == k);
+                }
             }
         }
     }
 }
 
-float* conv2D_layer(Onnx__GraphProto* graph, const float *input, int64_t* shapeInput, int64_t* shapeOutput, const char* layer_name)
+void conv2D(const float *input,                                                // input image
+            const int64_t dim_im_in_x,                                         // input image dimention x
+            const int64_t dim_im_in_y,                                         // input image dimention y
+            const int64_t ch_im_in,                                            // number of input image channels
+            const float *weight,                                               // kernel weights
+            const int64_t ch_im_out,                                           // number of filters, i.e., output image channels
+            const int64_t dim_kernel_x,                                        // filter kernel size x
+            const int64_t dim_kernel_y,                                        // filter kernel size y
+            const int64_t padding_x,                                           // padding sizes x
+            const int64_t padding_y,                                           // padding sizes y
+            const int64_t stride_x,                                            // stride x
+            const int64_t stride_y,                                            // stride y
+            const float *bias,                                                 // bias
+            float *output,                                                     // output image
+            const int64_t dim_im_out_x,                                        // output image dimension x
+            const int64_t dim_im_out_y                                         // output image dimension y
+)
 {
-    assert(graph != NULL && input != NULL && layer_name != "" );
+    conv2D_rows(input, dim_im_in_x, dim_im_in_y, ch_im_in, weight, ch_im_out, dim_kernel_x, dim_kernel_y,
+                padding_x, padding_y, stride_x, stride_y, bias, output, dim_im_out_x, 0, dim_im_out_y,
+                0, onnx_kernels_get(ONNX_ISA_SCALAR));
+}
 
-    Onnx__NodeProto* node = onnx_graph_get_node_by_name(graph, layer_name);
-    if(node == NULL)
+// Conv rows [y, y_end) of one sample with the step's direct or im2col kernel
+static void conv2D_band(const onnx_plan_step* step, const float* input, float* output, int64_t y, int64_t y_end,
+                        const onnx_kernels* kernels)
+{
+    const int64_t* in = step->in.dims;
+    const int64_t* out = step->pool.kernel_x != 0 ? step->conv.dims : step->out.dims;
+    if(step->kernel == conv2D_gemm_step)
+    {
+        conv2D_gemm_rows(input, in[ONNX_W], in[ONNX_H], in[ONNX_C],
+                         step->weight, out[ONNX_C], step->attr.kernel_x, step->attr.kernel_y,
+                         step->attr.padding_x, step->attr.padding_y, step->attr.stride_x, step->attr.stride_y,
+                         step->bias, output, out[ONNX_W], y, y_end, step->relu, kernels);
+    }
+    else
     {
-        // layer not found
-        return NULL;
+        conv2D_rows(input, in[ONNX_W], in[ONNX_H], in[ONNX_C],
+                    step->weight, out[ONNX_C], step->attr.kernel_x, step->attr.kernel_y,
+                    step->attr.padding_x, step->attr.padding_y, step->attr.stride_x, step->attr.stride_y,
+                    step->bias, output, out[ONNX_W], y, y_end, step->relu, kernels);
     }
-    const char* weight = node->input[1];
-    const char* bias = node->input[2];
+}
+
+// Items are output rows of every sample in the batch
+static void conv2D_task(void* arg, int64_t begin, int64_t end)
+{
+    const onnx_plan_step* step = ((onnx_step_task*) arg)->step;
+    float** slots = ((onnx_step_task*) arg)->slots;
+    int64_t in_len = onnx_tensor_sample(&step->in);
+    int64_t out_len = onnx_tensor_sample(&step->out);
+    int64_t row_len = step->out.dims[ONNX_W] * step->out.dims[ONNX_C];
+    int64_t rows = step->out.dims[ONNX_H];
+    const onnx_kernels* kernels = onnx_kernels_active;
+
+    while(begin < end)
+    {
+        int64_t b = begin / rows;
+        int64_t y = begin % rows;
+        int64_t y_end = y + (end - begin) < rows ? y + (end - begin) : rows;
+
+        conv2D_band(step, slots[step->input[0]] + b * in_len, slots[step->output] + b * out_len + y * row_len, y, y_end, kernels);
+        begin += y_end - y;
+    }
+}
+
+// Items are pooled output rows of every sample in the batch. Disjoint windows
+// over the direct kernel are pooled as the conv values are produced. Otherwise each block of
+// ONNX_PLAN_POOL_ROWS pooled rows computes the conv rows under its windows into
+// a per-thread band and pools them while they are still in cache. Either way
+// the conv output never goes through the arena.
+static void conv2D_pool_task(void* arg, int64_t begin, int64_t end)
+{
+    const onnx_plan_step* step = ((onnx_step_task*) arg)->step;
+    float** slots = ((onnx_step_task*) arg)->slots;
+    const onnx_plan_attr* pool = &step->pool;
+    const int64_t* in = step->in.dims;
+    const int64_t* conv = step->conv.dims;
+    int64_t in_len = onnx_tensor_sample(&step->in);
+    int64_t out_len = onnx_tensor_sample(&step->out);
+    int64_t conv_y = conv[ONNX_H];
+    int64_t rows = step->out.dims[ONNX_H];
+    const onnx_kernels* kernels = onnx_kernels_active;
 
-    // Get weight shape
-    int64_t* shapeW = onnx_graph_get_dims_by_name(graph, weight);
-    if(shapeW == NULL)
+    // Direct kernel and disjoint windows: no band at all
+    if(step->kernel == conv2D_step && pool->stride_x >= pool->kernel_x && pool->stride_y >= pool->kernel_y)
     {
-        return NULL;
+        while(begin < end)
+        {
+            int64_t b = begin / rows;
+            int64_t y = begin % rows;
+            int64_t y_end = y + (end - begin) < rows ? y + (end - begin) : rows;
+
+            conv2D_pool_rows(slots[step->input[0]] + b * in_len, in[ONNX_W], in[ONNX_H], in[ONNX_C],
+                             step->weight, conv[ONNX_C], &step->attr, step->bias, conv[ONNX_W], conv_y,
+                             pool, slots[step->output] + b * out_len, step->out.dims[ONNX_W], y, y_end, step->relu, kernels);
+            begin += y_end - y;
+        }
+        return;
     }
-    int64_t dimW = onnx_graph_get_dim_by_name(graph, weight);
-    if(dimW < 0)
+
+    // Per-thread band, reserved with the session
+    float* band = (float*) onnx_pool_scratch(conv2D_scratch_size(step));
+    assert(band != NULL);
+
+    while(begin < end)
     {
-        return NULL;
+        int64_t b = begin / rows;
+        int64_t y = begin % rows;
+        int64_t y_end = y + (end - begin) < rows ? y + (end - begin) : rows;
+        y_end = y_end - y < ONNX_PLAN_POOL_ROWS ? y_end : y + ONNX_PLAN_POOL_ROWS;
+
+        // Conv rows under the windows, clipped to the image; padding rows are skipped by the pool
+        int64_t r0 = y * pool->stride_y - pool->padding_y;
+        int64_t r1 = (y_end - 1) * pool->stride_y - pool->padding_y + pool->kernel_y;
+        r0 = r0 > 0 ? r0 : 0;
+        r1 = r1 < conv_y ? r1 : conv_y;
+
+        conv2D_band(step, slots[step->input[0]] + b * in_len, band, r0, r1, kernels);
+        maxpool_rows(band, conv[ONNX_W], r1 - r0, conv[ONNX_C],
+                     pool->kernel_x, pool->kernel_y, pool->padding_x, pool->padding_y + r0, pool->stride_x, pool->stride_y,
+                     step->out.dims[ONNX_W], y, y_end, slots[step->output] + b * out_len, kernels);
+        begin += y_end - y;
     }
+}
+
+void conv2D_step(const onnx_plan_step* step, float** slots, onnx_pool* pool)
+{
+    // The packed filters are shared by every row and every sample
+    onnx_step_task task = { step, slots };
+    const int64_t* out = step->pool.kernel_x != 0 ? step->conv.dims : step->out.dims;
+    int64_t work = out[ONNX_W] * out[ONNX_C] * step->attr.kernel_x * step->attr.kernel_y * step->in.dims[ONNX_C];
+    int64_t rows = step->out.dims[ONNX_N] * step->out.dims[ONNX_H];
 
-    // Get weights
-    // NCWH --> NWHC
-    int64_t permW_t[] = { 0, 2, 3, 1};
-    float* W = onnx_graph_get_weights_by_name(graph, weight);
-    if(W == NULL)
+    if(step->pool.kernel_x != 0)
     {
-        return NULL;
+        // Conv rows per pooled row, counting the overlap of the windows
+        work *= step->pool.stride_y < step->pool.kernel_y ? step->pool.kernel_y : step->pool.stride_y;
+        onnx_pool_parallel_for(pool, rows, ONNX_POOL_GRAIN / work + 1, conv2D_pool_task, &task);
+        return;
     }
-    float* W_t = transpose(W, shapeW, dimW, permW_t);
+    onnx_pool_parallel_for(pool, rows, ONNX_POOL_GRAIN / work + 1, conv2D_task, &task);
+}
 
-    // Get bias
-    float* B = onnx_graph_get_weights_by_name(graph, bias);
-    if(B == NULL)
+void conv2D_gemm_step(const onnx_plan_step* step, float** slots, onnx_pool* pool)
+{
+    // Same row split as conv2D_step; conv2D_band runs the GEMM rows for this kernel
+    conv2D_step(step, slots, pool);
+}
+
+// Per-thread scratch a step of this file's kernels asks onnx_pool_scratch for:
+// the Winograd tiles, or the conv band under ONNX_PLAN_POOL_ROWS pooled rows
+size_t conv2D_scratch_size(const onnx_plan_step* step)
+{
+    const onnx_plan_attr* pool = &step->pool;
+    if(step->kernel == conv2D_winograd_step)
+    {
+        return winograd_scratch_size(step->in.dims[ONNX_C], step->out.dims[ONNX_C], step->attr.tile);
+    }
+    if((step->kernel != conv2D_step && step->kernel != conv2D_gemm_step) || pool->kernel_x == 0 ||
+       (step->kernel == conv2D_step && pool->stride_x >= pool->kernel_x && pool->stride_y >= pool->kernel_y))
     {
-        return NULL;
+        return 0;
     }
+    int64_t band_rows = (ONNX_PLAN_POOL_ROWS - 1) * pool->stride_y + pool->kernel_y;
+    return sizeof(float) * band_rows * step->conv.dims[ONNX_W] * step->conv.dims[ONNX_C];
+}
+
+// Items are tile rows of every sample in the batch
+static void conv2D_winograd_task(void* arg, int64_t begin, int64_t end)
+{
+    const onnx_plan_step* step = ((onnx_step_task*) arg)->step;
+    float** slots = ((onnx_step_task*) arg)->slots;
+    const int64_t* in = step->in.dims;
+    const int64_t* out = step->out.dims;
+    int64_t in_len = onnx_tensor_sample(&step->in);
+    int64_t out_len = onnx_tensor_sample(&step->out);
+    int64_t rows = (out[ONNX_H] + step->attr.tile - 1) / step->attr.tile;
 
-    float* output = (float*) malloc(sizeof(float)*shapeW[0]*shapeInput[W_INDEX]*shapeInput[H_INDEX]);
-    memset(output, 0, sizeof(sizeof(float)*shapeW[0]*shapeInput[W_INDEX]*shapeInput[H_INDEX]));
-    conv2D(input, shapeInput[W_INDEX], shapeInput[H_INDEX], shapeW[1], W_t, shapeW[0], shapeW[2], shapeW[3], 1, 1, 1, 1, B, output, shapeInput[W_INDEX], shapeInput[H_INDEX]);
+    // Transformed tiles live in a per-thread buffer, reserved with the session
+    float* scratch = (float*) onnx_pool_scratch(conv2D_scratch_size(step));
+    assert(scratch != NULL);
 
-    shapeOutput[W_INDEX] = shapeInput[W_INDEX];
-    shapeOutput[H_INDEX] = shapeInput[H_INDEX];
-    shapeOutput[C_INDEX] = shapeW[0];
+    while(begin < end)
+    {
+        int64_t b = begin / rows;
+        int64_t y = begin % rows;
+        int64_t y_end = y + (end - begin) < rows ? y + (end - begin) : rows;
+
+        winograd_conv_rows(slots[step->input[0]] + b * in_len, in[ONNX_W], in[ONNX_H], in[ONNX_C],
+                           step->weight, out[ONNX_C], step->attr.tile, step->attr.padding_x, step->attr.padding_y,
+                           step->bias, slots[step->output] + b * out_len, out[ONNX_W], out[ONNX_H],
+                           y, y_end, step->relu, scratch);
+        begin += y_end - y;
+    }
+}
+
+void conv2D_winograd_step(const onnx_plan_step* step, float** slots, onnx_pool* pool)
+{
+    onnx_step_task task = { step, slots };
+    int64_t tile = step->attr.tile;
+    int64_t rows = (step->out.dims[ONNX_H] + tile - 1) / tile;
+    int64_t alpha = tile + 2;
 
-    free(W_t);
+    // Multiplies per tile row in the GEMMs, the bulk of the work
+    int64_t work = (step->out.dims[ONNX_W] + tile - 1) / tile * alpha * alpha *
+                   step->in.dims[ONNX_C] * step->out.dims[ONNX_C];
 
-    return output;
+    onnx_pool_parallel_for(pool, step->out.dims[ONNX_N] * rows, ONNX_POOL_GRAIN / work + 1, conv2D_winograd_task, &task);
 }
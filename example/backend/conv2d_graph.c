@@ -0,0 +1,170 @@
+#include "onnx.h"
+
+// Only group = 1 and two dilations of 1 are implemented; anything else,
+// including a dilations list of the wrong length, is refused
+static int conv2D_supported(Onnx__NodeProto* node)
+{
+    for(int i = 0; i < node->n_attribute; i++)
+    {
+        Onnx__AttributeProto* attribute = node->attribute[i];
+        int supported = 1;
+        if(strcmp(attribute->name, "group") == 0)
+        {
+            supported = attribute->i == 1;
+        }
+        else if(strcmp(attribute->name, "dilations") == 0)
+        {
+            supported = attribute->n_ints == 2;
+            for(size_t k = 0; k < attribute->n_ints; k++)
+            {
+                supported &= attribute->ints[k] == 1;
+            }
+        }
+        if(!supported)
+        {
+            printf("Conv %s: only group = 1 and dilations = 1 are supported\n", node->name);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int conv2D_layer(onnx_graph_index* index, const onnx_tensor* input, onnx_tensor* output, const char* layer_name)
+{
+    assert(index != NULL && input != NULL && input->data != NULL && layer_name != "" );
+
+    Onnx__NodeProto* node = onnx_graph_index_get_node_by_name(index, layer_name);
+    if(node == NULL || node->n_input < 3 || input->rank != 4)
+    {
+        // layer not found
+        return -1;
+    }
+    if(conv2D_supported(node) != 0)
+    {
+        return -1;
+    }
+    const char* weight = node->input[1];
+    const char* bias = node->input[2];
+
+    // Get weight shape
+    int64_t* shapeW = onnx_graph_index_get_dims_by_name(index, weight);
+    if(shapeW == NULL)
+    {
+        return -1;
+    }
+    int64_t dimW = onnx_graph_index_get_dim_by_name(index, weight);
+    if(dimW != 4 || shapeW[1] != input->dims[ONNX_C])
+    {
+        printf("Conv %s expects %ld input channels\n", node->name, dimW == 4 ? shapeW[1] : 0);
+        return -1;
+    }
+
+    // Get bias
+    float* B = onnx_graph_index_get_weights_by_name(index, bias);
+    if(B == NULL)
+    {
+        return -1;
+    }
+
+    // Output size from the pads and strides, as in the plan
+    onnx_plan_attr attr;
+    int64_t kernel[2] = { shapeW[2], shapeW[3] };
+    if(onnx_plan_window(node, input, kernel, &attr, output) != 0)
+    {
+        return -1;
+    }
+    output->dims[ONNX_C] = shapeW[0];
+
+    // Get weights
+    // OIHW --> OHWI
+    int64_t permW_t[] = { 0, 2, 3, 1};
+    float* W = onnx_graph_index_get_weights_by_name(index, weight);
+    if(W == NULL)
+    {
+        return -1;
+    }
+    float* W_t = transpose(W, shapeW, dimW, permW_t);
+    if(W_t == NULL || onnx_tensor_alloc(output, NULL) != 0)
+    {
+        free(W_t);
+        return -1;
+    }
+
+    int64_t in_len = onnx_tensor_sample(input);
+    int64_t out_len = onnx_tensor_sample(output);
+    for(int64_t b = 0; b < input->dims[ONNX_N]; b++)
+    {
+        conv2D((const float*) input->data + b * in_len, input->dims[ONNX_W], input->dims[ONNX_H], shapeW[1], W_t, shapeW[0],
+               attr.kernel_x, attr.kernel_y, attr.padding_x, attr.padding_y, attr.stride_x, attr.stride_y, B,
+               (float*) output->data + b * out_len, output->dims[ONNX_W], output->dims[ONNX_H]);
+    }
+
+    free(W_t);
+
+    return 0;
+}
+
+int conv2D_plan(onnx_plan* plan, Onnx__NodeProto* node, onnx_plan_step* step)
+{
+    if(node->n_input < 3)
+    {
+        return -1;
+    }
+
+    onnx_graph_index* index = plan->index;
+    int64_t* shapeW = onnx_graph_index_get_dims_by_name(index, node->input[1]);
+    int64_t dimW = onnx_graph_index_get_dim_by_name(index, node->input[1]);
+    step->bias = onnx_graph_index_get_weights_by_name(index, node->input[2]);
+    if(shapeW == NULL || dimW != 4 || step->bias == NULL)
+    {
+        return -1;
+    }
+    if(shapeW[1] != step->in.dims[ONNX_C])
+    {
+        printf("Conv %s expects %ld input channels, got %ld\n", node->name, shapeW[1], step->in.dims[ONNX_C]);
+        return -1;
+    }
+    if(conv2D_supported(node) != 0)
+    {
+        return -1;
+    }
+
+    memcpy(step->shapeW, shapeW, sizeof(int64_t)*4);
+    step->dimW = dimW;
+
+    // Kernel shape defaults to the weight shape (OIHW)
+    int64_t kernel[2] = { shapeW[2], shapeW[3] };
+    if(onnx_plan_window(node, &step->in, kernel, &step->attr, &step->out) != 0)
+    {
+        return -1;
+    }
+    int64_t dims[4] = { step->in.dims[ONNX_N], step->out.dims[ONNX_H], step->out.dims[ONNX_W], shapeW[0] };
+    onnx_tensor_init(&step->out, ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT, 4, dims, NULL);
+
+    // Winograd for 3x3 stride 1 with enough channels to amortize the
+    // transforms. F(4x4) saves the most multiplies and stays within 1e-4
+    // relative error; F(2x2) is kept for outputs smaller than one 4x4 tile
+    if(shapeW[2] == 3 && shapeW[3] == 3 && step->attr.stride_x == 1 && step->attr.stride_y == 1 &&
+       shapeW[0] >= ONNX_WINOGRAD_MIN_CH && shapeW[1] >= ONNX_WINOGRAD_MIN_CH)
+    {
+        int large = step->out.dims[ONNX_W] >= ONNX_WINOGRAD_4x4_MIN_DIM &&
+                    step->out.dims[ONNX_H] >= ONNX_WINOGRAD_4x4_MIN_DIM;
+        step->attr.tile = large ? 4 : 2;
+        step->weight = onnx_plan_pack_weights(plan, node->input[1], large ? ONNX_PACK_WINOGRAD_4 : ONNX_PACK_WINOGRAD_2);
+        step->kernel = conv2D_winograd_step;
+    }
+    // GEMM wins once the filters fill half a register tile (fewer leave the
+    // padded panel mostly zeros) and the reduction amortizes the im2col packing
+    else if(shapeW[0] >= ONNX_GEMM_NR / 2 && shapeW[1] * shapeW[2] * shapeW[3] >= ONNX_CONV_GEMM_MIN_K)
+    {
+        step->weight = onnx_plan_pack_weights(plan, node->input[1], ONNX_PACK_PANELS);
+        step->kernel = conv2D_gemm_step;
+    }
+    else
+    {
+        step->weight = onnx_plan_pack_weights(plan, node->input[1], ONNX_PACK_OHWI);
+        step->kernel = conv2D_step;
+    }
+
+    return step->weight != NULL ? 0 : -1;
+}
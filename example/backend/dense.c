@@ -1,9 +1,9 @@
-#include "onnx.h"
+#include "onnx-runtime.h"
 
 void dense(const float *input,              // pointer to vector
            const float *weight,             // pointer to matrix
-           const uint16_t dim_vec,         // length of the vector
-           const uint16_t num_of_rows,     // numCol of A
+           const int64_t dim_vec,          // length of the vector
+           const int64_t num_of_rows,      // numCol of A
            const float *bias,
            float *output)                   // output operand
 {
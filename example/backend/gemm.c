@@ -0,0 +1,63 @@
+#include "onnx-runtime.h"
+
+// Blocked SGEMM building blocks, C[m x n] (+)= A[m x k] * B[k x n].
+//
+// B is packed once into panels of ONNX_GEMM_NR columns, k rows each, so the
+// microkernel streams it with unit stride. A is packed by the caller into
+// panels of ONNX_GEMM_MR rows per block of ONNX_GEMM_KC (see the conv im2col).
+// The microkernel keeps an MR x NR tile of C in registers for the whole k loop.
+
+int64_t sgemm_pack_size(int64_t n, int64_t k)
+{
+    return (n + ONNX_GEMM_NR - 1) / ONNX_GEMM_NR * ONNX_GEMM_NR * k;
+}
+
+// b holds one row of k weights per output column (N x K, as OHWI filters)
+void sgemm_pack_b(const float* b, int64_t n, int64_t k, float* packed)
+{
+    for(int64_t j0 = 0; j0 < n; j0 += ONNX_GEMM_NR)
+    {
+        float* panel = packed + j0 * k;
+        for(int64_t p = 0; p < k; p++)
+        {
+            for(int64_t j = 0; j < ONNX_GEMM_NR; j++)
+            {
+                panel[p * ONNX_GEMM_NR + j] = j0 + j < n ? b[(j0 + j) * k + p] : 0.0f;
+            }
+        }
+    }
+}
+
+// a: MR x kc panel stored k-major, b: kc x NR panel. Only the top-left m x n
+// of the tile is written. With bias the tile is set to bias + A*B, otherwise
+// A*B is added to C. relu clamps the result at zero on the way out, so callers
+// set it on the last k block only.
+void sgemm_micro(int64_t kc, const float* a, const float* b, float* c, int64_t ldc, int m, int n, const float* bias, int relu)
+{
+    float acc[ONNX_GEMM_MR][ONNX_GEMM_NR] = { { 0 } };
+
+    for(int64_t p = 0; p < kc; p++)
+    {
+        const float* ap = a + p * ONNX_GEMM_MR;
+        const float* bp = b + p * ONNX_GEMM_NR;
+#pragma GCC unroll 16
+        for(int i = 0; i < ONNX_GEMM_MR; i++)
+        {
+#pragma GCC unroll 16
+            for(int j = 0; j < ONNX_GEMM_NR; j++)
+            {
+                acc[i][j] += ap[i] * bp[j];
+            }
+        }
+    }
+
+    for(int i = 0; i < m; i++)
+    {
+        float* ci = c + i * ldc;
+        for(int j = 0; j < n; j++)
+        {
+            float v = (bias != NULL ? bias[j] : ci[j]) + acc[i][j];
+            ci[j] = relu && v < 0 ? 0 : v;
+        }
+    }
+}
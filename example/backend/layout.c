@@ -0,0 +1,158 @@
+#include "onnx.h"
+
+const int8_t onnx_layout_identity[ONNX_LAYOUT_MAX_DIM] = { 0, 1, 2, 3 };
+const int8_t onnx_layout_nchw[ONNX_LAYOUT_MAX_DIM]     = { 0, 2, 3, 1 };
+
+// tensor holds the physical dims, batch first
+void onnx_layout_init(onnx_layout* layout, const onnx_tensor* tensor, const int8_t* perm)
+{
+    layout->rank = tensor->rank;
+    for(int32_t i = 0; i < tensor->rank; i++)
+    {
+        layout->perm[i] = perm[i];
+        layout->dims[perm[i]] = i == 0 ? 1 : tensor->dims[i];
+    }
+}
+
+// Dense physical descriptor of batch samples laid out as layout
+void onnx_layout_tensor(const onnx_layout* layout, int64_t batch, onnx_tensor* tensor)
+{
+    int64_t dims[ONNX_LAYOUT_MAX_DIM];
+    for(int32_t i = 0; i < layout->rank; i++)
+    {
+        dims[i] = i == 0 ? batch : layout->dims[layout->perm[i]];
+    }
+    onnx_tensor_init(tensor, ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT, layout->rank, dims, NULL);
+}
+
+int onnx_layout_transpose(onnx_layout* layout, const Onnx__NodeProto* node)
+{
+    const int64_t* perm = NULL;
+    for(size_t i = 0; i < node->n_attribute; i++)
+    {
+        if(strcmp(node->attribute[i]->name, "perm") == 0 && node->attribute[i]->n_ints == (size_t) layout->rank)
+        {
+            perm = node->attribute[i]->ints;
+        }
+    }
+    // Without perm the axes are reversed, which moves N as well
+    if(perm == NULL || perm[0] != 0)
+    {
+        printf("Transpose %s: only permutations that keep the batch axis first are supported\n", node->name);
+        return -1;
+    }
+
+    int8_t inverse[ONNX_LAYOUT_MAX_DIM] = { -1, -1, -1, -1 };
+    for(int32_t i = 0; i < layout->rank; i++)
+    {
+        if(perm[i] < 0 || perm[i] >= layout->rank || inverse[perm[i]] >= 0)
+        {
+            printf("Transpose %s: perm is not a permutation\n", node->name);
+            return -1;
+        }
+        inverse[perm[i]] = (int8_t) i;
+    }
+
+    // Logical axis j of the result is axis perm[j] of the input; the data stays put
+    int64_t dims[ONNX_LAYOUT_MAX_DIM];
+    memcpy(dims, layout->dims, sizeof(dims));
+    for(int32_t i = 0; i < layout->rank; i++)
+    {
+        layout->dims[i] = dims[perm[i]];
+        layout->perm[i] = inverse[layout->perm[i]];
+    }
+    return 0;
+}
+
+// Same order of the axes that are not 1
+int onnx_layout_is(const onnx_layout* layout, const int8_t* perm)
+{
+    int32_t i = 0, j = 0;
+    while(1)
+    {
+        while(i < layout->rank && layout->dims[layout->perm[i]] == 1)
+        {
+            i++;
+        }
+        while(j < layout->rank && layout->dims[perm[j]] == 1)
+        {
+            j++;
+        }
+        if(i == layout->rank || j == layout->rank)
+        {
+            return i == layout->rank && j == layout->rank;
+        }
+        if(layout->perm[i++] != perm[j++])
+        {
+            return 0;
+        }
+    }
+}
+
+// Arguments of transpose_into that lay one sample out as perm: the current
+// physical dims and the source axis of each target axis. layout then
+// describes the copy.
+int64_t onnx_layout_copy(onnx_layout* layout, const int8_t* perm, int64_t* shape, int64_t* axes)
+{
+    for(int32_t i = 1; i < layout->rank; i++)
+    {
+        shape[i - 1] = layout->dims[layout->perm[i]];
+        for(int32_t j = 1; j < layout->rank; j++)
+        {
+            if(layout->perm[j] == perm[i])
+            {
+                axes[i - 1] = j - 1;
+            }
+        }
+    }
+    memcpy(layout->perm, perm, sizeof(int8_t) * layout->rank);
+    return layout->rank - 1;
+}
+
+// order[p] is the logical row-major position of the p-th physical element of
+// a sample, i.e. where a flatten would have put it
+int64_t onnx_layout_flatten_order(const onnx_layout* layout, int64_t* order)
+{
+    // Row-major strides of the logical sample
+    int64_t stride[ONNX_LAYOUT_MAX_DIM];
+    int64_t len = 1;
+    for(int32_t a = layout->rank - 1; a > 0; a--)
+    {
+        stride[a] = len;
+        len *= layout->dims[a];
+    }
+
+    // Odometer over the physical axes, innermost last
+    int64_t index[ONNX_LAYOUT_MAX_DIM] = { 0 };
+    for(int64_t p = 0; p < len; p++)
+    {
+        int64_t logical = 0;
+        for(int32_t i = 1; i < layout->rank; i++)
+        {
+            logical += index[i] * stride[layout->perm[i]];
+        }
+        order[p] = logical;
+        for(int32_t i = layout->rank - 1; i > 0 && ++index[i] == layout->dims[layout->perm[i]]; i--)
+        {
+            index[i] = 0;
+        }
+    }
+    return len;
+}
+
+// Layout a node's kernel reads its first input in, NULL for any. The output
+// is written in the same layout.
+const int8_t* onnx_layout_input(onnx_graph_index* index, Onnx__NodeProto* node, const int32_t* inputs, int32_t n_inputs)
+{
+    if(strcmp(node->op_type, "Conv") == 0 || strcmp(node->op_type, "MaxPool") == 0)
+    {
+        return onnx_layout_nchw;
+    }
+    // Elementwise, unless a bound operand fixes the logical order
+    if(strcmp(node->op_type, "Relu") == 0 ||
+       (strcmp(node->op_type, "Add") == 0 && n_inputs > 1 && inputs[1] >= 0 && index->initializer_ids[inputs[1]] < 0))
+    {
+        return NULL;
+    }
+    return onnx_layout_identity;
+}
@@ -1,63 +1,65 @@
-#include "onnx.h"
+#include "onnx-runtime.h"
 
-void matmul(const float *input,              // pointer to vector
-           const float *weight,             // pointer to matrix
-           const uint16_t dim_vec,         // length of the vector
-           const uint16_t num_of_rows,     // numCol of A
-           float *output)
+#define MATMUL_BLOCK 16             // weight rows kept in cache across the batch
+
+// Weight rows [row_begin, row_end) of matmul. A fused bias and relu are
+// applied to each block of outputs while it is still in L1.
+static void matmul_rows(const float *input,
+                        const float *weight,
+                        const int64_t dim_vec,
+                        const int64_t num_of_rows,
+                        const int64_t num_of_batch,
+                        const int64_t row_begin,
+                        const int64_t row_end,
+                        const float *bias,
+                        const int relu,
+                        float *output,
+                        const onnx_kernels *kernels)
 {
-    for (int i = 0; i < num_of_rows; i++)
+    // Each block of weight rows is reused across the whole batch while it is in cache
+    for (int i = row_begin; i < row_end; i += MATMUL_BLOCK)
     {
-        float ip_out = 0;
-        for (int j = 0; j < dim_vec; j++)
+        int n = row_end - i < MATMUL_BLOCK ? row_end - i : MATMUL_BLOCK;
+        for (int b = 0; b < num_of_batch; b++)
         {
-            ip_out += input[j] * weight[i * dim_vec + j];
+            float* y = output + b * num_of_rows + i;
+            kernels->gemv(input + b * dim_vec, weight + i * dim_vec, dim_vec, n, y);
+            if (bias != NULL)
+            {
+                kernels->add(y, bias + i, n, y);
+            }
+            if (relu)
+            {
+                kernels->relu(y, n, y);
+            }
         }
-        output[i] = ip_out;
     }
 }
 
-float* matmul_layer(Onnx__GraphProto* graph, const float *input, int64_t* shapeInput, int64_t* shapeOutput, const char* layer_name)
+void matmul(const float *input,              // pointer to vector
+           const float *weight,             // pointer to matrix
+           const int64_t dim_vec,          // length of the vector
+           const int64_t num_of_rows,      // numCol of A
+           const int64_t num_of_batch,     // number of input vectors
+           float *output)
 {
-    assert(graph != NULL && input != NULL && layer_name != "" );
-
-    Onnx__NodeProto* node = onnx_graph_get_node_by_name(graph, layer_name);
-    const char* weight = node->input[1];
-
-    int64_t* shapeW =  onnx_graph_get_dims_by_name(graph, weight);
-    if(shapeW == NULL)
-    {
-        return NULL;
-    }
-    int64_t dimW = onnx_graph_get_dim_by_name(graph, weight);
-    if(dimW < 0)
-    {
-        return NULL;
-    }
-
-    assert(shapeW[0] == shapeInput[1]);
-
-    int64_t permW_t[] = {1, 0};
-    float* W = onnx_graph_get_weights_by_name(graph, weight);
-    if(W == NULL)
-    {
-        return NULL;
-    }
-    float* W_t = transpose(W, shapeW, dimW, permW_t);
+    matmul_rows(input, weight, dim_vec, num_of_rows, num_of_batch, 0, num_of_rows, NULL, 0, output, onnx_kernels_get(ONNX_ISA_SCALAR));
+}
 
-    float* output = (float*) malloc(sizeof(float)*shapeW[1]);
-    if(output == NULL)
-    {
-        // No memory
-        return NULL;
-    }
-    memset(output, 0, sizeof(sizeof(float)*shapeW[1]));
-    matmul(input, W_t, shapeW[0], shapeW[1], output);
+// Items are output features; each task streams its block of weight rows once
+static void matmul_task(void* arg, int64_t begin, int64_t end)
+{
+    const onnx_plan_step* step = ((onnx_step_task*) arg)->step;
+    float** slots = ((onnx_step_task*) arg)->slots;
 
-    shapeOutput[0] = shapeInput[0];
-    shapeOutput[1] = shapeW[1];
+    matmul_rows(slots[step->input[0]], step->weight, step->shapeW[0], step->shapeW[1], step->in.dims[0], begin, end,
+                step->bias, step->relu, slots[step->output], onnx_kernels_active);
+}
 
-    free(W_t);
+void matmul_step(const onnx_plan_step* step, float** slots, onnx_pool* pool)
+{
+    onnx_step_task task = { step, slots };
+    int64_t work = step->shapeW[0] * step->in.dims[0];
 
-    return output;
+    onnx_pool_parallel_for(pool, step->shapeW[1], ONNX_POOL_GRAIN / work + 1, matmul_task, &task);
 }
@@ -0,0 +1,134 @@
+#include "onnx.h"
+
+int matmul_layer(onnx_graph_index* index, const onnx_tensor* input, onnx_tensor* output, const char* layer_name)
+{
+    assert(index != NULL && input != NULL && input->data != NULL && layer_name != "" );
+
+    Onnx__NodeProto* node = onnx_graph_index_get_node_by_name(index, layer_name);
+    if(node == NULL)
+    {
+        return -1;
+    }
+    const char* weight = node->input[1];
+
+    int64_t* shapeW =  onnx_graph_index_get_dims_by_name(index, weight);
+    if(shapeW == NULL)
+    {
+        return -1;
+    }
+    int64_t dimW = onnx_graph_index_get_dim_by_name(index, weight);
+    if(dimW != 2 || input->rank != 2 || shapeW[0] != input->dims[1])
+    {
+        printf("MatMul %s: input does not match the weights\n", node->name);
+        return -1;
+    }
+
+    int64_t permW_t[] = {1, 0};
+    float* W = onnx_graph_index_get_weights_by_name(index, weight);
+    if(W == NULL)
+    {
+        return -1;
+    }
+    float* W_t = transpose(W, shapeW, dimW, permW_t);
+
+    int64_t dims[2] = { input->dims[0], shapeW[1] };
+    onnx_tensor_init(output, ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT, 2, dims, NULL);
+    if(W_t == NULL || onnx_tensor_alloc(output, NULL) != 0)
+    {
+        // No memory
+        free(W_t);
+        return -1;
+    }
+    matmul((const float*) input->data, W_t, shapeW[0], shapeW[1], input->dims[0], (float*) output->data);
+
+    free(W_t);
+
+    return 0;
+}
+
+int matmul_plan(onnx_plan* plan, Onnx__NodeProto* node, onnx_plan_step* step)
+{
+    int64_t* shapeW = onnx_graph_index_get_dims_by_name(plan->index, node->input[1]);
+    int64_t dimW = onnx_graph_index_get_dim_by_name(plan->index, node->input[1]);
+    step->weight = onnx_plan_pack_weights(plan, node->input[1], ONNX_PACK_NK);
+    if(shapeW == NULL || dimW != 2 || step->weight == NULL)
+    {
+        return -1;
+    }
+    if(shapeW[0] != step->in.dims[1])
+    {
+        printf("MatMul %s expects %ld inputs, got %ld\n", node->name, shapeW[0], step->in.dims[1]);
+        return -1;
+    }
+
+    memcpy(step->shapeW, shapeW, sizeof(int64_t)*2);
+    step->dimW = dimW;
+    int64_t dims[2] = { step->in.dims[0], shapeW[1] };
+    onnx_tensor_init(&step->out, ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT, 2, dims, NULL);
+    step->kernel = matmul_step;
+
+    return 0;
+}
+
+// Gemm as a MatMul with its bias already fused: Y = A * B + C, or A * B^T + C
+// with transB. The scalings and a transposed A are not supported.
+int gemm_plan(onnx_plan* plan, Onnx__NodeProto* node, onnx_plan_step* step)
+{
+    int trans_b = 0;
+    for(int i = 0; i < node->n_attribute; i++)
+    {
+        Onnx__AttributeProto* attribute = node->attribute[i];
+        if((strcmp(attribute->name, "alpha") == 0 && attribute->f != 1.0f) ||
+           (strcmp(attribute->name, "beta") == 0 && attribute->f != 1.0f) ||
+           (strcmp(attribute->name, "transA") == 0 && attribute->i != 0))
+        {
+            printf("Gemm %s: only alpha = beta = 1 and transA = 0 are supported\n", node->name);
+            return -1;
+        }
+        if(strcmp(attribute->name, "transB") == 0)
+        {
+            trans_b = attribute->i != 0;
+        }
+    }
+
+    int64_t* shapeW = onnx_graph_index_get_dims_by_name(plan->index, node->input[1]);
+    int64_t dimW = onnx_graph_index_get_dim_by_name(plan->index, node->input[1]);
+    if(shapeW == NULL || dimW != 2)
+    {
+        return -1;
+    }
+
+    // B^T is already one row of K weights per output
+    int64_t k = trans_b ? shapeW[1] : shapeW[0];
+    int64_t n = trans_b ? shapeW[0] : shapeW[1];
+    step->weight = trans_b ? onnx_graph_index_get_weights_by_name(plan->index, node->input[1])
+                           : onnx_plan_pack_weights(plan, node->input[1], ONNX_PACK_NK);
+    if(step->weight == NULL)
+    {
+        return -1;
+    }
+    if(k != step->in.dims[1])
+    {
+        printf("Gemm %s expects %ld inputs, got %ld\n", node->name, k, step->in.dims[1]);
+        return -1;
+    }
+    if(node->n_input > 2 && node->input[2][0] != '\0')
+    {
+        const onnx_tensor_view* view = onnx_graph_index_get_view_by_name(plan->index, node->input[2]);
+        step->bias = onnx_graph_index_get_weights_by_name(plan->index, node->input[2]);
+        if(view == NULL || step->bias == NULL || view->n_elem != n)
+        {
+            printf("Gemm %s: C must have %ld elements\n", node->name, n);
+            return -1;
+        }
+    }
+
+    step->shapeW[0] = k;
+    step->shapeW[1] = n;
+    step->dimW = dimW;
+    int64_t dims[2] = { step->in.dims[0], n };
+    onnx_tensor_init(&step->out, ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT, 2, dims, NULL);
+    step->kernel = matmul_step;
+
+    return 0;
+}
@@ -1,95 +1,105 @@
-#include "onnx.h"
+#include "onnx-runtime.h"
 
-void maxpool(const float *input,
-             const uint16_t dim_im_in_x,  // input image dimension x or W
-             const uint16_t dim_im_in_y,  // input image dimension y or H
-             const uint16_t ch_im_in,     // number of input image channels
-             const uint16_t dim_kernel_x, // window kernel size
-             const uint16_t dim_kernel_y, // window kernel size
-             const uint16_t padding_x,    // padding sizes
-             const uint16_t padding_y,    // padding sizes
-             const uint16_t stride_x,     // stride
-             const uint16_t stride_y,     // stride
-             const uint16_t dim_im_out_x, // output image dimension x or W
-             const uint16_t dim_im_out_y, // output image dimension y or H
-             float *output)
+// Output rows [out_y_begin, out_y_end) of maxpool. Also pools the conv band
+// of a fused Conv + MaxPool step, which passes the band's first row in padding_y.
+void maxpool_rows(const float *input,
+                  const int64_t dim_im_in_x,
+                  const int64_t dim_im_in_y,
+                  const int64_t ch_im_in,
+                  const int64_t dim_kernel_x,
+                  const int64_t dim_kernel_y,
+                  const int64_t padding_x,
+                  const int64_t padding_y,
+                  const int64_t stride_x,
+                  const int64_t stride_y,
+                  const int64_t dim_im_out_x,
+                  const int64_t out_y_begin,
+                  const int64_t out_y_end,
+                  float *output,
+                  const onnx_kernels *kernels)
 {
-    int16_t i_ch_in, i_x, i_y;
-    int16_t k_x, k_y;
+    int i_ch_in, i_x, i_y;
+    int k_x, k_y;
 
-    for (i_ch_in = 0; i_ch_in < ch_im_in; i_ch_in++)
+    // Channels are innermost in NWHC, so every window tap is one vector max
+    for (i_y = out_y_begin; i_y < out_y_end; i_y++)
     {
-        for (i_y = 0; i_y < dim_im_out_y; i_y++)
+        for (i_x = 0; i_x < dim_im_out_x; i_x++)
         {
-            for (i_x = 0; i_x < dim_im_out_x; i_x++)
+            float* max = output + ch_im_in * (i_x + i_y * dim_im_out_x);
+            int first = 1;
+            for (k_y = i_y * stride_y - padding_y; k_y < i_y * stride_y - padding_y + dim_kernel_y; k_y++)
             {
-                float max = FLT_MIN;
-                for (k_y = i_y * stride_y - padding_y; k_y < i_y * stride_y - padding_y + dim_kernel_y; k_y++)
+                for (k_x = i_x * stride_x - padding_x; k_x < i_x * stride_x - padding_x + dim_kernel_x; k_x++)
                 {
-                    for (k_x = i_x * stride_x - padding_x; k_x < i_x * stride_x - padding_x + dim_kernel_x; k_x++)
+                    if (k_y >= 0 && k_x >= 0 && k_y < dim_im_in_y && k_x < dim_im_in_x)
                     {
-                        if (k_y >= 0 && k_x >= 0 && k_y < dim_im_in_y && k_x < dim_im_in_x)
+                        const float* tap = input + ch_im_in * (k_x + k_y * dim_im_in_x);
+                        if (first)
+                        {
+                            memcpy(max, tap, sizeof(float) * ch_im_in);
+                            first = 0;
+                        }
+                        else
                         {
-                            if (input[i_ch_in + ch_im_in * (k_x + k_y * dim_im_in_x)] > max)
-                            {
-                                max = input[i_ch_in + ch_im_in * (k_x + k_y * dim_im_in_x)];
-                            }
+                            kernels->max(max, tap, ch_im_in, max);
                         }
                     }
                 }
-                output[i_ch_in + ch_im_in * (i_x + i_y * dim_im_out_x)] = max;
+            }
+            for (i_ch_in = 0; first && i_ch_in < ch_im_in; i_ch_in++)
+            {
+                max[i_ch_in] = -FLT_MAX;
             }
         }
     }
 }
 
-float* maxpool_layer(Onnx__GraphProto* graph, float* input, int64_t* shapeInput, int64_t* shapeOutput, const char* layer_name)
+void maxpool(const float *input,
+             const int64_t dim_im_in_x,   // input image dimension x or W
+             const int64_t dim_im_in_y,   // input image dimension y or H
+             const int64_t ch_im_in,      // number of input image channels
+             const int64_t dim_kernel_x,  // window kernel size
+             const int64_t dim_kernel_y,  // window kernel size
+             const int64_t padding_x,     // padding sizes
+             const int64_t padding_y,     // padding sizes
+             const int64_t stride_x,      // stride
+             const int64_t stride_y,      // stride
+             const int64_t dim_im_out_x,  // output image dimension x or W
+             const int64_t dim_im_out_y,  // output image dimension y or H
+             float *output)
 {
-    assert(graph != NULL && input != NULL && layer_name != "" );
-
-    Onnx__NodeProto* node = onnx_graph_get_node_by_name(graph, layer_name);
-    if(node == NULL)
-    {
-        // layer not found
-        return NULL;
-    }
+    maxpool_rows(input, dim_im_in_x, dim_im_in_y, ch_im_in, dim_kernel_x, dim_kernel_y, padding_x, padding_y,
+                 stride_x, stride_y, dim_im_out_x, 0, dim_im_out_y, output, onnx_kernels_get(ONNX_ISA_SCALAR));
+}
 
-    uint16_t kernel_x  = 1;
-    uint16_t kernel_y  = 1;
-    uint16_t padding_x = 0;
-    uint16_t padding_y = 0;
-    uint16_t stride_x  = 1;
-    uint16_t stride_y  = 1;
+// Items are output rows of every sample in the batch
+static void maxpool_task(void* arg, int64_t begin, int64_t end)
+{
+    const onnx_plan_step* step = ((onnx_step_task*) arg)->step;
+    float** slots = ((onnx_step_task*) arg)->slots;
+    int64_t in_len = onnx_tensor_sample(&step->in);
+    int64_t out_len = onnx_tensor_sample(&step->out);
+    int64_t rows = step->out.dims[ONNX_H];
 
-    for(int i = 0; i < node->n_attribute; i++)
+    while(begin < end)
     {
-        if( strcmp(node->attribute[i]->name, "kernel_shape") == 0 )
-        {
-            kernel_x = node->attribute[i]->ints[0];
-            kernel_y = node->attribute[i]->ints[1];
-        }
-        if( strcmp(node->attribute[i]->name, "strides") == 0 )
-        {
-            stride_x = node->attribute[i]->ints[0];
-            stride_y = node->attribute[i]->ints[1];
-        }
-    }
-
-    uint16_t out_x = (shapeInput[W_INDEX] - kernel_x + 2 * padding_x) / stride_x + 1;
-    uint16_t out_y = (shapeInput[H_INDEX] - kernel_y + 2 * padding_y) / stride_y + 1;
+        int64_t b = begin / rows;
+        int64_t y = begin % rows;
+        int64_t y_end = y + (end - begin) < rows ? y + (end - begin) : rows;
 
-    float* output = (float*) malloc(sizeof(float)*out_x*out_y*shapeInput[C_INDEX]);
-    if(output == NULL)
-    {
-        // No memory
-        return NULL;
+        maxpool_rows(slots[step->input[0]] + b * in_len, step->in.dims[ONNX_W], step->in.dims[ONNX_H], step->in.dims[ONNX_C],
+                     step->attr.kernel_x, step->attr.kernel_y, step->attr.padding_x, step->attr.padding_y,
+                     step->attr.stride_x, step->attr.stride_y, step->out.dims[ONNX_W], y, y_end,
+                     slots[step->output] + b * out_len, onnx_kernels_active);
+        begin += y_end - y;
     }
-    memset(output, 0, sizeof(sizeof(float)*out_x*out_y*shapeInput[C_INDEX]));
-    maxpool(input, shapeInput[W_INDEX], shapeInput[H_INDEX], shapeInput[C_INDEX], kernel_x, kernel_y, padding_x, padding_y, stride_x, stride_y, out_x, out_y, output);
+}
 
-    shapeOutput[W_INDEX] = out_x;
-    shapeOutput[H_INDEX] = out_y;
-    shapeOutput[C_INDEX] = shapeInput[C_INDEX];
+void maxpool_step(const onnx_plan_step* step, float** slots, onnx_pool* pool)
+{
+    onnx_step_task task = { step, slots };
+    int64_t work = step->out.dims[ONNX_W] * step->out.dims[ONNX_C] * step->attr.kernel_x * step->attr.kernel_y;
 
-    return output;
+    onnx_pool_parallel_for(pool, step->out.dims[ONNX_N] * step->out.dims[ONNX_H], ONNX_POOL_GRAIN / work + 1, maxpool_task, &task);
 }
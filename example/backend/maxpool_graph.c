@@ -0,0 +1,44 @@
+#include "onnx.h"
+
+int maxpool_layer(onnx_graph_index* index, const onnx_tensor* input, onnx_tensor* output, const char* layer_name)
+{
+    assert(index != NULL && input != NULL && input->data != NULL && layer_name != "" );
+
+    Onnx__NodeProto* node = onnx_graph_index_get_node_by_name(index, layer_name);
+    if(node == NULL || input->rank != 4)
+    {
+        // layer not found
+        return -1;
+    }
+
+    // Same window rules as the plan, pads and auto_pad included
+    onnx_plan_attr attr;
+    int64_t kernel[2] = { 1, 1 };
+    if(onnx_plan_window(node, input, kernel, &attr, output) != 0 || onnx_tensor_alloc(output, NULL) != 0)
+    {
+        return -1;
+    }
+
+    int64_t in_len = onnx_tensor_sample(input);
+    int64_t out_len = onnx_tensor_sample(output);
+    for(int64_t b = 0; b < input->dims[ONNX_N]; b++)
+    {
+        maxpool((const float*) input->data + b * in_len, input->dims[ONNX_W], input->dims[ONNX_H], input->dims[ONNX_C],
+                attr.kernel_x, attr.kernel_y, attr.padding_x, attr.padding_y, attr.stride_x, attr.stride_y,
+                output->dims[ONNX_W], output->dims[ONNX_H], (float*) output->data + b * out_len);
+    }
+
+    return 0;
+}
+
+int maxpool_plan(onnx_plan* plan, Onnx__NodeProto* node, onnx_plan_step* step)
+{
+    int64_t kernel[2] = { 1, 1 };
+    if(onnx_plan_window(node, &step->in, kernel, &step->attr, &step->out) != 0)
+    {
+        return -1;
+    }
+    step->kernel = maxpool_step;
+
+    return 0;
+}
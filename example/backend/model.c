@@ -1,83 +1,428 @@
 #include "onnx.h"
 
-float* onnx_model_run(Onnx__ModelProto* model, float* input, int64_t* shapeInput)
+// Hands the input on to a node that does not change the data (Identity,
+// Transpose, a Reshape of data in logical order). Owned data is moved when
+// this node is its last consumer; otherwise output gets a copy.
+static int onnx_forward(onnx_tensor* values, int32_t* remaining, int32_t tensor, onnx_tensor* output)
 {
-    int64_t* shapeOutput = (int64_t*) malloc(sizeof(int64_t)*3);
-    shapeOutput[0] = -1; shapeOutput[1] = -1; shapeOutput[2] =  -1;
+    *output = values[tensor];
+    if(remaining[tensor] == 1 && values[tensor].owned)
+    {
+        values[tensor].data = NULL;
+        values[tensor].owned = 0;
+        return 0;
+    }
+    if(onnx_tensor_alloc(output, NULL) != 0)
+    {
+        return -1;
+    }
+    memcpy(output->data, values[tensor].data, sizeof(float) * onnx_tensor_numel(output));
+    return 0;
+}
+
+// x laid out as perm, see Layout in onnx.h. y is x itself when it already is
+// and otherwise a copy for the caller to release; layout follows y.
+static int onnx_relayout(const onnx_tensor* x, onnx_layout* layout, const int8_t* perm, onnx_tensor* y)
+{
+    *y = *x;
+    y->owned = 0;
+    y->arena = NULL;
+    if(perm == NULL || onnx_layout_is(layout, perm))
+    {
+        return 0;
+    }
+
+    // The copy of every sample at once: the batch axis stays put
+    int64_t dims[ONNX_LAYOUT_MAX_DIM];
+    int64_t axes[ONNX_LAYOUT_MAX_DIM];
+    int64_t order[ONNX_LAYOUT_MAX_DIM] = { 0 };
+    int64_t dim = onnx_layout_copy(layout, perm, dims, axes);
+    for(int64_t i = 0; i < dim; i++)
+    {
+        order[i + 1] = axes[i] + 1;
+    }
+    onnx_tensor view;
+    onnx_layout_tensor(layout, x->dims[0], y);
+    if(onnx_tensor_permute(x, order, &view) != 0 || onnx_tensor_alloc(y, NULL) != 0 || onnx_tensor_copy(&view, y) != 0)
+    {
+        onnx_tensor_release(y);
+        return -1;
+    }
+    return 0;
+}
 
-    Onnx__NodeProto* node = onnx_graph_get_node_by_input(model->graph, model->graph->input[0]->name);
+// The target's first dim is taken as N, whatever its value, so the batch axis
+// stays first. A shape that is not bound, e.g. computed by Shape and Concat,
+// is taken as a flatten to [N, K].
+int onnx_reshape_target(onnx_graph_index* index, Onnx__NodeProto* node, const onnx_tensor* x, onnx_tensor* view)
+{
+    const onnx_tensor_view* shape = node->n_input > 1 ? onnx_graph_index_get_view_by_name(index, node->input[1]) : NULL;
+    if(shape == NULL)
+    {
+        return onnx_tensor_flatten(x, 1, view);
+    }
+    if(shape->data_type != ONNX__TENSOR_PROTO__DATA_TYPE__INT64 || shape->n_elem < 1 || shape->n_elem > ONNX_TENSOR_MAX_DIM)
+    {
+        return -1;
+    }
 
-    int i = 0;
-    float* output;
-    while(node != NULL)
+    // 0 keeps the input's dim, -1 is inferred
+    const int64_t* target = (const int64_t*) shape->data;
+    int64_t dims[ONNX_TENSOR_MAX_DIM];
+    dims[0] = x->dims[0];
+    for(size_t i = 1; i < shape->n_elem; i++)
     {
-        printf("[%2d] %-10s %-20s ", i++, node->op_type, node->name);
-        if(strcmp(node->op_type, "Conv") == 0)
+        dims[i] = target[i] == 0 && i < (size_t) x->rank ? x->dims[i] : target[i];
+    }
+    return onnx_tensor_reshape(x, (int32_t) shape->n_elem, dims, view);
+}
+
+// Profile of onnx_model_run, onnx_model_run_batch and onnx_graph_run
+static __thread onnx_profile* onnx_model_profile = NULL;
+
+void onnx_model_set_profile(onnx_profile* profile)
+{
+    onnx_model_profile = profile;
+}
+
+// Appends a node's event and sets its cost from the tensors it just ran on;
+// node is NULL for the event of the whole run
+static void onnx_graph_profile(onnx_profile* profile, onnx_graph_index* index, Onnx__NodeProto* node,
+                               const int32_t* inputs, int32_t n_inputs, const onnx_tensor* x, const onnx_tensor* y,
+                               const onnx_profile_event* event)
+{
+    onnx_profile_event* copy = node == NULL || event->node >= 0 ? onnx_profile_reserve(profile, 1) : NULL;
+    if(copy == NULL)
+    {
+        return;
+    }
+    *copy = *event;
+    if(node == NULL)
+    {
+        return;
+    }
+
+    int64_t bytes = sizeof(float) * onnx_tensor_numel(x);
+    int64_t weights = 0;
+    for(int32_t i = 1; i < n_inputs; i++)
+    {
+        int32_t id = inputs[i] >= 0 ? index->initializer_ids[inputs[i]] : -1;
+        if(id >= 0)
         {
-            output = conv2D_layer(model->graph, input, shapeInput, shapeOutput, node->name);
+            bytes += index->views[id].n_elem * index->views[id].elem_size;
+            weights = i == 1 ? (int64_t) index->views[id].n_elem : weights;
+        }
+        else if(inputs[i] >= 0)
+        {
+            bytes += sizeof(float) * onnx_tensor_numel(x);
+        }
+    }
+    onnx_profile_node* cost = &profile->nodes[event->node];
+    cost->bytes_in = bytes;
+    cost->bytes_out = sizeof(float) * onnx_tensor_numel(y);
+    cost->flops = onnx_profile_flops(node, x, y, weights);
+}
+
+int onnx_graph_run(onnx_graph_index* index, const onnx_tensor* input, onnx_tensor* output)
+{
+    Onnx__GraphProto* graph = index->graph;
+    int32_t n_tensors = index->n_tensors;
+    onnx_profile* profile = onnx_model_profile;
+    onnx_profile_event run, event;
+
+    if(input->dtype != ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT || (input->rank != 2 && input->rank != 4) ||
+       !onnx_tensor_is_contiguous(input) || input->data == NULL)
+    {
+        printf("The input must be a dense float tensor of rank 2 or 4\n");
+        return -1;
+    }
+
+    memset(output, 0, sizeof(onnx_tensor));
+
+    // Optional names that were left empty map to -1
+    int32_t input_id = graph->n_input > 0 ? onnx_graph_index_get_tensor_id(index, graph->input[0]->name) : -1;
+    int32_t output_id = graph->n_output > 0 ? onnx_graph_index_get_tensor_id(index, graph->output[0]->name) : -1;
+    if(input_id < 0 || output_id < 0)
+    {
+        printf("The graph has no input or output\n");
+        return -1;
+    }
+
+    // Per tensor: data, layout and the number of consumers still to run
+    onnx_tensor* values = (onnx_tensor*) calloc(n_tensors + 1, sizeof(onnx_tensor));
+    onnx_layout* layouts = (onnx_layout*) calloc(n_tensors + 1, sizeof(onnx_layout));
+    int32_t* remaining = (int32_t*) calloc(n_tensors + 1, sizeof(int32_t));
+    if(values == NULL || layouts == NULL || remaining == NULL)
+    {
+        free(values);
+        free(layouts);
+        free(remaining);
+        return -1;
+    }
+    for(int32_t t = 0; t < n_tensors; t++)
+    {
+        remaining[t] = index->consumer_offsets[t + 1] - index->consumer_offsets[t];
+    }
+
+    remaining[output_id]++;
+
+    // The caller's input is read, never released
+    values[input_id] = *input;
+    values[input_id].owned = 0;
+    values[input_id].arena = NULL;
+    onnx_layout_init(&layouts[input_id], input, onnx_layout_identity);
+
+    if(profile != NULL)
+    {
+        onnx_profile_begin(&run, ONNX_PROFILE_RUN);
+    }
+
+    int status = 0;
+    for(int i = 0; i < index->n_order && status == 0; i++)
+    {
+        int32_t n = index->order[i];
+        Onnx__NodeProto* node = graph->node[n];
+        int32_t* inputs = &index->node_inputs[index->node_input_offsets[n]];
+        int32_t n_inputs = index->node_input_offsets[n + 1] - index->node_input_offsets[n];
+        int32_t n_outputs = index->node_output_offsets[n + 1] - index->node_output_offsets[n];
+        int32_t in = n_inputs > 0 ? inputs[0] : -1;
+        int32_t out = n_outputs > 0 ? index->node_outputs[index->node_output_offsets[n]] : -1;
+        int forward = strcmp(node->op_type, "Identity") == 0 || strcmp(node->op_type, "Transpose") == 0;
+        onnx_tensor x = { 0 };
+        onnx_tensor y = { 0 };
+
+        // e.g. a Constant, which has no input, or an output left unnamed
+        if(in < 0 || out < 0)
+        {
+            printf("%s %s: needs an input and an output\n", node->op_type, node->name);
+            status = -1;
+            break;
+        }
+        onnx_layout layout = layouts[in];
+
+        if(profile != NULL)
+        {
+            onnx_profile_begin(&event, onnx_profile_node_id(profile, node->name, node->op_type));
+        }
+
+        if(values[in].data == NULL)
+        {
+            printf("%s %s: missing input %s\n", node->op_type, node->name, node->input[0]);
+            status = -1;
+            break;
+        }
+
+        // Lay the input out the way the layer reads it; a Transpose only
+        // relabels the axes
+        const int8_t* want = strcmp(node->op_type, "Reshape") == 0 ? onnx_layout_identity :
+                             onnx_layout_input(index, node, inputs, n_inputs);
+        status = onnx_relayout(&values[in], &layout, forward ? NULL : want, &x);
+
+        if(status != 0)
+        {
+            // No memory for the copy
+        }
+        else if(strcmp(node->op_type, "Conv") == 0)
+        {
+            status = conv2D_layer(index, &x, &y, node->name);
         }
         else if(strcmp(node->op_type, "Relu") == 0)
         {
-            output = relu_layer(model->graph, input, shapeInput, shapeOutput, node->name);
+            status = relu_layer(index, &x, &y, node->name);
         }
         else if(strcmp(node->op_type, "MaxPool") == 0)
         {
-            output = maxpool_layer(model->graph, input, shapeInput, shapeOutput, node->name);
+            status = maxpool_layer(index, &x, &y, node->name);
         }
         else if(strcmp(node->op_type, "Softmax") == 0)
         {
-            output = softmax_layer(model->graph, input, shapeInput, shapeOutput, node->name);
+            status = softmax_layer(index, &x, &y, node->name);
         }
         else if(strcmp(node->op_type, "MatMul") == 0)
         {
-            output = matmul_layer(model->graph, input, shapeInput, shapeOutput, node->name);
+            status = matmul_layer(index, &x, &y, node->name);
         }
         else if(strcmp(node->op_type, "Add") == 0)
         {
-            output = add_layer(model->graph, input, shapeInput, shapeOutput, node->name);
+            if(n_inputs < 2 || inputs[1] < 0)
+            {
+                printf("Add %s: second operand missing\n", node->name);
+                status = -1;
+            }
+            else if(index->initializer_ids[inputs[1]] >= 0)
+            {
+                status = add_layer(index, &x, &y, node->name);
+            }
+            else
+            {
+                // Both operands are activations, e.g. a residual connection;
+                // the second one follows the layout of the first
+                onnx_layout other = layouts[inputs[1]];
+                onnx_tensor b = { 0 };
+                status = values[inputs[1]].data != NULL ? onnx_relayout(&values[inputs[1]], &other, layout.perm, &b) : -1;
+                if(status == 0 && !onnx_tensor_same_shape(&x, &b))
+                {
+                    printf("Add %s: operands differ in shape\n", node->name);
+                    status = -1;
+                }
+                if(status == 0)
+                {
+                    y = x;
+                    status = onnx_tensor_alloc(&y, NULL);
+                }
+                if(status == 0)
+                {
+                    add((const float*) x.data, (const float*) b.data, onnx_tensor_numel(&x), (float*) y.data);
+                }
+                onnx_tensor_release(&b);
+            }
         }
-        else if(strcmp(node->op_type, "Identity") == 0)
+        else if(forward)
         {
-            node = onnx_graph_get_node_by_input(model->graph, node->output[0]);
-            printf("\n");
-
-            continue;
+            if(strcmp(node->op_type, "Transpose") == 0 && onnx_layout_transpose(&layout, node) != 0)
+            {
+                status = -1;
+            }
+            else
+            {
+                status = onnx_forward(values, remaining, in, &y);
+            }
         }
-        else if(strcmp(node->op_type, "Transpose") == 0)
+        else if(strcmp(node->op_type, "Reshape") == 0)
         {
-            node = onnx_graph_get_node_by_input(model->graph, node->output[0]);
-            printf("\n");
-
-            continue;
+            // A view of the data in logical order; the copy made for the
+            // layout, if any, is handed on
+            onnx_tensor view;
+            status = onnx_reshape_target(index, node, &x, &view);
+            if(status == 0 && x.owned)
+            {
+                y = x;
+                x.owned = 0;
+            }
+            else if(status == 0)
+            {
+                status = onnx_forward(values, remaining, in, &y);
+            }
+            if(status == 0)
+            {
+                y.rank = view.rank;
+                memcpy(y.dims, view.dims, sizeof(view.dims));
+                memcpy(y.strides, view.strides, sizeof(view.strides));
+            }
         }
-        else if(strcmp(node->op_type, "Reshape") == 0)
+        else
         {
-            shapeOutput[1] = shapeOutput[0] * shapeOutput[1] * shapeOutput[2]; 
-            shapeOutput[2] = 1; 
-            shapeOutput[0] = 1; 
-            printf("[%2ld, %2ld, %2ld] --> [%2ld, %2ld, %2ld]\n", shapeInput[0], shapeInput[1], shapeInput[2], shapeOutput[0], shapeOutput[1], shapeOutput[2]);
+            printf("Unsupported operand: %s\n", node->op_type);
+            status = -1;
+        }
+        onnx_tensor_release(&x);
 
-            // free(input);
-            // input = output;
-            memcpy(shapeInput, shapeOutput, sizeof(int64_t)*3);
+        if(status != 0)
+        {
+            onnx_tensor_release(&y);
+            break;
+        }
+        if(!forward)
+        {
+            onnx_layout_init(&layout, &y, want != NULL ? want : layout.perm);
+        }
+        if(profile != NULL)
+        {
+            onnx_profile_end(&event);
+            onnx_graph_profile(profile, index, node, inputs, n_inputs, &x, &y, &event);
+        }
+        layouts[out] = layout;
+        values[out] = y;
 
-            node = onnx_graph_get_node_by_input(model->graph, node->output[0]);
-            continue;
+        // Release inputs whose last consumer just ran
+        for(int32_t e = index->node_input_offsets[n]; e < index->node_input_offsets[n + 1]; e++)
+        {
+            int32_t t = index->node_inputs[e];
+            if(t >= 0 && index->initializer_ids[t] < 0 && --remaining[t] == 0)
+            {
+                onnx_tensor_release(&values[t]);
+            }
         }
-        else
+    }
+
+    // The caller gets the output in logical order, in memory of its own
+    if(status == 0 && values[output_id].data != NULL)
+    {
+        status = onnx_relayout(&values[output_id], &layouts[output_id], onnx_layout_identity, output);
+        if(status == 0 && !output->owned)
         {
-            printf("Unsupported operand: %s\n", node->op_type);
+            remaining[output_id] = 1;
+            status = onnx_forward(values, remaining, output_id, output);
         }
-        printf("[%2ld, %2ld, %2ld] --> [%2ld, %2ld, %2ld]\n", shapeInput[0], shapeInput[1], shapeInput[2], shapeOutput[0], shapeOutput[1], shapeOutput[2]);
+    }
+    else
+    {
+        status = -1;
+    }
+    if(profile != NULL && status == 0)
+    {
+        onnx_profile_end(&run);
+        onnx_graph_profile(profile, index, NULL, NULL, 0, NULL, NULL, &run);
+    }
+    for(int32_t t = 0; t < n_tensors; t++)
+    {
+        onnx_tensor_release(&values[t]);
+    }
+    free(values);
+    free(layouts);
+    free(remaining);
 
-        free(input);
-        input = output;
-        memcpy(shapeInput, shapeOutput, sizeof(int64_t)*3);
+    return status;
+}
 
-        node = onnx_graph_get_node_by_input(model->graph, node->output[0]);
+int onnx_model_run_batch(Onnx__ModelProto* model, const onnx_tensor* input, onnx_tensor* output)
+{
+    // One-shot helper: compile a plan and keep it when running more than once.
+    // The plan is compiled for the input's batch.
+    onnx_plan* plan = onnx_plan_compile_batch(model, input->dims[0]);
+    if(plan == NULL)
+    {
+        return -1;
     }
-    output = input;
-    free(shapeOutput);
+    if(onnx_model_profile != NULL && onnx_plan_set_profile(plan, onnx_model_profile) != 0)
+    {
+        onnx_plan_free(plan);
+        return -1;
+    }
+    if(!onnx_tensor_same_shape(&plan->input, input) || !onnx_tensor_is_contiguous(input) ||
+       input->dtype != ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT)
+    {
+        char shape[64], expected[64];
+        onnx_tensor_format_dims(input, shape, sizeof(shape));
+        onnx_tensor_format_dims(&plan->input, expected, sizeof(expected));
+        printf("Input shape %s does not match the model input %s\n", shape, expected);
+        onnx_plan_free(plan);
+        return -1;
+    }
+
+    *output = plan->output;
+    int status = onnx_tensor_alloc(output, NULL);
+    if(status == 0)
+    {
+        memcpy(output->data, onnx_plan_run(plan, (const float*) input->data), sizeof(float) * onnx_tensor_numel(output));
+    }
+    onnx_plan_free(plan);
+
+    return status;
+}
+
+int onnx_model_run(Onnx__ModelProto* model, const onnx_tensor* input, onnx_tensor* output)
+{
+    // One-shot helper: build the index once and call onnx_graph_run directly
+    // when running more than one inference
+    onnx_graph_index* index = onnx_graph_index_create(model->graph);
+    if(index == NULL)
+    {
+        return -1;
+    }
+
+    int status = onnx_graph_run(index, input, output);
+    onnx_graph_index_free(index);
 
-    return output;
+    return status;
 }
@@ -0,0 +1,333 @@
+#ifndef __ONNX_RUNTIME_H__
+#define __ONNX_RUNTIME_H__
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+
+// What the steps of a compiled plan need at run time: tensors, the thread
+// pool, the step records and the kernels. Nothing here depends on the parser
+// or on protobuf-c, so code generated by onnx-codegen builds against this
+// header and the run-time objects alone. onnx.h adds the model side.
+
+// Tensors
+//
+// onnx_tensor describes an array of up to ONNX_TENSOR_MAX_DIM axes: element
+// type, dims, strides in elements and the data. Views share the data of the
+// tensor they are taken from and copy nothing: reshape and flatten need dense
+// data, slice and permute only change strides, and broadcast repeats axes of
+// size 1 with stride 0. onnx_tensor_copy writes any float view out densely.
+// data is owned when onnx_tensor_alloc set it, either from an arena, released
+// with the arena, or from the heap, released by onnx_tensor_release.
+//
+// Activations are float tensors of rank 4 stored NHWC or of rank 2, [N, K].
+// dims[0] is always the batch. Plan steps and kernels take their shapes from
+// these descriptors; in a plan data stays NULL and slots are bound per run.
+#define ONNX_TENSOR_MAX_DIM 8
+
+// Axes of a rank 4 activation
+#define ONNX_N 0
+#define ONNX_H 1
+#define ONNX_W 2
+#define ONNX_C 3
+
+typedef struct onnx_tensor
+{
+    int32_t dtype;                          // Onnx__TensorProto__DataType
+    int32_t rank;
+    int64_t dims[ONNX_TENSOR_MAX_DIM];
+    int64_t strides[ONNX_TENSOR_MAX_DIM];   // in elements, 0 repeats the axis
+    void* data;
+    struct onnx_arena* arena;               // owner of data, NULL for the heap
+    uint8_t owned;
+} onnx_tensor;
+
+#define ONNX_TENSOR_FLOAT 1     // ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT
+
+void    onnx_tensor_dense(onnx_tensor* t);                         // row-major strides for the dims
+void    onnx_tensor_view_of(const onnx_tensor* t, onnx_tensor* view);   // shares the data, never owns it
+int64_t onnx_tensor_numel(const onnx_tensor* t);
+int64_t onnx_tensor_sample(const onnx_tensor* t);                  // elements per batch item
+int     onnx_tensor_is_contiguous(const onnx_tensor* t);
+int     onnx_tensor_same_shape(const onnx_tensor* a, const onnx_tensor* b);
+int     onnx_tensor_reshape(const onnx_tensor* t, int32_t rank, const int64_t* dims, onnx_tensor* view);  // one dim may be -1
+int     onnx_tensor_flatten(const onnx_tensor* t, int32_t axis, onnx_tensor* view);
+int     onnx_tensor_permute(const onnx_tensor* t, const int64_t* perm, onnx_tensor* view);
+int     onnx_tensor_broadcast(const onnx_tensor* t, int32_t rank, const int64_t* dims, onnx_tensor* view);
+int     onnx_tensor_copy(const onnx_tensor* src, onnx_tensor* dst);
+void    onnx_tensor_format_dims(const onnx_tensor* t, char* text, size_t size);   // "[N, H, W, C]"
+
+// Thread pool
+//
+// Persistent workers, optionally pinned to cpus[i]. onnx_pool_parallel_for
+// splits [0, n) into chunks of at least grain items and runs them on the
+// workers and the calling thread. Small ranges run inline. onnx_pool_run_graph
+// runs a task DAG with dependency counting: ready tasks go to per-thread deques
+// and idle threads steal them. Several threads may use one pool at once and
+// tasks may call back into it; the pool never runs more threads than it was
+// created with. onnx_pool_scratch hands kernels a per-thread buffer that is
+// reused across calls and freed when the thread exits. It only grows, and
+// onnx_pool_scratch_reserve grows it up front on the calling thread and every
+// worker, so kernels asking for no more than that never allocate or fail; it
+// must not be called from a pool task.
+#define ONNX_POOL_GRAIN 32768   // multiply-adds worth splitting off as a task
+
+typedef struct onnx_pool onnx_pool;
+typedef void (*onnx_task)(void* arg, int64_t begin, int64_t end);
+
+onnx_pool* onnx_pool_create(int n_workers, const int* cpus);
+void onnx_pool_destroy(onnx_pool* pool);
+int  onnx_pool_size(onnx_pool* pool);
+int  onnx_pool_default_workers(void);
+int  onnx_pool_worker_index(void);      // -1 outside the pool's workers
+void onnx_pool_parallel_for(onnx_pool* pool, int64_t n, int64_t grain, onnx_task fn, void* arg);
+void*  onnx_pool_scratch(size_t bytes);
+int    onnx_pool_scratch_reserve(onnx_pool* pool, size_t bytes);
+size_t onnx_pool_graph_scratch_size(onnx_pool* pool, int32_t n_tasks);
+void onnx_pool_run_graph(onnx_pool* pool, int32_t n_tasks, const int32_t* n_deps, const int32_t* succ_offsets,
+                         const int32_t* succ, onnx_task fn, void* arg, void* scratch);
+
+// Heap allocations made by the backend, counted for the profile events (see
+// Profiling in onnx.h)
+void    onnx_profile_count_alloc(void);
+int64_t onnx_profile_alloc_count(void);
+
+// Plan steps
+//
+// One step of a compiled plan: its kernel, the weights bound to it and the
+// shapes it runs on. onnx_plan_compile fills them in (see Execution plan in
+// onnx.h) and onnx-codegen writes them out as constants. node and fused only
+// name the step and are NULL in generated code.
+#define ONNX_PLAN_ALIGN 64      // arena and slot alignment in bytes
+#define ONNX_PLAN_MAX_FUSED 2   // nodes folded into one step besides its own
+#define ONNX_PLAN_POOL_ROWS 4   // pooled rows per conv band of a fused MaxPool
+
+typedef struct onnx_plan_step onnx_plan_step;
+typedef void (*onnx_kernel)(const onnx_plan_step* step, float** slots, onnx_pool* pool);
+
+typedef struct onnx_plan_attr
+{
+    int64_t kernel_x;
+    int64_t kernel_y;
+    int64_t padding_x;
+    int64_t padding_y;
+    int64_t stride_x;
+    int64_t stride_y;
+    int64_t tile;               // Winograd output tile, 0 for the other conv paths
+} onnx_plan_attr;
+
+struct onnx_plan_step
+{
+    onnx_kernel kernel;
+    struct _Onnx__NodeProto* node;
+    const float* weight;
+    const float* bias;
+    int64_t shapeW[4];
+    int64_t dimW;
+    onnx_plan_attr attr;
+    int32_t input[2];           // slot ids, -1 if unused
+    int32_t output;
+    onnx_tensor in;             // input[0] as the kernel reads it, batch first
+    onnx_tensor out;
+    int32_t n_fused;
+    struct _Onnx__NodeProto* fused[ONNX_PLAN_MAX_FUSED];
+    uint8_t relu;               // clamp at zero before storing
+    onnx_plan_attr pool;        // fused MaxPool window, kernel_x == 0 if none
+    onnx_tensor conv;           // conv output under a fused MaxPool
+    int64_t perm[4];            // layout copy: source axis of each axis of shapeW
+};
+
+// Arguments of a step split over a pool
+typedef struct onnx_step_task
+{
+    const onnx_plan_step* step;
+    float** slots;
+} onnx_step_task;
+
+void conv2D_step(const onnx_plan_step* step, float** slots, onnx_pool* pool);
+void conv2D_gemm_step(const onnx_plan_step* step, float** slots, onnx_pool* pool);
+void conv2D_winograd_step(const onnx_plan_step* step, float** slots, onnx_pool* pool);
+size_t conv2D_scratch_size(const onnx_plan_step* step);    // 0 for other kernels
+void relu_step(const onnx_plan_step* step, float** slots, onnx_pool* pool);
+void maxpool_step(const onnx_plan_step* step, float** slots, onnx_pool* pool);
+void matmul_step(const onnx_plan_step* step, float** slots, onnx_pool* pool);
+void add_step(const onnx_plan_step* step, float** slots, onnx_pool* pool);
+void softmax_step(const onnx_plan_step* step, float** slots, onnx_pool* pool);
+void transpose_step(const onnx_plan_step* step, float** slots, onnx_pool* pool);
+
+// Transpose
+//
+// Axis i of the result is axis perm[i] of the dense row-major input. Unit axes
+// are dropped and axes that stay adjacent in both layouts are merged, so most
+// permutations come down to a 2-D, 3-D or 4-D walk whose inner plane is either
+// a row copy or a 2-D transpose, done in TILE x TILE blocks by the active
+// kernels->transpose. Deeper shapes fall back to an odometer over the outer
+// axes. transpose_view does no copy at all: it returns the permuted shape with
+// strides into the input as an onnx_tensor, for consumers that can read
+// strided data, and onnx_strided_copy materializes any such view, including
+// broadcasts and slices. transpose still returns a new malloc'ed array.
+#define ONNX_TRANSPOSE_MAX_DIM ONNX_TENSOR_MAX_DIM
+#define ONNX_TRANSPOSE_TILE 32
+
+int    transpose_view(const float* A, const int64_t* shape, int64_t dim, const int64_t* perm, onnx_tensor* view);
+int    onnx_strided_copy(const onnx_tensor* view, float* B);
+int    transpose_into(const float* A, const int64_t* shape, int64_t dim, const int64_t* perm, float* B);
+float* transpose(const float* A, const int64_t* shape, int64_t dim, const int64_t* perm);
+
+// SGEMM tiles: MR x NR register tile, MC x KC packed A block (fits L2)
+#define ONNX_GEMM_MR 4
+#define ONNX_GEMM_NR 16
+#define ONNX_GEMM_MC 64
+#define ONNX_GEMM_KC 256
+#define ONNX_CONV_GEMM_MIN_K 16     // shortest im2col reduction worth a GEMM
+
+int64_t sgemm_pack_size(int64_t n, int64_t k);
+void sgemm_pack_b(const float* b, int64_t n, int64_t k, float* packed);
+void sgemm_micro(int64_t kc, const float* a, const float* b, float* c, int64_t ldc, int m, int n, const float* bias, int relu);
+
+// SIMD kernels
+//
+// The inner loops of the plan kernels go through a table of function pointers
+// picked at startup from cpuid: AVX-512F, AVX2 + FMA, or the portable scalar
+// loops, which stay the reference. ONNX_ISA=scalar|avx2|avx512 in the
+// environment caps the choice. Every level uses the same GEMM tiles, so packed
+// weights do not depend on the ISA. The legacy conv2D/maxpool/matmul/relu/add/
+// softmax functions always run the scalar code.
+#if defined(__x86_64__) && defined(__GNUC__)
+    #define ONNX_SIMD_X86
+#endif
+
+typedef enum onnx_isa
+{
+    ONNX_ISA_SCALAR,
+    ONNX_ISA_AVX2,
+    ONNX_ISA_AVX512,
+    ONNX_ISA_COUNT,
+} onnx_isa;
+
+typedef struct onnx_kernels
+{
+    const char* name;
+    void  (*sgemm_micro)(int64_t kc, const float* a, const float* b, float* c, int64_t ldc, int m, int n, const float* bias, int relu);
+    void  (*gemv)(const float* x, const float* w, int64_t k, int64_t n, float* y);  // y[j] = x . w[j*k ...]
+    float (*dot)(const float* a, const float* b, int64_t n);
+    void  (*axpy)(float a, const float* x, int64_t n, float* y);                    // y += a * x
+    void  (*relu)(const float* x, int64_t n, float* y);
+    void  (*add)(const float* a, const float* b, int64_t n, float* y);
+    void  (*max)(const float* a, const float* b, int64_t n, float* y);
+    void  (*softmax)(const float* x, int64_t n, float* y);
+    void  (*transpose)(const float* a, int64_t lda, float* b, int64_t ldb, int64_t m, int64_t n);  // m, n <= TILE
+} onnx_kernels;
+
+extern const onnx_kernels* onnx_kernels_active;
+#ifdef ONNX_SIMD_X86
+extern const onnx_kernels onnx_kernels_avx2;
+extern const onnx_kernels onnx_kernels_avx512;
+#endif
+
+const onnx_kernels* onnx_kernels_get(onnx_isa isa);    // NULL when the CPU lacks isa
+int onnx_kernels_use(onnx_isa isa);
+
+// Winograd F(m x m, 3 x 3), m = 2 or 4: tiles per transformed block (a multiple
+// of MR) and the smallest channel counts worth the transforms
+#define ONNX_WINOGRAD_TILES 32
+#define ONNX_WINOGRAD_MIN_CH 32
+#define ONNX_WINOGRAD_4x4_MIN_DIM 4 // smaller outputs waste most of a 4x4 tile
+
+int64_t winograd_pack_size(int64_t n, int64_t c, int tile);
+int     winograd_pack_filters(const float* filters, int64_t n, int64_t c, int tile, float* packed);
+size_t  winograd_scratch_size(int64_t ch_in, int64_t ch_out, int tile);
+void winograd_conv_rows(const float *input,
+                        const int64_t dim_im_in_x,
+                        const int64_t dim_im_in_y,
+                        const int64_t ch_im_in,
+                        const float *u,
+                        const int64_t ch_im_out,
+                        const int tile,
+                        const int64_t padding_x,
+                        const int64_t padding_y,
+                        const float *bias,
+                        float *output,
+                        const int64_t dim_im_out_x,
+                        const int64_t dim_im_out_y,
+                        const int64_t tile_y_begin,
+                        const int64_t tile_y_end,
+                        const int relu,
+                        float *scratch);
+
+void conv2D(const float *input,                                                // input image
+            const int64_t dim_im_in_x,                                         // input image dimention x
+            const int64_t dim_im_in_y,                                         // input image dimention y
+            const int64_t ch_im_in,                                            // number of input image channels
+            const float *weight,                                               // kernel weights
+            const int64_t ch_im_out,                                           // number of filters, i.e., output image channels
+            const int64_t dim_kernel_x,                                        // filter kernel size x
+            const int64_t dim_kernel_y,                                        // filter kernel size y
+            const int64_t padding_x,                                           // padding sizes x
+            const int64_t padding_y,                                           // padding sizes y
+            const int64_t stride_x,                                            // stride x
+            const int64_t stride_y,                                            // stride y
+            const float *bias,                                                 // bias
+            float *output,                                                     // output image
+            const int64_t dim_im_out_x,                                        // output image dimension x
+            const int64_t dim_im_out_y                                         // output image dimension y
+);
+
+void relu(const float *input, uint32_t size, float* output);
+
+void maxpool_rows(const float *input,
+                  const int64_t dim_im_in_x,
+                  const int64_t dim_im_in_y,
+                  const int64_t ch_im_in,
+                  const int64_t dim_kernel_x,
+                  const int64_t dim_kernel_y,
+                  const int64_t padding_x,
+                  const int64_t padding_y,
+                  const int64_t stride_x,
+                  const int64_t stride_y,
+                  const int64_t dim_im_out_x,
+                  const int64_t out_y_begin,
+                  const int64_t out_y_end,
+                  float *output,
+                  const onnx_kernels *kernels);
+
+void maxpool(const float *input,
+             const int64_t dim_im_in_x,     // input image dimension x or W
+             const int64_t dim_im_in_y,     // input image dimension y or H
+             const int64_t ch_im_in,        // number of input image channels
+             const int64_t dim_kernel_x,    // window kernel size
+             const int64_t dim_kernel_y,    // window kernel size
+             const int64_t padding_x,       // padding sizes
+             const int64_t padding_y,       // padding sizes
+             const int64_t stride_x,        // stride
+             const int64_t stride_y,        // stride
+             const int64_t dim_im_out_x,    // output image dimension x or W
+             const int64_t dim_im_out_y,    // output image dimension y or H
+             float *output);
+
+void matmul(const float *input,             // pointer to vector
+           const float *weight,             // pointer to matrix
+           const int64_t dim_vec,           // length of the vector
+           const int64_t num_of_rows,       // numCol of A
+           const int64_t num_of_batch,      // number of input vectors
+           float *output);
+
+void add(const float *input,                // pointer to vector
+           const float *bias,               // pointer to matrix
+           const uint32_t dim_vec,          // length of the vector
+           float *output);
+
+void dense(const float *input,              // pointer to vector
+           const float *weight,             // pointer to matrix
+           const int64_t dim_vec,           // length of the vector
+           const int64_t num_of_rows,       // numCol of A
+           const float *bias,
+           float *output);
+
+void softmax(const float *input, const uint32_t dim_vec, float *output);
+
+#endif // __ONNX_RUNTIME_H__
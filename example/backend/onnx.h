@@ -8,88 +8,294 @@
 #include <math.h>
 
 #include <onnx-parser.h>
+#include "onnx-runtime.h"
 
-#define ONNX_USE_NWHC
+// Model tensors
+//
+// onnx_tensor_init accepts any element type the parser knows the size of, and
+// onnx_tensor_slice offsets the data by it; see Tensors in onnx-runtime.h.
+// Generated code tags activations with ONNX_TENSOR_FLOAT, which must stay the
+// parser's FLOAT.
+_Static_assert(ONNX_TENSOR_FLOAT == ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT, "ONNX_TENSOR_FLOAT is not FLOAT");
 
-#ifdef  ONNX_USE_NWHC
-    // NWHC
-    #define W_INDEX 0
-    #define H_INDEX 1
-    #define C_INDEX 2
-#else
-    // NCWH
-    #define C_INDEX 0
-    #define W_INDEX 1
-    #define H_INDEX 2
-#endif
+int     onnx_tensor_init(onnx_tensor* t, Onnx__TensorProto__DataType dtype, int32_t rank, const int64_t* dims, void* data);
+int     onnx_tensor_from_view(const onnx_tensor_view* view, onnx_tensor* t);
+int     onnx_tensor_alloc(onnx_tensor* t, onnx_arena* arena);
+void    onnx_tensor_release(onnx_tensor* t);
+int     onnx_tensor_slice(const onnx_tensor* t, int32_t axis, int64_t start, int64_t end, int64_t step, onnx_tensor* view);
+
+// Execution plan
+//
+// onnx_plan_compile resolves every node once: weights are bound, attributes
+// parsed, shapes inferred and tensors mapped to slots. onnx_plan_run then only
+// walks the step array. Identity, Transpose and Reshape do not get a step
+// unless the layout pass needs a copy (see Layout); their output shares the
+// input's slot. All activation slots live in one arena, laid out from their
+// lifetimes at compile time, so a run does not allocate.
+//
+// Before memory is laid out, a fusion pass folds a step into its producer when
+// the producer's output has no other reader: Relu into Conv, MatMul and Gemm,
+// MaxPool into a direct or im2col Conv, and the bias Add into MatMul. The
+// producer then applies bias, clamp and pooling before it stores, and the
+// intermediate tensor gets no slot at all. onnx_plan_set_fusion(0) turns the
+// pass off for plans compiled afterwards, e.g. to measure what it saves.
+// Timed one plan after the other, fusion had measured neutral on mnist-sm and
+// about 8% slower on mnist-lg at batch 32, but that ordering moved by more
+// than 2x with the host clock. onnx-fusion now alternates the runs of the two
+// plans. On one core it then measures fusion 1.02-1.08x faster on both MNIST
+// models, 1.02x on a 96x96x16 conv stack and 1.07x on a 1024 wide MLP; the
+// activations of the last two are far larger than L1. It is on by default.
+//
+// A compiled plan is read-only once built. Everything a run writes (arena,
+// slot pointers, scheduler scratch) lives in an onnx_session, so any number of
+// threads can run one plan at once, each with its own session, sharing the
+// weights without locks. onnx_plan_run uses a session owned by the plan and is
+// meant for a single caller. The per-thread kernel scratch of the plan's
+// steps is reserved when a session is created; a run on a thread that has
+// none yet returns NULL if it cannot be had.
+typedef struct onnx_session onnx_session;
+typedef struct onnx_profile onnx_profile;
+typedef struct onnx_profile_event onnx_profile_event;
+
+// Kernel-ready weight layouts, packed once per plan
+typedef enum onnx_pack_layout
+{
+    ONNX_PACK_OHWI,             // conv filters OIHW --> OHWI for NWHC kernels
+    ONNX_PACK_NK,               // GEMM weights KxN --> NxK, one row per output
+    ONNX_PACK_NK_FOLDED,        // NxK rows with the K columns in a folded flatten's order
+    ONNX_PACK_PANELS,           // conv filters OIHW --> sgemm_pack_b panels of OHWI rows
+    ONNX_PACK_WINOGRAD_2,       // 3x3 conv filters --> G g G^T panels for F(2x2, 3x3)
+    ONNX_PACK_WINOGRAD_4,       // 3x3 conv filters --> G g G^T panels for F(4x4, 3x3)
+    ONNX_PACK_BROADCAST,        // bias repeated to the shape of a sample
+} onnx_pack_layout;
+
+typedef struct onnx_plan_pack
+{
+    const float* source;
+    onnx_pack_layout layout;
+    float* data;
+    size_t bytes;
+} onnx_plan_pack;
+
+typedef struct onnx_plan
+{
+    Onnx__ModelProto* model;
+    onnx_graph_index* index;
+    int32_t n_steps;
+    onnx_plan_step* steps;
+    int32_t n_slots;
+    int64_t* slot_size;         // elements per slot
+    size_t* slot_offset;        // byte offset into the arena, in step order
+    size_t* slot_offset_dag;    // same, safe for the DAG scheduler
+    size_t arena_bytes;         // planned peak activation memory
+    size_t arena_bytes_dag;
+    int32_t input_slot;
+    int32_t output_slot;
+    onnx_tensor input;          // graph input and output, dims[0] samples per run
+    onnx_tensor output;
+    int32_t n_packs;
+    onnx_plan_pack* packs;
+    size_t packed_bytes;
+    int32_t* step_deps;         // step DAG: writers of the inputs
+    int32_t* succ_offsets;
+    int32_t* succ;
+    onnx_session* session;      // used by onnx_plan_run
+    void* map;                  // plan file mapping of a loaded plan, NULL if compiled
+    size_t map_bytes;
+    Onnx__NodeProto* nodes;     // names and op types of a loaded plan's steps
+} onnx_plan;
+
+struct onnx_session
+{
+    const onnx_plan* plan;
+    float** slots;
+    float* arena;
+    size_t arena_bytes;
+    onnx_pool* pool;            // NULL runs the steps in order on the caller
+    void* sched;                // scheduler scratch for pool
+    size_t scratch_bytes;       // per-thread kernel scratch of the largest step
+    onnx_profile* profile;      // NULL unless profiling, see Profiling
+    int32_t* profile_nodes;     // profile node of each step
+    onnx_profile_event* events; // the current run's events, one per step
+};
+
+onnx_plan* onnx_plan_compile(Onnx__ModelProto* model);
+onnx_plan* onnx_plan_compile_batch(Onnx__ModelProto* model, int64_t batch);
+float* onnx_plan_run(onnx_plan* plan, const float* input);
+void   onnx_plan_free(onnx_plan* plan);
+void   onnx_plan_set_fusion(int enabled);
+int    onnx_plan_set_pool(onnx_plan* plan, onnx_pool* pool);
+void   onnx_plan_info(onnx_plan* plan);
+int    onnx_plan_step_ops(const onnx_plan_step* step, char* text, size_t size);   // "Conv+Relu"
+size_t onnx_plan_activation_bytes(onnx_plan* plan);
+const float* onnx_plan_pack_weights(onnx_plan* plan, const char* name, onnx_pack_layout layout);
+const float* onnx_plan_broadcast_weights(onnx_plan* plan, const char* name, const onnx_tensor* shape);
+int    onnx_plan_window(Onnx__NodeProto* node, const onnx_tensor* input, const int64_t* kernel, onnx_plan_attr* attr, onnx_tensor* output);
+
+// Session
+onnx_session* onnx_session_create(const onnx_plan* plan, onnx_pool* pool);
+float* onnx_session_run(onnx_session* session, const float* input);
+void   onnx_session_free(onnx_session* session);
+int    onnx_session_set_profile(onnx_session* session, onnx_profile* profile);
+int    onnx_plan_set_profile(onnx_plan* plan, onnx_profile* profile);
+
+// Plan files
+//
+// A compiled plan saved as one flat, versioned file: a header, the steps as
+// fixed records, the slot layouts and step DAG, node names, and the weights,
+// already packed and each aligned to ONNX_PLAN_ALIGN. onnx_plan_load maps the
+// file read-only and points the plan's weights, slot layouts and DAG into the
+// mapping; only the steps (kernel pointers) and the plan's session are
+// allocated, and nothing is parsed. The header keeps the FNV-1a checksum and
+// size of the .onnx the plan was compiled from. Given that model's path,
+// onnx_plan_load refuses a plan that no longer matches it. Files are written
+// in host byte order and refused on hosts that differ, and files whose weight
+// ranges or step DAG do not add up are refused as corrupt.
+#define ONNX_PLAN_FILE_MAGIC "ONNXPLAN"
+#define ONNX_PLAN_FILE_VERSION 3
+
+int        onnx_plan_save(const onnx_plan* plan, const char* path, const char* source);
+onnx_plan* onnx_plan_load(const char* path, const char* source);   // NULL source skips the check
+int        onnx_plan_checksum(const char* path, uint64_t* checksum, uint64_t* bytes);
+void       onnx_plan_unmap(onnx_plan* plan);
+
+// Profiling
+//
+// Opt-in timing per node. With a profile attached, onnx_session_run (and so
+// onnx_plan_run) records an event per step and onnx_graph_run one per node,
+// plus one for the whole run: start and duration on CLOCK_MONOTONIC, the
+// thread (0 for the caller, pool workers from 1) and the allocations made by
+// the backend meanwhile. Bytes read and written and FLOPs are kept per node;
+// bytes count activations and weights, FLOPs count a multiply-add as two.
+// Without a profile a run pays one branch. onnx_model_set_profile attaches a
+// profile to onnx_model_run, onnx_model_run_batch and onnx_graph_run on the
+// calling thread.
+//
+// Events accumulate over runs until onnx_profile_reset, which keeps the
+// nodes. onnx_profile_summary gives mean, p50 and p99 per node, with node -1
+// for whole runs; onnx_profile_report prints them and
+// onnx_profile_write_trace writes Chrome trace-event JSON for
+// chrome://tracing or Perfetto. A profile records one caller at a time.
+#define ONNX_PROFILE_RUN -1     // node of the event covering a whole run
+
+typedef struct onnx_profile_node
+{
+    char name[64];
+    char op[32];                // op types, "+" joined for fused steps
+    int64_t bytes_in;           // per run
+    int64_t bytes_out;
+    int64_t flops;
+} onnx_profile_node;
+
+struct onnx_profile_event
+{
+    int32_t node;
+    int32_t tid;
+    int64_t start_ns;
+    int64_t dur_ns;
+    int64_t allocs;
+};
+
+struct onnx_profile
+{
+    int32_t n_nodes;
+    int32_t cap_nodes;
+    onnx_profile_node* nodes;
+    int64_t n_events;
+    int64_t cap_events;
+    onnx_profile_event* events;
+    int64_t origin_ns;          // trace timestamps count from here
+};
+
+typedef struct onnx_profile_stats
+{
+    int64_t count;
+    double mean_us;
+    double p50_us;
+    double p99_us;
+    double allocs;              // per event
+} onnx_profile_stats;
+
+onnx_profile* onnx_profile_create(void);
+void    onnx_profile_free(onnx_profile* profile);
+void    onnx_profile_reset(onnx_profile* profile);
+int64_t onnx_profile_now(void);
+int32_t onnx_profile_node_id(onnx_profile* profile, const char* name, const char* op);
+int32_t onnx_profile_step_node(onnx_profile* profile, const onnx_plan_step* step);
+int64_t onnx_profile_flops(Onnx__NodeProto* node, const onnx_tensor* in, const onnx_tensor* out, int64_t weights);
+onnx_profile_event* onnx_profile_reserve(onnx_profile* profile, int64_t n);
+void    onnx_profile_begin(onnx_profile_event* event, int32_t node);
+void    onnx_profile_end(onnx_profile_event* event);
+int     onnx_profile_summary(const onnx_profile* profile, int32_t node, onnx_profile_stats* stats);
+void    onnx_profile_report(const onnx_profile* profile);
+int     onnx_profile_write_trace(const onnx_profile* profile, const char* path);
 
 // Model
+//
+// input and output are logical ONNX tensors (a rank 4 input is NHWC, see
+// Layout), batch first. The input is only read; output receives a heap tensor
+// for the caller to onnx_tensor_release. onnx_model_run_batch plans for
+// input->dims[0] samples. onnx_reshape_target resolves a Reshape node's shape
+// input against x, keeping the batch axis, and returns the view.
 void   onnx_tensor_info(const float* A, int64_t* shape, int64_t dim);
-float* onnx_model_run(Onnx__ModelProto* model, float* input, int64_t* shapeInput);
+int    onnx_model_run(Onnx__ModelProto* model, const onnx_tensor* input, onnx_tensor* output);
+int    onnx_model_run_batch(Onnx__ModelProto* model, const onnx_tensor* input, onnx_tensor* output);
+void   onnx_model_set_profile(onnx_profile* profile);
+int    onnx_graph_run(onnx_graph_index* index, const onnx_tensor* input, onnx_tensor* output);
+int    onnx_reshape_target(onnx_graph_index* index, Onnx__NodeProto* node, const onnx_tensor* x, onnx_tensor* view);
 
 // Layers
-float* conv2D_layer(Onnx__GraphProto* graph, const float *input, int64_t* shapeInput, int64_t* shapeOutput, const char* layer_name);
-float* relu_layer(Onnx__GraphProto* graph, const float *input, int64_t* shapeInput, int64_t* shapeOutput, const char* layer_name);
-float* maxpool_layer(Onnx__GraphProto* graph, float* input, int64_t* shapeInput, int64_t* shapeOutput, const char* layer_name);
-float* matmul_layer(Onnx__GraphProto* graph, const float *input, int64_t* shapeInput, int64_t* shapeOutput, const char* layer_name);
-float* add_layer(Onnx__GraphProto* graph, const float *input, int64_t* shapeInput, int64_t* shapeOutput, const char* layer_name);
-float* softmax_layer(Onnx__GraphProto* graph, const float *input, int64_t* shapeInput, int64_t* shapeOutput, const char* layer_name);
-
-// Operators
-float* transpose(const float* A, int64_t* shape, int64_t dim, int64_t* perm);
-
-void conv2D(const float *input,                                                // input image
-            const uint16_t dim_im_in_x,                                        // input image dimention x
-            const uint16_t dim_im_in_y,                                        // input image dimention y
-            const uint16_t ch_im_in,                                           // number of input image channels
-            const float *weight,                                               // kernel weights
-            const uint16_t ch_im_out,                                          // number of filters, i.e., output image channels
-            const uint16_t dim_kernel_x,                                       // filter kernel size x
-            const uint16_t dim_kernel_y,                                       // filter kernel size y
-            const uint16_t padding_x,                                          // padding sizes x
-            const uint16_t padding_y,                                          // padding sizes y
-            const uint16_t stride_x,                                           // stride x
-            const uint16_t stride_y,                                           // stride y
-            const float *bias,                                                 // bias
-            float *output,                                                     // output image
-            const uint16_t dim_im_out_x,                                       // output image dimension x
-            const uint16_t dim_im_out_y                                        // output image dimension y
-);
-
-void relu(const float *input, uint32_t size, float* output);
-
-void maxpool(const float *input,
-             const uint16_t dim_im_in_x,    // input image dimension x or W
-             const uint16_t dim_im_in_y,    // input image dimension y or H
-             const uint16_t ch_im_in,       // number of input image channels
-             const uint16_t dim_kernel_x,   // window kernel size
-             const uint16_t dim_kernel_y,   // window kernel size
-             const uint16_t padding_x,      // padding sizes
-             const uint16_t padding_y,      // padding sizes
-             const uint16_t stride_x,       // stride
-             const uint16_t stride_y,       // stride
-             const uint16_t dim_im_out_x,   // output image dimension x or W
-             const uint16_t dim_im_out_y,   // output image dimension y or H
-             float *output);
-
-void matmul(const float *input,             // pointer to vector
-           const float *weight,             // pointer to matrix
-           const uint16_t dim_vec,          // length of the vector
-           const uint16_t num_of_rows,      // numCol of A
-           float *output);
-
-void add(const float *input,                // pointer to vector
-           const float *bias,               // pointer to matrix
-           const uint16_t dim_vec,          // length of the vector
-           float *output);
-
-void dense(const float *input,              // pointer to vector
-           const float *weight,             // pointer to matrix
-           const uint16_t dim_vec,          // length of the vector
-           const uint16_t num_of_rows,      // numCol of A
-           const float *bias,
-           float *output);
-
-void softmax(const float *input, const uint32_t dim_vec, float *output);
+//
+// One node on activation tensors in the backend's layout; every sample of the
+// batch is run. output receives a heap tensor.
+int    conv2D_layer(onnx_graph_index* index, const onnx_tensor* input, onnx_tensor* output, const char* layer_name);
+int    relu_layer(onnx_graph_index* index, const onnx_tensor* input, onnx_tensor* output, const char* layer_name);
+int    maxpool_layer(onnx_graph_index* index, const onnx_tensor* input, onnx_tensor* output, const char* layer_name);
+int    matmul_layer(onnx_graph_index* index, const onnx_tensor* input, onnx_tensor* output, const char* layer_name);
+int    add_layer(onnx_graph_index* index, const onnx_tensor* input, onnx_tensor* output, const char* layer_name);
+int    softmax_layer(onnx_graph_index* index, const onnx_tensor* input, onnx_tensor* output, const char* layer_name);
+int    transpose_layer(onnx_graph_index* index, const onnx_tensor* input, onnx_tensor* output, const char* layer_name);
+
+// Nodes to plan steps
+int  conv2D_plan(onnx_plan* plan, Onnx__NodeProto* node, onnx_plan_step* step);
+int  relu_plan(onnx_plan* plan, Onnx__NodeProto* node, onnx_plan_step* step);
+int  maxpool_plan(onnx_plan* plan, Onnx__NodeProto* node, onnx_plan_step* step);
+int  matmul_plan(onnx_plan* plan, Onnx__NodeProto* node, onnx_plan_step* step);
+int  gemm_plan(onnx_plan* plan, Onnx__NodeProto* node, onnx_plan_step* step);
+int  add_plan(onnx_plan* plan, Onnx__NodeProto* node, onnx_plan_step* step);
+int  softmax_plan(onnx_plan* plan, Onnx__NodeProto* node, onnx_plan_step* step);
+
+// Layout
+//
+// Kernels read rank 4 activations as NHWC and rank 2 ones as [N, K]. Every
+// tensor of a plan records where its logical ONNX axes sit in that physical
+// order: physical axis i holds logical axis perm[i]. A Transpose node only
+// changes perm, so inverse pairs cancel without moving any data. Conv and
+// MaxPool take logical NCHW stored as NHWC (onnx_layout_nchw), the other
+// kernels take their input in logical order. When a tensor is not laid out
+// the way its reader needs, the plan puts a copy in front of the reader. The
+// one exception is a flatten whose only readers are MatMul or Gemm: there the
+// packed weight columns are put in the tensor's physical order instead. Axes
+// of size 1 do not count, e.g. [N, 1, H, W] is both NCHW and NHWC. The batch
+// axis always stays first.
+#define ONNX_LAYOUT_MAX_DIM 4
+
+typedef struct onnx_layout
+{
+    int32_t rank;                       // 4, or 2 for [N, K]
+    int64_t dims[ONNX_LAYOUT_MAX_DIM];  // logical dims of one sample, N = 1
+    int8_t  perm[ONNX_LAYOUT_MAX_DIM];
+} onnx_layout;
+
+extern const int8_t onnx_layout_identity[ONNX_LAYOUT_MAX_DIM];
+extern const int8_t onnx_layout_nchw[ONNX_LAYOUT_MAX_DIM];
+
+void    onnx_layout_init(onnx_layout* layout, const onnx_tensor* tensor, const int8_t* perm);
+void    onnx_layout_tensor(const onnx_layout* layout, int64_t batch, onnx_tensor* tensor);
+int     onnx_layout_transpose(onnx_layout* layout, const Onnx__NodeProto* node);
+int     onnx_layout_is(const onnx_layout* layout, const int8_t* perm);
+int64_t onnx_layout_copy(onnx_layout* layout, const int8_t* perm, int64_t* shape, int64_t* axes);
+int64_t onnx_layout_flatten_order(const onnx_layout* layout, int64_t* order);
+const int8_t* onnx_layout_input(onnx_graph_index* index, Onnx__NodeProto* node, const int32_t* inputs, int32_t n_inputs);  // NULL: any, kept
 
 #endif // __ONNX_H__
@@ -0,0 +1,1108 @@
+#include "onnx.h"
+
+typedef int (*onnx_plan_fn)(onnx_plan* plan, Onnx__NodeProto* node, onnx_plan_step* step);
+
+static const struct
+{
+    const char* op_type;
+    onnx_plan_fn plan;
+} onnx_plan_ops[] =
+{
+    { "Conv",    conv2D_plan  },
+    { "Relu",    relu_plan    },
+    { "MaxPool", maxpool_plan },
+    { "MatMul",  matmul_plan  },
+    { "Gemm",    gemm_plan    },
+    { "Add",     add_plan     },
+    { "Softmax", softmax_plan },
+};
+
+static int onnx_plan_fusion = 1;
+
+void onnx_plan_set_fusion(int enabled)
+{
+    onnx_plan_fusion = enabled;
+}
+
+static onnx_plan_fn onnx_plan_lookup(const char* op_type)
+{
+    for(size_t i = 0; i < sizeof(onnx_plan_ops)/sizeof(onnx_plan_ops[0]); i++)
+    {
+        if(strcmp(onnx_plan_ops[i].op_type, op_type) == 0)
+        {
+            return onnx_plan_ops[i].plan;
+        }
+    }
+    return NULL;
+}
+
+// Nodes that leave the data untouched in NHWC
+static int onnx_plan_is_forward(const char* op_type)
+{
+    return strcmp(op_type, "Identity") == 0 ||
+           strcmp(op_type, "Transpose") == 0 ||
+           strcmp(op_type, "Reshape") == 0;
+}
+
+// Graph input descriptor: rank 4 inputs are NHWC, the others [N, K] with the
+// trailing axes flattened. N is batch, or from the graph when batch is 0; a
+// symbolic N is taken as 1.
+static int onnx_plan_input_shape(Onnx__ValueInfoProto* info, int64_t batch, onnx_tensor* input)
+{
+    if(info->type == NULL || info->type->value_case != ONNX__TYPE_PROTO__VALUE_TENSOR_TYPE ||
+       info->type->tensor_type->shape == NULL)
+    {
+        return -1;
+    }
+
+    Onnx__TensorShapeProto* proto = info->type->tensor_type->shape;
+    int64_t dims[4] = { 1, 1, 1, 1 };
+    if(proto->n_dim > 4)
+    {
+        return -1;
+    }
+    for(size_t i = 0; i < proto->n_dim; i++)
+    {
+        // Symbolic dimensions are taken as 1
+        if(proto->dim[i]->value_case == ONNX__TENSOR_SHAPE_PROTO__DIMENSION__VALUE_DIM_VALUE)
+        {
+            dims[i] = proto->dim[i]->dim_value;
+        }
+    }
+
+    if(proto->n_dim < 2)
+    {
+        dims[1] = dims[0];
+        dims[0] = 1;
+    }
+    else if(proto->n_dim < 4)
+    {
+        dims[1] *= dims[2];
+    }
+    dims[0] = batch > 0 ? batch : dims[0];
+    return onnx_tensor_init(input, ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT, proto->n_dim == 4 ? 4 : 2, dims, NULL);
+}
+
+// output receives the NHWC window output with the channels of input
+int onnx_plan_window(Onnx__NodeProto* node, const onnx_tensor* input, const int64_t* kernel, onnx_plan_attr* attr, onnx_tensor* output)
+{
+    // Spatial attributes are ordered [y, x]; pads are [y_begin, x_begin, y_end, x_end]
+    int64_t size[2]   = { kernel[0], kernel[1] };
+    int64_t stride[2] = { 1, 1 };
+    int64_t pads[4]   = { 0, 0, 0, 0 };
+    int64_t in[2]     = { input->dims[ONNX_H], input->dims[ONNX_W] };
+    int64_t out[2];
+    int same = 0;
+
+    for(int i = 0; i < node->n_attribute; i++)
+    {
+        Onnx__AttributeProto* attribute = node->attribute[i];
+        if(strcmp(attribute->name, "kernel_shape") == 0 && attribute->n_ints == 2)
+        {
+            size[0] = attribute->ints[0];
+            size[1] = attribute->ints[1];
+        }
+        else if(strcmp(attribute->name, "strides") == 0 && attribute->n_ints == 2)
+        {
+            stride[0] = attribute->ints[0];
+            stride[1] = attribute->ints[1];
+        }
+        else if(strcmp(attribute->name, "pads") == 0 && attribute->n_ints == 4)
+        {
+            memcpy(pads, attribute->ints, sizeof(pads));
+        }
+        else if(strcmp(attribute->name, "auto_pad") == 0 && attribute->s.len >= 9 &&
+                memcmp(attribute->s.data, "SAME_", 5) == 0)
+        {
+            same = memcmp(attribute->s.data + 5, "UPPER", 5) == 0 ? 1 : 2;
+        }
+    }
+
+    for(int d = 0; d < 2; d++)
+    {
+        // A pad as wide as the kernel would give windows reading only padding
+        if(stride[d] < 1 || size[d] < 1 || pads[d] < 0 || pads[d + 2] < 0 || pads[d] >= size[d] || pads[d + 2] >= size[d])
+        {
+            return -1;
+        }
+        if(same)
+        {
+            // SAME_UPPER puts the odd padding at the end, SAME_LOWER at the start
+            out[d] = (in[d] + stride[d] - 1) / stride[d];
+            int64_t total = (out[d] - 1) * stride[d] + size[d] - in[d];
+            total = total > 0 ? total : 0;
+            pads[d] = same == 1 ? total / 2 : total - total / 2;
+        }
+        else
+        {
+            out[d] = (in[d] + pads[d] + pads[d + 2] - size[d]) / stride[d] + 1;
+        }
+        if(out[d] < 1)
+        {
+            printf("%s %s: window does not fit the input\n", node->op_type, node->name);
+            return -1;
+        }
+    }
+
+    attr->kernel_y  = size[0];
+    attr->kernel_x  = size[1];
+    attr->stride_y  = stride[0];
+    attr->stride_x  = stride[1];
+    attr->padding_y = pads[0];
+    attr->padding_x = pads[1];
+    attr->tile      = 0;
+
+    int64_t dims[4] = { input->dims[ONNX_N], out[0], out[1], input->dims[ONNX_C] };
+    return onnx_tensor_init(output, ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT, 4, dims, NULL);
+}
+
+// Takes ownership of data, which is freed on failure
+static const float* onnx_plan_add_pack(onnx_plan* plan, const float* source, onnx_pack_layout layout, float* data, int64_t n_elem)
+{
+    onnx_plan_pack* packs = (onnx_plan_pack*) realloc(plan->packs, sizeof(onnx_plan_pack) * (plan->n_packs + 1));
+    if(packs == NULL)
+    {
+        free(data);
+        return NULL;
+    }
+    plan->packs = packs;
+    plan->packs[plan->n_packs].source = source;
+    plan->packs[plan->n_packs].layout = layout;
+    plan->packs[plan->n_packs].data = data;
+    plan->packs[plan->n_packs].bytes = sizeof(float) * n_elem;
+    plan->packed_bytes += sizeof(float) * n_elem;
+    plan->n_packs++;
+
+    return data;
+}
+
+const float* onnx_plan_pack_weights(onnx_plan* plan, const char* name, onnx_pack_layout layout)
+{
+    const onnx_tensor_view* view = onnx_graph_index_get_view_by_name(plan->index, name);
+    const float* source = onnx_graph_index_get_weights_by_name(plan->index, name);
+    if(view == NULL || source == NULL)
+    {
+        return NULL;
+    }
+
+    // Shared initializers are packed once per layout
+    for(int32_t p = 0; p < plan->n_packs; p++)
+    {
+        if(plan->packs[p].source == source && plan->packs[p].layout == layout)
+        {
+            return plan->packs[p].data;
+        }
+    }
+
+    int64_t shape[4];
+    float* data = NULL;
+    int64_t n_elem = view->n_elem;
+    if((layout == ONNX_PACK_OHWI || layout == ONNX_PACK_PANELS) && view->n_dims == 4)
+    {
+        int64_t perm[] = { 0, 2, 3, 1 };
+        memcpy(shape, view->dims, sizeof(int64_t)*4);
+        data = transpose(source, shape, 4, perm);
+    }
+    if(layout == ONNX_PACK_PANELS && data != NULL)
+    {
+        // Filters are N rows of K taps; panels are padded to a whole NR
+        int64_t n = view->dims[0];
+        int64_t k = view->n_elem / n;
+        float* panels = (float*) malloc(sizeof(float) * sgemm_pack_size(n, k));
+        if(panels != NULL)
+        {
+            sgemm_pack_b(data, n, k, panels);
+            n_elem = sgemm_pack_size(n, k);
+        }
+        free(data);
+        data = panels;
+    }
+    else if((layout == ONNX_PACK_WINOGRAD_2 || layout == ONNX_PACK_WINOGRAD_4) && view->n_dims == 4 &&
+            view->dims[2] == 3 && view->dims[3] == 3)
+    {
+        // Filter transforms straight from OIHW, one panel set per patch position
+        int tile = layout == ONNX_PACK_WINOGRAD_2 ? 2 : 4;
+        n_elem = winograd_pack_size(view->dims[0], view->dims[1], tile);
+        data = (float*) malloc(sizeof(float) * n_elem);
+        if(data != NULL && winograd_pack_filters(source, view->dims[0], view->dims[1], tile, data) != 0)
+        {
+            free(data);
+            data = NULL;
+        }
+    }
+    else if(layout == ONNX_PACK_NK && view->n_dims == 2)
+    {
+        int64_t perm[] = { 1, 0 };
+        memcpy(shape, view->dims, sizeof(int64_t)*2);
+        data = transpose(source, shape, 2, perm);
+    }
+    if(data == NULL)
+    {
+        printf("Unable to pack %s\n", name);
+        return NULL;
+    }
+    return onnx_plan_add_pack(plan, source, layout, data, n_elem);
+}
+
+// name broadcast to shape. A bias as large as shape is used as it is, a
+// smaller one is repeated into a pack.
+const float* onnx_plan_broadcast_weights(onnx_plan* plan, const char* name, const onnx_tensor* shape)
+{
+    const onnx_tensor_view* view = onnx_graph_index_get_view_by_name(plan->index, name);
+    const float* source = onnx_graph_index_get_weights_by_name(plan->index, name);
+    onnx_tensor weights;
+    if(view == NULL || source == NULL || onnx_tensor_from_view(view, &weights) != 0 ||
+       onnx_tensor_broadcast(&weights, shape->rank, shape->dims, &weights) != 0)
+    {
+        return NULL;
+    }
+    int64_t n_elem = onnx_tensor_numel(shape);
+    if((int64_t) view->n_elem == n_elem)
+    {
+        return source;
+    }
+    for(int32_t p = 0; p < plan->n_packs; p++)
+    {
+        if(plan->packs[p].source == source && plan->packs[p].layout == ONNX_PACK_BROADCAST &&
+           plan->packs[p].bytes == sizeof(float) * n_elem)
+        {
+            return plan->packs[p].data;
+        }
+    }
+
+    onnx_tensor dense = *shape;
+    weights.data = (void*) source;
+    if(onnx_tensor_alloc(&dense, NULL) != 0 || onnx_tensor_copy(&weights, &dense) != 0)
+    {
+        onnx_tensor_release(&dense);
+        return NULL;
+    }
+    return onnx_plan_add_pack(plan, source, ONNX_PACK_BROADCAST, (float*) dense.data, n_elem);
+}
+
+// Weight rows of n outputs by k inputs with the columns in order, so that the
+// GEMM reads a flatten of a permuted tensor in its physical order
+static const float* onnx_plan_fold_weights(onnx_plan* plan, const float* weight, int64_t k, int64_t n, const int64_t* order)
+{
+    // A pack no planned step reads yet is permuted in place and retagged, so
+    // that later lookups of the plain layout pack the initializer again
+    onnx_plan_pack* pack = NULL;
+    for(int32_t p = 0; p < plan->n_packs; p++)
+    {
+        if(plan->packs[p].data == weight && plan->packs[p].layout == ONNX_PACK_NK)
+        {
+            pack = &plan->packs[p];
+        }
+    }
+    for(int32_t i = 0; i < plan->n_steps; i++)
+    {
+        pack = plan->steps[i].weight == weight ? NULL : pack;
+    }
+
+    float* row = (float*) malloc(sizeof(float) * k);
+    float* data = pack != NULL ? pack->data : (float*) malloc(sizeof(float) * k * n);
+    if(row == NULL || data == NULL)
+    {
+        free(row);
+        free(pack != NULL ? NULL : data);
+        return NULL;
+    }
+    for(int64_t j = 0; j < n; j++)
+    {
+        memcpy(row, weight + j * k, sizeof(float) * k);
+        for(int64_t i = 0; i < k; i++)
+        {
+            data[j * k + i] = row[order[i]];
+        }
+    }
+    free(row);
+
+    if(pack != NULL)
+    {
+        pack->layout = ONNX_PACK_NK_FOLDED;
+        return data;
+    }
+    return onnx_plan_add_pack(plan, weight, ONNX_PACK_NK_FOLDED, data, k * n);
+}
+
+#define ONNX_PLAN_REACH_MAX 16384
+
+typedef struct onnx_plan_interval
+{
+    int32_t slot;
+    int32_t first;              // step writing the slot
+    int32_t last;               // last step reading it
+    size_t bytes;
+    size_t offset;
+} onnx_plan_interval;
+
+// Everything needed to decide whether two slots may share memory
+typedef struct onnx_plan_liveness
+{
+    int32_t* writer;            // per slot
+    int32_t* reader_offsets;    // CSR of the steps reading each slot
+    int32_t* readers;
+    uint64_t* reach;            // per step, bitset of its data ancestors
+    int32_t words;
+} onnx_plan_liveness;
+
+static int onnx_plan_interval_cmp(const void* a, const void* b)
+{
+    const onnx_plan_interval* x = (const onnx_plan_interval*) a;
+    const onnx_plan_interval* y = (const onnx_plan_interval*) b;
+    if(x->bytes != y->bytes)
+    {
+        return x->bytes < y->bytes ? 1 : -1;
+    }
+    return x->first - y->first;
+}
+
+// Slot x is dead for good before slot y is written: its writer and all of its
+// readers are data ancestors of y's writer
+static int onnx_plan_before(const onnx_plan* plan, const onnx_plan_liveness* live, int32_t x, int32_t y)
+{
+    const uint64_t* ancestors = &live->reach[(size_t) live->writer[y] * live->words];
+    int32_t w = live->writer[x];
+
+    if(x == plan->output_slot || !(ancestors[w / 64] >> (w % 64) & 1))
+    {
+        return 0;
+    }
+    for(int32_t r = live->reader_offsets[x]; r < live->reader_offsets[x + 1]; r++)
+    {
+        int32_t step = live->readers[r];
+        if(!(ancestors[step / 64] >> (step % 64) & 1))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// In step order two slots conflict when their lifetimes overlap. Under the DAG
+// scheduler steps may run in any order the data edges allow, so slots only
+// share memory when one is provably dead before the other is written.
+static int onnx_plan_conflict(const onnx_plan* plan, const onnx_plan_liveness* live,
+                              const onnx_plan_interval* a, const onnx_plan_interval* b)
+{
+    if(live == NULL)
+    {
+        return !(a->first > b->last || b->first > a->last);
+    }
+    if(live->reach == NULL)
+    {
+        return 1;
+    }
+    return !(onnx_plan_before(plan, live, a->slot, b->slot) || onnx_plan_before(plan, live, b->slot, a->slot));
+}
+
+// Greedy by size: the largest slots are placed first, each at the lowest
+// offset that does not overlap a placed slot it conflicts with.
+static int onnx_plan_layout(onnx_plan* plan, const onnx_plan_liveness* live, size_t* offsets, size_t* bytes)
+{
+    int32_t n = plan->n_slots;
+    onnx_plan_interval* intervals = (onnx_plan_interval*) calloc(n, sizeof(onnx_plan_interval));
+    onnx_plan_interval** placed = (onnx_plan_interval**) calloc(n, sizeof(onnx_plan_interval*));
+    if(intervals == NULL || placed == NULL)
+    {
+        free(intervals);
+        free(placed);
+        return -1;
+    }
+
+    for(int32_t s = 0; s < n; s++)
+    {
+        intervals[s].slot = s;
+        intervals[s].first = -1;
+        intervals[s].last = -1;
+        intervals[s].bytes = (sizeof(float) * plan->slot_size[s] + ONNX_PLAN_ALIGN - 1) & ~(size_t)(ONNX_PLAN_ALIGN - 1);
+    }
+    for(int32_t i = 0; i < plan->n_steps; i++)
+    {
+        const onnx_plan_step* step = &plan->steps[i];
+        intervals[step->output].first = i;
+        intervals[step->output].last = i;
+        for(int k = 0; k < 2; k++)
+        {
+            if(step->input[k] >= 0)
+            {
+                intervals[step->input[k]].last = i;
+            }
+        }
+    }
+    intervals[plan->output_slot].last = plan->n_steps;
+    intervals[plan->input_slot].bytes = 0;
+
+    qsort(intervals, n, sizeof(onnx_plan_interval), onnx_plan_interval_cmp);
+
+    // placed[] is kept sorted by offset so the first fitting gap is found in one pass
+    int32_t n_placed = 0;
+    size_t peak = 0;
+    for(int32_t s = 0; s < n; s++)
+    {
+        onnx_plan_interval* it = &intervals[s];
+        if(it->bytes == 0)
+        {
+            continue;
+        }
+
+        size_t offset = 0;
+        int32_t at = 0;
+        for(int32_t p = 0; p < n_placed; p++)
+        {
+            onnx_plan_interval* other = placed[p];
+            if(other->offset + other->bytes <= offset || !onnx_plan_conflict(plan, live, it, other))
+            {
+                continue;
+            }
+            if(other->offset >= offset + it->bytes)
+            {
+                break;
+            }
+            offset = other->offset + other->bytes;
+        }
+        it->offset = offset;
+        while(at < n_placed && placed[at]->offset <= offset)
+        {
+            at++;
+        }
+        memmove(&placed[at + 1], &placed[at], sizeof(onnx_plan_interval*) * (n_placed - at));
+        placed[at] = it;
+        n_placed++;
+
+        offsets[it->slot] = offset;
+        if(offset + it->bytes > peak)
+        {
+            peak = offset + it->bytes;
+        }
+    }
+    free(intervals);
+    free(placed);
+
+    *bytes = peak;
+    return 0;
+}
+
+// Step DAG for the scheduler: a step depends on the writers of its inputs.
+// Memory reuse needs no extra edges, see onnx_plan_conflict.
+static int onnx_plan_build_deps(onnx_plan* plan, onnx_plan_liveness* live)
+{
+    int32_t n = plan->n_steps;
+    int32_t n_slots = plan->n_slots;
+    live->writer = (int32_t*) malloc(sizeof(int32_t) * n_slots);
+    live->reader_offsets = (int32_t*) calloc(n_slots + 1, sizeof(int32_t));
+    live->readers = (int32_t*) malloc(sizeof(int32_t) * (2 * n + 1));
+    plan->step_deps = (int32_t*) calloc(n + 1, sizeof(int32_t));
+    plan->succ_offsets = (int32_t*) calloc(n + 2, sizeof(int32_t));
+    plan->succ = (int32_t*) malloc(sizeof(int32_t) * (2 * n + 1));
+    if(live->writer == NULL || live->reader_offsets == NULL || live->readers == NULL ||
+       plan->step_deps == NULL || plan->succ_offsets == NULL || plan->succ == NULL)
+    {
+        return -1;
+    }
+
+    // Writer and readers (CSR) of every slot
+    for(int32_t s = 0; s < n_slots; s++)
+    {
+        live->writer[s] = -1;
+    }
+    for(int32_t i = 0; i < n; i++)
+    {
+        live->writer[plan->steps[i].output] = i;
+        for(int k = 0; k < 2; k++)
+        {
+            if(plan->steps[i].input[k] >= 0)
+            {
+                live->reader_offsets[plan->steps[i].input[k] + 1]++;
+            }
+        }
+    }
+    for(int32_t s = 0; s < n_slots; s++)
+    {
+        live->reader_offsets[s + 1] += live->reader_offsets[s];
+    }
+    int32_t n_reads = live->reader_offsets[n_slots];
+    for(int32_t i = n - 1; i >= 0; i--)
+    {
+        for(int k = 1; k >= 0; k--)
+        {
+            int32_t s = plan->steps[i].input[k];
+            if(s >= 0)
+            {
+                live->readers[--live->reader_offsets[s + 1]] = i;
+            }
+        }
+    }
+    memmove(&live->reader_offsets[0], &live->reader_offsets[1], sizeof(int32_t) * n_slots);
+    live->reader_offsets[n_slots] = n_reads;
+
+    // Predecessors are the writers of the inputs; successors as CSR
+    for(int32_t i = 0; i < n; i++)
+    {
+        const onnx_plan_step* step = &plan->steps[i];
+        for(int k = 0; k < 2; k++)
+        {
+            int32_t s = step->input[k];
+            if(s >= 0 && live->writer[s] >= 0 && !(k == 1 && s == step->input[0]))
+            {
+                plan->step_deps[i]++;
+                plan->succ_offsets[live->writer[s] + 2]++;
+            }
+        }
+    }
+    for(int32_t i = 0; i < n; i++)
+    {
+        plan->succ_offsets[i + 2] += plan->succ_offsets[i + 1];
+    }
+    for(int32_t i = 0; i < n; i++)
+    {
+        const onnx_plan_step* step = &plan->steps[i];
+        for(int k = 0; k < 2; k++)
+        {
+            int32_t s = step->input[k];
+            if(s >= 0 && live->writer[s] >= 0 && !(k == 1 && s == step->input[0]))
+            {
+                plan->succ[plan->succ_offsets[live->writer[s] + 1]++] = i;
+            }
+        }
+    }
+
+    // Transitive closure for the DAG layout, skipped for very large graphs
+    if(n > ONNX_PLAN_REACH_MAX)
+    {
+        return 0;
+    }
+    live->words = (n + 63) / 64;
+    live->reach = (uint64_t*) calloc((size_t) n * live->words + 1, sizeof(uint64_t));
+    if(live->reach == NULL)
+    {
+        return 0;
+    }
+    for(int32_t i = 0; i < n; i++)
+    {
+        uint64_t* row = &live->reach[(size_t) i * live->words];
+        for(int32_t e = plan->succ_offsets[i]; e < plan->succ_offsets[i + 1]; e++)
+        {
+            uint64_t* next = &live->reach[(size_t) plan->succ[e] * live->words];
+            for(int32_t w = 0; w < live->words; w++)
+            {
+                next[w] |= row[w];
+            }
+            next[i / 64] |= (uint64_t) 1 << (i % 64);
+        }
+    }
+    return 0;
+}
+
+// Plans both arena layouts: step order for serial runs, DAG-safe for a pool
+static int onnx_plan_assign_memory(onnx_plan* plan)
+{
+    onnx_plan_liveness live = { 0 };
+    plan->slot_offset = (size_t*) calloc(plan->n_slots, sizeof(size_t));
+    plan->slot_offset_dag = (size_t*) calloc(plan->n_slots, sizeof(size_t));
+
+    int status = -1;
+    if(plan->slot_offset != NULL && plan->slot_offset_dag != NULL && onnx_plan_build_deps(plan, &live) == 0 &&
+       onnx_plan_layout(plan, NULL, plan->slot_offset, &plan->arena_bytes) == 0)
+    {
+        status = onnx_plan_layout(plan, &live, plan->slot_offset_dag, &plan->arena_bytes_dag);
+    }
+
+    free(live.writer);
+    free(live.reader_offsets);
+    free(live.readers);
+    free(live.reach);
+    return status;
+}
+
+size_t onnx_plan_activation_bytes(onnx_plan* plan)
+{
+    return plan->session->arena_bytes;
+}
+
+// The one step reading slot, or -1 when the slot is the graph output, has
+// several readers or is read as a second operand
+static int32_t onnx_plan_only_reader(const onnx_plan* plan, int32_t slot, int32_t first)
+{
+    int32_t reader = -1;
+    if(slot == plan->output_slot)
+    {
+        return -1;
+    }
+    for(int32_t i = first; i < plan->n_steps; i++)
+    {
+        const onnx_plan_step* step = &plan->steps[i];
+        if(step->kernel == NULL || (step->input[0] != slot && step->input[1] != slot))
+        {
+            continue;
+        }
+        if(reader >= 0 || step->input[0] != slot || step->input[1] == slot)
+        {
+            return -1;
+        }
+        reader = i;
+    }
+    return reader;
+}
+
+// Folds next into step when step's kernel can apply it before storing
+static int onnx_plan_fuse_pair(onnx_plan_step* step, const onnx_plan_step* next)
+{
+    int conv = step->kernel == conv2D_step || step->kernel == conv2D_gemm_step || step->kernel == conv2D_winograd_step;
+    int matmul = step->kernel == matmul_step;
+
+    // Relu commutes with max, so it may also follow a fused MaxPool
+    if(next->kernel == relu_step && (conv || matmul) && !step->relu)
+    {
+        step->relu = 1;
+        return 1;
+    }
+    // The pool reads a band of conv rows; Winograd produces whole tile rows
+    if(next->kernel == maxpool_step && conv && step->kernel != conv2D_winograd_step && step->pool.kernel_x == 0)
+    {
+        step->pool = next->attr;
+        step->conv = step->out;
+        return 1;
+    }
+    // Bias before the clamp, and only a bound one
+    if(next->kernel == add_step && matmul && next->input[1] < 0 && step->bias == NULL && !step->relu)
+    {
+        step->bias = next->bias;
+        return 1;
+    }
+    return 0;
+}
+
+// Fusion pass, see onnx.h. The folded steps are dropped and the slots between
+// them get no memory.
+static void onnx_plan_fuse(onnx_plan* plan)
+{
+    for(int32_t i = 0; i < plan->n_steps; i++)
+    {
+        onnx_plan_step* step = &plan->steps[i];
+        while(step->kernel != NULL && step->n_fused < ONNX_PLAN_MAX_FUSED)
+        {
+            int32_t r = onnx_plan_only_reader(plan, step->output, i + 1);
+            if(r < 0 || !onnx_plan_fuse_pair(step, &plan->steps[r]))
+            {
+                break;
+            }
+            onnx_plan_step* next = &plan->steps[r];
+            plan->slot_size[step->output] = 0;
+            step->output = next->output;
+            step->out = next->out;
+            step->fused[step->n_fused++] = next->node;
+            next->kernel = NULL;
+        }
+    }
+
+    int32_t n = 0;
+    for(int32_t i = 0; i < plan->n_steps; i++)
+    {
+        if(plan->steps[i].kernel != NULL)
+        {
+            plan->steps[n++] = plan->steps[i];
+        }
+    }
+    plan->n_steps = n;
+}
+
+// A flatten whose readers are all MatMul or Gemm on bound weights can be
+// folded into the weights instead of being copied
+static int onnx_plan_folds_into(onnx_plan* plan, int32_t tensor, int32_t output_id)
+{
+    onnx_graph_index* index = plan->index;
+    int32_t n_consumers = 0;
+    const int32_t* consumers = onnx_graph_index_get_consumers(index, tensor, &n_consumers);
+
+    for(int32_t c = 0; c < n_consumers; c++)
+    {
+        int32_t n = consumers[c];
+        Onnx__NodeProto* node = index->graph->node[n];
+        int32_t* inputs = &index->node_inputs[index->node_input_offsets[n]];
+        int32_t n_inputs = index->node_input_offsets[n + 1] - index->node_input_offsets[n];
+        if((strcmp(node->op_type, "MatMul") != 0 && strcmp(node->op_type, "Gemm") != 0) ||
+           n_inputs < 2 || inputs[0] != tensor || inputs[1] < 0 || index->initializer_ids[inputs[1]] < 0)
+        {
+            return 0;
+        }
+    }
+    return n_consumers > 0 && tensor != output_id;
+}
+
+// Per tensor state while the plan is built. The physical descriptor of a
+// tensor follows from its layout and the batch, see onnx_layout_tensor.
+typedef struct onnx_plan_tensor
+{
+    int32_t slot;               // -1 until computed
+    onnx_layout layout;
+    int64_t* fold;              // flatten folded into the readers' weights, see onnx_layout_flatten_order
+    int32_t copy;               // layout copy shared by readers, -1 if none
+    onnx_layout copy_layout;
+} onnx_plan_tensor;
+
+// Puts a copy of slot in front of node that lays it out as perm. layout is
+// updated to the copy's.
+static int32_t onnx_plan_relayout(onnx_plan* plan, Onnx__NodeProto* node, int32_t slot, onnx_layout* layout,
+                                  const int8_t* perm)
+{
+    onnx_plan_step* step = &plan->steps[plan->n_steps++];
+    step->node = node;
+    step->kernel = transpose_step;
+    step->input[0] = slot;
+    step->input[1] = -1;
+    onnx_layout_tensor(layout, plan->input.dims[0], &step->in);
+    step->dimW = onnx_layout_copy(layout, perm, step->shapeW, step->perm);
+    onnx_layout_tensor(layout, plan->input.dims[0], &step->out);
+
+    step->output = plan->n_slots++;
+    plan->slot_size[step->output] = onnx_tensor_numel(&step->out);
+    return step->output;
+}
+
+// Slot of tensor laid out as perm (NULL: as it is) for node. A copy is made
+// only when the tensor is laid out otherwise, and readers wanting the same
+// layout share it.
+static int32_t onnx_plan_read(onnx_plan* plan, Onnx__NodeProto* node, onnx_plan_tensor* tensor, const int8_t* perm,
+                              onnx_layout* layout)
+{
+    *layout = tensor->layout;
+    if(perm == NULL || onnx_layout_is(layout, perm))
+    {
+        return tensor->slot;
+    }
+    if(tensor->copy < 0 || !onnx_layout_is(&tensor->copy_layout, perm))
+    {
+        tensor->copy = onnx_plan_relayout(plan, node, tensor->slot, layout, perm);
+        tensor->copy_layout = *layout;
+    }
+    *layout = tensor->copy_layout;
+    return tensor->copy;
+}
+
+// Walks the nodes in topological order, assigning slots, tracking layouts and
+// planning each step
+static int onnx_plan_build(onnx_plan* plan, onnx_plan_tensor* tensors, int64_t batch)
+{
+    onnx_graph_index* index = plan->index;
+    Onnx__GraphProto* graph = index->graph;
+
+    for(int32_t t = 0; t < index->n_tensors; t++)
+    {
+        tensors[t].slot = -1;
+        tensors[t].copy = -1;
+    }
+
+    // Slot 0 is the caller's input; every step writes a slot of its own
+    int32_t input_id = onnx_graph_index_get_tensor_id(index, graph->input[0]->name);
+    int32_t output_id = onnx_graph_index_get_tensor_id(index, graph->output[0]->name);
+    if(input_id < 0 || output_id < 0 || onnx_plan_input_shape(graph->input[0], batch, &plan->input) != 0)
+    {
+        printf("Unable to infer the shape of input %s\n", graph->input[0]->name);
+        return -1;
+    }
+    batch = plan->input.dims[0];
+    tensors[input_id].slot = 0;
+    plan->input_slot = 0;
+    plan->n_slots = 1;
+    onnx_layout_init(&tensors[input_id].layout, &plan->input, onnx_layout_identity);
+
+    for(int i = 0; i < index->n_order; i++)
+    {
+        int32_t n = index->order[i];
+        Onnx__NodeProto* node = graph->node[n];
+        int32_t* inputs = &index->node_inputs[index->node_input_offsets[n]];
+        int32_t n_inputs = index->node_input_offsets[n + 1] - index->node_input_offsets[n];
+        int32_t out = index->node_outputs[index->node_output_offsets[n]];
+
+        if(n_inputs < 1 || inputs[0] < 0 || tensors[inputs[0]].slot < 0 || out < 0)
+        {
+            printf("%s %s: input %s is not computed by the graph\n", node->op_type, node->name, node->input[0]);
+            return -1;
+        }
+        onnx_plan_tensor* input = &tensors[inputs[0]];
+        onnx_plan_tensor* output = &tensors[out];
+        onnx_layout layout;
+
+        if(onnx_plan_is_forward(node->op_type))
+        {
+            int32_t slot = onnx_plan_read(plan, node, input, NULL, &layout);
+            if(strcmp(node->op_type, "Transpose") == 0 && onnx_layout_transpose(&layout, node) != 0)
+            {
+                return -1;
+            }
+            if(strcmp(node->op_type, "Reshape") == 0)
+            {
+                // The target shape is in logical order
+                onnx_layout logical = layout;
+                onnx_tensor x, y;
+                memcpy(logical.perm, onnx_layout_identity, sizeof(logical.perm));
+                onnx_layout_tensor(&logical, batch, &x);
+                if(onnx_reshape_target(index, node, &x, &y) != 0 || y.rank < 2 || y.rank > ONNX_LAYOUT_MAX_DIM)
+                {
+                    printf("Reshape %s: unsupported target shape\n", node->name);
+                    return -1;
+                }
+
+                // A flatten is folded into the readers' weights, anything else is copied
+                if(y.rank == 2 && !onnx_layout_is(&layout, onnx_layout_identity) && onnx_plan_folds_into(plan, out, output_id))
+                {
+                    output->fold = (int64_t*) malloc(sizeof(int64_t) * onnx_tensor_sample(&y));
+                    if(output->fold == NULL)
+                    {
+                        return -1;
+                    }
+                    onnx_layout_flatten_order(&layout, output->fold);
+                }
+                else
+                {
+                    slot = onnx_plan_read(plan, node, input, onnx_layout_identity, &layout);
+                }
+                onnx_layout_init(&layout, &y, onnx_layout_identity);
+            }
+            output->slot = slot;
+            output->layout = layout;
+            continue;
+        }
+
+        onnx_plan_fn plan_node = onnx_plan_lookup(node->op_type);
+        if(plan_node == NULL)
+        {
+            printf("Unsupported operand: %s\n", node->op_type);
+            return -1;
+        }
+
+        // Copies go in front of the node's own step
+        const int8_t* want = onnx_layout_input(index, node, inputs, n_inputs);
+        int flat = strcmp(node->op_type, "MatMul") == 0 || strcmp(node->op_type, "Gemm") == 0;
+        if((want == onnx_layout_nchw && input->layout.rank != 4) || (flat && input->layout.rank != 2))
+        {
+            printf("%s %s: input %s has rank %d\n", node->op_type, node->name, node->input[0], input->layout.rank);
+            return -1;
+        }
+        int32_t slot = onnx_plan_read(plan, node, input, want, &layout);
+        int32_t slot1 = -1;
+        if(n_inputs > 1 && inputs[1] >= 0 && index->initializer_ids[inputs[1]] < 0)
+        {
+            if(tensors[inputs[1]].slot < 0)
+            {
+                printf("%s %s: input %s is not computed by the graph\n", node->op_type, node->name, node->input[1]);
+                return -1;
+            }
+            // The second operand follows the first
+            onnx_layout other;
+            onnx_tensor x, y;
+            slot1 = onnx_plan_read(plan, node, &tensors[inputs[1]], layout.perm, &other);
+            onnx_layout_tensor(&layout, batch, &x);
+            onnx_layout_tensor(&other, batch, &y);
+            if(!onnx_tensor_same_shape(&x, &y))
+            {
+                printf("%s %s: inputs %s and %s differ in shape\n", node->op_type, node->name, node->input[0], node->input[1]);
+                return -1;
+            }
+        }
+
+        onnx_plan_step* step = &plan->steps[plan->n_steps];
+        step->node = node;
+        step->input[0] = slot;
+        step->input[1] = slot1;
+        onnx_layout_tensor(&layout, batch, &step->in);
+
+        if(plan_node(plan, node, step) != 0)
+        {
+            printf("Failed to plan %s %s\n", node->op_type, node->name);
+            return -1;
+        }
+        if(input->fold != NULL)
+        {
+            step->weight = onnx_plan_fold_weights(plan, step->weight, step->shapeW[0], step->shapeW[1], input->fold);
+            if(step->weight == NULL)
+            {
+                return -1;
+            }
+        }
+
+        step->output = plan->n_slots++;
+        plan->slot_size[step->output] = onnx_tensor_numel(&step->out);
+        output->slot = step->output;
+        onnx_layout_init(&output->layout, &step->out, want != NULL ? want : layout.perm);
+        plan->n_steps++;
+    }
+
+    if(tensors[output_id].slot < 0)
+    {
+        printf("Output %s is not computed by the graph\n", graph->output[0]->name);
+        return -1;
+    }
+    // The caller gets the output in logical order
+    onnx_layout layout;
+    Onnx__NodeProto* last = index->producers[output_id] >= 0 ? graph->node[index->producers[output_id]] : NULL;
+    plan->output_slot = onnx_plan_read(plan, last, &tensors[output_id], onnx_layout_identity, &layout);
+    onnx_layout_tensor(&layout, batch, &plan->output);
+
+    if(onnx_plan_fusion)
+    {
+        onnx_plan_fuse(plan);
+    }
+    return onnx_plan_assign_memory(plan);
+}
+
+onnx_plan* onnx_plan_compile(Onnx__ModelProto* model)
+{
+    // Batch size from the graph input, 1 if it is symbolic
+    return onnx_plan_compile_batch(model, 0);
+}
+
+onnx_plan* onnx_plan_compile_batch(Onnx__ModelProto* model, int64_t batch)
+{
+    assert(model != NULL && model->graph != NULL && batch >= 0);
+
+    Onnx__GraphProto* graph = model->graph;
+    if(graph->n_input == 0 || graph->n_output == 0)
+    {
+        return NULL;
+    }
+
+    onnx_plan* plan = (onnx_plan*) calloc(1, sizeof(onnx_plan));
+    if(plan == NULL)
+    {
+        return NULL;
+    }
+    plan->model = model;
+    plan->index = onnx_graph_index_create(graph);
+    if(plan->index == NULL)
+    {
+        free(plan);
+        return NULL;
+    }
+
+    // Per node at most its step and a layout copy of each of its two inputs,
+    // plus a copy of the output; one slot per step, plus the input slot
+    int32_t n_order = plan->index->n_order;
+    int32_t n_tensors = plan->index->n_tensors;
+    onnx_plan_tensor* tensors = (onnx_plan_tensor*) calloc(n_tensors, sizeof(onnx_plan_tensor));
+    plan->steps = (onnx_plan_step*) calloc(3 * n_order + 1, sizeof(onnx_plan_step));
+    plan->slot_size = (int64_t*) calloc(3 * n_order + 2, sizeof(int64_t));
+
+    int status = -1;
+    if(tensors != NULL && plan->steps != NULL && plan->slot_size != NULL)
+    {
+        status = onnx_plan_build(plan, tensors, batch);
+    }
+    for(int32_t t = 0; tensors != NULL && t < n_tensors; t++)
+    {
+        free(tensors[t].fold);
+    }
+    free(tensors);
+    if(status == 0)
+    {
+        plan->session = onnx_session_create(plan, NULL);
+    }
+
+    if(status != 0 || plan->session == NULL)
+    {
+        onnx_plan_free(plan);
+        return NULL;
+    }
+    return plan;
+}
+
+float* onnx_plan_run(onnx_plan* plan, const float* input)
+{
+    assert(plan != NULL && input != NULL);
+    return onnx_session_run(plan->session, input);
+}
+
+int onnx_plan_set_pool(onnx_plan* plan, onnx_pool* pool)
+{
+    // Arena layout and scheduler scratch depend on the pool, so the plan's
+    // session is rebuilt once here and runs still do not allocate
+    onnx_session* session = onnx_session_create(plan, pool);
+    if(session == NULL || onnx_session_set_profile(session, plan->session->profile) != 0)
+    {
+        onnx_session_free(session);
+        return -1;
+    }
+    onnx_session_free(plan->session);
+    plan->session = session;
+    return 0;
+}
+
+int onnx_plan_set_profile(onnx_plan* plan, onnx_profile* profile)
+{
+    return onnx_session_set_profile(plan->session, profile);
+}
+
+void onnx_plan_free(onnx_plan* plan)
+{
+    if(plan == NULL)
+    {
+        return;
+    }
+    onnx_session_free(plan->session);
+    // A loaded plan's layouts and DAG are in its file mapping
+    if(plan->map != NULL)
+    {
+        onnx_plan_unmap(plan);
+    }
+    else
+    {
+        free(plan->slot_size);
+        free(plan->slot_offset);
+        free(plan->slot_offset_dag);
+        free(plan->step_deps);
+        free(plan->succ_offsets);
+        free(plan->succ);
+    }
+    for(int32_t p = 0; p < plan->n_packs; p++)
+    {
+        free(plan->packs[p].data);
+    }
+    free(plan->packs);
+    free(plan->steps);
+    free(plan->nodes);
+    onnx_graph_index_free(plan->index);
+    free(plan);
+}
+
+// Layout copies are named Transpose after the node they feed
+int onnx_plan_step_ops(const onnx_plan_step* step, char* text, size_t size)
+{
+    int len = snprintf(text, size, "%s", step->kernel == transpose_step ? "Transpose" : step->node->op_type);
+    for(int32_t f = 0; f < step->n_fused && len < (int) size; f++)
+    {
+        len += snprintf(text + len, size - len, "+%s", step->fused[f]->op_type);
+    }
+    return len;
+}
+
+void onnx_plan_info(onnx_plan* plan)
+{
+    printf("Batch: %ld\n", plan->input.dims[0]);
+    for(int32_t i = 0; i < plan->n_steps; i++)
+    {
+        const onnx_plan_step* step = &plan->steps[i];
+        char ops[64];
+        onnx_plan_step_ops(step, ops, sizeof(ops));
+        char in[64], out[64];
+        onnx_tensor_format_dims(&step->in, in, sizeof(in));
+        onnx_tensor_format_dims(&step->out, out, sizeof(out));
+        printf("[%2d] %-18s %-20s %-18s --> %-18s  slot %d --> %d\n", i, ops, step->node->name, in, out,
+               step->input[0], step->output);
+    }
+    size_t total = 0;
+    for(int32_t s = 0; s < plan->n_slots; s++)
+    {
+        total += sizeof(float) * plan->slot_size[s];
+    }
+    if(plan->map != NULL)
+    {
+        printf("Weights: %zu bytes, mapped from the plan file\n", plan->packed_bytes);
+    }
+    else
+    {
+        printf("Packed weights: %d tensors, %zu bytes\n", plan->n_packs, plan->packed_bytes);
+    }
+    printf("Activations: %zu bytes planned, %zu bytes for the DAG scheduler, %zu bytes without reuse\n",
+           plan->arena_bytes, plan->arena_bytes_dag, total);
+}
@@ -0,0 +1,805 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "onnx.h"
+
+// File layout, every section aligned to ONNX_PLAN_ALIGN:
+//
+//   header | steps | slot sizes | slot offsets | DAG slot offsets | step deps
+//   | successor offsets | successors | blob table | strings | blobs
+//
+// Blobs are the weights the steps point into, a plan pack or an initializer
+// each. Steps refer to them by index, element offset and the element count
+// their kernel reads. On load the counts must fit the blobs and match the
+// step shapes, the step shapes must fit their slots and windows, and the step
+// deps must match the successors.
+
+#define ONNX_PLAN_FILE_BYTE_ORDER 0x01020304u
+#define ONNX_PLAN_FILE_FNV_BASIS 0xcbf29ce484222325ull
+#define ONNX_PLAN_FILE_FNV_PRIME 0x100000001b3ull
+
+// Kernels by their number in the file. Append only: the numbers are the format.
+static const onnx_kernel onnx_plan_file_kernels[] = {
+    conv2D_step,
+    conv2D_gemm_step,
+    conv2D_winograd_step,
+    relu_step,
+    maxpool_step,
+    matmul_step,
+    add_step,
+    softmax_step,
+    transpose_step,
+};
+
+#define ONNX_PLAN_FILE_KERNELS ((int32_t) (sizeof(onnx_plan_file_kernels) / sizeof(onnx_plan_file_kernels[0])))
+
+typedef struct onnx_plan_file_tensor
+{
+    int32_t dtype;
+    int32_t rank;
+    int64_t dims[ONNX_TENSOR_MAX_DIM];
+    int64_t strides[ONNX_TENSOR_MAX_DIM];
+} onnx_plan_file_tensor;
+
+typedef struct onnx_plan_file_step
+{
+    int32_t kernel;
+    int32_t weight;             // blob, -1 if none
+    int64_t weight_offset;      // in elements
+    int64_t weight_count;
+    int32_t bias;
+    int32_t relu;
+    int64_t bias_offset;
+    int64_t bias_count;
+    int64_t shapeW[4];
+    int64_t dimW;
+    int64_t perm[4];
+    onnx_plan_attr attr;
+    onnx_plan_attr pool;
+    int32_t input[2];
+    int32_t output;
+    int32_t n_fused;
+    uint64_t name;              // string offsets
+    uint64_t op;
+    uint64_t fused[ONNX_PLAN_MAX_FUSED];
+    onnx_plan_file_tensor in;
+    onnx_plan_file_tensor out;
+    onnx_plan_file_tensor conv;
+} onnx_plan_file_step;
+
+typedef struct onnx_plan_file_blob
+{
+    uint64_t offset;            // from the start of the file
+    uint64_t bytes;
+} onnx_plan_file_blob;
+
+typedef struct onnx_plan_file_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t align;
+    uint32_t size_bytes;        // sizeof(size_t) of the writer
+    uint64_t file_bytes;
+    uint64_t source_checksum;
+    uint64_t source_bytes;
+    int32_t n_steps;
+    int32_t n_slots;
+    int32_t n_blobs;
+    int32_t n_succ;
+    int32_t input_slot;
+    int32_t output_slot;
+    uint64_t arena_bytes;
+    uint64_t arena_bytes_dag;
+    uint64_t weight_bytes;
+    onnx_plan_file_tensor input;
+    onnx_plan_file_tensor output;
+    uint64_t steps;             // section offsets
+    uint64_t slot_size;
+    uint64_t slot_offset;
+    uint64_t slot_offset_dag;
+    uint64_t step_deps;
+    uint64_t succ_offsets;
+    uint64_t succ;
+    uint64_t blobs;
+    uint64_t strings;
+    uint64_t strings_bytes;
+} onnx_plan_file_header;
+
+// Weights of a compiled plan with where they come from
+typedef struct onnx_plan_file_source
+{
+    const float* data;
+    int64_t len;
+    int used;
+} onnx_plan_file_source;
+
+static uint64_t onnx_plan_file_align(uint64_t offset)
+{
+    return (offset + ONNX_PLAN_ALIGN - 1) / ONNX_PLAN_ALIGN * ONNX_PLAN_ALIGN;
+}
+
+static uint64_t onnx_plan_file_fnv(const unsigned char* data, size_t len)
+{
+    uint64_t hash = ONNX_PLAN_FILE_FNV_BASIS;
+    for(size_t i = 0; i < len; i++)
+    {
+        hash = (hash ^ data[i]) * ONNX_PLAN_FILE_FNV_PRIME;
+    }
+    return hash;
+}
+
+static void* onnx_plan_file_map(const char* path, size_t* bytes)
+{
+    int fd = open(path, O_RDONLY);
+    if(fd < 0)
+    {
+        return NULL;
+    }
+    struct stat st;
+    void* map = MAP_FAILED;
+    if(fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        *bytes = st.st_size;
+    }
+    close(fd);
+    return map != MAP_FAILED ? map : NULL;
+}
+
+int onnx_plan_checksum(const char* path, uint64_t* checksum, uint64_t* bytes)
+{
+    size_t len;
+    unsigned char* map = (unsigned char*) onnx_plan_file_map(path, &len);
+    if(map == NULL)
+    {
+        return -1;
+    }
+    *checksum = onnx_plan_file_fnv(map, len);
+    *bytes = len;
+    munmap(map, len);
+    return 0;
+}
+
+void onnx_plan_unmap(onnx_plan* plan)
+{
+    munmap(plan->map, plan->map_bytes);
+    plan->map = NULL;
+    plan->map_bytes = 0;
+}
+
+static void onnx_plan_file_put_tensor(const onnx_tensor* t, onnx_plan_file_tensor* f)
+{
+    f->dtype = t->dtype;
+    f->rank = t->rank;
+    memcpy(f->dims, t->dims, sizeof(f->dims));
+    memcpy(f->strides, t->strides, sizeof(f->strides));
+}
+
+static int onnx_plan_file_get_tensor(const onnx_plan_file_tensor* f, onnx_tensor* t)
+{
+    if(f->rank < 0 || f->rank > ONNX_TENSOR_MAX_DIM)
+    {
+        return -1;
+    }
+    memset(t, 0, sizeof(onnx_tensor));
+    t->dtype = (Onnx__TensorProto__DataType) f->dtype;
+    t->rank = f->rank;
+    memcpy(t->dims, f->dims, sizeof(f->dims));
+    memcpy(t->strides, f->strides, sizeof(f->strides));
+    return 0;
+}
+
+static int32_t onnx_plan_file_find(const onnx_plan_file_source* sources, int32_t n, const float* p, int64_t* offset)
+{
+    for(int32_t b = 0; p != NULL && b < n; b++)
+    {
+        if(p >= sources[b].data && p < sources[b].data + sources[b].len)
+        {
+            *offset = p - sources[b].data;
+            return b;
+        }
+    }
+    return -1;
+}
+
+// Elements a step's kernel reads through its weight or bias, from the shapes
+// it reads them with; *required when it reads the pointer in any case
+static int64_t onnx_plan_file_need(const onnx_plan_step* step, int bias, int* required)
+{
+    const onnx_tensor* out = step->pool.kernel_x != 0 ? &step->conv : &step->out;
+    int conv = step->kernel == conv2D_step || step->kernel == conv2D_gemm_step || step->kernel == conv2D_winograd_step;
+    int64_t n = out->rank > 0 ? out->dims[out->rank - 1] : 0;
+    int64_t k = conv ? step->attr.kernel_x * step->attr.kernel_y * step->in.dims[ONNX_C] : step->in.dims[1];
+    if(bias)
+    {
+        *required = conv || (step->kernel == add_step && step->input[1] < 0);
+        return step->kernel == add_step ? onnx_tensor_sample(&step->out) : conv || step->kernel == matmul_step ? n : 0;
+    }
+    *required = conv || step->kernel == matmul_step;
+    if(step->kernel == conv2D_gemm_step)
+    {
+        return sgemm_pack_size(n, k);
+    }
+    if(step->kernel == conv2D_winograd_step)
+    {
+        return winograd_pack_size(n, step->in.dims[ONNX_C], step->attr.tile);
+    }
+    return *required ? n * k : 0;
+}
+
+// Appends a string with its terminator, returns its offset in the section
+static uint64_t onnx_plan_file_string(char* strings, uint64_t* len, const char* text)
+{
+    uint64_t offset = *len;
+    size_t n = strlen(text) + 1;
+    if(strings != NULL)
+    {
+        memcpy(strings + offset, text, n);
+    }
+    *len += n;
+    return offset;
+}
+
+static int onnx_plan_file_write(FILE* file, uint64_t* at, uint64_t offset, const void* data, size_t bytes)
+{
+    static const char zeros[ONNX_PLAN_ALIGN] = { 0 };
+    while(*at < offset)
+    {
+        size_t n = offset - *at < sizeof(zeros) ? offset - *at : sizeof(zeros);
+        if(fwrite(zeros, 1, n, file) != n)
+        {
+            return -1;
+        }
+        *at += n;
+    }
+    if(bytes > 0 && fwrite(data, 1, bytes, file) != bytes)
+    {
+        return -1;
+    }
+    *at += bytes;
+    return 0;
+}
+
+int onnx_plan_save(const onnx_plan* plan, const char* path, const char* source)
+{
+    if(plan->index == NULL)
+    {
+        printf("%s: only compiled plans can be saved\n", path);
+        return -1;
+    }
+    onnx_plan_file_header header;
+    memset(&header, 0, sizeof(header));
+    if(onnx_plan_checksum(source, &header.source_checksum, &header.source_bytes) != 0)
+    {
+        printf("Failed to read %s\n", source);
+        return -1;
+    }
+
+    // 0. Weights: packs, then float initializers the steps use as they are
+    onnx_graph_index* index = plan->index;
+    int32_t n_init = (int32_t) index->graph->n_initializer;
+    onnx_plan_file_source* sources = (onnx_plan_file_source*) calloc(plan->n_packs + n_init + 1, sizeof(onnx_plan_file_source));
+    onnx_plan_file_step* steps = (onnx_plan_file_step*) calloc(plan->n_steps + 1, sizeof(onnx_plan_file_step));
+    if(sources == NULL || steps == NULL)
+    {
+        free(sources);
+        free(steps);
+        return -1;
+    }
+    int32_t n_sources = 0;
+    for(int32_t p = 0; p < plan->n_packs; p++)
+    {
+        sources[n_sources++] = (onnx_plan_file_source) { plan->packs[p].data, plan->packs[p].bytes / sizeof(float), 0 };
+    }
+    for(int32_t i = 0; i < n_init; i++)
+    {
+        if(index->views[i].data_type == ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT)
+        {
+            sources[n_sources++] = (onnx_plan_file_source) { (const float*) index->views[i].data, (int64_t) index->views[i].n_elem, 0 };
+        }
+    }
+
+    // 1. Step records; strings are sized first and filled below
+    uint64_t strings_bytes = 0;
+    int status = 0;
+    for(int32_t s = 0; s < plan->n_steps && status == 0; s++)
+    {
+        const onnx_plan_step* step = &plan->steps[s];
+        onnx_plan_file_step* f = &steps[s];
+        f->kernel = -1;
+        for(int32_t k = 0; k < ONNX_PLAN_FILE_KERNELS; k++)
+        {
+            f->kernel = onnx_plan_file_kernels[k] == step->kernel ? k : f->kernel;
+        }
+        int required;
+        f->weight = onnx_plan_file_find(sources, n_sources, step->weight, &f->weight_offset);
+        f->bias = onnx_plan_file_find(sources, n_sources, step->bias, &f->bias_offset);
+        f->weight_count = f->weight >= 0 ? onnx_plan_file_need(step, 0, &required) : 0;
+        f->bias_count = f->bias >= 0 ? onnx_plan_file_need(step, 1, &required) : 0;
+        if(f->kernel < 0 || (step->weight != NULL && f->weight < 0) || (step->bias != NULL && f->bias < 0) ||
+           (f->weight >= 0 && f->weight_offset + f->weight_count > sources[f->weight].len) ||
+           (f->bias >= 0 && f->bias_offset + f->bias_count > sources[f->bias].len))
+        {
+            printf("%s: step %d (%s) cannot be saved\n", path, s, step->node->name);
+            status = -1;
+            break;
+        }
+        sources[f->weight >= 0 ? f->weight : n_sources].used = 1;
+        sources[f->bias >= 0 ? f->bias : n_sources].used = 1;
+
+        memcpy(f->shapeW, step->shapeW, sizeof(f->shapeW));
+        memcpy(f->perm, step->perm, sizeof(f->perm));
+        f->dimW = step->dimW;
+        f->attr = step->attr;
+        f->pool = step->pool;
+        f->relu = step->relu;
+        f->input[0] = step->input[0];
+        f->input[1] = step->input[1];
+        f->output = step->output;
+        f->n_fused = step->n_fused;
+        onnx_plan_file_put_tensor(&step->in, &f->in);
+        onnx_plan_file_put_tensor(&step->out, &f->out);
+        onnx_plan_file_put_tensor(&step->conv, &f->conv);
+        f->name = onnx_plan_file_string(NULL, &strings_bytes, step->node->name);
+        f->op = onnx_plan_file_string(NULL, &strings_bytes, step->kernel == transpose_step ? "Transpose" : step->node->op_type);
+        for(int32_t k = 0; k < step->n_fused; k++)
+        {
+            f->fused[k] = onnx_plan_file_string(NULL, &strings_bytes, step->fused[k]->op_type);
+        }
+    }
+
+    // Used sources become the blobs, numbered in order
+    int32_t* blob_of = (int32_t*) malloc(sizeof(int32_t) * (n_sources + 1));
+    onnx_plan_file_blob* blobs = (onnx_plan_file_blob*) calloc(n_sources + 1, sizeof(onnx_plan_file_blob));
+    char* strings = (char*) malloc(strings_bytes + 1);
+    status = blob_of == NULL || blobs == NULL || strings == NULL ? -1 : status;
+
+    // 2. Section offsets
+    int32_t n = plan->n_steps;
+    int32_t n_succ = status == 0 ? plan->succ_offsets[n] : 0;
+    uint64_t at = onnx_plan_file_align(sizeof(header));
+    header.steps = at;
+    at = onnx_plan_file_align(at + sizeof(onnx_plan_file_step) * n);
+    header.slot_size = at;
+    at = onnx_plan_file_align(at + sizeof(int64_t) * plan->n_slots);
+    header.slot_offset = at;
+    at = onnx_plan_file_align(at + sizeof(uint64_t) * plan->n_slots);
+    header.slot_offset_dag = at;
+    at = onnx_plan_file_align(at + sizeof(uint64_t) * plan->n_slots);
+    header.step_deps = at;
+    at = onnx_plan_file_align(at + sizeof(int32_t) * (n + 1));
+    header.succ_offsets = at;
+    at = onnx_plan_file_align(at + sizeof(int32_t) * (n + 2));
+    header.succ = at;
+    at = onnx_plan_file_align(at + sizeof(int32_t) * (n_succ + 1));
+    header.blobs = at;
+    int32_t n_blobs = 0;
+    for(int32_t b = 0; status == 0 && b < n_sources; b++)
+    {
+        blob_of[b] = sources[b].used ? n_blobs++ : -1;
+    }
+    at = onnx_plan_file_align(at + sizeof(onnx_plan_file_blob) * n_blobs);
+    header.strings = at;
+    header.strings_bytes = strings_bytes;
+    at = onnx_plan_file_align(at + strings_bytes);
+    for(int32_t b = 0; status == 0 && b < n_sources; b++)
+    {
+        if(blob_of[b] >= 0)
+        {
+            blobs[blob_of[b]].offset = at;
+            blobs[blob_of[b]].bytes = sizeof(float) * sources[b].len;
+            header.weight_bytes += blobs[blob_of[b]].bytes;
+            at = onnx_plan_file_align(at + blobs[blob_of[b]].bytes);
+        }
+    }
+
+    // Steps refer to blobs; the strings are filled
+    strings_bytes = 0;
+    for(int32_t s = 0; status == 0 && s < n; s++)
+    {
+        const onnx_plan_step* step = &plan->steps[s];
+        onnx_plan_file_step* f = &steps[s];
+        f->weight = f->weight >= 0 ? blob_of[f->weight] : -1;
+        f->bias = f->bias >= 0 ? blob_of[f->bias] : -1;
+        onnx_plan_file_string(strings, &strings_bytes, step->node->name);
+        onnx_plan_file_string(strings, &strings_bytes, step->kernel == transpose_step ? "Transpose" : step->node->op_type);
+        for(int32_t k = 0; k < step->n_fused; k++)
+        {
+            onnx_plan_file_string(strings, &strings_bytes, step->fused[k]->op_type);
+        }
+    }
+
+    memcpy(header.magic, ONNX_PLAN_FILE_MAGIC, sizeof(header.magic));
+    header.version = ONNX_PLAN_FILE_VERSION;
+    header.byte_order = ONNX_PLAN_FILE_BYTE_ORDER;
+    header.align = ONNX_PLAN_ALIGN;
+    header.size_bytes = sizeof(size_t);
+    header.file_bytes = at;
+    header.n_steps = n;
+    header.n_slots = plan->n_slots;
+    header.n_blobs = n_blobs;
+    header.n_succ = n_succ;
+    header.input_slot = plan->input_slot;
+    header.output_slot = plan->output_slot;
+    header.arena_bytes = plan->arena_bytes;
+    header.arena_bytes_dag = plan->arena_bytes_dag;
+    onnx_plan_file_put_tensor(&plan->input, &header.input);
+    onnx_plan_file_put_tensor(&plan->output, &header.output);
+
+    // 3. Sections in file order
+    uint64_t* offsets = (uint64_t*) malloc(sizeof(uint64_t) * (2 * plan->n_slots + 1));
+    FILE* file = status == 0 && offsets != NULL ? fopen(path, "wb") : NULL;
+    if(file == NULL)
+    {
+        status = -1;
+    }
+    else
+    {
+        for(int32_t s = 0; s < plan->n_slots; s++)
+        {
+            offsets[s] = plan->slot_offset[s];
+            offsets[plan->n_slots + s] = plan->slot_offset_dag[s];
+        }
+        uint64_t pos = 0;
+        status |= onnx_plan_file_write(file, &pos, 0, &header, sizeof(header));
+        status |= onnx_plan_file_write(file, &pos, header.steps, steps, sizeof(onnx_plan_file_step) * n);
+        status |= onnx_plan_file_write(file, &pos, header.slot_size, plan->slot_size, sizeof(int64_t) * plan->n_slots);
+        status |= onnx_plan_file_write(file, &pos, header.slot_offset, offsets, sizeof(uint64_t) * plan->n_slots);
+        status |= onnx_plan_file_write(file, &pos, header.slot_offset_dag, offsets + plan->n_slots, sizeof(uint64_t) * plan->n_slots);
+        status |= onnx_plan_file_write(file, &pos, header.step_deps, plan->step_deps, sizeof(int32_t) * (n + 1));
+        status |= onnx_plan_file_write(file, &pos, header.succ_offsets, plan->succ_offsets, sizeof(int32_t) * (n + 2));
+        status |= onnx_plan_file_write(file, &pos, header.succ, plan->succ, sizeof(int32_t) * n_succ);
+        status |= onnx_plan_file_write(file, &pos, header.blobs, blobs, sizeof(onnx_plan_file_blob) * n_blobs);
+        status |= onnx_plan_file_write(file, &pos, header.strings, strings, strings_bytes);
+        for(int32_t b = 0; b < n_sources; b++)
+        {
+            if(blob_of[b] >= 0)
+            {
+                status |= onnx_plan_file_write(file, &pos, blobs[blob_of[b]].offset, sources[b].data, blobs[blob_of[b]].bytes);
+            }
+        }
+        status |= onnx_plan_file_write(file, &pos, header.file_bytes, NULL, 0);
+        status |= fclose(file) != 0 ? -1 : 0;
+    }
+
+    free(offsets);
+    free(strings);
+    free(blobs);
+    free(blob_of);
+    free(steps);
+    free(sources);
+    return status == 0 ? 0 : -1;
+}
+
+// Sections must lie inside the file
+static int onnx_plan_file_fits(const onnx_plan_file_header* h, uint64_t offset, uint64_t bytes)
+{
+    return offset % ONNX_PLAN_ALIGN == 0 && offset <= h->file_bytes && bytes <= h->file_bytes - offset;
+}
+
+static int onnx_plan_file_check(const onnx_plan_file_header* h, size_t map_bytes)
+{
+    if(map_bytes < sizeof(onnx_plan_file_header) || memcmp(h->magic, ONNX_PLAN_FILE_MAGIC, sizeof(h->magic)) != 0)
+    {
+        return -1;
+    }
+    if(h->version != ONNX_PLAN_FILE_VERSION || h->byte_order != ONNX_PLAN_FILE_BYTE_ORDER ||
+       h->align != ONNX_PLAN_ALIGN || h->size_bytes != sizeof(size_t) || h->file_bytes != map_bytes)
+    {
+        return -1;
+    }
+    if(h->n_steps <= 0 || h->n_slots <= 0 || h->n_blobs < 0 || h->n_succ < 0 ||
+       h->input_slot < 0 || h->input_slot >= h->n_slots || h->output_slot < 0 || h->output_slot >= h->n_slots)
+    {
+        return -1;
+    }
+    uint64_t n = h->n_steps;
+    uint64_t slots = h->n_slots;
+    int fits = onnx_plan_file_fits(h, h->steps, sizeof(onnx_plan_file_step) * n) &&
+               onnx_plan_file_fits(h, h->slot_size, sizeof(int64_t) * slots) &&
+               onnx_plan_file_fits(h, h->slot_offset, sizeof(uint64_t) * slots) &&
+               onnx_plan_file_fits(h, h->slot_offset_dag, sizeof(uint64_t) * slots) &&
+               onnx_plan_file_fits(h, h->step_deps, sizeof(int32_t) * (n + 1)) &&
+               onnx_plan_file_fits(h, h->succ_offsets, sizeof(int32_t) * (n + 2)) &&
+               onnx_plan_file_fits(h, h->succ, sizeof(int32_t) * h->n_succ) &&
+               onnx_plan_file_fits(h, h->blobs, sizeof(onnx_plan_file_blob) * h->n_blobs) &&
+               onnx_plan_file_fits(h, h->strings, h->strings_bytes);
+    return fits ? 0 : -1;
+}
+
+// Elements of t, -1 unless every dim is positive and the count is at most limit
+static int64_t onnx_plan_file_numel(const onnx_tensor* t, int64_t limit)
+{
+    int64_t n = 1;
+    for(int32_t i = 0; i < t->rank; i++)
+    {
+        if(t->dims[i] < 1 || t->dims[i] > limit / n)
+        {
+            return -1;
+        }
+        n *= t->dims[i];
+    }
+    return n;
+}
+
+// Elements slot holds; the input slot is the caller's input
+static int64_t onnx_plan_file_slot(const onnx_plan* plan, int32_t slot)
+{
+    return slot == plan->input_slot ? onnx_tensor_numel(&plan->input) : plan->slot_size[slot];
+}
+
+// One spatial axis of a window taking in to out. As onnx_plan_window and the
+// exporters have them, kernel and stride are positive and both pads are
+// smaller than the kernel; the end pad is not stored, so some end pad must
+// give out.
+static int onnx_plan_file_axis(int64_t in, int64_t out, int64_t kernel, int64_t stride, int64_t pad)
+{
+    if(kernel < 1 || kernel > INT32_MAX || stride < 1 || stride > INT32_MAX || pad < 0 || pad >= kernel ||
+       (out > 1 && stride > (in + pad) / (out - 1)))
+    {
+        return 0;
+    }
+    // The smallest end pad giving out; up to stride - 1 more give it too
+    int64_t end = (out - 1) * stride + kernel - in - pad;
+    return end < kernel && end + stride > 0;
+}
+
+static int onnx_plan_file_window(const onnx_tensor* in, const onnx_tensor* out, const onnx_plan_attr* a)
+{
+    return in->rank == 4 && out->rank == 4 && in->dims[ONNX_N] == out->dims[ONNX_N] &&
+           onnx_plan_file_axis(in->dims[ONNX_H], out->dims[ONNX_H], a->kernel_y, a->stride_y, a->padding_y) &&
+           onnx_plan_file_axis(in->dims[ONNX_W], out->dims[ONNX_W], a->kernel_x, a->stride_x, a->padding_x);
+}
+
+// The step's tensors fit its slots and agree with each other the way its
+// kernel reads them, so that the kernel stays within its slots and weights
+static int onnx_plan_file_shapes(const onnx_plan* plan, const onnx_plan_step* step)
+{
+    int64_t in = onnx_plan_file_numel(&step->in, onnx_plan_file_slot(plan, step->input[0]));
+    int64_t out = onnx_plan_file_numel(&step->out, onnx_plan_file_slot(plan, step->output));
+    if(in < 0 || out < 0 || (step->input[1] >= 0 && onnx_plan_file_numel(&step->in, onnx_plan_file_slot(plan, step->input[1])) < 0))
+    {
+        return -1;
+    }
+    const int64_t* x = step->in.dims;
+    const int64_t* y = step->out.dims;
+    int pooled = step->pool.kernel_x != 0;
+    if(step->kernel == conv2D_step || step->kernel == conv2D_gemm_step || step->kernel == conv2D_winograd_step)
+    {
+        // Under a fused MaxPool the conv output never reaches a slot
+        const onnx_tensor* conv = pooled ? &step->conv : &step->out;
+        int ok = onnx_plan_file_window(&step->in, conv, &step->attr) && onnx_plan_file_numel(conv, INT64_MAX) > 0;
+        if(pooled)
+        {
+            ok &= step->kernel != conv2D_winograd_step && onnx_plan_file_window(conv, &step->out, &step->pool) &&
+                  conv->dims[ONNX_C] == y[ONNX_C];
+        }
+        if(step->kernel == conv2D_winograd_step)
+        {
+            ok &= (step->attr.tile == 2 || step->attr.tile == 4) && step->attr.kernel_x == 3 &&
+                  step->attr.kernel_y == 3 && step->attr.stride_x == 1 && step->attr.stride_y == 1;
+        }
+        else
+        {
+            ok &= step->attr.tile == 0;
+        }
+        return ok ? 0 : -1;
+    }
+    if(pooled)
+    {
+        return -1;
+    }
+    if(step->kernel == maxpool_step)
+    {
+        return onnx_plan_file_window(&step->in, &step->out, &step->attr) && x[ONNX_C] == y[ONNX_C] ? 0 : -1;
+    }
+    if(step->kernel == matmul_step)
+    {
+        return step->in.rank == 2 && step->out.rank == 2 && x[0] == y[0] && step->dimW == 2 &&
+               step->shapeW[0] == x[1] && step->shapeW[1] == y[1] ? 0 : -1;
+    }
+    if(step->kernel == transpose_step)
+    {
+        // The copy permutes each sample as shapeW
+        int64_t len = 1;
+        int seen = 0;
+        for(int64_t d = 0; d < step->dimW; d++)
+        {
+            len = step->shapeW[d] > 0 && step->shapeW[d] <= in / len ? len * step->shapeW[d] : -1;
+            seen |= step->perm[d] >= 0 && step->perm[d] < step->dimW ? 1 << step->perm[d] : 0;
+            if(len < 0)
+            {
+                return -1;
+            }
+        }
+        return step->in.rank > 0 && step->out.rank > 0 && x[0] == y[0] && in == out && step->dimW > 0 &&
+               len == onnx_tensor_sample(&step->in) && seen == (1 << step->dimW) - 1 ? 0 : -1;
+    }
+    // Relu, Add and Softmax keep the shape
+    return in == out ? 0 : -1;
+}
+
+// count elements from offset, which must lie in the blob; the step needs
+// need of them, and must have them when required
+static const float* onnx_plan_file_weights(const onnx_plan_file_header* h, const onnx_plan_file_blob* blobs,
+                                           int32_t blob, int64_t offset, int64_t count, int64_t need, int required,
+                                           int* status)
+{
+    if(blob < 0)
+    {
+        *status |= required ? -1 : 0;
+        return NULL;
+    }
+    if(blob >= h->n_blobs || !onnx_plan_file_fits(h, blobs[blob].offset, blobs[blob].bytes) || offset < 0 ||
+       count != need || (uint64_t) offset >= blobs[blob].bytes / sizeof(float) ||
+       (uint64_t) count > blobs[blob].bytes / sizeof(float) - (uint64_t) offset)
+    {
+        *status = -1;
+        return NULL;
+    }
+    return (const float*) ((const char*) h + blobs[blob].offset) + offset;
+}
+
+static char* onnx_plan_file_text(const onnx_plan_file_header* h, uint64_t offset, int* status)
+{
+    const char* strings = (const char*) h + h->strings;
+    if(offset >= h->strings_bytes || memchr(strings + offset, '\0', h->strings_bytes - offset) == NULL)
+    {
+        *status = -1;
+        return "";
+    }
+    return (char*) strings + offset;
+}
+
+onnx_plan* onnx_plan_load(const char* path, const char* source)
+{
+    size_t map_bytes = 0;
+    void* map = onnx_plan_file_map(path, &map_bytes);
+    if(map == NULL)
+    {
+        printf("Failed to map %s\n", path);
+        return NULL;
+    }
+    const onnx_plan_file_header* h = (const onnx_plan_file_header*) map;
+    if(onnx_plan_file_check(h, map_bytes) != 0)
+    {
+        printf("%s is not a version %d plan file for this host\n", path, ONNX_PLAN_FILE_VERSION);
+        munmap(map, map_bytes);
+        return NULL;
+    }
+    uint64_t checksum, bytes;
+    if(source != NULL &&
+       (onnx_plan_checksum(source, &checksum, &bytes) != 0 || checksum != h->source_checksum || bytes != h->source_bytes))
+    {
+        printf("%s was not compiled from %s as it is now\n", path, source);
+        munmap(map, map_bytes);
+        return NULL;
+    }
+
+    onnx_plan* plan = (onnx_plan*) calloc(1, sizeof(onnx_plan));
+    if(plan == NULL)
+    {
+        munmap(map, map_bytes);
+        return NULL;
+    }
+    plan->map = map;
+    plan->map_bytes = map_bytes;
+
+    // Layouts and DAG are used in place
+    const char* base = (const char*) map;
+    plan->n_steps = h->n_steps;
+    plan->n_slots = h->n_slots;
+    plan->slot_size = (int64_t*) (base + h->slot_size);
+    plan->slot_offset = (size_t*) (base + h->slot_offset);
+    plan->slot_offset_dag = (size_t*) (base + h->slot_offset_dag);
+    plan->arena_bytes = h->arena_bytes;
+    plan->arena_bytes_dag = h->arena_bytes_dag;
+    plan->input_slot = h->input_slot;
+    plan->output_slot = h->output_slot;
+    plan->packed_bytes = h->weight_bytes;
+    plan->step_deps = (int32_t*) (base + h->step_deps);
+    plan->succ_offsets = (int32_t*) (base + h->succ_offsets);
+    plan->succ = (int32_t*) (base + h->succ);
+    int status = onnx_plan_file_get_tensor(&h->input, &plan->input) | onnx_plan_file_get_tensor(&h->output, &plan->output);
+    status |= status == 0 && onnx_plan_file_numel(&plan->input, INT64_MAX) < 0 ? -1 : 0;
+    for(int32_t s = 0; s < plan->n_slots; s++)
+    {
+        uint64_t bytes = sizeof(float) * (uint64_t) plan->slot_size[s];
+        if(s != plan->input_slot && (plan->slot_size[s] < 0 || plan->slot_offset[s] + bytes > plan->arena_bytes ||
+                                     plan->slot_offset_dag[s] + bytes > plan->arena_bytes_dag))
+        {
+            status = -1;
+        }
+    }
+    for(int32_t i = 0; i < plan->n_steps; i++)
+    {
+        int32_t begin = plan->succ_offsets[i], end = plan->succ_offsets[i + 1];
+        status |= begin < 0 || begin > end || end > h->n_succ ? -1 : 0;
+        for(int32_t e = begin; status == 0 && e < end; e++)
+        {
+            status |= plan->succ[e] <= i || plan->succ[e] >= plan->n_steps ? -1 : 0;
+        }
+    }
+
+    // The scheduler starts the steps whose deps reach zero, so they must be
+    // the in-degrees of the successor lists
+    int32_t* deps = (int32_t*) calloc(plan->n_steps + 1, sizeof(int32_t));
+    status |= deps == NULL ? -1 : 0;
+    for(int32_t e = 0; status == 0 && e < plan->succ_offsets[plan->n_steps]; e++)
+    {
+        deps[plan->succ[e]]++;
+    }
+    status |= status == 0 && memcmp(deps, plan->step_deps, sizeof(int32_t) * (plan->n_steps + 1)) != 0 ? -1 : 0;
+    free(deps);
+
+    // Steps get their kernels and weights back, and nodes for their names
+    const onnx_plan_file_step* records = (const onnx_plan_file_step*) (base + h->steps);
+    const onnx_plan_file_blob* blobs = (const onnx_plan_file_blob*) (base + h->blobs);
+    plan->steps = (onnx_plan_step*) calloc(plan->n_steps, sizeof(onnx_plan_step));
+    plan->nodes = (Onnx__NodeProto*) calloc((size_t) plan->n_steps * (ONNX_PLAN_MAX_FUSED + 1), sizeof(Onnx__NodeProto));
+    status |= plan->steps == NULL || plan->nodes == NULL ? -1 : 0;
+    for(int32_t s = 0; status == 0 && s < plan->n_steps; s++)
+    {
+        const onnx_plan_file_step* f = &records[s];
+        onnx_plan_step* step = &plan->steps[s];
+        if(f->kernel < 0 || f->kernel >= ONNX_PLAN_FILE_KERNELS || f->n_fused < 0 || f->n_fused > ONNX_PLAN_MAX_FUSED ||
+           f->dimW < 0 || f->dimW > 4 || f->output < 0 || f->output >= plan->n_slots ||
+           f->input[0] < 0 || f->input[0] >= plan->n_slots || f->input[1] < -1 || f->input[1] >= plan->n_slots)
+        {
+            status = -1;
+            break;
+        }
+        step->kernel = onnx_plan_file_kernels[f->kernel];
+        memcpy(step->shapeW, f->shapeW, sizeof(step->shapeW));
+        memcpy(step->perm, f->perm, sizeof(step->perm));
+        step->dimW = f->dimW;
+        step->attr = f->attr;
+        step->pool = f->pool;
+        step->relu = (uint8_t) f->relu;
+        step->input[0] = f->input[0];
+        step->input[1] = f->input[1];
+        step->output = f->output;
+        status |= onnx_plan_file_get_tensor(&f->in, &step->in) | onnx_plan_file_get_tensor(&f->out, &step->out) |
+                  onnx_plan_file_get_tensor(&f->conv, &step->conv);
+        if(status != 0 || onnx_plan_file_shapes(plan, step) != 0)
+        {
+            status = -1;
+            break;
+        }
+
+        // Weights last, checked against the shapes the kernel reads them with
+        int required;
+        int64_t need = onnx_plan_file_need(step, 0, &required);
+        step->weight = onnx_plan_file_weights(h, blobs, f->weight, f->weight_offset, f->weight_count, need, required, &status);
+        need = onnx_plan_file_need(step, 1, &required);
+        step->bias = onnx_plan_file_weights(h, blobs, f->bias, f->bias_offset, f->bias_count, need, required, &status);
+
+        Onnx__NodeProto* nodes = &plan->nodes[(size_t) s * (ONNX_PLAN_MAX_FUSED + 1)];
+        onnx__node_proto__init(&nodes[0]);
+        nodes[0].name = onnx_plan_file_text(h, f->name, &status);
+        nodes[0].op_type = onnx_plan_file_text(h, f->op, &status);
+        step->node = &nodes[0];
+        step->n_fused = f->n_fused;
+        for(int32_t k = 0; k < f->n_fused; k++)
+        {
+            onnx__node_proto__init(&nodes[k + 1]);
+            nodes[k + 1].name = nodes[0].name;
+            nodes[k + 1].op_type = onnx_plan_file_text(h, f->fused[k], &status);
+            step->fused[k] = &nodes[k + 1];
+        }
+    }
+    if(status == 0)
+    {
+        plan->session = onnx_session_create(plan, NULL);
+    }
+    if(status != 0 || plan->session == NULL)
+    {
+        printf("%s: corrupt plan file\n", path);
+        onnx_plan_free(plan);
+        return NULL;
+    }
+    return plan;
+}
@@ -0,0 +1,584 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#include "onnx-runtime.h"
+
+// A job in flight. Lives on the caller's stack; workers register in active
+// while they hold a pointer to it.
+typedef struct onnx_pool_job
+{
+    int (*has_work)(struct onnx_pool_job* job);
+    void (*work)(struct onnx_pool_job* job, int queue);
+    int active;
+    struct onnx_pool_job* next_job;
+} onnx_pool_job;
+
+// parallel_for: chunks of [0, n) claimed with an atomic counter
+typedef struct onnx_pool_range_job
+{
+    onnx_pool_job base;
+    onnx_task fn;
+    void* arg;
+    int64_t n;
+    int64_t chunk;
+    atomic_int_fast64_t next;
+    atomic_int_fast64_t done;
+} onnx_pool_range_job;
+
+// run_graph: ready tasks sit in per-thread deques. The owner pops from the
+// back of its own deque, idle threads steal from the front of the others.
+typedef struct onnx_pool_queue
+{
+    pthread_mutex_t lock;
+    int32_t head;
+    int32_t tail;
+    int32_t* items;
+} onnx_pool_queue;
+
+typedef struct onnx_pool_graph_job
+{
+    onnx_pool_job base;
+    onnx_pool* pool;
+    onnx_task fn;
+    void* arg;
+    const int32_t* succ_offsets;
+    const int32_t* succ;
+    atomic_int* deps;
+    atomic_int remaining;
+    atomic_int ready;
+    int n_queues;
+    onnx_pool_queue* queues;
+} onnx_pool_graph_job;
+
+// Worker index, used to pick a deque; -1 outside the pool
+static __thread int onnx_pool_worker_id = -1;
+
+struct onnx_pool
+{
+    int n_workers;
+    atomic_int next_id;
+    pthread_t* threads;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t finished;
+    onnx_pool_job* jobs;
+    int stop;
+};
+
+// Runs chunks of job until none are left
+static void onnx_pool_range_work(onnx_pool_job* base, int queue)
+{
+    onnx_pool_range_job* job = (onnx_pool_range_job*) base;
+
+    for(;;)
+    {
+        int64_t begin = atomic_fetch_add(&job->next, job->chunk);
+        if(begin >= job->n)
+        {
+            return;
+        }
+        int64_t end = begin + job->chunk < job->n ? begin + job->chunk : job->n;
+        job->fn(job->arg, begin, end);
+        atomic_fetch_add(&job->done, end - begin);
+    }
+}
+
+// Called with the lock held
+static onnx_pool_job* onnx_pool_find(onnx_pool* pool)
+{
+    for(onnx_pool_job* job = pool->jobs; job != NULL; job = job->next_job)
+    {
+        if(job->has_work(job))
+        {
+            return job;
+        }
+    }
+    return NULL;
+}
+
+static void* onnx_pool_worker(void* arg)
+{
+    onnx_pool* pool = (onnx_pool*) arg;
+    onnx_pool_worker_id = atomic_fetch_add(&pool->next_id, 1);
+
+    pthread_mutex_lock(&pool->lock);
+    for(;;)
+    {
+        onnx_pool_job* job = onnx_pool_find(pool);
+        if(job == NULL)
+        {
+            if(pool->stop)
+            {
+                break;
+            }
+            pthread_cond_wait(&pool->wake, &pool->lock);
+            continue;
+        }
+
+        job->active++;
+        pthread_mutex_unlock(&pool->lock);
+        job->work(job, onnx_pool_worker_id);
+        pthread_mutex_lock(&pool->lock);
+        job->active--;
+        pthread_cond_broadcast(&pool->finished);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+onnx_pool* onnx_pool_create(int n_workers, const int* cpus)
+{
+    assert(n_workers >= 0);
+
+    onnx_pool* pool = (onnx_pool*) calloc(1, sizeof(onnx_pool));
+    if(pool == NULL)
+    {
+        return NULL;
+    }
+    pool->threads = (pthread_t*) calloc(n_workers + 1, sizeof(pthread_t));
+    if(pool->threads == NULL)
+    {
+        free(pool);
+        return NULL;
+    }
+    atomic_init(&pool->next_id, 0);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->finished, NULL);
+
+    for(int t = 0; t < n_workers; t++)
+    {
+        if(pthread_create(&pool->threads[t], NULL, onnx_pool_worker, pool) != 0)
+        {
+            printf("Unable to start worker %d\n", t);
+            break;
+        }
+        pool->n_workers++;
+#ifdef __linux__
+        if(cpus != NULL)
+        {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpus[t], &set);
+            pthread_setaffinity_np(pool->threads[t], sizeof(set), &set);
+        }
+#endif
+    }
+
+    return pool;
+}
+
+void onnx_pool_destroy(onnx_pool* pool)
+{
+    if(pool == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    for(int t = 0; t < pool->n_workers; t++)
+    {
+        pthread_join(pool->threads[t], NULL);
+    }
+    pthread_cond_destroy(&pool->finished);
+    pthread_cond_destroy(&pool->wake);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->threads);
+    free(pool);
+}
+
+int onnx_pool_size(onnx_pool* pool)
+{
+    // Workers plus the calling thread
+    return pool == NULL ? 1 : pool->n_workers + 1;
+}
+
+int onnx_pool_default_workers(void)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 1 ? (int) cpus - 1 : 0;
+}
+
+int onnx_pool_worker_index(void)
+{
+    return onnx_pool_worker_id;
+}
+
+// Per-thread kernel scratch, kept in a thread key so it is freed on thread exit
+typedef struct onnx_pool_scratch_block
+{
+    size_t bytes;
+    void* data;
+} onnx_pool_scratch_block;
+
+static pthread_key_t onnx_pool_scratch_key;
+static pthread_once_t onnx_pool_scratch_once = PTHREAD_ONCE_INIT;
+
+static void onnx_pool_scratch_free(void* arg)
+{
+    onnx_pool_scratch_block* block = (onnx_pool_scratch_block*) arg;
+    free(block->data);
+    free(block);
+}
+
+static void onnx_pool_scratch_init(void)
+{
+    pthread_key_create(&onnx_pool_scratch_key, onnx_pool_scratch_free);
+}
+
+void* onnx_pool_scratch(size_t bytes)
+{
+    pthread_once(&onnx_pool_scratch_once, onnx_pool_scratch_init);
+
+    onnx_pool_scratch_block* block = (onnx_pool_scratch_block*) pthread_getspecific(onnx_pool_scratch_key);
+    if(block == NULL)
+    {
+        block = (onnx_pool_scratch_block*) calloc(1, sizeof(onnx_pool_scratch_block));
+        if(block == NULL || pthread_setspecific(onnx_pool_scratch_key, block) != 0)
+        {
+            free(block);
+            return NULL;
+        }
+    }
+    if(block->bytes < bytes)
+    {
+        // Grows to the largest request seen, so steady state runs do not allocate
+        void* data = aligned_alloc(ONNX_PLAN_ALIGN, (bytes + ONNX_PLAN_ALIGN - 1) & ~(size_t)(ONNX_PLAN_ALIGN - 1));
+        if(data == NULL)
+        {
+            return NULL;
+        }
+        onnx_profile_count_alloc();
+        free(block->data);
+        block->data = data;
+        block->bytes = bytes;
+    }
+    return block->data;
+}
+
+// scratch_reserve: every worker grows its scratch once. A worker only reads
+// and writes its own flag, so they need no lock.
+typedef struct onnx_pool_reserve_job
+{
+    onnx_pool_job base;
+    size_t bytes;
+    char* reserved;             // per worker
+    atomic_int done;
+    atomic_int failed;
+} onnx_pool_reserve_job;
+
+static int onnx_pool_reserve_has_work(onnx_pool_job* base)
+{
+    onnx_pool_reserve_job* job = (onnx_pool_reserve_job*) base;
+    return onnx_pool_worker_id >= 0 && !job->reserved[onnx_pool_worker_id];
+}
+
+static void onnx_pool_reserve_work(onnx_pool_job* base, int queue)
+{
+    onnx_pool_reserve_job* job = (onnx_pool_reserve_job*) base;
+    job->reserved[queue] = 1;
+    if(onnx_pool_scratch(job->bytes) == NULL)
+    {
+        atomic_store(&job->failed, 1);
+    }
+    atomic_fetch_add(&job->done, 1);
+}
+
+static int onnx_pool_range_has_work(onnx_pool_job* base)
+{
+    onnx_pool_range_job* job = (onnx_pool_range_job*) base;
+    return atomic_load(&job->next) < job->n;
+}
+
+// Publishes job to the workers
+static void onnx_pool_push(onnx_pool* pool, onnx_pool_job* job)
+{
+    job->active = 0;
+    pthread_mutex_lock(&pool->lock);
+    job->next_job = pool->jobs;
+    pool->jobs = job;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Called with the lock held once the job is complete
+static void onnx_pool_retire(onnx_pool* pool, onnx_pool_job* job)
+{
+    while(job->active > 0)
+    {
+        pthread_cond_wait(&pool->finished, &pool->lock);
+    }
+    onnx_pool_job** link = &pool->jobs;
+    while(*link != job)
+    {
+        link = &(*link)->next_job;
+    }
+    *link = job->next_job;
+}
+
+int onnx_pool_scratch_reserve(onnx_pool* pool, size_t bytes)
+{
+    if(bytes == 0)
+    {
+        return 0;
+    }
+    if(onnx_pool_scratch(bytes) == NULL)
+    {
+        return -1;
+    }
+    if(onnx_pool_size(pool) == 1)
+    {
+        return 0;
+    }
+
+    onnx_pool_reserve_job job;
+    job.base.has_work = onnx_pool_reserve_has_work;
+    job.base.work = onnx_pool_reserve_work;
+    job.bytes = bytes;
+    job.reserved = (char*) calloc(pool->n_workers, 1);
+    if(job.reserved == NULL)
+    {
+        return -1;
+    }
+    atomic_init(&job.done, 0);
+    atomic_init(&job.failed, 0);
+    onnx_pool_push(pool, &job.base);
+
+    // Workers busy elsewhere pick it up once they are done
+    pthread_mutex_lock(&pool->lock);
+    while(atomic_load(&job.done) < pool->n_workers)
+    {
+        pthread_cond_wait(&pool->finished, &pool->lock);
+    }
+    onnx_pool_retire(pool, &job.base);
+    pthread_mutex_unlock(&pool->lock);
+
+    free(job.reserved);
+    return atomic_load(&job.failed) ? -1 : 0;
+}
+
+void onnx_pool_parallel_for(onnx_pool* pool, int64_t n, int64_t grain, onnx_task fn, void* arg)
+{
+    if(n <= 0)
+    {
+        return;
+    }
+    grain = grain > 0 ? grain : 1;
+
+    // Too little work to be worth waking anybody up
+    int threads = onnx_pool_size(pool);
+    if(threads == 1 || n <= grain)
+    {
+        fn(arg, 0, n);
+        return;
+    }
+
+    // A few chunks per thread balance uneven tiles; never below the grain
+    int64_t chunk = (n + 4 * threads - 1) / (4 * threads);
+    chunk = chunk > grain ? chunk : grain;
+
+    onnx_pool_range_job job;
+    job.base.has_work = onnx_pool_range_has_work;
+    job.base.work = onnx_pool_range_work;
+    job.fn = fn;
+    job.arg = arg;
+    job.n = n;
+    job.chunk = chunk;
+    atomic_init(&job.next, 0);
+    atomic_init(&job.done, 0);
+    onnx_pool_push(pool, &job.base);
+
+    // The caller works on its own job, then waits for chunks still running elsewhere
+    onnx_pool_range_work(&job.base, -1);
+
+    pthread_mutex_lock(&pool->lock);
+    while(atomic_load(&job.done) < n)
+    {
+        pthread_cond_wait(&pool->finished, &pool->lock);
+    }
+    onnx_pool_retire(pool, &job.base);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static int32_t onnx_pool_pop(onnx_pool_queue* queue)
+{
+    int32_t task = -1;
+    pthread_mutex_lock(&queue->lock);
+    if(queue->tail > queue->head)
+    {
+        task = queue->items[--queue->tail];
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return task;
+}
+
+static int32_t onnx_pool_steal(onnx_pool_queue* queue)
+{
+    int32_t task = -1;
+    pthread_mutex_lock(&queue->lock);
+    if(queue->tail > queue->head)
+    {
+        task = queue->items[queue->head++];
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return task;
+}
+
+static void onnx_pool_put(onnx_pool_queue* queue, int32_t task)
+{
+    pthread_mutex_lock(&queue->lock);
+    queue->items[queue->tail++] = task;
+    pthread_mutex_unlock(&queue->lock);
+}
+
+static int onnx_pool_graph_has_work(onnx_pool_job* base)
+{
+    onnx_pool_graph_job* job = (onnx_pool_graph_job*) base;
+    return atomic_load(&job->ready) > 0;
+}
+
+// Runs ready tasks until none are left to take; returns while others may still run
+static void onnx_pool_graph_work(onnx_pool_job* base, int queue)
+{
+    onnx_pool_graph_job* job = (onnx_pool_graph_job*) base;
+    onnx_pool_queue* own = &job->queues[queue];
+
+    for(;;)
+    {
+        int32_t task = onnx_pool_pop(own);
+        for(int q = 1; task < 0 && q < job->n_queues; q++)
+        {
+            task = onnx_pool_steal(&job->queues[(queue + q) % job->n_queues]);
+        }
+        if(task < 0)
+        {
+            return;
+        }
+        atomic_fetch_sub(&job->ready, 1);
+
+        job->fn(job->arg, task, task + 1);
+
+        // Successors that became ready go to this thread's deque
+        int woken = 0;
+        for(int32_t e = job->succ_offsets[task]; e < job->succ_offsets[task + 1]; e++)
+        {
+            int32_t next = job->succ[e];
+            if(atomic_fetch_sub(&job->deps[next], 1) == 1)
+            {
+                onnx_pool_put(own, next);
+                atomic_fetch_add(&job->ready, 1);
+                woken++;
+            }
+        }
+
+        // One ready successor is picked up by this thread; more are worth waking for
+        if(atomic_fetch_sub(&job->remaining, 1) == 1 || woken > 1)
+        {
+            pthread_mutex_lock(&job->pool->lock);
+            pthread_cond_broadcast(&job->pool->wake);
+            pthread_cond_broadcast(&job->pool->finished);
+            pthread_mutex_unlock(&job->pool->lock);
+        }
+    }
+}
+
+size_t onnx_pool_graph_scratch_size(onnx_pool* pool, int32_t n_tasks)
+{
+    int n_queues = onnx_pool_size(pool);
+    return sizeof(onnx_pool_queue) * n_queues + sizeof(atomic_int) * n_tasks + sizeof(int32_t) * n_tasks * n_queues;
+}
+
+void onnx_pool_run_graph(onnx_pool* pool, int32_t n_tasks, const int32_t* n_deps, const int32_t* succ_offsets,
+                         const int32_t* succ, onnx_task fn, void* arg, void* scratch)
+{
+    // Tasks are numbered in a topological order, which is all one thread needs
+    if(onnx_pool_size(pool) == 1)
+    {
+        for(int32_t t = 0; t < n_tasks; t++)
+        {
+            fn(arg, t, t + 1);
+        }
+        return;
+    }
+
+    onnx_pool_graph_job job;
+    job.base.has_work = onnx_pool_graph_has_work;
+    job.base.work = onnx_pool_graph_work;
+    job.pool = pool;
+    job.fn = fn;
+    job.arg = arg;
+    job.succ_offsets = succ_offsets;
+    job.succ = succ;
+    job.n_queues = onnx_pool_size(pool);
+    job.queues = (onnx_pool_queue*) scratch;
+    job.deps = (atomic_int*) (job.queues + job.n_queues);
+    int32_t* items = (int32_t*) (job.deps + n_tasks);
+
+    // Workers use their own deque, the caller the last one
+    int owner = pool->n_workers;
+    for(int q = 0; q < job.n_queues; q++)
+    {
+        pthread_mutex_init(&job.queues[q].lock, NULL);
+        job.queues[q].head = 0;
+        job.queues[q].tail = 0;
+        job.queues[q].items = items + (size_t) q * n_tasks;
+    }
+    int32_t n_ready = 0;
+    for(int32_t t = 0; t < n_tasks; t++)
+    {
+        atomic_init(&job.deps[t], n_deps[t]);
+        if(n_deps[t] == 0)
+        {
+            job.queues[owner].items[job.queues[owner].tail++] = t;
+            n_ready++;
+        }
+    }
+    atomic_init(&job.remaining, n_tasks);
+    atomic_init(&job.ready, n_ready);
+    onnx_pool_push(pool, &job.base);
+
+    for(;;)
+    {
+        onnx_pool_graph_work(&job.base, owner);
+
+        pthread_mutex_lock(&pool->lock);
+        while(atomic_load(&job.remaining) > 0 && atomic_load(&job.ready) == 0)
+        {
+            pthread_cond_wait(&pool->finished, &pool->lock);
+        }
+        if(atomic_load(&job.remaining) == 0)
+        {
+            onnx_pool_retire(pool, &job.base);
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    for(int q = 0; q < job.n_queues; q++)
+    {
+        pthread_mutex_destroy(&job.queues[q].lock);
+    }
+}
+
+// Allocations by the backend's allocators, over all threads. The counter lives
+// with the pool so the run-time objects need nothing from profile.c.
+static atomic_int_fast64_t onnx_profile_allocs;
+
+void onnx_profile_count_alloc(void)
+{
+    atomic_fetch_add_explicit(&onnx_profile_allocs, 1, memory_order_relaxed);
+}
+
+int64_t onnx_profile_alloc_count(void)
+{
+    return atomic_load_explicit(&onnx_profile_allocs, memory_order_relaxed);
+}
@@ -0,0 +1,308 @@
+#include <time.h>
+
+#include "onnx.h"
+
+int64_t onnx_profile_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+onnx_profile* onnx_profile_create(void)
+{
+    onnx_profile* profile = (onnx_profile*) calloc(1, sizeof(onnx_profile));
+    if(profile != NULL)
+    {
+        profile->origin_ns = onnx_profile_now();
+    }
+    return profile;
+}
+
+void onnx_profile_free(onnx_profile* profile)
+{
+    if(profile == NULL)
+    {
+        return;
+    }
+    free(profile->nodes);
+    free(profile->events);
+    free(profile);
+}
+
+// Sessions keep node ids, so only the events go
+void onnx_profile_reset(onnx_profile* profile)
+{
+    profile->n_events = 0;
+    profile->origin_ns = onnx_profile_now();
+}
+
+int32_t onnx_profile_node_id(onnx_profile* profile, const char* name, const char* op)
+{
+    for(int32_t i = 0; i < profile->n_nodes; i++)
+    {
+        if(strncmp(profile->nodes[i].name, name, sizeof(profile->nodes[i].name) - 1) == 0 &&
+           strncmp(profile->nodes[i].op, op, sizeof(profile->nodes[i].op) - 1) == 0)
+        {
+            return i;
+        }
+    }
+    if(profile->n_nodes == profile->cap_nodes)
+    {
+        int32_t cap = profile->cap_nodes > 0 ? 2 * profile->cap_nodes : 16;
+        onnx_profile_node* nodes = (onnx_profile_node*) realloc(profile->nodes, sizeof(onnx_profile_node) * cap);
+        if(nodes == NULL)
+        {
+            return -1;
+        }
+        profile->nodes = nodes;
+        profile->cap_nodes = cap;
+    }
+    onnx_profile_node* node = &profile->nodes[profile->n_nodes];
+    memset(node, 0, sizeof(onnx_profile_node));
+    snprintf(node->name, sizeof(node->name), "%s", name);
+    snprintf(node->op, sizeof(node->op), "%s", op);
+    return profile->n_nodes++;
+}
+
+// Weighted ops read weights / out channels inputs per output. MaxPool counts
+// one compare per window element, Softmax three ops per element and the other
+// element-wise ops one; data movement counts none.
+int64_t onnx_profile_flops(Onnx__NodeProto* node, const onnx_tensor* in, const onnx_tensor* out, int64_t weights)
+{
+    const char* op = node->op_type;
+    int64_t n = onnx_tensor_numel(out);
+    if(strcmp(op, "Conv") == 0 || strcmp(op, "MatMul") == 0 || strcmp(op, "Gemm") == 0)
+    {
+        int64_t channels = out->rank > 0 ? out->dims[out->rank - 1] : 0;
+        return channels > 0 ? 2 * n * (weights / channels) : 0;
+    }
+    if(strcmp(op, "MaxPool") == 0)
+    {
+        int64_t window = 1;
+        for(size_t i = 0; i < node->n_attribute; i++)
+        {
+            if(strcmp(node->attribute[i]->name, "kernel_shape") == 0)
+            {
+                for(size_t k = 0; k < node->attribute[i]->n_ints; k++)
+                {
+                    window *= node->attribute[i]->ints[k];
+                }
+            }
+        }
+        return n * window;
+    }
+    if(strcmp(op, "Softmax") == 0)
+    {
+        return 3 * n;
+    }
+    if(strcmp(op, "Relu") == 0 || strcmp(op, "Add") == 0)
+    {
+        return n;
+    }
+    return 0;
+}
+
+int32_t onnx_profile_step_node(onnx_profile* profile, const onnx_plan_step* step)
+{
+    char ops[32];
+    onnx_plan_step_ops(step, ops, sizeof(ops));
+    int32_t id = onnx_profile_node_id(profile, step->node->name, ops);
+    if(id < 0)
+    {
+        return -1;
+    }
+
+    int64_t weights = 0;
+    if(step->weight != NULL)
+    {
+        weights = 1;
+        for(int64_t i = 0; i < step->dimW; i++)
+        {
+            weights *= step->shapeW[i];
+        }
+    }
+    int64_t in_len = onnx_tensor_numel(&step->in);
+    int64_t out_len = onnx_tensor_numel(&step->out);
+
+    // Fused ops work on the producer's output, before a fused MaxPool
+    onnx_profile_node* node = &profile->nodes[id];
+    const onnx_tensor* inner = step->pool.kernel_x > 0 ? &step->conv : &step->out;
+    node->bytes_in = sizeof(float) * (in_len + (step->input[1] >= 0 ? out_len : 0) + weights);
+    node->bytes_out = sizeof(float) * out_len;
+    node->flops = step->kernel == transpose_step ? 0 : onnx_profile_flops(step->node, &step->in, inner, weights);
+    for(int32_t f = 0; f < step->n_fused; f++)
+    {
+        const char* op = step->fused[f]->op_type;
+        node->flops += onnx_profile_flops(step->fused[f], inner, strcmp(op, "MaxPool") == 0 ? &step->out : inner, 0);
+    }
+    return id;
+}
+
+// n events at the end of the list for the caller to fill, NULL when out of
+// memory. The pointer is valid until the next reserve.
+onnx_profile_event* onnx_profile_reserve(onnx_profile* profile, int64_t n)
+{
+    if(profile->n_events + n > profile->cap_events)
+    {
+        int64_t cap = profile->cap_events > 0 ? 2 * profile->cap_events : 1024;
+        while(cap < profile->n_events + n)
+        {
+            cap *= 2;
+        }
+        onnx_profile_event* events = (onnx_profile_event*) realloc(profile->events, sizeof(onnx_profile_event) * cap);
+        if(events == NULL)
+        {
+            return NULL;
+        }
+        profile->events = events;
+        profile->cap_events = cap;
+    }
+    onnx_profile_event* events = &profile->events[profile->n_events];
+    profile->n_events += n;
+    return events;
+}
+
+void onnx_profile_begin(onnx_profile_event* event, int32_t node)
+{
+    event->node = node;
+    event->tid = onnx_pool_worker_index() + 1;
+    event->allocs = onnx_profile_alloc_count();
+    event->start_ns = onnx_profile_now();
+}
+
+void onnx_profile_end(onnx_profile_event* event)
+{
+    event->dur_ns = onnx_profile_now() - event->start_ns;
+    event->allocs = onnx_profile_alloc_count() - event->allocs;
+}
+
+static int onnx_profile_cmp(const void* a, const void* b)
+{
+    int64_t x = *(const int64_t*) a;
+    int64_t y = *(const int64_t*) b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentiles over the node's events
+int onnx_profile_summary(const onnx_profile* profile, int32_t node, onnx_profile_stats* stats)
+{
+    memset(stats, 0, sizeof(onnx_profile_stats));
+    int64_t count = 0;
+    for(int64_t e = 0; e < profile->n_events; e++)
+    {
+        count += profile->events[e].node == node;
+    }
+    if(count == 0)
+    {
+        return 0;
+    }
+
+    int64_t* durations = (int64_t*) malloc(sizeof(int64_t) * count);
+    if(durations == NULL)
+    {
+        return -1;
+    }
+    double total = 0, allocs = 0;
+    for(int64_t e = 0, i = 0; e < profile->n_events; e++)
+    {
+        if(profile->events[e].node == node)
+        {
+            durations[i++] = profile->events[e].dur_ns;
+            total += profile->events[e].dur_ns;
+            allocs += profile->events[e].allocs;
+        }
+    }
+    qsort(durations, count, sizeof(int64_t), onnx_profile_cmp);
+
+    stats->count = count;
+    stats->mean_us = total / count / 1e3;
+    stats->p50_us = durations[(count * 50 + 99) / 100 - 1] / 1e3;
+    stats->p99_us = durations[(count * 99 + 99) / 100 - 1] / 1e3;
+    stats->allocs = allocs / count;
+    free(durations);
+    return 0;
+}
+
+void onnx_profile_report(const onnx_profile* profile)
+{
+    printf("%-20s %-18s %6s %10s %10s %10s %8s %10s %10s %7s\n", "node", "op", "count", "mean us", "p50 us",
+           "p99 us", "GFLOP/s", "bytes in", "bytes out", "allocs");
+    for(int32_t i = ONNX_PROFILE_RUN; i < profile->n_nodes; i++)
+    {
+        onnx_profile_stats stats;
+        if(onnx_profile_summary(profile, i, &stats) != 0 || stats.count == 0)
+        {
+            continue;
+        }
+        if(i == ONNX_PROFILE_RUN)
+        {
+            printf("%-20s %-18s %6ld %10.2f %10.2f %10.2f\n", "(run)", "", (long) stats.count, stats.mean_us,
+                   stats.p50_us, stats.p99_us);
+            continue;
+        }
+        const onnx_profile_node* node = &profile->nodes[i];
+        double gflops = stats.mean_us > 0 ? node->flops / stats.mean_us / 1e3 : 0;
+        printf("%-20s %-18s %6ld %10.2f %10.2f %10.2f %8.2f %10ld %10ld %7.1f\n", node->name, node->op,
+               (long) stats.count, stats.mean_us, stats.p50_us, stats.p99_us, gflops, (long) node->bytes_in,
+               (long) node->bytes_out, stats.allocs);
+    }
+}
+
+static void onnx_profile_write_string(FILE* file, const char* text)
+{
+    fputc('"', file);
+    for(const char* c = text; *c != '\0'; c++)
+    {
+        if(*c == '"' || *c == '\\')
+        {
+            fprintf(file, "\\%c", *c);
+        }
+        else if((unsigned char) *c < 0x20)
+        {
+            fprintf(file, "\\u%04x", (unsigned char) *c);
+        }
+        else
+        {
+            fputc(*c, file);
+        }
+    }
+    fputc('"', file);
+}
+
+// Complete ("X") events in microseconds, one row per thread
+int onnx_profile_write_trace(const onnx_profile* profile, const char* path)
+{
+    FILE* file = fopen(path, "w");
+    if(file == NULL)
+    {
+        return -1;
+    }
+
+    fprintf(file, "{\"traceEvents\":[\n");
+    for(int64_t e = 0; e < profile->n_events; e++)
+    {
+        const onnx_profile_event* event = &profile->events[e];
+        const onnx_profile_node* node = event->node >= 0 ? &profile->nodes[event->node] : NULL;
+        fprintf(file, "{\"name\":");
+        onnx_profile_write_string(file, node != NULL ? node->name : "run");
+        fprintf(file, ",\"cat\":");
+        onnx_profile_write_string(file, node != NULL ? node->op : "run");
+        fprintf(file, ",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"allocs\":%ld",
+                event->tid, (event->start_ns - profile->origin_ns) / 1e3, event->dur_ns / 1e3, (long) event->allocs);
+        if(node != NULL)
+        {
+            fprintf(file, ",\"bytes_in\":%ld,\"bytes_out\":%ld,\"flops\":%ld", (long) node->bytes_in,
+                    (long) node->bytes_out, (long) node->flops);
+        }
+        fprintf(file, "}}%s\n", e + 1 < profile->n_events ? "," : "");
+    }
+    fprintf(file, "],\"displayTimeUnit\":\"ns\"}\n");
+
+    int status = ferror(file) ? -1 : 0;
+    if(fclose(file) != 0)
+    {
+        status = -1;
+    }
+    return status;
+}
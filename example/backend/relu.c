@@ -1,4 +1,4 @@
-#include "onnx.h"
+#include "onnx-runtime.h"
 
 void relu(const float *input, uint32_t size, float* output)
 {
@@ -11,17 +11,19 @@ void relu(const float *input, uint32_t size, float* output)
     }
 }
 
-float* relu_layer(Onnx__GraphProto* graph, const float *input, int64_t* shapeInput, int64_t* shapeOutput, const char* layer_name)
+static void relu_task(void* arg, int64_t begin, int64_t end)
 {
-    assert(graph != NULL && input != NULL && layer_name != "" );
+    const onnx_plan_step* step = ((onnx_step_task*) arg)->step;
+    float** slots = ((onnx_step_task*) arg)->slots;
 
-    int64_t len = shapeInput[0] * shapeInput[1] * shapeInput[2];
-    float* output = (float*) malloc(sizeof(float)*len);
-    memset(output, 0, sizeof(sizeof(float)*len));
-
-    relu(input, len, output);
+    onnx_kernels_active->relu(slots[step->input[0]] + begin, end - begin, slots[step->output] + begin);
+}
 
-    memcpy(shapeInput, shapeOutput, sizeof(int64_t)*3);
+void relu_step(const onnx_plan_step* step, float** slots, onnx_pool* pool)
+{
+    onnx_step_task task = { step, slots };
+    int64_t len = onnx_tensor_numel(&step->in);
 
-    return output;
+    // Memory bound: only large tensors are worth splitting
+    onnx_pool_parallel_for(pool, len, ONNX_POOL_GRAIN, relu_task, &task);
 }
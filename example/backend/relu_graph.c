@@ -0,0 +1,23 @@
+#include "onnx.h"
+
+int relu_layer(onnx_graph_index* index, const onnx_tensor* input, onnx_tensor* output, const char* layer_name)
+{
+    assert(index != NULL && input != NULL && input->data != NULL && layer_name != "" );
+
+    *output = *input;
+    if(onnx_tensor_alloc(output, NULL) != 0)
+    {
+        return -1;
+    }
+    relu((const float*) input->data, onnx_tensor_numel(input), (float*) output->data);
+
+    return 0;
+}
+
+int relu_plan(onnx_plan* plan, Onnx__NodeProto* node, onnx_plan_step* step)
+{
+    step->out = step->in;
+    step->kernel = relu_step;
+
+    return 0;
+}
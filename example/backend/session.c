@@ -0,0 +1,182 @@
+#include "onnx.h"
+
+// Per-caller state for running a compiled plan. The plan itself is only read,
+// so sessions on one plan can run on different threads at the same time.
+
+onnx_session* onnx_session_create(const onnx_plan* plan, onnx_pool* pool)
+{
+    assert(plan != NULL);
+
+    onnx_session* session = (onnx_session*) calloc(1, sizeof(onnx_session));
+    if(session == NULL)
+    {
+        return NULL;
+    }
+    session->plan = plan;
+    session->pool = pool;
+
+    // The DAG scheduler needs the layout that is safe under any step order
+    const size_t* offsets = pool == NULL ? plan->slot_offset : plan->slot_offset_dag;
+    session->arena_bytes = pool == NULL ? plan->arena_bytes : plan->arena_bytes_dag;
+    session->slots = (float**) calloc(plan->n_slots, sizeof(float*));
+    session->arena = (float*) aligned_alloc(ONNX_PLAN_ALIGN, session->arena_bytes > 0 ? session->arena_bytes : ONNX_PLAN_ALIGN);
+    if(pool != NULL)
+    {
+        session->sched = malloc(onnx_pool_graph_scratch_size(pool, plan->n_steps));
+    }
+    if(session->slots == NULL || session->arena == NULL || (pool != NULL && session->sched == NULL))
+    {
+        onnx_session_free(session);
+        return NULL;
+    }
+
+    // Kernel scratch, so that no step has to allocate it mid-run
+    for(int32_t i = 0; i < plan->n_steps; i++)
+    {
+        size_t bytes = conv2D_scratch_size(&plan->steps[i]);
+        session->scratch_bytes = bytes > session->scratch_bytes ? bytes : session->scratch_bytes;
+    }
+    if(onnx_pool_scratch_reserve(pool, session->scratch_bytes) != 0)
+    {
+        printf("Failed to reserve %zu bytes of kernel scratch per thread\n", session->scratch_bytes);
+        onnx_session_free(session);
+        return NULL;
+    }
+
+    for(int32_t s = 0; s < plan->n_slots; s++)
+    {
+        if(s != plan->input_slot)
+        {
+            session->slots[s] = (float*) ((char*) session->arena + offsets[s]);
+        }
+    }
+    return session;
+}
+
+static void onnx_session_task(void* arg, int64_t begin, int64_t end)
+{
+    onnx_session* session = (onnx_session*) arg;
+
+    for(int64_t i = begin; i < end; i++)
+    {
+        const onnx_plan_step* step = &session->plan->steps[i];
+        step->kernel(step, session->slots, session->pool);
+    }
+}
+
+// Each step fills its own event, reserved before the run
+static void onnx_session_task_profiled(void* arg, int64_t begin, int64_t end)
+{
+    onnx_session* session = (onnx_session*) arg;
+
+    for(int64_t i = begin; i < end; i++)
+    {
+        const onnx_plan_step* step = &session->plan->steps[i];
+        onnx_profile_begin(&session->events[i], session->profile_nodes[i]);
+        step->kernel(step, session->slots, session->pool);
+        onnx_profile_end(&session->events[i]);
+    }
+}
+
+static void onnx_session_run_profiled(onnx_session* session)
+{
+    const onnx_plan* plan = session->plan;
+    onnx_profile_event* run = onnx_profile_reserve(session->profile, plan->n_steps + 1);
+    if(run == NULL)
+    {
+        // Out of memory for the events: the run still happens, unrecorded
+        onnx_session_task(session, 0, plan->n_steps);
+        return;
+    }
+    session->events = run + 1;
+
+    onnx_profile_begin(run, ONNX_PROFILE_RUN);
+    if(session->pool == NULL)
+    {
+        onnx_session_task_profiled(session, 0, plan->n_steps);
+    }
+    else
+    {
+        onnx_pool_run_graph(session->pool, plan->n_steps, plan->step_deps, plan->succ_offsets, plan->succ,
+                            onnx_session_task_profiled, session, session->sched);
+    }
+    onnx_profile_end(run);
+    session->events = NULL;
+}
+
+// Node ids are resolved here so that runs only fill in events
+int onnx_session_set_profile(onnx_session* session, onnx_profile* profile)
+{
+    int32_t* nodes = NULL;
+    if(profile != NULL)
+    {
+        nodes = (int32_t*) malloc(sizeof(int32_t) * (session->plan->n_steps + 1));
+        for(int32_t i = 0; nodes != NULL && i < session->plan->n_steps; i++)
+        {
+            nodes[i] = onnx_profile_step_node(profile, &session->plan->steps[i]);
+            if(nodes[i] < 0)
+            {
+                free(nodes);
+                nodes = NULL;
+            }
+        }
+        if(nodes == NULL)
+        {
+            return -1;
+        }
+    }
+    free(session->profile_nodes);
+    session->profile_nodes = nodes;
+    session->profile = profile;
+    return 0;
+}
+
+float* onnx_session_run(onnx_session* session, const float* input)
+{
+    assert(session != NULL && input != NULL);
+    const onnx_plan* plan = session->plan;
+
+    // The caller may not be the thread the session was created on
+    if(session->scratch_bytes > 0 && onnx_pool_scratch(session->scratch_bytes) == NULL)
+    {
+        return NULL;
+    }
+
+    // Kernels only read their inputs, so the caller's buffer is bound as is
+    session->slots[plan->input_slot] = (float*) input;
+    if(session->profile != NULL)
+    {
+        onnx_session_run_profiled(session);
+    }
+    else if(session->pool == NULL)
+    {
+        for(int32_t i = 0; i < plan->n_steps; i++)
+        {
+            const onnx_plan_step* step = &plan->steps[i];
+            step->kernel(step, session->slots, NULL);
+        }
+    }
+    else
+    {
+        // Independent branches overlap; kernels split further on the same pool
+        onnx_pool_run_graph(session->pool, plan->n_steps, plan->step_deps, plan->succ_offsets, plan->succ,
+                            onnx_session_task, session, session->sched);
+    }
+    session->slots[plan->input_slot] = NULL;
+
+    // Owned by the session, valid until its next run
+    return session->slots[plan->output_slot];
+}
+
+void onnx_session_free(onnx_session* session)
+{
+    if(session == NULL)
+    {
+        return;
+    }
+    free(session->arena);
+    free(session->slots);
+    free(session->sched);
+    free(session->profile_nodes);
+    free(session);
+}
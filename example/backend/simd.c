@@ -0,0 +1,144 @@
+#include <stdlib.h>
+
+#include "onnx-runtime.h"
+
+// Scalar reference kernels and the startup dispatch. The scalar entries are
+// the plain C loops the backend always had; they run on any CPU and are what
+// the vector variants are checked against.
+
+static void scalar_gemv(const float* x, const float* w, int64_t k, int64_t n, float* y)
+{
+    for(int64_t j = 0; j < n; j++)
+    {
+        const float* row = w + j * k;
+        float acc = 0;
+        for(int64_t p = 0; p < k; p++)
+        {
+            acc += x[p] * row[p];
+        }
+        y[j] = acc;
+    }
+}
+
+static float scalar_dot(const float* a, const float* b, int64_t n)
+{
+    float acc = 0;
+    for(int64_t i = 0; i < n; i++)
+    {
+        acc += a[i] * b[i];
+    }
+    return acc;
+}
+
+static void scalar_axpy(float a, const float* x, int64_t n, float* y)
+{
+    for(int64_t i = 0; i < n; i++)
+    {
+        y[i] += a * x[i];
+    }
+}
+
+// A loop rather than relu(), whose memcpy must not run in place
+static void scalar_relu(const float* x, int64_t n, float* y)
+{
+    for(int64_t i = 0; i < n; i++)
+    {
+        y[i] = x[i] < 0 ? 0 : x[i];
+    }
+}
+
+static void scalar_add(const float* a, const float* b, int64_t n, float* y)
+{
+    add(a, b, n, y);
+}
+
+static void scalar_max(const float* a, const float* b, int64_t n, float* y)
+{
+    for(int64_t i = 0; i < n; i++)
+    {
+        y[i] = a[i] > b[i] ? a[i] : b[i];
+    }
+}
+
+static void scalar_softmax(const float* x, int64_t n, float* y)
+{
+    softmax(x, n, y);
+}
+
+static void scalar_transpose(const float* a, int64_t lda, float* b, int64_t ldb, int64_t m, int64_t n)
+{
+    for(int64_t i = 0; i < m; i++)
+    {
+        for(int64_t j = 0; j < n; j++)
+        {
+            b[j * ldb + i] = a[i * lda + j];
+        }
+    }
+}
+
+static const onnx_kernels onnx_kernels_scalar =
+{
+    "scalar",
+    sgemm_micro,
+    scalar_gemv,
+    scalar_dot,
+    scalar_axpy,
+    scalar_relu,
+    scalar_add,
+    scalar_max,
+    scalar_softmax,
+    scalar_transpose,
+};
+
+const onnx_kernels* onnx_kernels_active = &onnx_kernels_scalar;
+
+static const char* onnx_isa_names[ONNX_ISA_COUNT] = { "scalar", "avx2", "avx512" };
+
+const onnx_kernels* onnx_kernels_get(onnx_isa isa)
+{
+#ifdef ONNX_SIMD_X86
+    __builtin_cpu_init();
+    if(isa == ONNX_ISA_AVX2 && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    {
+        return &onnx_kernels_avx2;
+    }
+    if(isa == ONNX_ISA_AVX512 && __builtin_cpu_supports("avx512f"))
+    {
+        return &onnx_kernels_avx512;
+    }
+#endif
+    return isa == ONNX_ISA_SCALAR ? &onnx_kernels_scalar : NULL;
+}
+
+int onnx_kernels_use(onnx_isa isa)
+{
+    const onnx_kernels* kernels = onnx_kernels_get(isa);
+    if(kernels == NULL)
+    {
+        return -1;
+    }
+    onnx_kernels_active = kernels;
+    return 0;
+}
+
+// Picks the widest ISA the CPU supports before main runs. ONNX_ISA=scalar,
+// avx2 or avx512 caps the choice, e.g. to compare levels on one machine.
+__attribute__((constructor)) static void onnx_kernels_init(void)
+{
+    int limit = ONNX_ISA_COUNT - 1;
+    const char* env = getenv("ONNX_ISA");
+    for(int isa = 0; env != NULL && isa < ONNX_ISA_COUNT; isa++)
+    {
+        if(strcmp(env, onnx_isa_names[isa]) == 0)
+        {
+            limit = isa;
+        }
+    }
+    for(int isa = limit; isa > ONNX_ISA_SCALAR; isa--)
+    {
+        if(onnx_kernels_use((onnx_isa) isa) == 0)
+        {
+            return;
+        }
+    }
+}
@@ -0,0 +1,339 @@
+#include "onnx-runtime.h"
+
+// AVX2 + FMA kernels, 8 floats per register. Built for any x86-64 target:
+// every function carries its own target attribute and is only reached
+// through the dispatch table once cpuid reports the extensions.
+
+#ifdef ONNX_SIMD_X86
+
+#include <immintrin.h>
+
+#define AVX2 __attribute__((target("avx2,fma")))
+
+AVX2 static inline float avx2_hsum(__m256 v)
+{
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_movehdup_ps(s));
+    return _mm_cvtss_f32(s);
+}
+
+AVX2 static inline float avx2_hmax(__m256 v)
+{
+    __m128 s = _mm_max_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    s = _mm_max_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_max_ss(s, _mm_movehdup_ps(s));
+    return _mm_cvtss_f32(s);
+}
+
+// Cephes-style expf: 2^n * p(r), |r| <= ln2 / 2, about 2 ulp
+AVX2 static inline __m256 avx2_exp(__m256 x)
+{
+    x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-87.3f)), _mm256_set1_ps(88.3f));
+    __m256 n = _mm256_floor_ps(_mm256_fmadd_ps(x, _mm256_set1_ps(1.44269504f), _mm256_set1_ps(0.5f)));
+    __m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(0.693359375f), x);
+    r = _mm256_fnmadd_ps(n, _mm256_set1_ps(-2.12194440e-4f), r);
+
+    __m256 p = _mm256_set1_ps(1.9875691500e-4f);
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.3981999507e-3f));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(8.3334519073e-3f));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(4.1665795894e-2f));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.6666665459e-1f));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(5.0000001201e-1f));
+    p = _mm256_fmadd_ps(p, _mm256_mul_ps(r, r), _mm256_add_ps(r, _mm256_set1_ps(1.0f)));
+
+    __m256i e = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+    return _mm256_mul_ps(p, _mm256_castsi256_ps(e));
+}
+
+// 4 x 16 tile in eight accumulators, two B vectors per k step
+AVX2 static void avx2_sgemm_micro(int64_t kc, const float* a, const float* b, float* c, int64_t ldc, int m, int n, const float* bias, int relu)
+{
+    __m256 acc[ONNX_GEMM_MR][2];
+    for(int i = 0; i < ONNX_GEMM_MR; i++)
+    {
+        acc[i][0] = _mm256_setzero_ps();
+        acc[i][1] = _mm256_setzero_ps();
+    }
+
+    for(int64_t p = 0; p < kc; p++)
+    {
+        __m256 b0 = _mm256_loadu_ps(b + p * ONNX_GEMM_NR);
+        __m256 b1 = _mm256_loadu_ps(b + p * ONNX_GEMM_NR + 8);
+#pragma GCC unroll 4
+        for(int i = 0; i < ONNX_GEMM_MR; i++)
+        {
+            __m256 ai = _mm256_broadcast_ss(a + p * ONNX_GEMM_MR + i);
+            acc[i][0] = _mm256_fmadd_ps(ai, b0, acc[i][0]);
+            acc[i][1] = _mm256_fmadd_ps(ai, b1, acc[i][1]);
+        }
+    }
+
+    if(n == ONNX_GEMM_NR)
+    {
+        __m256 zero = _mm256_setzero_ps();
+        for(int i = 0; i < m; i++)
+        {
+            float* ci = c + i * ldc;
+            const float* base = bias != NULL ? bias : ci;
+            __m256 r0 = _mm256_add_ps(_mm256_loadu_ps(base), acc[i][0]);
+            __m256 r1 = _mm256_add_ps(_mm256_loadu_ps(base + 8), acc[i][1]);
+            _mm256_storeu_ps(ci, relu ? _mm256_max_ps(r0, zero) : r0);
+            _mm256_storeu_ps(ci + 8, relu ? _mm256_max_ps(r1, zero) : r1);
+        }
+        return;
+    }
+
+    // Edge tile: spill and finish like the scalar kernel
+    float tile[ONNX_GEMM_MR][ONNX_GEMM_NR];
+    for(int i = 0; i < m; i++)
+    {
+        _mm256_storeu_ps(tile[i], acc[i][0]);
+        _mm256_storeu_ps(tile[i] + 8, acc[i][1]);
+        float* ci = c + i * ldc;
+        for(int j = 0; j < n; j++)
+        {
+            float v = (bias != NULL ? bias[j] : ci[j]) + tile[i][j];
+            ci[j] = relu && v < 0 ? 0 : v;
+        }
+    }
+}
+
+AVX2 static float avx2_dot(const float* a, const float* b, int64_t n)
+{
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    int64_t i = 0;
+    for(; i + 16 <= n; i += 16)
+    {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+    }
+    for(; i + 8 <= n; i += 8)
+    {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+    }
+    float sum = avx2_hsum(_mm256_add_ps(acc0, acc1));
+    for(; i < n; i++)
+    {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+// Four weight rows per pass share every load of x
+AVX2 static void avx2_gemv(const float* x, const float* w, int64_t k, int64_t n, float* y)
+{
+    int64_t j = 0;
+    for(; j + 4 <= n; j += 4)
+    {
+        const float* w0 = w + j * k;
+        const float* w1 = w0 + k;
+        const float* w2 = w1 + k;
+        const float* w3 = w2 + k;
+        __m256 acc0 = _mm256_setzero_ps();
+        __m256 acc1 = _mm256_setzero_ps();
+        __m256 acc2 = _mm256_setzero_ps();
+        __m256 acc3 = _mm256_setzero_ps();
+        int64_t p = 0;
+        for(; p + 8 <= k; p += 8)
+        {
+            __m256 xv = _mm256_loadu_ps(x + p);
+            acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(w0 + p), xv, acc0);
+            acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(w1 + p), xv, acc1);
+            acc2 = _mm256_fmadd_ps(_mm256_loadu_ps(w2 + p), xv, acc2);
+            acc3 = _mm256_fmadd_ps(_mm256_loadu_ps(w3 + p), xv, acc3);
+        }
+        float s0 = avx2_hsum(acc0), s1 = avx2_hsum(acc1), s2 = avx2_hsum(acc2), s3 = avx2_hsum(acc3);
+        for(; p < k; p++)
+        {
+            s0 += x[p] * w0[p];
+            s1 += x[p] * w1[p];
+            s2 += x[p] * w2[p];
+            s3 += x[p] * w3[p];
+        }
+        y[j] = s0;
+        y[j + 1] = s1;
+        y[j + 2] = s2;
+        y[j + 3] = s3;
+    }
+    for(; j < n; j++)
+    {
+        y[j] = avx2_dot(x, w + j * k, k);
+    }
+}
+
+AVX2 static void avx2_axpy(float a, const float* x, int64_t n, float* y)
+{
+    __m256 av = _mm256_set1_ps(a);
+    int64_t i = 0;
+    for(; i + 8 <= n; i += 8)
+    {
+        _mm256_storeu_ps(y + i, _mm256_fmadd_ps(av, _mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i)));
+    }
+    for(; i < n; i++)
+    {
+        y[i] += a * x[i];
+    }
+}
+
+AVX2 static void avx2_relu(const float* x, int64_t n, float* y)
+{
+    __m256 zero = _mm256_setzero_ps();
+    int64_t i = 0;
+    for(; i + 8 <= n; i += 8)
+    {
+        _mm256_storeu_ps(y + i, _mm256_max_ps(_mm256_loadu_ps(x + i), zero));
+    }
+    for(; i < n; i++)
+    {
+        y[i] = x[i] < 0 ? 0 : x[i];
+    }
+}
+
+AVX2 static void avx2_add(const float* a, const float* b, int64_t n, float* y)
+{
+    int64_t i = 0;
+    for(; i + 8 <= n; i += 8)
+    {
+        _mm256_storeu_ps(y + i, _mm256_add_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+    }
+    for(; i < n; i++)
+    {
+        y[i] = a[i] + b[i];
+    }
+}
+
+AVX2 static void avx2_max(const float* a, const float* b, int64_t n, float* y)
+{
+    int64_t i = 0;
+    for(; i + 8 <= n; i += 8)
+    {
+        _mm256_storeu_ps(y + i, _mm256_max_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+    }
+    for(; i < n; i++)
+    {
+        y[i] = a[i] > b[i] ? a[i] : b[i];
+    }
+}
+
+AVX2 static void avx2_softmax(const float* x, int64_t n, float* y)
+{
+    __m256 mv = _mm256_set1_ps(-FLT_MAX);
+    int64_t i = 0;
+    for(; i + 8 <= n; i += 8)
+    {
+        mv = _mm256_max_ps(mv, _mm256_loadu_ps(x + i));
+    }
+    float max = avx2_hmax(mv);
+    for(; i < n; i++)
+    {
+        max = x[i] > max ? x[i] : max;
+    }
+
+    mv = _mm256_set1_ps(max);
+    __m256 sv = _mm256_setzero_ps();
+    for(i = 0; i + 8 <= n; i += 8)
+    {
+        __m256 e = avx2_exp(_mm256_sub_ps(_mm256_loadu_ps(x + i), mv));
+        _mm256_storeu_ps(y + i, e);
+        sv = _mm256_add_ps(sv, e);
+    }
+    float sum = avx2_hsum(sv);
+    for(; i < n; i++)
+    {
+        y[i] = expf(x[i] - max);
+        sum += y[i];
+    }
+
+    __m256 inv = _mm256_set1_ps(1.0f / sum);
+    for(i = 0; i + 8 <= n; i += 8)
+    {
+        _mm256_storeu_ps(y + i, _mm256_mul_ps(_mm256_loadu_ps(y + i), inv));
+    }
+    for(; i < n; i++)
+    {
+        y[i] /= sum;
+    }
+}
+
+// 8 x 8 blocks transposed in registers: unpack pairs of rows, shuffle 4 x 4
+// blocks within each 128-bit lane, then swap the lanes. Edges go scalar.
+AVX2 static void avx2_transpose(const float* a, int64_t lda, float* b, int64_t ldb, int64_t m, int64_t n)
+{
+    int64_t i = 0;
+    for(; i + 8 <= m; i += 8)
+    {
+        int64_t j = 0;
+        for(; j + 8 <= n; j += 8)
+        {
+            const float* src = a + i * lda + j;
+            __m256 r0 = _mm256_loadu_ps(src);
+            __m256 r1 = _mm256_loadu_ps(src + lda);
+            __m256 r2 = _mm256_loadu_ps(src + 2 * lda);
+            __m256 r3 = _mm256_loadu_ps(src + 3 * lda);
+            __m256 r4 = _mm256_loadu_ps(src + 4 * lda);
+            __m256 r5 = _mm256_loadu_ps(src + 5 * lda);
+            __m256 r6 = _mm256_loadu_ps(src + 6 * lda);
+            __m256 r7 = _mm256_loadu_ps(src + 7 * lda);
+
+            __m256 t0 = _mm256_unpacklo_ps(r0, r1);
+            __m256 t1 = _mm256_unpackhi_ps(r0, r1);
+            __m256 t2 = _mm256_unpacklo_ps(r2, r3);
+            __m256 t3 = _mm256_unpackhi_ps(r2, r3);
+            __m256 t4 = _mm256_unpacklo_ps(r4, r5);
+            __m256 t5 = _mm256_unpackhi_ps(r4, r5);
+            __m256 t6 = _mm256_unpacklo_ps(r6, r7);
+            __m256 t7 = _mm256_unpackhi_ps(r6, r7);
+
+            __m256 s0 = _mm256_shuffle_ps(t0, t2, 0x44);
+            __m256 s1 = _mm256_shuffle_ps(t0, t2, 0xEE);
+            __m256 s2 = _mm256_shuffle_ps(t1, t3, 0x44);
+            __m256 s3 = _mm256_shuffle_ps(t1, t3, 0xEE);
+            __m256 s4 = _mm256_shuffle_ps(t4, t6, 0x44);
+            __m256 s5 = _mm256_shuffle_ps(t4, t6, 0xEE);
+            __m256 s6 = _mm256_shuffle_ps(t5, t7, 0x44);
+            __m256 s7 = _mm256_shuffle_ps(t5, t7, 0xEE);
+
+            float* dst = b + j * ldb + i;
+            _mm256_storeu_ps(dst,           _mm256_permute2f128_ps(s0, s4, 0x20));
+            _mm256_storeu_ps(dst + ldb,     _mm256_permute2f128_ps(s1, s5, 0x20));
+            _mm256_storeu_ps(dst + 2 * ldb, _mm256_permute2f128_ps(s2, s6, 0x20));
+            _mm256_storeu_ps(dst + 3 * ldb, _mm256_permute2f128_ps(s3, s7, 0x20));
+            _mm256_storeu_ps(dst + 4 * ldb, _mm256_permute2f128_ps(s0, s4, 0x31));
+            _mm256_storeu_ps(dst + 5 * ldb, _mm256_permute2f128_ps(s1, s5, 0x31));
+            _mm256_storeu_ps(dst + 6 * ldb, _mm256_permute2f128_ps(s2, s6, 0x31));
+            _mm256_storeu_ps(dst + 7 * ldb, _mm256_permute2f128_ps(s3, s7, 0x31));
+        }
+        for(int64_t r = i; r < i + 8; r++)
+        {
+            for(int64_t c = j; c < n; c++)
+            {
+                b[c * ldb + r] = a[r * lda + c];
+            }
+        }
+    }
+    for(; i < m; i++)
+    {
+        for(int64_t c = 0; c < n; c++)
+        {
+            b[c * ldb + i] = a[i * lda + c];
+        }
+    }
+}
+
+const onnx_kernels onnx_kernels_avx2 =
+{
+    "avx2",
+    avx2_sgemm_micro,
+    avx2_gemv,
+    avx2_dot,
+    avx2_axpy,
+    avx2_relu,
+    avx2_add,
+    avx2_max,
+    avx2_softmax,
+    avx2_transpose,
+};
+
+#endif // ONNX_SIMD_X86
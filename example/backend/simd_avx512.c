@@ -0,0 +1,284 @@
+#include "onnx-runtime.h"
+
+// AVX-512F kernels, 16 floats per register. One register holds a whole NR
+// column block, and tails are handled with masked loads and stores instead
+// of scalar loops. Like the AVX2 file, only reached through the dispatch.
+
+#ifdef ONNX_SIMD_X86
+
+#include <immintrin.h>
+
+#define AVX512 __attribute__((target("avx512f")))
+
+AVX512 static inline __mmask16 avx512_tail(int64_t n)
+{
+    return (__mmask16) ((1u << n) - 1);
+}
+
+AVX512 static inline __m512 avx512_exp(__m512 x)
+{
+    x = _mm512_min_ps(_mm512_max_ps(x, _mm512_set1_ps(-87.3f)), _mm512_set1_ps(88.3f));
+    __m512 n = _mm512_roundscale_ps(_mm512_fmadd_ps(x, _mm512_set1_ps(1.44269504f), _mm512_set1_ps(0.5f)),
+                                    _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+    __m512 r = _mm512_fnmadd_ps(n, _mm512_set1_ps(0.693359375f), x);
+    r = _mm512_fnmadd_ps(n, _mm512_set1_ps(-2.12194440e-4f), r);
+
+    __m512 p = _mm512_set1_ps(1.9875691500e-4f);
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(1.3981999507e-3f));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(8.3334519073e-3f));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(4.1665795894e-2f));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(1.6666665459e-1f));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(5.0000001201e-1f));
+    p = _mm512_fmadd_ps(p, _mm512_mul_ps(r, r), _mm512_add_ps(r, _mm512_set1_ps(1.0f)));
+
+    // p * 2^n without building the exponent bits by hand
+    return _mm512_scalef_ps(p, n);
+}
+
+// 4 x 16 tile: four accumulators per k step are too few to hide the FMA
+// latency, so even and odd k steps go to separate sets and are summed last
+AVX512 static void avx512_sgemm_micro(int64_t kc, const float* a, const float* b, float* c, int64_t ldc, int m, int n, const float* bias, int relu)
+{
+    __m512 acc0[ONNX_GEMM_MR];
+    __m512 acc1[ONNX_GEMM_MR];
+    for(int i = 0; i < ONNX_GEMM_MR; i++)
+    {
+        acc0[i] = _mm512_setzero_ps();
+        acc1[i] = _mm512_setzero_ps();
+    }
+
+    int64_t p = 0;
+    for(; p + 2 <= kc; p += 2)
+    {
+        __m512 b0 = _mm512_loadu_ps(b + p * ONNX_GEMM_NR);
+        __m512 b1 = _mm512_loadu_ps(b + (p + 1) * ONNX_GEMM_NR);
+#pragma GCC unroll 4
+        for(int i = 0; i < ONNX_GEMM_MR; i++)
+        {
+            acc0[i] = _mm512_fmadd_ps(_mm512_set1_ps(a[p * ONNX_GEMM_MR + i]), b0, acc0[i]);
+            acc1[i] = _mm512_fmadd_ps(_mm512_set1_ps(a[(p + 1) * ONNX_GEMM_MR + i]), b1, acc1[i]);
+        }
+    }
+    if(p < kc)
+    {
+        __m512 b0 = _mm512_loadu_ps(b + p * ONNX_GEMM_NR);
+        for(int i = 0; i < ONNX_GEMM_MR; i++)
+        {
+            acc0[i] = _mm512_fmadd_ps(_mm512_set1_ps(a[p * ONNX_GEMM_MR + i]), b0, acc0[i]);
+        }
+    }
+
+    __mmask16 mask = avx512_tail(n);
+    for(int i = 0; i < m; i++)
+    {
+        float* ci = c + i * ldc;
+        __m512 base = _mm512_maskz_loadu_ps(mask, bias != NULL ? bias : ci);
+        __m512 r = _mm512_add_ps(base, _mm512_add_ps(acc0[i], acc1[i]));
+        _mm512_mask_storeu_ps(ci, mask, relu ? _mm512_max_ps(r, _mm512_setzero_ps()) : r);
+    }
+}
+
+AVX512 static float avx512_dot(const float* a, const float* b, int64_t n)
+{
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    int64_t i = 0;
+    for(; i + 32 <= n; i += 32)
+    {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), acc1);
+    }
+    for(; i < n; i += 16)
+    {
+        __mmask16 mask = avx512_tail(n - i < 16 ? n - i : 16);
+        acc0 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i), acc0);
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+}
+
+// Four weight rows per pass share every load of x
+AVX512 static void avx512_gemv(const float* x, const float* w, int64_t k, int64_t n, float* y)
+{
+    int64_t j = 0;
+    for(; j + 4 <= n; j += 4)
+    {
+        const float* w0 = w + j * k;
+        const float* w1 = w0 + k;
+        const float* w2 = w1 + k;
+        const float* w3 = w2 + k;
+        __m512 acc0 = _mm512_setzero_ps();
+        __m512 acc1 = _mm512_setzero_ps();
+        __m512 acc2 = _mm512_setzero_ps();
+        __m512 acc3 = _mm512_setzero_ps();
+        for(int64_t p = 0; p < k; p += 16)
+        {
+            __mmask16 mask = avx512_tail(k - p < 16 ? k - p : 16);
+            __m512 xv = _mm512_maskz_loadu_ps(mask, x + p);
+            acc0 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, w0 + p), xv, acc0);
+            acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, w1 + p), xv, acc1);
+            acc2 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, w2 + p), xv, acc2);
+            acc3 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, w3 + p), xv, acc3);
+        }
+        y[j] = _mm512_reduce_add_ps(acc0);
+        y[j + 1] = _mm512_reduce_add_ps(acc1);
+        y[j + 2] = _mm512_reduce_add_ps(acc2);
+        y[j + 3] = _mm512_reduce_add_ps(acc3);
+    }
+    for(; j < n; j++)
+    {
+        y[j] = avx512_dot(x, w + j * k, k);
+    }
+}
+
+AVX512 static void avx512_axpy(float a, const float* x, int64_t n, float* y)
+{
+    __m512 av = _mm512_set1_ps(a);
+    for(int64_t i = 0; i < n; i += 16)
+    {
+        __mmask16 mask = avx512_tail(n - i < 16 ? n - i : 16);
+        __m512 r = _mm512_fmadd_ps(av, _mm512_maskz_loadu_ps(mask, x + i), _mm512_maskz_loadu_ps(mask, y + i));
+        _mm512_mask_storeu_ps(y + i, mask, r);
+    }
+}
+
+AVX512 static void avx512_relu(const float* x, int64_t n, float* y)
+{
+    __m512 zero = _mm512_setzero_ps();
+    for(int64_t i = 0; i < n; i += 16)
+    {
+        __mmask16 mask = avx512_tail(n - i < 16 ? n - i : 16);
+        _mm512_mask_storeu_ps(y + i, mask, _mm512_max_ps(_mm512_maskz_loadu_ps(mask, x + i), zero));
+    }
+}
+
+AVX512 static void avx512_add(const float* a, const float* b, int64_t n, float* y)
+{
+    for(int64_t i = 0; i < n; i += 16)
+    {
+        __mmask16 mask = avx512_tail(n - i < 16 ? n - i : 16);
+        __m512 r = _mm512_add_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i));
+        _mm512_mask_storeu_ps(y + i, mask, r);
+    }
+}
+
+AVX512 static void avx512_max(const float* a, const float* b, int64_t n, float* y)
+{
+    for(int64_t i = 0; i < n; i += 16)
+    {
+        __mmask16 mask = avx512_tail(n - i < 16 ? n - i : 16);
+        __m512 r = _mm512_max_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i));
+        _mm512_mask_storeu_ps(y + i, mask, r);
+    }
+}
+
+AVX512 static void avx512_softmax(const float* x, int64_t n, float* y)
+{
+    __m512 mv = _mm512_set1_ps(-FLT_MAX);
+    for(int64_t i = 0; i < n; i += 16)
+    {
+        __mmask16 mask = avx512_tail(n - i < 16 ? n - i : 16);
+        mv = _mm512_mask_max_ps(mv, mask, mv, _mm512_maskz_loadu_ps(mask, x + i));
+    }
+    mv = _mm512_set1_ps(_mm512_reduce_max_ps(mv));
+
+    __m512 sv = _mm512_setzero_ps();
+    for(int64_t i = 0; i < n; i += 16)
+    {
+        __mmask16 mask = avx512_tail(n - i < 16 ? n - i : 16);
+        __m512 e = avx512_exp(_mm512_sub_ps(_mm512_maskz_loadu_ps(mask, x + i), mv));
+        _mm512_mask_storeu_ps(y + i, mask, e);
+        sv = _mm512_mask_add_ps(sv, mask, sv, e);
+    }
+
+    __m512 inv = _mm512_set1_ps(1.0f / _mm512_reduce_add_ps(sv));
+    for(int64_t i = 0; i < n; i += 16)
+    {
+        __mmask16 mask = avx512_tail(n - i < 16 ? n - i : 16);
+        _mm512_mask_storeu_ps(y + i, mask, _mm512_mul_ps(_mm512_maskz_loadu_ps(mask, y + i), inv));
+    }
+}
+
+// 16 x 16 block in registers: 4 x 4 transposes within each 128-bit lane,
+// then two rounds of lane shuffles. Missing rows load as zeros and only the
+// valid part of each column is stored.
+AVX512 static inline void avx512_transpose_block(const float* a, int64_t lda, float* b, int64_t ldb, int64_t m, int64_t n)
+{
+    __mmask16 load = avx512_tail(n);
+    __mmask16 store = avx512_tail(m);
+    __m512 r[16];
+#pragma GCC unroll 16
+    for(int k = 0; k < 16; k++)
+    {
+        r[k] = k < m ? _mm512_maskz_loadu_ps(load, a + k * lda) : _mm512_setzero_ps();
+    }
+
+    __m512 t[16];
+#pragma GCC unroll 8
+    for(int k = 0; k < 16; k += 2)
+    {
+        t[k] = _mm512_unpacklo_ps(r[k], r[k + 1]);
+        t[k + 1] = _mm512_unpackhi_ps(r[k], r[k + 1]);
+    }
+    // u[4q + c] holds column c of each lane's 4 x 4 block, rows 4q..4q+3
+    __m512 u[16];
+#pragma GCC unroll 4
+    for(int k = 0; k < 16; k += 4)
+    {
+        u[k] = _mm512_shuffle_ps(t[k], t[k + 2], 0x44);
+        u[k + 1] = _mm512_shuffle_ps(t[k], t[k + 2], 0xEE);
+        u[k + 2] = _mm512_shuffle_ps(t[k + 1], t[k + 3], 0x44);
+        u[k + 3] = _mm512_shuffle_ps(t[k + 1], t[k + 3], 0xEE);
+    }
+#pragma GCC unroll 4
+    for(int c = 0; c < 4; c++)
+    {
+        __m512 even0 = _mm512_shuffle_f32x4(u[c], u[4 + c], 0x88);
+        __m512 odd0 = _mm512_shuffle_f32x4(u[c], u[4 + c], 0xDD);
+        __m512 even1 = _mm512_shuffle_f32x4(u[8 + c], u[12 + c], 0x88);
+        __m512 odd1 = _mm512_shuffle_f32x4(u[8 + c], u[12 + c], 0xDD);
+        if(c < n)
+        {
+            _mm512_mask_storeu_ps(b + c * ldb, store, _mm512_shuffle_f32x4(even0, even1, 0x88));
+        }
+        if(4 + c < n)
+        {
+            _mm512_mask_storeu_ps(b + (4 + c) * ldb, store, _mm512_shuffle_f32x4(odd0, odd1, 0x88));
+        }
+        if(8 + c < n)
+        {
+            _mm512_mask_storeu_ps(b + (8 + c) * ldb, store, _mm512_shuffle_f32x4(even0, even1, 0xDD));
+        }
+        if(12 + c < n)
+        {
+            _mm512_mask_storeu_ps(b + (12 + c) * ldb, store, _mm512_shuffle_f32x4(odd0, odd1, 0xDD));
+        }
+    }
+}
+
+AVX512 static void avx512_transpose(const float* a, int64_t lda, float* b, int64_t ldb, int64_t m, int64_t n)
+{
+    for(int64_t i = 0; i < m; i += 16)
+    {
+        for(int64_t j = 0; j < n; j += 16)
+        {
+            avx512_transpose_block(a + i * lda + j, lda, b + j * ldb + i, ldb,
+                                   m - i < 16 ? m - i : 16, n - j < 16 ? n - j : 16);
+        }
+    }
+}
+
+const onnx_kernels onnx_kernels_avx512 =
+{
+    "avx512",
+    avx512_sgemm_micro,
+    avx512_gemv,
+    avx512_dot,
+    avx512_axpy,
+    avx512_relu,
+    avx512_add,
+    avx512_max,
+    avx512_softmax,
+    avx512_transpose,
+};
+
+#endif // ONNX_SIMD_X86
@@ -1,12 +1,18 @@
-#include "onnx.h"
+#include "onnx-runtime.h"
 
 void softmax(const float *input, const uint32_t dim_vec, float *output)
 {
     float sum = 0.0f;
+    float max = -FLT_MAX;
 
+    // Shifting by the max keeps expf finite for large logits
     for(int i = 0; i < dim_vec; i++)
     {
-        output[i] = expf(input[i]);
+        max = input[i] > max ? input[i] : max;
+    }
+    for(int i = 0; i < dim_vec; i++)
+    {
+        output[i] = expf(input[i] - max);
         sum = sum + output[i];
     }
 
@@ -16,15 +22,23 @@ void softmax(const float *input, const uint32_t dim_vec, float *output)
     }
 }
 
-float* softmax_layer(Onnx__GraphProto* graph, const float *input, int64_t* shapeInput, int64_t* shapeOutput, const char* layer_name)
+// Items are samples
+static void softmax_task(void* arg, int64_t begin, int64_t end)
 {
-    assert(graph != NULL && input != NULL && layer_name != "" && shapeInput[1] > 0);
+    const onnx_plan_step* step = ((onnx_step_task*) arg)->step;
+    float** slots = ((onnx_step_task*) arg)->slots;
+    int64_t len = onnx_tensor_sample(&step->in);
 
-    float* output = (float*) malloc(sizeof(float)*shapeInput[1]);
-    memset(output, 0, sizeof(sizeof(float)*shapeInput[1]));
-    softmax(input, shapeInput[1], output);
+    for(int64_t b = begin; b < end; b++)
+    {
+        onnx_kernels_active->softmax(slots[step->input[0]] + b * len, len, slots[step->output] + b * len);
+    }
+}
 
-    memcpy(shapeInput, shapeOutput, sizeof(int64_t)*3);
+void softmax_step(const onnx_plan_step* step, float** slots, onnx_pool* pool)
+{
+    onnx_step_task task = { step, slots };
+    int64_t len = onnx_tensor_sample(&step->in);
 
-    return output;
+    onnx_pool_parallel_for(pool, step->in.dims[0], ONNX_POOL_GRAIN / len + 1, softmax_task, &task);
 }
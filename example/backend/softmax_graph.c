@@ -0,0 +1,28 @@
+#include "onnx.h"
+
+// Over the features of each sample
+int softmax_layer(onnx_graph_index* index, const onnx_tensor* input, onnx_tensor* output, const char* layer_name)
+{
+    assert(index != NULL && input != NULL && input->data != NULL && layer_name != "" );
+
+    int64_t len = onnx_tensor_sample(input);
+    *output = *input;
+    if(len < 1 || onnx_tensor_alloc(output, NULL) != 0)
+    {
+        return -1;
+    }
+    for(int64_t b = 0; b < input->dims[0]; b++)
+    {
+        softmax((const float*) input->data + b * len, len, (float*) output->data + b * len);
+    }
+
+    return 0;
+}
+
+int softmax_plan(onnx_plan* plan, Onnx__NodeProto* node, onnx_plan_step* step)
+{
+    step->out = step->in;
+    step->kernel = softmax_step;
+
+    return 0;
+}
@@ -0,0 +1,199 @@
+#include "onnx-runtime.h"
+
+// Row-major strides of dense data
+void onnx_tensor_dense(onnx_tensor* t)
+{
+    int64_t stride = 1;
+    for(int32_t i = t->rank - 1; i >= 0; i--)
+    {
+        t->strides[i] = stride;
+        stride *= t->dims[i];
+    }
+}
+
+// A view shares the data and never owns it
+void onnx_tensor_view_of(const onnx_tensor* t, onnx_tensor* view)
+{
+    if(view != t)
+    {
+        *view = *t;
+    }
+    view->arena = NULL;
+    view->owned = 0;
+}
+
+int64_t onnx_tensor_numel(const onnx_tensor* t)
+{
+    int64_t n = 1;
+    for(int32_t i = 0; i < t->rank; i++)
+    {
+        n *= t->dims[i];
+    }
+    return n;
+}
+
+int64_t onnx_tensor_sample(const onnx_tensor* t)
+{
+    int64_t n = 1;
+    for(int32_t i = 1; i < t->rank; i++)
+    {
+        n *= t->dims[i];
+    }
+    return n;
+}
+
+// Axes of size 1 may have any stride
+int onnx_tensor_is_contiguous(const onnx_tensor* t)
+{
+    int64_t stride = 1;
+    for(int32_t i = t->rank - 1; i >= 0; i--)
+    {
+        if(t->dims[i] != 1 && t->strides[i] != stride)
+        {
+            return 0;
+        }
+        stride *= t->dims[i];
+    }
+    return 1;
+}
+
+int onnx_tensor_same_shape(const onnx_tensor* a, const onnx_tensor* b)
+{
+    return a->rank == b->rank && memcmp(a->dims, b->dims, sizeof(int64_t) * a->rank) == 0;
+}
+
+int onnx_tensor_reshape(const onnx_tensor* t, int32_t rank, const int64_t* dims, onnx_tensor* view)
+{
+    if(rank < 0 || rank > ONNX_TENSOR_MAX_DIM || !onnx_tensor_is_contiguous(t))
+    {
+        return -1;
+    }
+
+    int64_t shape[ONNX_TENSOR_MAX_DIM];
+    int64_t known = 1;
+    int32_t infer = -1;
+    for(int32_t i = 0; i < rank; i++)
+    {
+        shape[i] = dims[i];
+        if(dims[i] == -1 && infer < 0)
+        {
+            infer = i;
+        }
+        else if(dims[i] < 0)
+        {
+            return -1;
+        }
+        else
+        {
+            known *= dims[i];
+        }
+    }
+    int64_t n = onnx_tensor_numel(t);
+    if(infer >= 0)
+    {
+        if(known == 0 || n % known != 0)
+        {
+            return -1;
+        }
+        shape[infer] = n / known;
+        known = n;
+    }
+    if(known != n)
+    {
+        return -1;
+    }
+
+    onnx_tensor_view_of(t, view);
+    view->rank = rank;
+    memcpy(view->dims, shape, sizeof(int64_t) * rank);
+    onnx_tensor_dense(view);
+    return 0;
+}
+
+// [d0 ... d(axis-1), d(axis) ... d(rank-1)] --> [d0 * ... * d(axis-1), d(axis) * ... * d(rank-1)]
+int onnx_tensor_flatten(const onnx_tensor* t, int32_t axis, onnx_tensor* view)
+{
+    if(axis < 0 || axis > t->rank)
+    {
+        return -1;
+    }
+    int64_t dims[2] = { 1, 1 };
+    for(int32_t i = 0; i < t->rank; i++)
+    {
+        dims[i < axis ? 0 : 1] *= t->dims[i];
+    }
+    return onnx_tensor_reshape(t, 2, dims, view);
+}
+
+// Axis i of the view is axis perm[i] of t
+int onnx_tensor_permute(const onnx_tensor* t, const int64_t* perm, onnx_tensor* view)
+{
+    int seen[ONNX_TENSOR_MAX_DIM] = { 0 };
+    onnx_tensor src = *t;
+    for(int32_t i = 0; i < t->rank; i++)
+    {
+        if(perm[i] < 0 || perm[i] >= t->rank || seen[perm[i]]++)
+        {
+            return -1;
+        }
+    }
+    onnx_tensor_view_of(t, view);
+    for(int32_t i = 0; i < t->rank; i++)
+    {
+        view->dims[i] = src.dims[perm[i]];
+        view->strides[i] = src.strides[perm[i]];
+    }
+    return 0;
+}
+
+// Numpy rules: the dims are aligned at the end and axes of size 1 repeat
+int onnx_tensor_broadcast(const onnx_tensor* t, int32_t rank, const int64_t* dims, onnx_tensor* view)
+{
+    if(rank < t->rank || rank > ONNX_TENSOR_MAX_DIM)
+    {
+        return -1;
+    }
+    onnx_tensor src = *t;
+    int32_t lead = rank - t->rank;
+    for(int32_t i = 0; i < t->rank; i++)
+    {
+        if(src.dims[i] != dims[lead + i] && src.dims[i] != 1)
+        {
+            return -1;
+        }
+    }
+
+    onnx_tensor_view_of(t, view);
+    view->rank = rank;
+    for(int32_t i = 0; i < rank; i++)
+    {
+        int repeat = i < lead || src.dims[i - lead] != dims[i];
+        view->dims[i] = dims[i];
+        view->strides[i] = repeat ? 0 : src.strides[i - lead];
+    }
+    return 0;
+}
+
+void onnx_tensor_format_dims(const onnx_tensor* t, char* text, size_t size)
+{
+    int len = snprintf(text, size, "[");
+    for(int32_t i = 0; i < t->rank && len < (int) size; i++)
+    {
+        len += snprintf(text + len, size - len, i > 0 ? ", %2ld" : "%2ld", (long) t->dims[i]);
+    }
+    if(len < (int) size)
+    {
+        snprintf(text + len, size - len, "]");
+    }
+}
+
+// Float views only; dst must be dense and of the same shape
+int onnx_tensor_copy(const onnx_tensor* src, onnx_tensor* dst)
+{
+    if(src->dtype != ONNX_TENSOR_FLOAT || dst->dtype != ONNX_TENSOR_FLOAT ||
+       !onnx_tensor_same_shape(src, dst) || !onnx_tensor_is_contiguous(dst) || src->data == NULL || dst->data == NULL)
+    {
+        return -1;
+    }
+    return onnx_strided_copy(src, (float*) dst->data);
+}
@@ -0,0 +1,101 @@
+#include "onnx.h"
+
+int onnx_tensor_init(onnx_tensor* t, Onnx__TensorProto__DataType dtype, int32_t rank, const int64_t* dims, void* data)
+{
+    memset(t, 0, sizeof(onnx_tensor));
+    if(rank < 0 || rank > ONNX_TENSOR_MAX_DIM || onnx_tensor_data_type_size(dtype) == 0)
+    {
+        return -1;
+    }
+    t->dtype = dtype;
+    t->rank = rank;
+    for(int32_t i = 0; i < rank; i++)
+    {
+        if(dims[i] < 0)
+        {
+            return -1;
+        }
+        t->dims[i] = dims[i];
+    }
+    onnx_tensor_dense(t);
+    t->data = data;
+    return 0;
+}
+
+// The initializer's data is borrowed, not copied
+int onnx_tensor_from_view(const onnx_tensor_view* view, onnx_tensor* t)
+{
+    if(view->n_dims > ONNX_TENSOR_MAX_DIM)
+    {
+        return -1;
+    }
+    return onnx_tensor_init(t, view->data_type, (int32_t) view->n_dims, view->dims, (void*) view->data);
+}
+
+// Dense data for the dims, zeroed, with ONNX_PLAN_ALIGN on the heap
+int onnx_tensor_alloc(onnx_tensor* t, onnx_arena* arena)
+{
+    t->data = NULL;
+    t->arena = NULL;
+    t->owned = 0;
+
+    size_t bytes = onnx_tensor_data_type_size(t->dtype) * (size_t) onnx_tensor_numel(t);
+    bytes = (bytes + ONNX_PLAN_ALIGN - 1) / ONNX_PLAN_ALIGN * ONNX_PLAN_ALIGN;
+    void* data = arena != NULL ? onnx_arena_alloc(arena, bytes) : aligned_alloc(ONNX_PLAN_ALIGN, bytes > 0 ? bytes : ONNX_PLAN_ALIGN);
+    if(data == NULL)
+    {
+        return -1;
+    }
+    onnx_profile_count_alloc();
+    memset(data, 0, bytes);
+    onnx_tensor_dense(t);
+    t->data = data;
+    t->arena = arena;
+    t->owned = 1;
+    return 0;
+}
+
+// Arena data goes with its arena
+void onnx_tensor_release(onnx_tensor* t)
+{
+    if(t->owned && t->arena == NULL)
+    {
+        free(t->data);
+    }
+    t->data = NULL;
+    t->arena = NULL;
+    t->owned = 0;
+}
+
+// ONNX Slice on one axis: negative bounds count from the end and are clamped
+int onnx_tensor_slice(const onnx_tensor* t, int32_t axis, int64_t start, int64_t end, int64_t step, onnx_tensor* view)
+{
+    if(axis < 0 || axis >= t->rank || step == 0)
+    {
+        return -1;
+    }
+    int64_t dim = t->dims[axis];
+    start = start < 0 ? start + dim : start;
+    end = end < 0 ? end + dim : end;
+    if(step > 0)
+    {
+        start = start < 0 ? 0 : start > dim ? dim : start;
+        end = end < 0 ? 0 : end > dim ? dim : end;
+    }
+    else
+    {
+        start = start < 0 ? -1 : start > dim - 1 ? dim - 1 : start;
+        end = end < -1 ? -1 : end > dim - 1 ? dim - 1 : end;
+    }
+    int64_t count = step > 0 ? (end - start + step - 1) / step : (start - end - step - 1) / -step;
+    count = count > 0 ? count : 0;
+
+    onnx_tensor_view_of(t, view);
+    if(count > 0 && view->data != NULL)
+    {
+        view->data = (char*) view->data + start * t->strides[axis] * (int64_t) onnx_tensor_data_type_size(t->dtype);
+    }
+    view->dims[axis] = count;
+    view->strides[axis] = t->strides[axis] * step;
+    return 0;
+}
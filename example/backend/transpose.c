@@ -1,100 +1,270 @@
-#include "onnx.h"
+#include "onnx-runtime.h"
 
-float* transpose(const float* A, int64_t* shape, int64_t dim, int64_t* perm)
+// A view with unit axes dropped and axes that are contiguous in both layouts
+// merged, plus the strides of the dense result
+typedef struct transpose_shape
 {
-    // Get array size
-    int elem = 1;
-    for(int i = 0; i < dim; i++)
+    int     dim;
+    int64_t shape[ONNX_TRANSPOSE_MAX_DIM];
+    int64_t src[ONNX_TRANSPOSE_MAX_DIM];
+    int64_t dst[ONNX_TRANSPOSE_MAX_DIM];
+} transpose_shape;
+
+typedef enum transpose_kind
+{
+    TRANSPOSE_COPY,     // inner axis contiguous on both sides
+    TRANSPOSE_BLOCKED,  // contiguous on each side along a different axis
+    TRANSPOSE_GATHER,   // no contiguous source axis (a view of a view)
+} transpose_kind;
+
+// The innermost plane, repeated over the outer axes
+typedef struct transpose_plane
+{
+    transpose_kind kind;
+    int64_t m, n;       // rows and columns of the source plane
+    int64_t lda, ldb;
+    const onnx_kernels* kernels;
+} transpose_plane;
+
+static void transpose_simplify(const onnx_tensor* view, transpose_shape* t)
+{
+    t->dim = 0;
+    for(int32_t i = 0; i < view->rank; i++)
     {
-        elem = elem * shape[i];
+        if(view->dims[i] == 1)
+        {
+            continue;
+        }
+        if(t->dim > 0 && t->src[t->dim - 1] == view->strides[i] * view->dims[i])
+        {
+            t->shape[t->dim - 1] *= view->dims[i];
+            t->src[t->dim - 1] = view->strides[i];
+            continue;
+        }
+        t->shape[t->dim] = view->dims[i];
+        t->src[t->dim] = view->strides[i];
+        t->dim++;
     }
 
-    // Malloc memory for B
-    float* B = malloc(sizeof(float) * elem);
-    if(B == NULL)
+    int64_t stride = 1;
+    for(int i = t->dim - 1; i >= 0; i--)
     {
-        return NULL;
+        t->dst[i] = stride;
+        stride *= t->shape[i];
     }
+}
 
-    // Malloc memory for shapeB
-    int* shapeB = malloc(sizeof(int) * dim);
-    if( shapeB == NULL)
+static void transpose_run_plane(const transpose_plane* p, const float* a, float* b)
+{
+    switch(p->kind)
     {
-        return NULL;
+    case TRANSPOSE_COPY:
+        memcpy(b, a, sizeof(float) * p->n);
+        break;
+    case TRANSPOSE_GATHER:
+        for(int64_t j = 0; j < p->n; j++)
+        {
+            b[j] = a[j * p->lda];
+        }
+        break;
+    case TRANSPOSE_BLOCKED:
+        // TILE x TILE blocks keep both the rows read and the rows written in L1
+        for(int64_t i = 0; i < p->m; i += ONNX_TRANSPOSE_TILE)
+        {
+            int64_t m = p->m - i < ONNX_TRANSPOSE_TILE ? p->m - i : ONNX_TRANSPOSE_TILE;
+            for(int64_t j = 0; j < p->n; j += ONNX_TRANSPOSE_TILE)
+            {
+                int64_t n = p->n - j < ONNX_TRANSPOSE_TILE ? p->n - j : ONNX_TRANSPOSE_TILE;
+                p->kernels->transpose(a + i * p->lda + j, p->lda, b + j * p->ldb + i, p->ldb, m, n);
+            }
+        }
+        break;
     }
-    for(int i = 0; i < dim; i++)
+}
+
+int transpose_view(const float* A, const int64_t* shape, int64_t dim, const int64_t* perm, onnx_tensor* view)
+{
+    if(dim < 1 || dim > ONNX_TRANSPOSE_MAX_DIM)
     {
-        shapeB[i] = shape[perm[i]];
+        printf("Transpose of %ld axes is not supported\n", (long) dim);
+        return -1;
     }
 
-    // Transpose
-    for(int src = 0; src < elem; src++)
+    onnx_tensor dense = { .dtype = ONNX_TENSOR_FLOAT, .rank = (int32_t) dim, .data = (void*) A };
+    for(int64_t i = 0; i < dim; i++)
     {
-        // Get transposed B array
-        // A[1][0][3] -> B[3][1][0]
-        int temp = src;
-        int* indexA = malloc(sizeof(int) * dim);
-        if(indexA == NULL)
+        if(shape[i] < 0)
         {
-            return NULL;
+            printf("Invalid transpose shape\n");
+            return -1;
         }
-        int* indexB = malloc(sizeof(int) * dim);
-        if(indexB == NULL)
+        dense.dims[i] = shape[i];
+    }
+    onnx_tensor_dense(&dense);
+    if(onnx_tensor_permute(&dense, perm, view) != 0)
+    {
+        printf("Invalid transpose permutation\n");
+        return -1;
+    }
+    return 0;
+}
+
+int onnx_strided_copy(const onnx_tensor* view, float* B)
+{
+    for(int32_t i = 0; i < view->rank; i++)
+    {
+        if(view->dims[i] == 0)
         {
-            return NULL;
+            return 0;
         }
-        for(int i = dim-1; i >= 0; i--)
+    }
+
+    transpose_shape t;
+    transpose_simplify(view, &t);
+    if(t.dim == 0)
+    {
+        B[0] = *(const float*) view->data;
+        return 0;
+    }
+
+    // Pick the plane; every other axis is an outer loop
+    int inner = t.dim - 1;
+    int k = inner;
+    transpose_plane plane = { TRANSPOSE_COPY, 1, t.shape[inner], t.src[inner], 1, onnx_kernels_active };
+    if(t.src[inner] != 1)
+    {
+        plane.kind = TRANSPOSE_GATHER;
+        for(int i = 0; i < inner; i++)
         {
-            indexA[i] = temp % shape[i];
-            temp = temp / shape[i];
+            if(t.src[i] == 1)
+            {
+                k = i;
+                plane.kind = TRANSPOSE_BLOCKED;
+                plane.m = t.shape[inner];
+                plane.n = t.shape[k];
+                plane.ldb = t.dst[k];
+                break;
+            }
         }
-        for(int i = 0; i < dim; i++)
+    }
+    // A plane only a few elements thick (NCHW <-> NHWC with 3 channels)
+    // leaves register blocks mostly empty
+    if(plane.m < 8 || plane.n < 8)
+    {
+        plane.kernels = onnx_kernels_get(ONNX_ISA_SCALAR);
+    }
+
+    int n_outer = 0;
+    int64_t shape[ONNX_TRANSPOSE_MAX_DIM], src[ONNX_TRANSPOSE_MAX_DIM], dst[ONNX_TRANSPOSE_MAX_DIM];
+    for(int i = 0; i < inner; i++)
+    {
+        if(i != k)
         {
-            indexB[i] = indexA[perm[i]];
+            shape[n_outer] = t.shape[i];
+            src[n_outer] = t.src[i];
+            dst[n_outer] = t.dst[i];
+            n_outer++;
         }
+    }
 
-        // Get transposed B index 
-        // #15 A[1][0][3] -> B[3][1][0] #21
-        int dst = 0;
-        temp = 1;
-        for(int i = dim - 1; i >= 0; i--)
+    const float* a = (const float*) view->data;
+    float* b = B;
+    switch(n_outer)
+    {
+    case 0:
+        transpose_run_plane(&plane, a, b);
+        return 0;
+    case 1:
+        for(int64_t x = 0; x < shape[0]; x++)
         {
-            dst = dst + indexB[i] * temp;
-            temp = temp * shapeB[i];
+            transpose_run_plane(&plane, a + x * src[0], b + x * dst[0]);
         }
-
-        B[dst] = A[src];
-
-        free(indexA);
-        free(indexB);
+        return 0;
+    case 2:
+        for(int64_t x = 0; x < shape[0]; x++)
+        {
+            for(int64_t y = 0; y < shape[1]; y++)
+            {
+                transpose_run_plane(&plane, a + x * src[0] + y * src[1], b + x * dst[0] + y * dst[1]);
+            }
+        }
+        return 0;
     }
 
-    free(shapeB);
+    // Generic: odometer over the outer axes, moving both pointers by stride
+    int64_t index[ONNX_TRANSPOSE_MAX_DIM] = { 0 };
+    for(;;)
+    {
+        transpose_run_plane(&plane, a, b);
+        int i = n_outer - 1;
+        for(; i >= 0; i--)
+        {
+            a += src[i];
+            b += dst[i];
+            if(++index[i] < shape[i])
+            {
+                break;
+            }
+            a -= src[i] * shape[i];
+            b -= dst[i] * shape[i];
+            index[i] = 0;
+        }
+        if(i < 0)
+        {
+            return 0;
+        }
+    }
+}
 
-    return B;
+int transpose_into(const float* A, const int64_t* shape, int64_t dim, const int64_t* perm, float* B)
+{
+    onnx_tensor view;
+    if(transpose_view(A, shape, dim, perm, &view) != 0)
+    {
+        return -1;
+    }
+    return onnx_strided_copy(&view, B);
 }
 
-float* transpose_layer(Onnx__GraphProto* graph, const float *input, int64_t* shapeInput, int64_t* shapeOutput, const char* layer_name)
+float* transpose(const float* A, const int64_t* shape, int64_t dim, const int64_t* perm)
 {
-    assert(graph != NULL && input != NULL && layer_name != "" );
+    int64_t elem = 1;
+    for(int64_t i = 0; i < dim; i++)
+    {
+        elem = elem * shape[i];
+    }
 
-    Onnx__NodeProto* node = onnx_graph_get_node_by_name(graph, layer_name);
-    if(node == NULL)
+    float* B = malloc(sizeof(float) * (elem > 0 ? elem : 1));
+    if(B == NULL)
+    {
+        return NULL;
+    }
+    onnx_profile_count_alloc();
+    if(transpose_into(A, shape, dim, perm, B) != 0)
     {
+        free(B);
         return NULL;
     }
+    return B;
+}
 
-    int64_t perm_t[3];
-    int64_t* perm = node->attribute[0]->ints;
-    perm_t[0] = perm[1] - 1;
-    perm_t[1] = perm[2] - 1;
-    perm_t[2] = perm[3] - 1;
+// Items are samples
+static void transpose_task(void* arg, int64_t begin, int64_t end)
+{
+    const onnx_plan_step* step = ((onnx_step_task*) arg)->step;
+    float** slots = ((onnx_step_task*) arg)->slots;
+    int64_t len = onnx_tensor_sample(&step->out);
 
-    float* output = transpose(input, shapeInput, 3, perm_t);
+    for(int64_t b = begin; b < end; b++)
+    {
+        transpose_into(slots[step->input[0]] + b * len, step->shapeW, step->dimW, step->perm, slots[step->output] + b * len);
+    }
+}
 
-    shapeOutput[0] = shapeInput[perm_t[0]];
-    shapeOutput[1] = shapeInput[perm_t[1]];
-    shapeOutput[2] = shapeInput[perm_t[2]];
+void transpose_step(const onnx_plan_step* step, float** slots, onnx_pool* pool)
+{
+    onnx_step_task task = { step, slots };
+    int64_t len = onnx_tensor_sample(&step->out);
 
-    return output;
+    onnx_pool_parallel_for(pool, step->out.dims[0], ONNX_POOL_GRAIN / len + 1, transpose_task, &task);
 }
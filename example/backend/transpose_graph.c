@@ -0,0 +1,28 @@
+#include "onnx.h"
+
+// Moves the data: perm applies to the tensor as stored and must keep the batch first
+int transpose_layer(onnx_graph_index* index, const onnx_tensor* input, onnx_tensor* output, const char* layer_name)
+{
+    assert(index != NULL && input != NULL && input->data != NULL && layer_name != "" );
+
+    Onnx__NodeProto* node = onnx_graph_index_get_node_by_name(index, layer_name);
+    if(node == NULL || node->n_attribute < 1 || node->attribute[0]->n_ints != (size_t) input->rank ||
+       node->attribute[0]->ints[0] != 0)
+    {
+        return -1;
+    }
+
+    onnx_tensor view;
+    if(onnx_tensor_permute(input, node->attribute[0]->ints, &view) != 0)
+    {
+        return -1;
+    }
+    *output = view;
+    if(onnx_tensor_alloc(output, NULL) != 0 || onnx_tensor_copy(&view, output) != 0)
+    {
+        onnx_tensor_release(output);
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,302 @@
+#include "onnx-runtime.h"
+
+// Winograd convolution F(m x m, 3 x 3) for 3x3 stride-1 layers, m = 2 or 4.
+//
+// Every m x m output tile comes from an (m + 2) x (m + 2) input patch:
+//
+//   Y = A^T [ (G g G^T) . (B^T d B) ] A
+//
+// The filter transform U = G g G^T is done once per plan and packed, per
+// patch position xi, as sgemm_pack_b panels of C_in x C_out. At run time a
+// block of tiles has its patches transformed (V = B^T d B), then each of the
+// alpha^2 positions is one GEMM, tiles x C_in times C_in x C_out, on the
+// same microkernel as the im2col path. The output transform adds the bias.
+// F(2x2) does 16 multiplies per tile and channel pair instead of 36, F(4x4)
+// does 36 instead of 144.
+
+static const float winograd_bt_2[4 * 4] = {
+    1,  0, -1,  0,
+    0,  1,  1,  0,
+    0, -1,  1,  0,
+    0,  1,  0, -1,
+};
+
+static const float winograd_g_2[4 * 3] = {
+    1.0f,  0.0f, 0.0f,
+    0.5f,  0.5f, 0.5f,
+    0.5f, -0.5f, 0.5f,
+    0.0f,  0.0f, 1.0f,
+};
+
+static const float winograd_at_2[2 * 4] = {
+    1, 1,  1,  0,
+    0, 1, -1, -1,
+};
+
+static const float winograd_bt_4[6 * 6] = {
+    4,  0, -5,  0, 1, 0,
+    0, -4, -4,  1, 1, 0,
+    0,  4, -4, -1, 1, 0,
+    0, -2, -1,  2, 1, 0,
+    0,  2, -1, -2, 1, 0,
+    0,  4,  0, -5, 0, 1,
+};
+
+static const float winograd_g_4[6 * 3] = {
+     1.0f / 4,   0.0f,        0.0f,
+    -1.0f / 6,  -1.0f / 6,   -1.0f / 6,
+    -1.0f / 6,   1.0f / 6,   -1.0f / 6,
+     1.0f / 24,  1.0f / 12,   1.0f / 6,
+     1.0f / 24, -1.0f / 12,   1.0f / 6,
+     0.0f,       0.0f,        1.0f,
+};
+
+static const float winograd_at_4[4 * 6] = {
+    1, 1,  1, 1,  1, 0,
+    0, 1, -1, 2, -2, 0,
+    0, 1,  1, 4,  4, 0,
+    0, 1, -1, 8, -8, 1,
+};
+
+// Zero bias: the first K block of every GEMM overwrites instead of adding
+static const float winograd_zeros[ONNX_GEMM_NR];
+
+int64_t winograd_pack_size(int64_t n, int64_t c, int tile)
+{
+    int64_t alpha = tile + 2;
+    return alpha * alpha * sgemm_pack_size(n, c);
+}
+
+// filters: OIHW, n x c x 3 x 3
+int winograd_pack_filters(const float* filters, int64_t n, int64_t c, int tile, float* packed)
+{
+    const float* g = tile == 2 ? winograd_g_2 : winograd_g_4;
+    int alpha = tile + 2;
+    int64_t stride = sgemm_pack_size(n, c);
+
+    float* u = (float*) malloc(sizeof(float) * alpha * alpha * n * c);
+    if(u == NULL)
+    {
+        return -1;
+    }
+
+    // u[xi] holds one row of c weights per filter, as sgemm_pack_b expects
+    for(int64_t o = 0; o < n; o++)
+    {
+        for(int64_t i = 0; i < c; i++)
+        {
+            const float* f = filters + (o * c + i) * 9;
+            float t[6][3];
+            for(int r = 0; r < alpha; r++)
+            {
+                for(int s = 0; s < 3; s++)
+                {
+                    t[r][s] = g[r * 3] * f[s] + g[r * 3 + 1] * f[3 + s] + g[r * 3 + 2] * f[6 + s];
+                }
+            }
+            for(int r = 0; r < alpha; r++)
+            {
+                for(int s = 0; s < alpha; s++)
+                {
+                    float v = t[r][0] * g[s * 3] + t[r][1] * g[s * 3 + 1] + t[r][2] * g[s * 3 + 2];
+                    u[((int64_t)(r * alpha + s) * n + o) * c + i] = v;
+                }
+            }
+        }
+    }
+    for(int xi = 0; xi < alpha * alpha; xi++)
+    {
+        sgemm_pack_b(u + (int64_t) xi * n * c, n, c, packed + xi * stride);
+    }
+    free(u);
+    return 0;
+}
+
+size_t winograd_scratch_size(int64_t ch_in, int64_t ch_out, int tile)
+{
+    int64_t alpha = tile + 2;
+    int64_t kc = ch_in < ONNX_GEMM_KC ? ch_in : ONNX_GEMM_KC;
+    int64_t wide = kc > ch_out ? kc : ch_out;
+
+    // V panels, M results, patch and half-transformed rows
+    return sizeof(float) * alpha * alpha * (ONNX_WINOGRAD_TILES * (kc + ch_out) + 2 * wide);
+}
+
+// out[r][s][*] = sum_a sum_b t[r][a] d[a][b][*] t[s][b], vectorized over the
+// channel run of len floats. d is rows x rows, out is cols x cols and may be d.
+static void winograd_transform(const onnx_kernels* kernels, const float* t, int cols, int rows, const float* d,
+                               float* tmp, float* out, int64_t len)
+{
+    for(int r = 0; r < cols; r++)
+    {
+        for(int b = 0; b < rows; b++)
+        {
+            float* dst = tmp + (r * rows + b) * len;
+            memset(dst, 0, sizeof(float) * len);
+            for(int a = 0; a < rows; a++)
+            {
+                float w = t[r * rows + a];
+                if(w == 0.0f)
+                {
+                    continue;
+                }
+                kernels->axpy(w, d + (a * rows + b) * len, len, dst);
+            }
+        }
+    }
+    for(int r = 0; r < cols; r++)
+    {
+        for(int s = 0; s < cols; s++)
+        {
+            float* dst = out + (r * cols + s) * len;
+            memset(dst, 0, sizeof(float) * len);
+            for(int b = 0; b < rows; b++)
+            {
+                float w = t[s * rows + b];
+                if(w == 0.0f)
+                {
+                    continue;
+                }
+                kernels->axpy(w, tmp + (r * rows + b) * len, len, dst);
+            }
+        }
+    }
+}
+
+// Output tile rows [tile_y_begin, tile_y_end) of a 3x3 stride-1 conv. u comes
+// from winograd_pack_filters, scratch holds winograd_scratch_size bytes. Runs
+// on the active SIMD kernels.
+void winograd_conv_rows(const float *input,
+                        const int64_t dim_im_in_x,
+                        const int64_t dim_im_in_y,
+                        const int64_t ch_im_in,
+                        const float *u,
+                        const int64_t ch_im_out,
+                        const int tile,
+                        const int64_t padding_x,
+                        const int64_t padding_y,
+                        const float *bias,
+                        float *output,
+                        const int64_t dim_im_out_x,
+                        const int64_t dim_im_out_y,
+                        const int64_t tile_y_begin,
+                        const int64_t tile_y_end,
+                        const int relu,
+                        float *scratch)
+{
+    const onnx_kernels* kernels = onnx_kernels_active;
+    const float* bt = tile == 2 ? winograd_bt_2 : winograd_bt_4;
+    const float* at = tile == 2 ? winograd_at_2 : winograd_at_4;
+    int alpha = tile + 2;
+    int n_xi = alpha * alpha;
+    int64_t kc_max = ch_im_in < ONNX_GEMM_KC ? ch_im_in : ONNX_GEMM_KC;
+    int64_t wide = kc_max > ch_im_out ? kc_max : ch_im_out;
+    int64_t u_stride = sgemm_pack_size(ch_im_out, ch_im_in);
+    int64_t tiles_x = (dim_im_out_x + tile - 1) / tile;
+    int64_t t_begin = (int64_t) tile_y_begin * tiles_x;
+    int64_t t_end = (int64_t) tile_y_end * tiles_x;
+
+    float* v = scratch;
+    float* m = v + (int64_t) n_xi * ONNX_WINOGRAD_TILES * kc_max;
+    float* patch = m + (int64_t) n_xi * ONNX_WINOGRAD_TILES * ch_im_out;
+    float* tmp = patch + (int64_t) n_xi * wide;
+
+    for(int64_t t0 = t_begin; t0 < t_end; t0 += ONNX_WINOGRAD_TILES)
+    {
+        int64_t mc = t_end - t0 < ONNX_WINOGRAD_TILES ? t_end - t0 : ONNX_WINOGRAD_TILES;
+        int64_t m_pad = (mc + ONNX_GEMM_MR - 1) / ONNX_GEMM_MR * ONNX_GEMM_MR;
+
+        for(int64_t k0 = 0; k0 < ch_im_in; k0 += ONNX_GEMM_KC)
+        {
+            int64_t kc = ch_im_in - k0 < ONNX_GEMM_KC ? ch_im_in - k0 : ONNX_GEMM_KC;
+
+            // V = B^T d B per tile, scattered into MR-row panels, one matrix per xi
+            for(int64_t i = 0; i < m_pad; i++)
+            {
+                if(i < mc)
+                {
+                    int64_t y0 = (t0 + i) / tiles_x * tile - padding_y;
+                    int64_t x0 = (t0 + i) % tiles_x * tile - padding_x;
+                    for(int a = 0; a < alpha; a++)
+                    {
+                        for(int b = 0; b < alpha; b++)
+                        {
+                            float* dst = patch + (a * alpha + b) * kc;
+                            int64_t row = y0 + a;
+                            int64_t col = x0 + b;
+                            if(row >= 0 && col >= 0 && row < dim_im_in_y && col < dim_im_in_x)
+                            {
+                                memcpy(dst, input + (row * dim_im_in_x + col) * ch_im_in + k0, sizeof(float) * kc);
+                            }
+                            else
+                            {
+                                memset(dst, 0, sizeof(float) * kc);
+                            }
+                        }
+                    }
+                    winograd_transform(kernels, bt, alpha, alpha, patch, tmp, patch, kc);
+                }
+                else
+                {
+                    memset(patch, 0, sizeof(float) * n_xi * kc);
+                }
+
+                float* dst = v + (i / ONNX_GEMM_MR) * ONNX_GEMM_MR * kc + i % ONNX_GEMM_MR;
+                for(int xi = 0; xi < n_xi; xi++)
+                {
+                    const float* src = patch + xi * kc;
+                    float* panel = dst + xi * m_pad * kc;
+                    for(int64_t c = 0; c < kc; c++)
+                    {
+                        panel[c * ONNX_GEMM_MR] = src[c];
+                    }
+                }
+            }
+
+            // alpha^2 independent GEMMs, each V panel block stays in cache
+            for(int xi = 0; xi < n_xi; xi++)
+            {
+                const float* a = v + xi * m_pad * kc;
+                float* c = m + (int64_t) xi * ONNX_WINOGRAD_TILES * ch_im_out;
+                for(int64_t j0 = 0; j0 < ch_im_out; j0 += ONNX_GEMM_NR)
+                {
+                    int n = ch_im_out - j0 < ONNX_GEMM_NR ? ch_im_out - j0 : ONNX_GEMM_NR;
+                    const float* b = u + xi * u_stride + j0 * ch_im_in + k0 * ONNX_GEMM_NR;
+                    for(int64_t i0 = 0; i0 < mc; i0 += ONNX_GEMM_MR)
+                    {
+                        int rows = mc - i0 < ONNX_GEMM_MR ? mc - i0 : ONNX_GEMM_MR;
+                        kernels->sgemm_micro(kc, a + i0 * kc, b, c + i0 * ch_im_out + j0, ch_im_out,
+                                    rows, n, k0 == 0 ? winograd_zeros : NULL, 0);
+                    }
+                }
+            }
+        }
+
+        // Y = A^T M A per tile, plus bias and the fused relu, clipped at the image border
+        for(int64_t i = 0; i < mc; i++)
+        {
+            for(int xi = 0; xi < n_xi; xi++)
+            {
+                memcpy(patch + xi * ch_im_out, m + ((int64_t) xi * ONNX_WINOGRAD_TILES + i) * ch_im_out,
+                       sizeof(float) * ch_im_out);
+            }
+            winograd_transform(kernels, at, tile, alpha, patch, tmp, patch, ch_im_out);
+
+            int64_t y0 = (t0 + i) / tiles_x * tile;
+            int64_t x0 = (t0 + i) % tiles_x * tile;
+            for(int r = 0; r < tile && y0 + r < dim_im_out_y; r++)
+            {
+                for(int s = 0; s < tile && x0 + s < dim_im_out_x; s++)
+                {
+                    const float* src = patch + (r * tile + s) * ch_im_out;
+                    float* dst = output + ((y0 + r) * dim_im_out_x + x0 + s) * ch_im_out;
+                    kernels->add(src, bias, ch_im_out, dst);
+                    if(relu)
+                    {
+                        kernels->relu(dst, ch_im_out, dst);
+                    }
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,45 @@
+#include <stdlib.h>
+#include <time.h>
+
+#include "bench/bench.h"
+
+double bench_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+float* bench_random(int64_t len)
+{
+    float* data = (float*) malloc(sizeof(float) * len);
+    for(int64_t i = 0; i < len; i++)
+    {
+        data[i] = (float) rand() / RAND_MAX - 0.5f;
+    }
+    return data;
+}
+
+int bench_list(const char* text, int* values, int max)
+{
+    int n = 0;
+    char* end;
+    while(n < max && *text != '\0')
+    {
+        long v = strtol(text, &end, 10);
+        if(end == text || v <= 0)
+        {
+            return -1;
+        }
+        values[n++] = (int) v;
+        text = *end == ',' ? end + 1 : end;
+    }
+    return n;
+}
+
+int bench_cmp(const void* a, const void* b)
+{
+    double x = *(const double*) a;
+    double y = *(const double*) b;
+    return (x > y) - (x < y);
+}
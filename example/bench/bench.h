@@ -0,0 +1,13 @@
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include <stdint.h>
+
+// Helpers shared by the benchmarks and by the tests that time or feed kernels
+
+double bench_now_ms(void);                                  // monotonic clock
+float* bench_random(int64_t len);                           // uniform in [-0.5, 0.5), to free
+int    bench_list(const char* text, int* values, int max);  // "1,8,64" --> { 1, 8, 64 }, -1 if malformed
+int    bench_cmp(const void* a, const void* b);             // qsort order of doubles
+
+#endif
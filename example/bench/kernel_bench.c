@@ -0,0 +1,515 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "bench/bench.h"
+#include "onnx.h"
+
+// Kernel microbenchmarks: each plan step kernel on a sweep of realistic
+// shapes, checked against the scalar reference functions (conv2D, maxpool,
+// matmul, softmax and a per-element transpose) and timed in isolation. The
+// calling thread and the pool workers are pinned to cpus 0 .. threads - 1.
+// After warmup, runs are batched so one sample lasts at least
+// BENCH_SAMPLE_MS, and samples are taken until min ms have passed; ns/op is
+// the median sample. One row per case goes to stdout as CSV or JSON:
+//
+//   kernel, variant, shape, isa, threads, iters, ns/op, min ns/op, GFLOP/s,
+//   GB/s (activations in and out plus weights), max rel err, ok
+//
+//   usage: onnx-kernels [csv|json] [threads] [min ms per case] [kernel]
+//
+// Exits with 1 when any kernel differs from its reference.
+
+#define BENCH_WARMUP 3
+#define BENCH_SAMPLE_MS 0.05
+#define BENCH_MIN_SAMPLES 5
+#define BENCH_MAX_SAMPLES 1000
+#define BENCH_TOLERANCE 1e-4    // largest difference, relative to the largest reference value
+
+typedef struct bench_case bench_case;
+typedef void (*bench_reference)(const bench_case* c, const float* input, float* output);
+
+struct bench_case
+{
+    const char* kernel;
+    const char* variant;
+    char shape[48];
+    onnx_plan_step step;
+    bench_reference reference;
+    float* ohwi;                // conv filters for the reference
+    int64_t in_len;             // whole batch
+    int64_t out_len;
+    double flops;
+    double bytes;
+    double tolerance;
+};
+
+typedef struct bench_result
+{
+    int64_t iters;
+    double ns;                  // median per op
+    double ns_min;
+    double err;
+} bench_result;
+
+static double bench_diff(const float* reference, const float* output, int64_t len)
+{
+    double diff = 0;
+    double scale = 1e-30;
+    for(int64_t i = 0; i < len; i++)
+    {
+        double d = fabs(reference[i] - output[i]);
+        diff = d > diff ? d : diff;
+        scale = fabs(reference[i]) > scale ? fabs(reference[i]) : scale;
+    }
+    return diff / scale;
+}
+
+static void bench_pin(pthread_t thread, int cpu)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(thread, sizeof(set), &set);
+#endif
+}
+
+// References, one sample at a time
+
+static void bench_conv_reference(const bench_case* c, const float* input, float* output)
+{
+    const onnx_plan_step* s = &c->step;
+    int64_t in_len = onnx_tensor_sample(&s->in);
+    int64_t out_len = onnx_tensor_sample(&s->out);
+    for(int64_t b = 0; b < s->in.dims[ONNX_N]; b++)
+    {
+        conv2D(input + b * in_len, s->in.dims[ONNX_W], s->in.dims[ONNX_H], s->in.dims[ONNX_C], c->ohwi,
+               s->out.dims[ONNX_C], s->attr.kernel_x, s->attr.kernel_y, s->attr.padding_x, s->attr.padding_y,
+               s->attr.stride_x, s->attr.stride_y, s->bias, output + b * out_len, s->out.dims[ONNX_W], s->out.dims[ONNX_H]);
+    }
+}
+
+static void bench_maxpool_reference(const bench_case* c, const float* input, float* output)
+{
+    const onnx_plan_step* s = &c->step;
+    int64_t in_len = onnx_tensor_sample(&s->in);
+    int64_t out_len = onnx_tensor_sample(&s->out);
+    for(int64_t b = 0; b < s->in.dims[ONNX_N]; b++)
+    {
+        maxpool(input + b * in_len, s->in.dims[ONNX_W], s->in.dims[ONNX_H], s->in.dims[ONNX_C], s->attr.kernel_x,
+                s->attr.kernel_y, s->attr.padding_x, s->attr.padding_y, s->attr.stride_x, s->attr.stride_y,
+                s->out.dims[ONNX_W], s->out.dims[ONNX_H], output + b * out_len);
+    }
+}
+
+static void bench_matmul_reference(const bench_case* c, const float* input, float* output)
+{
+    const onnx_plan_step* s = &c->step;
+    matmul(input, s->weight, s->shapeW[0], s->shapeW[1], s->in.dims[0], output);
+}
+
+static void bench_softmax_reference(const bench_case* c, const float* input, float* output)
+{
+    int64_t len = onnx_tensor_sample(&c->step.in);
+    for(int64_t b = 0; b < c->step.in.dims[0]; b++)
+    {
+        softmax(input + b * len, len, output + b * len);
+    }
+}
+
+// Output element by element, source index from the permuted strides
+static void bench_transpose_reference(const bench_case* c, const float* input, float* output)
+{
+    const onnx_plan_step* s = &c->step;
+    int64_t stride[ONNX_TRANSPOSE_MAX_DIM];
+    int64_t len = 1;
+    for(int64_t a = s->dimW - 1; a >= 0; a--)
+    {
+        stride[a] = len;
+        len *= s->shapeW[a];
+    }
+    for(int64_t b = 0; b < s->in.dims[0]; b++)
+    {
+        for(int64_t i = 0; i < len; i++)
+        {
+            int64_t rest = i;
+            int64_t src = 0;
+            for(int64_t a = s->dimW - 1; a >= 0; a--)
+            {
+                int64_t n = s->shapeW[s->perm[a]];
+                src += (rest % n) * stride[s->perm[a]];
+                rest /= n;
+            }
+            output[b * len + i] = input[b * len + src];
+        }
+    }
+}
+
+// Sweeps
+
+static bench_case* bench_add(bench_case* cases, int* n, const char* kernel, const char* variant)
+{
+    bench_case* c = &cases[(*n)++];
+    memset(c, 0, sizeof(bench_case));
+    c->kernel = kernel;
+    c->variant = variant;
+    c->tolerance = BENCH_TOLERANCE;
+    c->step.input[0] = 0;
+    c->step.input[1] = -1;
+    c->step.output = 1;
+    return c;
+}
+
+static void bench_tensors(bench_case* c, int32_t rank, const int64_t* in, const int64_t* out)
+{
+    onnx_tensor_init(&c->step.in, ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT, rank, in, NULL);
+    onnx_tensor_init(&c->step.out, ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT, rank, out, NULL);
+    c->in_len = onnx_tensor_numel(&c->step.in);
+    c->out_len = onnx_tensor_numel(&c->step.out);
+    c->bytes = sizeof(float) * (c->in_len + c->out_len);
+}
+
+typedef struct bench_conv
+{
+    int64_t batch, in, ch_in, ch_out, kernel, stride, padding;
+    const char* variants;       // d: direct, g: gemm, 2/4: Winograd tile
+} bench_conv;
+
+static const bench_conv bench_convs[] = {
+    { 1,  28,   1,   8, 5, 1, 2, "d" },       // mnist first layer
+    { 8,  14,   8,  16, 3, 1, 1, "dg2" },
+    { 1,  56,  64,  64, 3, 1, 1, "dg24" },    // resnet stage 1
+    { 1,  28, 128, 128, 3, 1, 1, "g24" },
+    { 1,  56, 128, 128, 3, 2, 1, "g" },       // strided, Winograd does not apply
+    { 1,  14, 512, 512, 1, 1, 0, "dg" },      // mobilenet pointwise
+};
+
+static void bench_conv_cases(bench_case* cases, int* n)
+{
+    for(size_t i = 0; i < sizeof(bench_convs) / sizeof(bench_convs[0]); i++)
+    {
+        const bench_conv* v = &bench_convs[i];
+        int64_t out = (v->in + 2 * v->padding - v->kernel) / v->stride + 1;
+        int64_t k = v->kernel * v->kernel * v->ch_in;
+        int64_t shapeW[] = { v->ch_out, v->ch_in, v->kernel, v->kernel };
+        int64_t perm[] = { 0, 2, 3, 1 };
+        float* oihw = bench_random(v->ch_out * k);
+        float* ohwi = transpose(oihw, shapeW, 4, perm);
+        float* bias = bench_random(v->ch_out);
+
+        for(const char* p = v->variants; *p != '\0'; p++)
+        {
+            bench_case* c = bench_add(cases, n, "conv2D", *p == 'd' ? "direct" : *p == 'g' ? "gemm" :
+                                                         *p == '2' ? "winograd 2" : "winograd 4");
+            int64_t in[] = { v->batch, v->in, v->in, v->ch_in };
+            int64_t dims[] = { v->batch, out, out, v->ch_out };
+            bench_tensors(c, 4, in, dims);
+            snprintf(c->shape, sizeof(c->shape), "%ldx%ldx%ldx%ld>%ld k%ld s%ld", (long) v->batch, (long) v->in,
+                     (long) v->in, (long) v->ch_in, (long) v->ch_out, (long) v->kernel, (long) v->stride);
+            c->step.attr.kernel_x = c->step.attr.kernel_y = v->kernel;
+            c->step.attr.stride_x = c->step.attr.stride_y = v->stride;
+            c->step.attr.padding_x = c->step.attr.padding_y = v->padding;
+            c->step.shapeW[0] = v->ch_out;
+            c->step.shapeW[1] = v->ch_in;
+            c->step.shapeW[2] = c->step.shapeW[3] = v->kernel;
+            c->step.dimW = 4;
+            c->step.bias = bias;
+            c->ohwi = ohwi;
+            c->reference = bench_conv_reference;
+            c->flops = 2.0 * c->out_len * k;
+            c->bytes += sizeof(float) * v->ch_out * k;
+
+            float* weight;
+            if(*p == 'd')
+            {
+                c->step.kernel = conv2D_step;
+                weight = (float*) malloc(sizeof(float) * v->ch_out * k);
+                memcpy(weight, ohwi, sizeof(float) * v->ch_out * k);
+            }
+            else if(*p == 'g')
+            {
+                c->step.kernel = conv2D_gemm_step;
+                weight = (float*) malloc(sizeof(float) * sgemm_pack_size(v->ch_out, k));
+                sgemm_pack_b(ohwi, v->ch_out, k, weight);
+            }
+            else
+            {
+                int tile = *p - '0';
+                c->step.kernel = conv2D_winograd_step;
+                c->step.attr.tile = tile;
+                c->tolerance = tile == 4 ? 1e-3 : BENCH_TOLERANCE;
+                weight = (float*) malloc(sizeof(float) * winograd_pack_size(v->ch_out, v->ch_in, tile));
+                winograd_pack_filters(oihw, v->ch_out, v->ch_in, tile, weight);
+            }
+            c->step.weight = weight;
+        }
+        free(oihw);
+    }
+}
+
+typedef struct bench_window
+{
+    int64_t batch, in, ch, kernel, stride, padding;
+} bench_window;
+
+static const bench_window bench_pools[] = {
+    {  1, 112,  64, 2, 2, 0 },
+    {  1,  56, 256, 3, 2, 1 },                // resnet stem
+    { 32,  28,   8, 2, 2, 0 },                // mnist, batched
+};
+
+static void bench_maxpool_cases(bench_case* cases, int* n)
+{
+    for(size_t i = 0; i < sizeof(bench_pools) / sizeof(bench_pools[0]); i++)
+    {
+        const bench_window* v = &bench_pools[i];
+        int64_t out = (v->in + 2 * v->padding - v->kernel) / v->stride + 1;
+        bench_case* c = bench_add(cases, n, "maxpool", "nhwc");
+        int64_t in[] = { v->batch, v->in, v->in, v->ch };
+        int64_t dims[] = { v->batch, out, out, v->ch };
+        bench_tensors(c, 4, in, dims);
+        snprintf(c->shape, sizeof(c->shape), "%ldx%ldx%ldx%ld k%ld s%ld", (long) v->batch, (long) v->in,
+                 (long) v->in, (long) v->ch, (long) v->kernel, (long) v->stride);
+        c->step.kernel = maxpool_step;
+        c->step.attr.kernel_x = c->step.attr.kernel_y = v->kernel;
+        c->step.attr.stride_x = c->step.attr.stride_y = v->stride;
+        c->step.attr.padding_x = c->step.attr.padding_y = v->padding;
+        c->reference = bench_maxpool_reference;
+        c->flops = (double) c->out_len * v->kernel * v->kernel;
+    }
+}
+
+static const int64_t bench_matmuls[][3] = {
+    {   1, 1024, 1024 },                      // GEMV
+    {  32, 1024, 1024 },
+    { 256,  784,  128 },                      // MLP on mnist
+    {   1, 9216, 4096 },                      // weight bound
+};
+
+static void bench_matmul_cases(bench_case* cases, int* n)
+{
+    for(size_t i = 0; i < sizeof(bench_matmuls) / sizeof(bench_matmuls[0]); i++)
+    {
+        int64_t batch = bench_matmuls[i][0], k = bench_matmuls[i][1], m = bench_matmuls[i][2];
+        bench_case* c = bench_add(cases, n, "matmul", batch == 1 ? "gemv" : "gemm");
+        int64_t in[] = { batch, k };
+        int64_t dims[] = { batch, m };
+        bench_tensors(c, 2, in, dims);
+        snprintf(c->shape, sizeof(c->shape), "%ldx%ld>%ld", (long) batch, (long) k, (long) m);
+        c->step.kernel = matmul_step;
+        c->step.shapeW[0] = k;
+        c->step.shapeW[1] = m;
+        c->step.dimW = 2;
+        c->step.weight = bench_random(k * m);
+        c->reference = bench_matmul_reference;
+        c->flops = 2.0 * batch * k * m;
+        c->bytes += sizeof(float) * k * m;
+    }
+}
+
+typedef struct bench_perm
+{
+    int64_t dim;
+    int64_t shape[4];
+    int64_t perm[4];
+    const char* variant;
+} bench_perm;
+
+static const bench_perm bench_perms[] = {
+    { 2, { 1024, 1024 },     { 1, 0 },       "2d" },
+    { 3, { 64, 56, 56 },     { 1, 2, 0 },    "nchw>nhwc" },
+    { 3, { 56, 56, 64 },     { 2, 0, 1 },    "nhwc>nchw" },
+    { 3, { 3, 224, 224 },    { 1, 2, 0 },    "nchw>nhwc" },
+    { 4, { 8, 16, 32, 24 },  { 3, 1, 0, 2 }, "4d" },
+};
+
+static void bench_transpose_cases(bench_case* cases, int* n)
+{
+    for(size_t i = 0; i < sizeof(bench_perms) / sizeof(bench_perms[0]); i++)
+    {
+        const bench_perm* v = &bench_perms[i];
+        bench_case* c = bench_add(cases, n, "transpose", v->variant);
+        int64_t in[ONNX_TRANSPOSE_MAX_DIM + 1] = { 1 };
+        int64_t out[ONNX_TRANSPOSE_MAX_DIM + 1] = { 1 };
+        int len = snprintf(c->shape, sizeof(c->shape), "1");
+        for(int64_t a = 0; a < v->dim; a++)
+        {
+            in[a + 1] = v->shape[a];
+            out[a + 1] = v->shape[v->perm[a]];
+            len += snprintf(c->shape + len, sizeof(c->shape) - len, "x%ld", (long) v->shape[a]);
+        }
+        bench_tensors(c, (int32_t) v->dim + 1, in, out);
+        c->step.kernel = transpose_step;
+        c->step.dimW = v->dim;
+        memcpy(c->step.shapeW, v->shape, sizeof(int64_t) * v->dim);
+        memcpy(c->step.perm, v->perm, sizeof(int64_t) * v->dim);
+        c->reference = bench_transpose_reference;
+    }
+}
+
+static const int64_t bench_softmaxes[][2] = {
+    {   1,    10 },                           // mnist classes
+    { 256,  1000 },
+    {  32, 32000 },                           // vocabulary
+};
+
+static void bench_softmax_cases(bench_case* cases, int* n)
+{
+    for(size_t i = 0; i < sizeof(bench_softmaxes) / sizeof(bench_softmaxes[0]); i++)
+    {
+        bench_case* c = bench_add(cases, n, "softmax", "rows");
+        int64_t dims[] = { bench_softmaxes[i][0], bench_softmaxes[i][1] };
+        bench_tensors(c, 2, dims, dims);
+        snprintf(c->shape, sizeof(c->shape), "%ldx%ld", (long) dims[0], (long) dims[1]);
+        c->step.kernel = softmax_step;
+        c->reference = bench_softmax_reference;
+        c->flops = 3.0 * c->out_len;
+    }
+}
+
+// Median of samples of batched runs; the first runs warm caches and the pool
+static void bench_run(bench_case* c, float** slots, onnx_pool* pool, double min_ms, bench_result* result)
+{
+    for(int i = 0; i < BENCH_WARMUP; i++)
+    {
+        c->step.kernel(&c->step, slots, pool);
+    }
+
+    int64_t batch = 1;
+    for(;;)
+    {
+        double start = bench_now_ms();
+        for(int64_t i = 0; i < batch; i++)
+        {
+            c->step.kernel(&c->step, slots, pool);
+        }
+        if(bench_now_ms() - start >= BENCH_SAMPLE_MS)
+        {
+            break;
+        }
+        batch *= 2;
+    }
+
+    static double samples[BENCH_MAX_SAMPLES];
+    int n = 0;
+    double begin = bench_now_ms();
+    while(n < BENCH_MAX_SAMPLES && (n < BENCH_MIN_SAMPLES || bench_now_ms() - begin < min_ms))
+    {
+        double start = bench_now_ms();
+        for(int64_t i = 0; i < batch; i++)
+        {
+            c->step.kernel(&c->step, slots, pool);
+        }
+        samples[n++] = (bench_now_ms() - start) * 1e6 / batch;
+    }
+    qsort(samples, n, sizeof(double), bench_cmp);
+    result->iters = n * batch;
+    result->ns = samples[n / 2];
+    result->ns_min = samples[0];
+}
+
+int main(int argc, char const *argv[])
+{
+    int json = argc > 1 && strcmp(argv[1], "json") == 0;
+    int threads = argc > 2 ? atoi(argv[2]) : 1;
+    double min_ms = argc > 3 ? atof(argv[3]) : 100.0;
+    const char* only = argc > 4 ? argv[4] : NULL;
+    int failed = 0;
+
+    // 0. The caller on cpu 0, workers after it
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = threads > 0 ? threads : 1;
+    int* worker_cpus = (int*) malloc(sizeof(int) * threads);
+    for(int t = 0; t < threads; t++)
+    {
+        worker_cpus[t] = (int) ((t + 1) % (cpus > 0 ? cpus : 1));
+    }
+    bench_pin(pthread_self(), 0);
+    onnx_pool* pool = threads > 1 ? onnx_pool_create(threads - 1, worker_cpus) : NULL;
+    const onnx_kernels* active = onnx_kernels_active;
+
+    static bench_case cases[64];
+    int n = 0;
+    bench_conv_cases(cases, &n);
+    bench_maxpool_cases(cases, &n);
+    bench_matmul_cases(cases, &n);
+    bench_transpose_cases(cases, &n);
+    bench_softmax_cases(cases, &n);
+
+    if(json)
+    {
+        printf("[\n");
+    }
+    else
+    {
+        printf("kernel,variant,shape,isa,threads,iters,ns_per_op,ns_min,gflops,gbps,max_rel_err,ok\n");
+    }
+    int rows = 0;
+    for(int i = 0; i < n; i++)
+    {
+        bench_case* c = &cases[i];
+        if(only != NULL && strcmp(only, c->kernel) != 0)
+        {
+            continue;
+        }
+
+        // 1. Reference on the scalar level, then the kernel on the active one
+        float* input = bench_random(c->in_len);
+        float* slots[2] = { input, (float*) calloc(c->out_len, sizeof(float)) };
+        float* reference = (float*) calloc(c->out_len, sizeof(float));
+        onnx_kernels_use(ONNX_ISA_SCALAR);
+        c->reference(c, input, reference);
+        onnx_kernels_active = active;
+
+        bench_result r = { 0 };
+        c->step.kernel(&c->step, slots, pool);
+        r.err = bench_diff(reference, slots[1], c->out_len);
+        int ok = r.err <= c->tolerance;
+        failed |= !ok;
+
+        // 2. Timed
+        bench_run(c, slots, pool, min_ms, &r);
+        double gflops = c->flops / r.ns;
+        double gbps = c->bytes / r.ns;
+        if(json)
+        {
+            printf("%s  {\"kernel\": \"%s\", \"variant\": \"%s\", \"shape\": \"%s\", \"isa\": \"%s\", \"threads\": %d, "
+                   "\"iters\": %ld, \"ns_per_op\": %.1f, \"ns_min\": %.1f, \"gflops\": %.3f, \"gbps\": %.3f, "
+                   "\"max_rel_err\": %.3e, \"ok\": %s}", rows > 0 ? ",\n" : "", c->kernel, c->variant, c->shape,
+                   active->name, threads, (long) r.iters, r.ns, r.ns_min, gflops, gbps, r.err, ok ? "true" : "false");
+        }
+        else
+        {
+            printf("%s,%s,%s,%s,%d,%ld,%.1f,%.1f,%.3f,%.3f,%.3e,%d\n", c->kernel, c->variant, c->shape, active->name,
+                   threads, (long) r.iters, r.ns, r.ns_min, gflops, gbps, r.err, ok);
+        }
+        fflush(stdout);
+        rows++;
+
+        free(input);
+        free(slots[1]);
+        free(reference);
+    }
+    if(json)
+    {
+        printf("\n]\n");
+    }
+
+    // Shared conv filters and biases are freed once, with the first case using them
+    for(int i = 0; i < n; i++)
+    {
+        free((float*) cases[i].step.weight);
+        if(i == 0 || cases[i].step.bias != cases[i - 1].step.bias)
+        {
+            free((float*) cases[i].step.bias);
+            free(cases[i].ohwi);
+        }
+    }
+    onnx_pool_destroy(pool);
+    free(worker_cpus);
+    return failed;
+}
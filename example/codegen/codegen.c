@@ -0,0 +1,411 @@
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "onnx.h"
+
+// Ahead-of-time compiler: compiles a model into a plan and writes the plan
+// out as C, the way mnist.c is written by hand. Weights become static const
+// arrays, already packed for their kernels, and every step is a constant
+// descriptor with its shapes baked in. The activations live in one static
+// arena sized by the plan. The generated file only calls kernels, so a
+// binary built from it never parses a model, and allocates nothing beyond the
+// scratch some kernels keep per thread:
+//
+//   int    <name>_reserve(struct onnx_pool* pool);
+//   float* <name>_run(const float* input, struct onnx_pool* pool);
+//
+// reserve sets that scratch aside on the calling thread and the workers of
+// pool, and returns -1 when out of memory; call it before running on a pool.
+// run runs the steps in order, each split over pool when it is not NULL, and
+// returns the output in the arena, valid until the next run, or NULL when the
+// calling thread cannot get its scratch. With one arena per program, runs
+// must not overlap. <name>.h declares both along with the input and output
+// sizes and includes nothing. <name>.c includes onnx-runtime.h and links
+// against the run-time objects alone (see SConstruct), without the parser or
+// protobuf-c.
+//
+//   usage: onnx-codegen model.onnx out.c [name] [batch]
+//
+// The name defaults to the model file's, the batch to the model's own.
+
+#define CODEGEN_VALUES_PER_LINE 8
+
+typedef struct codegen_kernel
+{
+    onnx_kernel kernel;
+    const char* name;
+} codegen_kernel;
+
+static const codegen_kernel codegen_kernels[] = {
+    { conv2D_step,          "conv2D_step" },
+    { conv2D_gemm_step,     "conv2D_gemm_step" },
+    { conv2D_winograd_step, "conv2D_winograd_step" },
+    { relu_step,            "relu_step" },
+    { maxpool_step,         "maxpool_step" },
+    { matmul_step,          "matmul_step" },
+    { add_step,             "add_step" },
+    { softmax_step,         "softmax_step" },
+    { transpose_step,       "transpose_step" },
+};
+
+// Weights the steps point into: packs of the plan and initializers
+typedef struct codegen_blob
+{
+    const float* data;
+    int64_t len;
+    const char* source;
+    int used;
+} codegen_blob;
+
+static const char* codegen_kernel_name(onnx_kernel kernel)
+{
+    for(size_t i = 0; i < sizeof(codegen_kernels) / sizeof(codegen_kernels[0]); i++)
+    {
+        if(codegen_kernels[i].kernel == kernel)
+        {
+            return codegen_kernels[i].name;
+        }
+    }
+    return NULL;
+}
+
+static int32_t codegen_find(const codegen_blob* blobs, int32_t n_blobs, const float* p, int64_t* offset)
+{
+    for(int32_t b = 0; p != NULL && b < n_blobs; b++)
+    {
+        if(p >= blobs[b].data && p < blobs[b].data + blobs[b].len)
+        {
+            *offset = p - blobs[b].data;
+            return b;
+        }
+    }
+    return -1;
+}
+
+// C identifier from the file name: "models/mnist-lg.onnx" --> "mnist_lg"
+static void codegen_identifier(const char* path, char* name, size_t size)
+{
+    const char* base = strrchr(path, '/') != NULL ? strrchr(path, '/') + 1 : path;
+    size_t n = 0;
+    for(const char* c = base; *c != '\0' && *c != '.' && n + 1 < size; c++)
+    {
+        name[n++] = isalnum((unsigned char) *c) ? (char) tolower((unsigned char) *c) : '_';
+    }
+    name[n] = '\0';
+    if(n == 0 || isdigit((unsigned char) name[0]))
+    {
+        snprintf(name, size, "model");
+    }
+}
+
+// %.9g round-trips a finite float; infinities and NaN, which it would print
+// as inf and nan, get the <math.h> macros
+static void codegen_floats(FILE* file, const float* data, int64_t len)
+{
+    for(int64_t i = 0; i < len; i++)
+    {
+        fprintf(file, "%s", i % CODEGEN_VALUES_PER_LINE == 0 ? "    " : "");
+        if(isnan(data[i]))
+        {
+            fprintf(file, "NAN");
+        }
+        else if(isinf(data[i]))
+        {
+            fprintf(file, "%sINFINITY", data[i] < 0 ? "-" : "");
+        }
+        else
+        {
+            fprintf(file, "%.9g", data[i]);
+        }
+        fprintf(file, "%s", i + 1 == len ? "\n" : (i + 1) % CODEGEN_VALUES_PER_LINE == 0 ? ",\n" : ", ");
+    }
+}
+
+static void codegen_ints(FILE* file, const int64_t* values, int64_t n)
+{
+    fprintf(file, "{ ");
+    for(int64_t i = 0; i < n; i++)
+    {
+        fprintf(file, "%s%ld", i > 0 ? ", " : "", (long) values[i]);
+    }
+    fprintf(file, " }");
+}
+
+static void codegen_tensor(FILE* file, const char* field, const onnx_tensor* t)
+{
+    // Activations are float
+    fprintf(file, "        .%s = { .dtype = ONNX_TENSOR_FLOAT, .rank = %d, .dims = ", field, t->rank);
+    codegen_ints(file, t->dims, t->rank);
+    fprintf(file, ", .strides = ");
+    codegen_ints(file, t->strides, t->rank);
+    fprintf(file, " },\n");
+}
+
+static void codegen_attr(FILE* file, const char* field, const onnx_plan_attr* a)
+{
+    fprintf(file, "        .%s = { %ld, %ld, %ld, %ld, %ld, %ld, %ld },\n", field, (long) a->kernel_x, (long) a->kernel_y,
+            (long) a->padding_x, (long) a->padding_y, (long) a->stride_x, (long) a->stride_y, (long) a->tile);
+}
+
+static void codegen_pointer(FILE* file, const char* field, const char* name, const codegen_blob* blobs,
+                            int32_t n_blobs, const float* p)
+{
+    int64_t offset = 0;
+    int32_t b = codegen_find(blobs, n_blobs, p, &offset);
+    if(b >= 0)
+    {
+        fprintf(file, "        .%s = %s_w%d + %ld,\n", field, name, b, (long) offset);
+    }
+}
+
+static int codegen_header(const char* path, const char* name, const onnx_plan* plan, const char* model)
+{
+    FILE* file = fopen(path, "w");
+    if(file == NULL)
+    {
+        return -1;
+    }
+    char guard[128];
+    size_t n = 0;
+    for(const char* c = name; *c != '\0' && n + 1 < sizeof(guard); c++)
+    {
+        guard[n++] = (char) toupper((unsigned char) *c);
+    }
+    guard[n] = '\0';
+
+    fprintf(file, "#ifndef __%s_H__\n#define __%s_H__\n\n", guard, guard);
+    fprintf(file, "// Generated by onnx-codegen from %s, do not edit.\n\n", model);
+    fprintf(file, "struct onnx_pool;\n\n");
+    fprintf(file, "#define %s_BATCH %ld\n", guard, (long) plan->input.dims[0]);
+    fprintf(file, "#define %s_INPUT_SIZE %ld     // floats per run\n", guard, (long) onnx_tensor_numel(&plan->input));
+    fprintf(file, "#define %s_OUTPUT_SIZE %ld\n\n", guard, (long) onnx_tensor_numel(&plan->output));
+    fprintf(file, "int    %s_reserve(struct onnx_pool* pool);\n", name);
+    fprintf(file, "float* %s_run(const float* input, struct onnx_pool* pool);\n\n#endif\n", name);
+
+    int status = ferror(file) ? -1 : 0;
+    return fclose(file) != 0 ? -1 : status;
+}
+
+static int codegen_source(const char* path, const char* header, const char* name, const onnx_plan* plan,
+                          const char* model)
+{
+    // 0. Every pointer a step holds must come from a pack or an initializer
+    onnx_graph_index* index = plan->index;
+    int32_t n_init = (int32_t) index->graph->n_initializer;
+    codegen_blob* blobs = (codegen_blob*) calloc(plan->n_packs + n_init + 1, sizeof(codegen_blob));
+    if(blobs == NULL)
+    {
+        return -1;
+    }
+    int32_t n_blobs = 0;
+    for(int32_t p = 0; p < plan->n_packs; p++)
+    {
+        blobs[n_blobs] = (codegen_blob) { plan->packs[p].data, plan->packs[p].bytes / sizeof(float), "", 0 };
+        for(int32_t i = 0; i < n_init; i++)
+        {
+            if(index->views[i].data == plan->packs[p].source)
+            {
+                blobs[n_blobs].source = index->graph->initializer[i]->name;
+            }
+        }
+        n_blobs++;
+    }
+    for(int32_t i = 0; i < n_init; i++)
+    {
+        const onnx_tensor_view* view = &index->views[i];
+        if(view->data_type == ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT)
+        {
+            blobs[n_blobs++] = (codegen_blob) { (const float*) view->data, (int64_t) view->n_elem,
+                                                index->graph->initializer[i]->name, 0 };
+        }
+    }
+    for(int32_t s = 0; s < plan->n_steps; s++)
+    {
+        const onnx_plan_step* step = &plan->steps[s];
+        const float* pointers[] = { step->weight, step->bias };
+        for(int k = 0; k < 2; k++)
+        {
+            int64_t offset;
+            int32_t b = codegen_find(blobs, n_blobs, pointers[k], &offset);
+            if(pointers[k] != NULL && b < 0)
+            {
+                printf("Step %d (%s): weights outside the plan's packs and initializers\n", s, step->node->name);
+                free(blobs);
+                return -1;
+            }
+            if(b >= 0)
+            {
+                blobs[b].used = 1;
+            }
+        }
+        if(codegen_kernel_name(step->kernel) == NULL)
+        {
+            printf("Step %d (%s): no generator for its kernel\n", s, step->node->name);
+            free(blobs);
+            return -1;
+        }
+    }
+
+    FILE* file = fopen(path, "w");
+    if(file == NULL)
+    {
+        free(blobs);
+        return -1;
+    }
+    fprintf(file, "// Generated by onnx-codegen from %s, do not edit.\n\n", model);
+    fprintf(file, "#include <math.h>\n\n#include \"onnx-runtime.h\"\n#include \"%s\"\n\n", header);
+
+    // 1. Weights, packed for their kernels
+    for(int32_t b = 0; b < n_blobs; b++)
+    {
+        if(!blobs[b].used)
+        {
+            continue;
+        }
+        fprintf(file, "// %s%s\n", blobs[b].source, b < plan->n_packs ? ", packed" : "");
+        fprintf(file, "static const float %s_w%d[%ld] __attribute__((aligned(ONNX_PLAN_ALIGN))) = {\n", name, b,
+                (long) blobs[b].len);
+        codegen_floats(file, blobs[b].data, blobs[b].len);
+        fprintf(file, "};\n\n");
+    }
+
+    // 2. Activations, at the plan's offsets
+    size_t arena = plan->arena_bytes > 0 ? plan->arena_bytes : ONNX_PLAN_ALIGN;
+    fprintf(file, "static float %s_arena[%zu] __attribute__((aligned(ONNX_PLAN_ALIGN)));\n\n", name,
+            arena / sizeof(float));
+
+    // 3. Steps
+    fprintf(file, "static const onnx_plan_step %s_steps[%d] = {\n", name, plan->n_steps);
+    for(int32_t s = 0; s < plan->n_steps; s++)
+    {
+        const onnx_plan_step* step = &plan->steps[s];
+        char ops[64];
+        onnx_plan_step_ops(step, ops, sizeof(ops));
+        fprintf(file, "    // [%d] %s %s\n    {\n", s, ops, step->node->name);
+        fprintf(file, "        .kernel = %s,\n", codegen_kernel_name(step->kernel));
+        codegen_pointer(file, "weight", name, blobs, n_blobs, step->weight);
+        codegen_pointer(file, "bias", name, blobs, n_blobs, step->bias);
+        if(step->dimW > 0)
+        {
+            fprintf(file, "        .shapeW = ");
+            codegen_ints(file, step->shapeW, step->dimW);
+            fprintf(file, ",\n        .dimW = %ld,\n", (long) step->dimW);
+        }
+        codegen_attr(file, "attr", &step->attr);
+        fprintf(file, "        .input = { %d, %d },\n        .output = %d,\n", step->input[0], step->input[1],
+                step->output);
+        codegen_tensor(file, "in", &step->in);
+        codegen_tensor(file, "out", &step->out);
+        if(step->relu)
+        {
+            fprintf(file, "        .relu = 1,\n");
+        }
+        if(step->pool.kernel_x > 0)
+        {
+            codegen_attr(file, "pool", &step->pool);
+            codegen_tensor(file, "conv", &step->conv);
+        }
+        if(step->kernel == transpose_step)
+        {
+            fprintf(file, "        .perm = ");
+            codegen_ints(file, step->perm, step->dimW);
+            fprintf(file, ",\n");
+        }
+        fprintf(file, "    },\n");
+    }
+    fprintf(file, "};\n\n");
+
+    // 4. Kernel scratch per thread, as onnx_session_create reserves it
+    size_t scratch = 0;
+    for(int32_t s = 0; s < plan->n_steps; s++)
+    {
+        size_t bytes = conv2D_scratch_size(&plan->steps[s]);
+        scratch = bytes > scratch ? bytes : scratch;
+    }
+    fprintf(file, "int %s_reserve(onnx_pool* pool)\n{\n    return onnx_pool_scratch_reserve(pool, %zu);\n}\n\n", name,
+            scratch);
+
+    // 5. Run
+    fprintf(file, "float* %s_run(const float* input, onnx_pool* pool)\n{\n", name);
+    if(scratch > 0)
+    {
+        fprintf(file, "    if(onnx_pool_scratch(%zu) == NULL)\n    {\n        return NULL;\n    }\n", scratch);
+    }
+    fprintf(file, "    float* slots[%d] = {\n", plan->n_slots);
+    for(int32_t s = 0; s < plan->n_slots; s++)
+    {
+        if(s == plan->input_slot)
+        {
+            fprintf(file, "        (float*) input,\n");
+        }
+        else
+        {
+            fprintf(file, "        %s_arena + %zu,\n", name, plan->slot_offset[s] / sizeof(float));
+        }
+    }
+    fprintf(file, "    };\n");
+    fprintf(file, "    for(int32_t i = 0; i < %d; i++)\n    {\n", plan->n_steps);
+    fprintf(file, "        %s_steps[i].kernel(&%s_steps[i], slots, pool);\n    }\n", name, name);
+    fprintf(file, "    return slots[%d];\n}\n", plan->output_slot);
+
+    free(blobs);
+    int status = ferror(file) ? -1 : 0;
+    return fclose(file) != 0 ? -1 : status;
+}
+
+int main(int argc, char const *argv[])
+{
+    if(argc < 3)
+    {
+        printf("usage: %s model.onnx out.c [name] [batch]\n", argv[0]);
+        return 1;
+    }
+    const char* model_name = argv[1];
+    const char* out = argv[2];
+    char name[64];
+    codegen_identifier(argc > 3 ? argv[3] : model_name, name, sizeof(name));
+    int64_t batch = argc > 4 ? atol(argv[4]) : 0;
+
+    // <out>.h next to <out>.c, included by its file name
+    size_t len = strlen(out);
+    if(len < 3 || strcmp(out + len - 2, ".c") != 0)
+    {
+        printf("%s: the output must be a .c file\n", out);
+        return 1;
+    }
+    char* header = strdup(out);
+    header[len - 1] = 'h';
+    const char* include = strrchr(header, '/') != NULL ? strrchr(header, '/') + 1 : header;
+
+    Onnx__ModelProto* model = onnx_load_model(model_name);
+    if(model == NULL)
+    {
+        printf("Failed to load model %s\n", model_name);
+        return 1;
+    }
+    onnx_plan* plan = onnx_plan_compile_batch(model, batch);
+    if(plan == NULL)
+    {
+        printf("Failed to compile model %s\n", model_name);
+        return 1;
+    }
+
+    int status = codegen_header(header, name, plan, model_name) == 0 &&
+                 codegen_source(out, include, name, plan, model_name) == 0 ? 0 : 1;
+    if(status == 0)
+    {
+        printf("%s: %d steps, %zu bytes of weights, %zu bytes of activations --> %s\n", model_name, plan->n_steps,
+               plan->packed_bytes, plan->arena_bytes, out);
+    }
+    else
+    {
+        printf("Failed to write %s\n", out);
+    }
+
+    free(header);
+    onnx_plan_free(plan);
+    onnx__model_proto__free_unpacked(model, NULL);
+    return status;
+}
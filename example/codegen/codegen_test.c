@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "mnist/mnist.h"
+#include "codegen/mnist_lg.h"
+#include "onnx.h"
+
+// Runs mnist_lg.c, generated by onnx-codegen from mnist-lg.onnx, against the
+// plan compiled from the model at run time: outputs must be the same bit for
+// bit, serially and on a pool.
+//
+//   usage: onnx-codegen-test [runs]
+//
+// Exits with 1 when they differ.
+
+#define ONNX_MODEL_NAME "mnist-lg.onnx"
+
+int main(int argc, char const *argv[])
+{
+    int runs = argc > 1 ? atoi(argv[1]) : 100;
+    int failed = 0;
+
+    Onnx__ModelProto* model = onnx_load_model(ONNX_MODEL_NAME);
+    onnx_plan* plan = model != NULL ? onnx_plan_compile(model) : NULL;
+    if(plan == NULL || onnx_tensor_numel(&plan->output) != MNIST_LG_OUTPUT_SIZE)
+    {
+        printf("Failed to compile model %s, or it changed since mnist_lg.c was generated\n", ONNX_MODEL_NAME);
+        return 1;
+    }
+
+    onnx_pool* pool = onnx_pool_create(2, NULL);
+    if(pool == NULL || mnist_lg_reserve(pool) != 0)
+    {
+        printf("Failed to set up the pool\n");
+        return 1;
+    }
+    for(int i = 0; i < TOTAL_IMAGE; i++)
+    {
+        const float* expected = onnx_plan_run(plan, img[i]);
+        const float* serial = mnist_lg_run(img[i], NULL);
+        int same = memcmp(serial, expected, sizeof(float) * MNIST_LG_OUTPUT_SIZE) == 0;
+        const float* pooled = mnist_lg_run(img[i], pool);
+        same &= memcmp(pooled, expected, sizeof(float) * MNIST_LG_OUTPUT_SIZE) == 0;
+
+        int best = 0;
+        for(int k = 1; k < MNIST_LG_OUTPUT_SIZE; k++)
+        {
+            best = pooled[k] > pooled[best] ? k : best;
+        }
+        printf("Image %d: predicted %d, label %d, %s\n", i, best, label[i], same ? "matches the plan" : "DIFFERS");
+        failed |= !same;
+    }
+
+    // CPU time per run of either
+    double start = (double) clock();
+    for(int r = 0; r < runs; r++)
+    {
+        mnist_lg_run(img[r % TOTAL_IMAGE], NULL);
+    }
+    double generated_us = ((double) clock() - start) / CLOCKS_PER_SEC * 1e6 / runs;
+    start = (double) clock();
+    for(int r = 0; r < runs; r++)
+    {
+        onnx_plan_run(plan, img[r % TOTAL_IMAGE]);
+    }
+    double plan_us = ((double) clock() - start) / CLOCKS_PER_SEC * 1e6 / runs;
+    printf("Generated: %.1f us per run, plan: %.1f us per run\n", generated_us, plan_us);
+
+    onnx_pool_destroy(pool);
+    onnx_plan_free(plan);
+    onnx__model_proto__free_unpacked(model, NULL);
+    return failed;
+}
@@ -0,0 +1,51 @@
+#include <stdio.h>
+
+#include "mnist/mnist.h"
+#include "codegen/mnist_lg.h"
+#include "onnx-runtime.h"
+
+// mnist_lg.c built the way a program shipping generated code would be: linked
+// against the run-time objects only, without the parser or protobuf-c, which
+// SConstruct also checks on the binary's symbols. Runs the test images
+// serially and on a pool; both runs must give the same output bit for bit and
+// predict the labels.
+//
+//   usage: onnx-codegen-standalone
+//
+// Exits with 1 when the runs differ or an image is misclassified.
+
+int main(int argc, char const *argv[])
+{
+    int failed = 0;
+
+    onnx_pool* pool = onnx_pool_create(2, NULL);
+    if(pool == NULL || mnist_lg_reserve(pool) != 0)
+    {
+        printf("Failed to set up the pool\n");
+        return 1;
+    }
+    float serial[MNIST_LG_OUTPUT_SIZE];
+    for(int i = 0; i < TOTAL_IMAGE; i++)
+    {
+        const float* output = mnist_lg_run(img[i], NULL);
+        if(output == NULL)
+        {
+            printf("Image %d: no kernel scratch\n", i);
+            return 1;
+        }
+        memcpy(serial, output, sizeof(serial));
+        const float* pooled = mnist_lg_run(img[i], pool);
+        int same = pooled != NULL && memcmp(pooled, serial, sizeof(serial)) == 0;
+
+        int best = 0;
+        for(int k = 1; k < MNIST_LG_OUTPUT_SIZE; k++)
+        {
+            best = serial[k] > serial[best] ? k : best;
+        }
+        printf("Image %d: predicted %d, label %d, %s\n", i, best, label[i], same ? "same on the pool" : "DIFFERS");
+        failed |= !same || best != label[i];
+    }
+
+    onnx_pool_destroy(pool);
+    return failed;
+}
@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench/bench.h"
+#include "onnx.h"
+
+// Direct conv2D against the im2col + blocked SGEMM path on typical ResNet and
+// MobileNet layer shapes, single threaded. Also prints which path the plan
+// heuristic would pick; Winograd layers are timed by onnx-winograd.
+//
+//   usage: onnx-conv [min ms per kernel]
+
+typedef struct bench_conv
+{
+    const char* name;
+    int64_t in_x, in_y, ch_in;
+    int64_t ch_out, kernel, stride, padding;
+} bench_conv;
+
+static const bench_conv bench_shapes[] = {
+    { "resnet conv1 7x7/2",   224, 224,   3,  64, 7, 2, 3 },
+    { "resnet 3x3 56",         56,  56,  64,  64, 3, 1, 1 },
+    { "resnet 1x1 56 up",      56,  56,  64, 256, 1, 1, 0 },
+    { "resnet 1x1 56 down",    56,  56, 256,  64, 1, 1, 0 },
+    { "resnet 3x3 28",         28,  28, 128, 128, 3, 1, 1 },
+    { "resnet 3x3 14",         14,  14, 256, 256, 3, 1, 1 },
+    { "resnet 3x3 7",           7,   7, 512, 512, 3, 1, 1 },
+    { "mobilenet stem 3x3/2", 224, 224,   3,  32, 3, 2, 1 },
+    { "mobilenet pw 112",     112, 112,  32,  64, 1, 1, 0 },
+    { "mobilenet pw 14",       14,  14, 512, 512, 1, 1, 0 },
+    { "mnist 5x5",             28,  28,   1,   8, 5, 1, 2 },
+    { "mnist-sm 5x5 2",        14,  14,   2,   2, 5, 1, 2 },
+    { "narrow 3x3 16-4",       28,  28,  16,   4, 3, 1, 1 },
+    { "tiny 1x1 4-4",          28,  28,   4,   4, 1, 1, 0 },
+};
+
+static double bench_time(onnx_plan_step* step, float** slots, double min_ms)
+{
+    int runs = 0;
+    double start = bench_now_ms();
+    double elapsed = 0;
+    while(elapsed < min_ms)
+    {
+        step->kernel(step, slots, NULL);
+        runs++;
+        elapsed = bench_now_ms() - start;
+    }
+    return elapsed / runs;
+}
+
+int main(int argc, char const *argv[])
+{
+    double min_ms = argc > 1 ? atof(argv[1]) : 300.0;
+
+    printf("%-22s %10s %10s %8s %10s %9s\n", "layer", "direct", "gemm", "speedup", "max diff", "heuristic");
+    for(size_t s = 0; s < sizeof(bench_shapes) / sizeof(bench_shapes[0]); s++)
+    {
+        const bench_conv* c = &bench_shapes[s];
+        onnx_plan_step step = { 0 };
+        int64_t dims_in[] = { 1, c->in_y, c->in_x, c->ch_in };
+        int64_t dims_out[] = { 1, (c->in_y + 2 * c->padding - c->kernel) / c->stride + 1,
+                               (c->in_x + 2 * c->padding - c->kernel) / c->stride + 1, c->ch_out };
+        onnx_tensor_init(&step.in, ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT, 4, dims_in, NULL);
+        onnx_tensor_init(&step.out, ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT, 4, dims_out, NULL);
+        step.attr.kernel_x = step.attr.kernel_y = c->kernel;
+        step.attr.stride_x = step.attr.stride_y = c->stride;
+        step.attr.padding_x = step.attr.padding_y = c->padding;
+        step.input[0] = 0;
+        step.input[1] = -1;
+        step.output = 1;
+
+        int64_t k = c->kernel * c->kernel * c->ch_in;
+        int64_t in_len = onnx_tensor_numel(&step.in);
+        int64_t out_len = onnx_tensor_numel(&step.out);
+        double flops = 2.0 * out_len * k;
+
+        // OHWI filters for the direct kernel, panels for the GEMM
+        float* weight = bench_random(c->ch_out * k);
+        float* panels = (float*) malloc(sizeof(float) * sgemm_pack_size(c->ch_out, k));
+        sgemm_pack_b(weight, c->ch_out, k, panels);
+        float* bias = bench_random(c->ch_out);
+        float* input = bench_random(in_len);
+        float* direct = (float*) malloc(sizeof(float) * out_len);
+        float* gemm = (float*) malloc(sizeof(float) * out_len);
+        step.bias = bias;
+
+        float* slots[2] = { input, direct };
+        step.kernel = conv2D_step;
+        step.weight = weight;
+        double ms_direct = bench_time(&step, slots, min_ms);
+
+        slots[1] = gemm;
+        step.kernel = conv2D_gemm_step;
+        step.weight = panels;
+        double ms_gemm = bench_time(&step, slots, min_ms);
+
+        float diff = 0;
+        for(int64_t i = 0; i < out_len; i++)
+        {
+            float d = fabsf(direct[i] - gemm[i]);
+            diff = d > diff ? d : diff;
+        }
+        int picks_gemm = c->ch_out >= ONNX_GEMM_NR / 2 && k >= ONNX_CONV_GEMM_MIN_K;
+        int picks_winograd = c->kernel == 3 && c->stride == 1 &&
+                             c->ch_in >= ONNX_WINOGRAD_MIN_CH && c->ch_out >= ONNX_WINOGRAD_MIN_CH;
+        printf("%-22s %10.2f %10.2f %8.2f %10.2e %9s\n", c->name, flops / ms_direct / 1e6, flops / ms_gemm / 1e6,
+               ms_direct / ms_gemm, diff, picks_winograd ? "winograd" : picks_gemm ? "gemm" : "direct");
+
+        free(weight);
+        free(panels);
+        free(bias);
+        free(input);
+        free(direct);
+        free(gemm);
+    }
+    printf("(GFLOP/s)\n");
+
+    return 0;
+}
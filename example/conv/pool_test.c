@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench/bench.h"
+#include "onnx.h"
+
+// Conv + MaxPool fused into one step against the conv step followed by
+// maxpool, for the direct and im2col kernels with disjoint and overlapping
+// windows. Batches run on a pool whose per-thread band scratch is reserved
+// first, as a session does, so the fused runs must not allocate.
+//
+//   usage: onnx-conv-pool
+//
+// Exits with 1 when an output differs or a run allocates.
+
+#define TEST_BATCH 3
+
+typedef struct test_shape
+{
+    const char* name;
+    int64_t in_x, in_y, ch_in, ch_out, kernel, padding;
+    int64_t pool, pool_stride, pool_padding;
+    int gemm;
+} test_shape;
+
+static const test_shape test_shapes[] = {
+    { "direct 5x5, pool 2/2",    28, 28,  1,  8, 5, 2, 2, 2, 0, 0 },
+    { "direct 3x3, pool 3/2",    28, 28,  8, 16, 3, 1, 3, 2, 1, 0 },
+    { "gemm 3x3, pool 2/2",      28, 28, 16, 32, 3, 1, 2, 2, 0, 1 },
+    { "gemm 3x3, pool 3/2",      27, 19, 16, 32, 3, 1, 3, 2, 1, 1 },
+    { "gemm 1x1, pool 3/1",      14, 14, 32, 64, 1, 0, 3, 1, 1, 1 },
+};
+
+static int test_shape_run(const test_shape* c, onnx_pool* pool)
+{
+    onnx_plan_step step = { 0 };
+    int64_t conv_y = c->in_y + 2 * c->padding - c->kernel + 1;
+    int64_t conv_x = c->in_x + 2 * c->padding - c->kernel + 1;
+    int64_t dims_in[] = { TEST_BATCH, c->in_y, c->in_x, c->ch_in };
+    int64_t dims_conv[] = { TEST_BATCH, conv_y, conv_x, c->ch_out };
+    int64_t dims_out[] = { TEST_BATCH, (conv_y + 2 * c->pool_padding - c->pool) / c->pool_stride + 1,
+                           (conv_x + 2 * c->pool_padding - c->pool) / c->pool_stride + 1, c->ch_out };
+    onnx_tensor_init(&step.in, ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT, 4, dims_in, NULL);
+    onnx_tensor_init(&step.out, ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT, 4, dims_conv, NULL);
+    step.attr.kernel_x = step.attr.kernel_y = c->kernel;
+    step.attr.stride_x = step.attr.stride_y = 1;
+    step.attr.padding_x = step.attr.padding_y = c->padding;
+    step.input[0] = 0;
+    step.input[1] = -1;
+    step.output = 1;
+    step.relu = 1;
+
+    int64_t k = c->kernel * c->kernel * c->ch_in;
+    float* weight = bench_random(c->ch_out * k);
+    float* panels = (float*) malloc(sizeof(float) * sgemm_pack_size(c->ch_out, k));
+    sgemm_pack_b(weight, c->ch_out, k, panels);
+    float* bias = bench_random(c->ch_out);
+    int64_t in_len = onnx_tensor_sample(&step.in);
+    float* input = bench_random(in_len * TEST_BATCH);
+    step.kernel = c->gemm ? conv2D_gemm_step : conv2D_step;
+    step.weight = c->gemm ? panels : weight;
+    step.bias = bias;
+
+    // Unfused: the conv step, then each sample pooled
+    int64_t conv_len = onnx_tensor_sample(&step.out);
+    float* conv = (float*) malloc(sizeof(float) * conv_len * TEST_BATCH);
+    float* slots[2] = { input, conv };
+    step.kernel(&step, slots, NULL);
+
+    onnx_tensor_init(&step.conv, ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT, 4, dims_conv, NULL);
+    onnx_tensor_init(&step.out, ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT, 4, dims_out, NULL);
+    int64_t out_len = onnx_tensor_sample(&step.out);
+    float* expected = (float*) malloc(sizeof(float) * out_len * TEST_BATCH);
+    for(int64_t b = 0; b < TEST_BATCH; b++)
+    {
+        maxpool(conv + b * conv_len, conv_x, conv_y, c->ch_out, c->pool, c->pool, c->pool_padding, c->pool_padding,
+                c->pool_stride, c->pool_stride, dims_out[2], dims_out[1], expected + b * out_len);
+    }
+
+    // Fused, on the pool
+    step.pool.kernel_x = step.pool.kernel_y = c->pool;
+    step.pool.stride_x = step.pool.stride_y = c->pool_stride;
+    step.pool.padding_x = step.pool.padding_y = c->pool_padding;
+    float* output = (float*) calloc(out_len * TEST_BATCH, sizeof(float));
+    slots[1] = output;
+    size_t scratch = conv2D_scratch_size(&step);
+    int banded = c->gemm || c->pool_stride < c->pool;
+    onnx_profile_event event;
+    int reserved = onnx_pool_scratch_reserve(pool, scratch) == 0;
+    onnx_profile_begin(&event, 0);
+    step.kernel(&step, slots, pool);
+    onnx_profile_end(&event);
+
+    int same = memcmp(output, expected, sizeof(float) * out_len * TEST_BATCH) == 0;
+    int ok = same && reserved && event.allocs == 0 && (scratch > 0) == banded;
+    printf("%-24s %10zu %8ld %6s %6s\n", c->name, scratch, (long) event.allocs, same ? "same" : "differ", ok ? "ok" : "FAIL");
+
+    free(weight);
+    free(panels);
+    free(bias);
+    free(input);
+    free(conv);
+    free(expected);
+    free(output);
+    return !ok;
+}
+
+int main(int argc, char const *argv[])
+{
+    onnx_pool* pool = onnx_pool_create(2, NULL);
+    if(pool == NULL)
+    {
+        printf("Failed to create the pool\n");
+        return 1;
+    }
+
+    int failed = 0;
+    printf("%-24s %10s %8s %6s\n", "layer", "scratch", "allocs", "output");
+    for(size_t s = 0; s < sizeof(test_shapes) / sizeof(test_shapes[0]); s++)
+    {
+        failed |= test_shape_run(&test_shapes[s], pool);
+    }
+    onnx_pool_destroy(pool);
+    return failed;
+}
@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench/bench.h"
+#include "onnx.h"
+
+// Winograd F(2x2, 3x3) and F(4x4, 3x3) against the direct conv2D kernel on
+// 3x3 stride-1 layers. The error of every output is checked against a bound
+// scaled by the magnitude of its dot product, sum |w| |x| + |bias|, so the
+// check does not depend on cancellation in the reference. Also runs batches
+// on a pool to cover the per-thread scratch, which is reserved first so the
+// run must not allocate, and reports the multiply count and time of each path.
+//
+//   usage: onnx-winograd [min ms per kernel]
+//
+// Exits with 1 when any output is out of bounds.
+
+// Relative error bounds for single precision; F(4x4) has larger transform
+// constants and loses about one more digit
+#define BENCH_BOUND_2 1e-5
+#define BENCH_BOUND_4 1e-4
+
+typedef struct bench_conv
+{
+    const char* name;
+    int64_t in_x, in_y, ch_in, ch_out, padding;
+} bench_conv;
+
+static const bench_conv bench_shapes[] = {
+    { "resnet 3x3 56",     56,  56,  64,  64, 1 },
+    { "resnet 3x3 28",     28,  28, 128, 128, 1 },
+    { "resnet 3x3 14",     14,  14, 256, 256, 1 },
+    { "resnet 3x3 7",       7,   7, 512, 512, 1 },
+    { "vgg 3x3 56",        56,  56, 256, 256, 1 },
+    { "narrow 3x3 28",     28,  28,  32,  32, 1 },
+    { "odd 3x3 13x9",      13,   9,  24,  40, 1 },
+    { "small 3x3 5",        5,   5, 256, 256, 1 },
+    { "valid 3x3 30",      30,  30,  16,  32, 0 },
+    { "mnist 3x3 28",      28,  28,   8,  16, 1 },
+};
+
+static double bench_time(onnx_plan_step* step, float** slots, onnx_pool* pool, double min_ms)
+{
+    int runs = 0;
+    double start = bench_now_ms();
+    double elapsed = 0;
+    while(elapsed < min_ms)
+    {
+        step->kernel(step, slots, pool);
+        runs++;
+        elapsed = bench_now_ms() - start;
+    }
+    return elapsed / runs;
+}
+
+// Largest error relative to the magnitude of the output's dot product
+static double bench_error(const onnx_plan_step* step, const float* input, const float* ohwi,
+                          const float* reference, const float* output)
+{
+    int64_t out_x = step->out.dims[ONNX_W];
+    int64_t out_y = step->out.dims[ONNX_H];
+    int64_t ch_in = step->in.dims[ONNX_C];
+    int64_t ch_out = step->out.dims[ONNX_C];
+    double worst = 0;
+
+    for(int64_t y = 0; y < out_y; y++)
+    {
+        for(int64_t x = 0; x < out_x; x++)
+        {
+            for(int64_t o = 0; o < ch_out; o++)
+            {
+                double scale = fabs(step->bias[o]);
+                for(int64_t ky = 0; ky < 3; ky++)
+                {
+                    for(int64_t kx = 0; kx < 3; kx++)
+                    {
+                        int64_t row = y + ky - step->attr.padding_y;
+                        int64_t col = x + kx - step->attr.padding_x;
+                        if(row < 0 || col < 0 || row >= step->in.dims[ONNX_H] || col >= step->in.dims[ONNX_W])
+                        {
+                            continue;
+                        }
+                        for(int64_t c = 0; c < ch_in; c++)
+                        {
+                            scale += fabs(input[(row * step->in.dims[ONNX_W] + col) * ch_in + c] *
+                                          ohwi[((o * 3 + ky) * 3 + kx) * ch_in + c]);
+                        }
+                    }
+                }
+                int64_t i = (y * out_x + x) * ch_out + o;
+                double err = fabs(reference[i] - output[i]) / scale;
+                worst = err > worst ? err : worst;
+            }
+        }
+    }
+    return worst;
+}
+
+int main(int argc, char const *argv[])
+{
+    double min_ms = argc > 1 ? atof(argv[1]) : 300.0;
+    int failed = 0;
+
+    onnx_pool* pool = onnx_pool_create(2, NULL);
+    if(pool == NULL)
+    {
+        printf("Failed to create the pool\n");
+        return 1;
+    }
+
+    printf("%-16s %4s %10s %10s %10s %8s %8s %10s %6s\n", "layer", "F", "direct", "gemm", "winograd",
+           "speedup", "mults", "rel error", "");
+    for(size_t s = 0; s < sizeof(bench_shapes) / sizeof(bench_shapes[0]); s++)
+    {
+        const bench_conv* c = &bench_shapes[s];
+        int64_t batch = 2;
+        onnx_plan_step step = { 0 };
+        int64_t dims_in[] = { 1, c->in_y, c->in_x, c->ch_in };
+        int64_t dims_out[] = { 1, c->in_y + 2 * c->padding - 2, c->in_x + 2 * c->padding - 2, c->ch_out };
+        onnx_tensor_init(&step.in, ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT, 4, dims_in, NULL);
+        onnx_tensor_init(&step.out, ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT, 4, dims_out, NULL);
+        step.attr.kernel_x = step.attr.kernel_y = 3;
+        step.attr.stride_x = step.attr.stride_y = 1;
+        step.attr.padding_x = step.attr.padding_y = c->padding;
+        step.input[0] = 0;
+        step.input[1] = -1;
+        step.output = 1;
+
+        int64_t k = 9 * c->ch_in;
+        int64_t in_len = onnx_tensor_numel(&step.in);
+        int64_t out_len = onnx_tensor_numel(&step.out);
+        double flops = 2.0 * out_len * k;
+
+        // OIHW filters as stored in the model; OHWI for the direct kernel
+        int64_t shapeW[] = { c->ch_out, c->ch_in, 3, 3 };
+        int64_t perm[] = { 0, 2, 3, 1 };
+        float* oihw = bench_random(c->ch_out * k);
+        float* ohwi = transpose(oihw, shapeW, 4, perm);
+        float* panels = (float*) malloc(sizeof(float) * sgemm_pack_size(c->ch_out, k));
+        sgemm_pack_b(ohwi, c->ch_out, k, panels);
+        float* bias = bench_random(c->ch_out);
+        float* input = bench_random(in_len * batch);
+        float* direct = (float*) malloc(sizeof(float) * out_len * batch);
+        float* output = (float*) malloc(sizeof(float) * out_len * batch);
+        step.bias = bias;
+
+        float* slots[2] = { input, direct };
+        step.kernel = conv2D_step;
+        step.weight = ohwi;
+        double ms_direct = bench_time(&step, slots, NULL, min_ms);
+        step.in.dims[0] = step.out.dims[0] = batch;
+        step.kernel(&step, slots, NULL);
+        step.in.dims[0] = step.out.dims[0] = 1;
+
+        slots[1] = output;
+        step.kernel = conv2D_gemm_step;
+        step.weight = panels;
+        double ms_gemm = bench_time(&step, slots, NULL, min_ms);
+
+        for(int tile = 2; tile <= 4; tile += 2)
+        {
+            float* u = (float*) malloc(sizeof(float) * winograd_pack_size(c->ch_out, c->ch_in, tile));
+            winograd_pack_filters(oihw, c->ch_out, c->ch_in, tile, u);
+            step.kernel = conv2D_winograd_step;
+            step.weight = u;
+            step.attr.tile = tile;
+            double ms_winograd = bench_time(&step, slots, NULL, min_ms);
+
+            // Whole batch on the pool, every sample checked
+            memset(output, 0, sizeof(float) * out_len * batch);
+            step.in.dims[0] = step.out.dims[0] = batch;
+            onnx_profile_event event;
+            int reserved = onnx_pool_scratch_reserve(pool, conv2D_scratch_size(&step)) == 0;
+            onnx_profile_begin(&event, 0);
+            step.kernel(&step, slots, pool);
+            onnx_profile_end(&event);
+            step.in.dims[0] = step.out.dims[0] = 1;
+            int ok = reserved && event.allocs == 0;
+            failed |= !ok;
+            double err = 0;
+            for(int64_t b = 0; b < batch; b++)
+            {
+                double e = bench_error(&step, input + b * in_len, ohwi, direct + b * out_len, output + b * out_len);
+                err = e > err ? e : err;
+            }
+            double bound = tile == 2 ? BENCH_BOUND_2 : BENCH_BOUND_4;
+            failed |= !(err <= bound);
+
+            // Multiplies per output against the 9 * C_in of the direct kernel
+            int64_t tiles = ((step.out.dims[ONNX_W] + tile - 1) / tile) * ((step.out.dims[ONNX_H] + tile - 1) / tile);
+            double mults = (double) tiles * (tile + 2) * (tile + 2) * c->ch_in * c->ch_out / out_len;
+            printf("%-16s %dx%d %10.2f %10.2f %10.2f %8.2f %7.2fx %10.2e %6s\n", c->name, tile, tile,
+                   flops / ms_direct / 1e6, flops / ms_gemm / 1e6, flops / ms_winograd / 1e6,
+                   ms_gemm / ms_winograd, k / mults, err, ok && err <= bound ? "ok" : "FAIL");
+            free(u);
+        }
+        step.attr.tile = 0;
+
+        free(oihw);
+        free(ohwi);
+        free(panels);
+        free(bias);
+        free(input);
+        free(direct);
+        free(output);
+    }
+    printf("(effective GFLOP/s of the direct algorithm; speedup over gemm; fewer multiplies than direct)\n");
+
+    onnx_pool_destroy(pool);
+    return failed;
+}
@@ -0,0 +1,224 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench/bench.h"
+#include "mnist/mnist.h"
+#include "onnx.h"
+#include "test/graph.h"
+
+// The same model compiled with and without the fusion pass. Reports the steps,
+// the activation bytes read and written per run, the planned arena and the
+// median latency, and checks that both plans give the same outputs. Besides
+// the MNIST models, two graphs built in memory have activations far larger
+// than L1: a conv stack on a 96x96x16 image and a 1024 wide MLP on a batch
+// of 64.
+//
+//   usage: onnx-fusion [model ...]
+//
+// Exits with 1 when the outputs differ.
+
+#define BENCH_TOLERANCE 1e-5
+#define BENCH_RUNS 2000
+#define BENCH_MIN_RUNS 20
+#define BENCH_BUDGET_MS 8000.0      // per model and batch, fewer runs for the slow ones
+
+static const char* bench_models[] = { "mnist-sm.onnx", "mnist-lg.onnx" };
+static const int64_t bench_batches[] = { 1, 32 };
+
+// Activation bytes every step reads and writes, the caller's input included
+static size_t bench_traffic(const onnx_plan* plan)
+{
+    size_t bytes = 0;
+    for(int32_t i = 0; i < plan->n_steps; i++)
+    {
+        const onnx_plan_step* step = &plan->steps[i];
+        int64_t in_len = onnx_tensor_numel(&step->in);
+        int64_t out_len = onnx_tensor_numel(&step->out);
+        bytes += sizeof(float) * (in_len * (step->input[1] >= 0 ? 2 : 1) + out_len);
+    }
+    return bytes;
+}
+
+// Median latency of each plan, their runs alternated so that both see the
+// same clock and cache conditions
+static void bench_median_us(onnx_plan** plans, const float* input, double* us)
+{
+    static double times[2][BENCH_RUNS];
+    double start = bench_now_ms();
+    onnx_plan_run(plans[0], input);
+    onnx_plan_run(plans[1], input);
+    double once = bench_now_ms() - start;
+    int runs = once * BENCH_RUNS > BENCH_BUDGET_MS ? (int) (BENCH_BUDGET_MS / once) : BENCH_RUNS;
+    runs = runs > BENCH_MIN_RUNS ? runs : BENCH_MIN_RUNS;
+    for(int r = 0; r < runs; r++)
+    {
+        for(int p = 0; p < 2; p++)
+        {
+            start = bench_now_ms();
+            onnx_plan_run(plans[p], input);
+            times[p][r] = (bench_now_ms() - start) * 1e3;
+        }
+    }
+    for(int p = 0; p < 2; p++)
+    {
+        qsort(times[p], runs, sizeof(double), bench_cmp);
+        us[p] = times[p][runs / 2];
+    }
+}
+
+// Conv 3x3 + Relu, MaxPool 2x2, Conv 3x3 + Relu on [1, 16, 96, 96]
+static test_graph* bench_conv_graph(void)
+{
+    static const int64_t dims[] = { 1, 16, 96, 96 };
+    static const int64_t kernel[] = { 3, 3 };
+    static const int64_t pads[] = { 1, 1, 1, 1 };
+    static const int64_t window[] = { 2, 2 };
+    static const int64_t dims_w1[] = { 16, 16, 3, 3 };
+    static const int64_t dims_w2[] = { 32, 16, 3, 3 };
+    static const int64_t dims_b1[] = { 16 };
+    static const int64_t dims_b2[] = { 32 };
+
+    test_graph* g = test_graph_create("conv", dims, 4);
+    test_graph_weights(g, "w1", dims_w1, 4);
+    test_graph_weights(g, "b1", dims_b1, 1);
+    test_graph_weights(g, "w2", dims_w2, 4);
+    test_graph_weights(g, "b2", dims_b2, 1);
+    Onnx__NodeProto* conv = test_graph_node(g, "Conv", NULL, "x", "w1", "b1", "conv1");
+    test_graph_ints(g, conv, "kernel_shape", kernel, 2);
+    test_graph_ints(g, conv, "pads", pads, 4);
+    test_graph_node(g, "Relu", NULL, "conv1", NULL, NULL, "relu1");
+    Onnx__NodeProto* pool = test_graph_node(g, "MaxPool", NULL, "relu1", NULL, NULL, "pool1");
+    test_graph_ints(g, pool, "kernel_shape", window, 2);
+    test_graph_ints(g, pool, "strides", window, 2);
+    conv = test_graph_node(g, "Conv", NULL, "pool1", "w2", "b2", "conv2");
+    test_graph_ints(g, conv, "kernel_shape", kernel, 2);
+    test_graph_ints(g, conv, "pads", pads, 4);
+    test_graph_node(g, "Relu", NULL, "conv2", NULL, NULL, "y");
+    test_graph_output(g, "y");
+    return g;
+}
+
+// MatMul + Add + Relu twice, 1024 wide, on a batch of 64
+static test_graph* bench_mlp_graph(void)
+{
+    static const int64_t dims[] = { 64, 1024 };
+    static const int64_t dims_w1[] = { 1024, 1024 };
+    static const int64_t dims_w2[] = { 1024, 256 };
+    static const int64_t dims_b1[] = { 1024 };
+    static const int64_t dims_b2[] = { 256 };
+
+    test_graph* g = test_graph_create("mlp", dims, 2);
+    // Scaled by 1 / sqrt(1024) to keep the outputs near the inputs
+    float* w1 = test_graph_weights(g, "w1", dims_w1, 2);
+    float* w2 = test_graph_weights(g, "w2", dims_w2, 2);
+    for(int64_t i = 0; i < 1024 * 1024; i++)
+    {
+        w1[i] /= 32;
+    }
+    for(int64_t i = 0; i < 1024 * 256; i++)
+    {
+        w2[i] /= 32;
+    }
+    test_graph_weights(g, "b1", dims_b1, 1);
+    test_graph_weights(g, "b2", dims_b2, 1);
+    test_graph_node(g, "MatMul", NULL, "x", "w1", NULL, "mm1");
+    test_graph_node(g, "Add", NULL, "mm1", "b1", NULL, "add1");
+    test_graph_node(g, "Relu", NULL, "add1", NULL, NULL, "relu1");
+    test_graph_node(g, "MatMul", NULL, "relu1", "w2", NULL, "mm2");
+    test_graph_node(g, "Add", NULL, "mm2", "b2", NULL, "add2");
+    test_graph_node(g, "Relu", NULL, "add2", NULL, NULL, "y");
+    test_graph_output(g, "y");
+    return g;
+}
+
+// One row of the table, 0 if the fused plan gives the unfused outputs; batch 0
+// keeps the model's own
+static int bench_compare(const char* name, Onnx__ModelProto* model, int64_t batch)
+{
+    onnx_plan* plans[2];
+    for(int fused = 0; fused < 2; fused++)
+    {
+        onnx_plan_set_fusion(fused);
+        plans[fused] = onnx_plan_compile_batch(model, batch);
+    }
+    onnx_plan_set_fusion(1);
+    if(plans[0] == NULL || plans[1] == NULL)
+    {
+        printf("Failed to compile model %s\n", name);
+        onnx_plan_free(plans[0]);
+        onnx_plan_free(plans[1]);
+        return 1;
+    }
+
+    // The test images, repeated over the batch and over larger samples
+    batch = plans[0]->input.dims[0];
+    int64_t in_len = onnx_tensor_sample(&plans[0]->input);
+    int64_t out_len = onnx_tensor_numel(&plans[0]->output);
+    float* input = (float*) malloc(sizeof(float) * in_len * batch);
+    float* reference = (float*) malloc(sizeof(float) * out_len);
+    for(int64_t i = 0; i < batch; i++)
+    {
+        for(int64_t j = 0; j < in_len; j++)
+        {
+            input[i * in_len + j] = img[i % TOTAL_IMAGE][j % 784];
+        }
+    }
+
+    memcpy(reference, onnx_plan_run(plans[0], input), sizeof(float) * out_len);
+    const float* output = onnx_plan_run(plans[1], input);
+    double diff = 0;
+    for(int64_t i = 0; i < out_len; i++)
+    {
+        double d = fabs(output[i] - reference[i]);
+        diff = d > diff ? d : diff;
+    }
+
+    double us[2];
+    bench_median_us(plans, input, us);
+    printf("%-14s %5ld %6d %6d %10zu %10zu %8zu %8zu %8.1f %8.1f %7.2fx %s\n", name, (long) batch,
+           plans[0]->n_steps, plans[1]->n_steps, bench_traffic(plans[0]), bench_traffic(plans[1]),
+           plans[0]->arena_bytes, plans[1]->arena_bytes, us[0], us[1], us[0] / us[1],
+           diff <= BENCH_TOLERANCE ? "" : "FAIL");
+
+    free(input);
+    free(reference);
+    onnx_plan_free(plans[0]);
+    onnx_plan_free(plans[1]);
+    return !(diff <= BENCH_TOLERANCE);
+}
+
+int main(int argc, char const *argv[])
+{
+    int n_models = argc > 1 ? argc - 1 : (int) (sizeof(bench_models) / sizeof(bench_models[0]));
+    int failed = 0;
+
+    printf("%-14s %5s %6s %6s %10s %10s %8s %8s %8s %8s %8s\n", "model", "batch", "steps", "fused",
+           "traffic", "fused", "arena", "fused", "us", "fused", "speedup");
+    for(int m = 0; m < n_models; m++)
+    {
+        const char* name = argc > 1 ? argv[m + 1] : bench_models[m];
+        Onnx__ModelProto* model = onnx_load_model(name);
+        if(model == NULL)
+        {
+            printf("Failed to load model %s\n", name);
+            return 1;
+        }
+        for(size_t b = 0; b < sizeof(bench_batches) / sizeof(bench_batches[0]); b++)
+        {
+            failed |= bench_compare(name, model, bench_batches[b]);
+        }
+        onnx__model_proto__free_unpacked(model, NULL);
+    }
+    if(argc <= 1)
+    {
+        test_graph* graphs[] = { bench_conv_graph(), bench_mlp_graph() };
+        for(size_t i = 0; i < sizeof(graphs) / sizeof(graphs[0]); i++)
+        {
+            failed |= bench_compare(graphs[i]->graph.name, &graphs[i]->model, 0);
+            test_graph_free(graphs[i]);
+        }
+    }
+    printf("(activation bytes per run and median latency of up to %d runs, unfused then fused)\n", BENCH_RUNS);
+
+    return failed;
+}
@@ -0,0 +1,295 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench/bench.h"
+#include "mnist.h"
+#include "onnx.h"
+
+// End-to-end inference over the MNIST test set: the IDX images and labels are
+// streamed from disk, batched, and run through the compiled plan for every
+// batch size and intra-op thread count. Each configuration reports accuracy,
+// images/s and the p50/p90/p99/p99.9 latency of one batch. Loading and
+// compiling are timed separately. The images are run once untimed per
+// configuration first.
+//
+//   usage: onnx-mnist-bench [model] [data dir] [batch sizes] [threads] [images] [min accuracy %]
+//
+//   e.g.   onnx-mnist-bench mnist-lg.onnx ./data 1,8,64 1,4 10000 98
+//
+// The data dir holds t10k-images-idx3-ubyte and t10k-labels-idx1-ubyte,
+// uncompressed. Without a data dir the two images from mnist.h are used.
+// Exits with 1 when the data dir does not load, when a configuration predicts
+// differently from the first one, or when its accuracy is below the minimum.
+
+#define ONNX_MODEL_NAME "mnist-lg.onnx"
+#define MNIST_IMAGES "t10k-images-idx3-ubyte"
+#define MNIST_LABELS "t10k-labels-idx1-ubyte"
+#define MNIST_IDX_IMAGES 0x00000803     // unsigned byte, 3 dims
+#define MNIST_IDX_LABELS 0x00000801     // unsigned byte, 1 dim
+#define MNIST_PIXELS (28 * 28)
+#define MNIST_CLASSES 10
+#define MNIST_MAX_CONFIGS 16
+
+typedef struct mnist_set
+{
+    int64_t count;
+    float* images;              // count x 28 x 28, scaled to [0, 1]
+    uint8_t* labels;
+} mnist_set;
+
+// Nearest rank of sorted values
+static double bench_percentile(const double* sorted, int64_t n, double p)
+{
+    int64_t rank = (int64_t) (p / 100 * n + 0.999999);
+    return sorted[(rank > 0 ? rank : 1) - 1];
+}
+
+// IDX header: magic, then one big-endian count per dim
+static int mnist_idx_header(FILE* file, uint32_t magic, uint32_t* dims, int n_dims)
+{
+    for(int i = -1; i < n_dims; i++)
+    {
+        uint8_t b[4];
+        if(fread(b, 1, 4, file) != 4)
+        {
+            return -1;
+        }
+        uint32_t v = (uint32_t) b[0] << 24 | (uint32_t) b[1] << 16 | (uint32_t) b[2] << 8 | b[3];
+        if(i < 0 && v != magic)
+        {
+            return -1;
+        }
+        if(i >= 0)
+        {
+            dims[i] = v;
+        }
+    }
+    return 0;
+}
+
+// Up to limit images of the test set in dir, 0 for all
+static int mnist_load(const char* dir, int64_t limit, mnist_set* set)
+{
+    char path[1024];
+    uint32_t dims[3], n_labels;
+    memset(set, 0, sizeof(mnist_set));
+
+    snprintf(path, sizeof(path), "%s/%s", dir, MNIST_IMAGES);
+    FILE* images = fopen(path, "rb");
+    snprintf(path, sizeof(path), "%s/%s", dir, MNIST_LABELS);
+    FILE* labels = fopen(path, "rb");
+    int status = -1;
+    if(images == NULL || labels == NULL ||
+       mnist_idx_header(images, MNIST_IDX_IMAGES, dims, 3) != 0 || dims[1] * dims[2] != MNIST_PIXELS ||
+       mnist_idx_header(labels, MNIST_IDX_LABELS, &n_labels, 1) != 0 || n_labels != dims[0])
+    {
+        goto done;
+    }
+
+    set->count = limit > 0 && limit < dims[0] ? limit : dims[0];
+    set->images = (float*) malloc(sizeof(float) * MNIST_PIXELS * set->count);
+    set->labels = (uint8_t*) malloc(set->count);
+    uint8_t pixels[MNIST_PIXELS];
+    for(int64_t i = 0; set->images != NULL && set->labels != NULL && i < set->count; i++)
+    {
+        if(fread(pixels, 1, MNIST_PIXELS, images) != MNIST_PIXELS)
+        {
+            goto done;
+        }
+        for(int p = 0; p < MNIST_PIXELS; p++)
+        {
+            set->images[i * MNIST_PIXELS + p] = pixels[p] / 255.0f;
+        }
+    }
+    if(set->images != NULL && set->labels != NULL && fread(set->labels, 1, set->count, labels) == (size_t) set->count)
+    {
+        status = 0;
+    }
+
+done:
+    if(images != NULL)
+    {
+        fclose(images);
+    }
+    if(labels != NULL)
+    {
+        fclose(labels);
+    }
+    if(status != 0)
+    {
+        free(set->images);
+        free(set->labels);
+        memset(set, 0, sizeof(mnist_set));
+    }
+    return status;
+}
+
+// The images of mnist.h
+static void mnist_builtin(mnist_set* set)
+{
+    set->count = TOTAL_IMAGE;
+    set->images = (float*) malloc(sizeof(float) * MNIST_PIXELS * set->count);
+    set->labels = (uint8_t*) malloc(set->count);
+    for(int64_t i = 0; i < set->count; i++)
+    {
+        memcpy(&set->images[i * MNIST_PIXELS], img[i], sizeof(float) * MNIST_PIXELS);
+        set->labels[i] = (uint8_t) label[i];
+    }
+}
+
+static int bench_argmax(const float* scores, int64_t n)
+{
+    int best = 0;
+    for(int64_t i = 1; i < n; i++)
+    {
+        best = scores[i] > scores[best] ? (int) i : best;
+    }
+    return best;
+}
+
+// One pass over the set in batches; the last batch is padded with zeros.
+// latency gets one entry per batch when not NULL.
+static void bench_pass(onnx_plan* plan, const mnist_set* set, int batch, float* input, uint8_t* predicted,
+                       double* latency)
+{
+    int64_t out_len = onnx_tensor_sample(&plan->output);
+    for(int64_t first = 0, b = 0; first < set->count; first += batch, b++)
+    {
+        int64_t n = set->count - first < batch ? set->count - first : batch;
+        memcpy(input, &set->images[first * MNIST_PIXELS], sizeof(float) * MNIST_PIXELS * n);
+        memset(input + n * MNIST_PIXELS, 0, sizeof(float) * MNIST_PIXELS * (batch - n));
+
+        double start = bench_now_ms();
+        const float* output = onnx_plan_run(plan, input);
+        if(latency != NULL)
+        {
+            latency[b] = bench_now_ms() - start;
+        }
+        for(int64_t i = 0; i < n; i++)
+        {
+            predicted[first + i] = (uint8_t) bench_argmax(output + i * out_len, out_len);
+        }
+    }
+}
+
+int main(int argc, char const *argv[])
+{
+    const char* name = argc > 1 ? argv[1] : ONNX_MODEL_NAME;
+    const char* dir = argc > 2 ? argv[2] : NULL;
+    int batches[MNIST_MAX_CONFIGS] = { 1, 8, 64 };
+    int threads[MNIST_MAX_CONFIGS] = { 1, onnx_pool_default_workers() + 1 };
+    int n_batches = argc > 3 ? bench_list(argv[3], batches, MNIST_MAX_CONFIGS) : 3;
+    int n_threads = argc > 4 ? bench_list(argv[4], threads, MNIST_MAX_CONFIGS) : threads[1] > 1 ? 2 : 1;
+    int64_t limit = argc > 5 ? atol(argv[5]) : 0;
+    double min_accuracy = argc > 6 ? atof(argv[6]) : 0;
+    if(n_batches <= 0 || n_threads <= 0)
+    {
+        printf("Batch sizes and thread counts are lists of positive numbers, e.g. 1,8,64\n");
+        return 1;
+    }
+
+    // 0. Test set
+    mnist_set set;
+    double start = bench_now_ms();
+    if(dir == NULL)
+    {
+        printf("No data dir; using the %d images of mnist.h\n", TOTAL_IMAGE);
+        mnist_builtin(&set);
+    }
+    else if(mnist_load(dir, limit, &set) == 0)
+    {
+        printf("%s: %ld test images in %.1f ms\n", dir, (long) set.count, bench_now_ms() - start);
+    }
+    else
+    {
+        printf("No MNIST test set in %s (%s, %s)\n", dir, MNIST_IMAGES, MNIST_LABELS);
+        return 1;
+    }
+
+    // 1. Load time, apart from inference
+    start = bench_now_ms();
+    Onnx__ModelProto* model = onnx_load_model(name);
+    double load_ms = bench_now_ms() - start;
+    if(model == NULL)
+    {
+        printf("Failed to load model %s\n", name);
+        return 1;
+    }
+    printf("%s: loaded in %.2f ms\n\n", name, load_ms);
+
+    printf("%6s %7s %10s %9s %12s %9s %9s %9s %9s %8s\n", "batch", "threads", "compile ms", "accuracy",
+           "images/s", "p50 ms", "p90 ms", "p99 ms", "p99.9 ms", "agree");
+    uint8_t* first = (uint8_t*) malloc(set.count);
+    uint8_t* predicted = (uint8_t*) malloc(set.count);
+    int failed = 0;
+    int inaccurate = 0;
+    for(int bi = 0; bi < n_batches; bi++)
+    {
+        // 2. One plan per batch size, its arena sized for it
+        int batch = batches[bi];
+        start = bench_now_ms();
+        onnx_plan* plan = onnx_plan_compile_batch(model, batch);
+        double compile_ms = bench_now_ms() - start;
+        if(plan == NULL)
+        {
+            printf("Failed to compile model %s for batch %d\n", name, batch);
+            failed = 1;
+            continue;
+        }
+        int64_t n_runs = (set.count + batch - 1) / batch;
+        float* input = (float*) malloc(sizeof(float) * MNIST_PIXELS * batch);
+        double* latency = (double*) malloc(sizeof(double) * n_runs);
+
+        for(int ti = 0; ti < n_threads; ti++)
+        {
+            onnx_pool* pool = threads[ti] > 1 ? onnx_pool_create(threads[ti] - 1, NULL) : NULL;
+            onnx_plan_set_pool(plan, pool);
+
+            // 3. Untimed pass to warm caches and the pool, then the timed one
+            bench_pass(plan, &set, batch, input, predicted, NULL);
+            start = bench_now_ms();
+            bench_pass(plan, &set, batch, input, predicted, latency);
+            double total_ms = bench_now_ms() - start;
+
+            int64_t correct = 0, agree = 0;
+            for(int64_t i = 0; i < set.count; i++)
+            {
+                correct += predicted[i] == set.labels[i];
+            }
+            if(bi == 0 && ti == 0)
+            {
+                memcpy(first, predicted, set.count);
+            }
+            for(int64_t i = 0; i < set.count; i++)
+            {
+                agree += predicted[i] == first[i];
+            }
+            failed |= agree != set.count;
+            inaccurate |= 100.0 * correct / set.count < min_accuracy;
+
+            qsort(latency, n_runs, sizeof(double), bench_cmp);
+            printf("%6d %7d %10.2f %8.2f%% %12.1f %9.3f %9.3f %9.3f %9.3f %8s\n", batch, threads[ti], compile_ms,
+                   100.0 * correct / set.count, set.count / total_ms * 1e3, bench_percentile(latency, n_runs, 50),
+                   bench_percentile(latency, n_runs, 90), bench_percentile(latency, n_runs, 99),
+                   bench_percentile(latency, n_runs, 99.9), agree == set.count ? "yes" : "NO");
+
+            onnx_plan_set_pool(plan, NULL);
+            onnx_pool_destroy(pool);
+        }
+        free(latency);
+        free(input);
+        onnx_plan_free(plan);
+    }
+    printf("\n%s\n", failed ? "Predictions differ between configurations" : "All configurations agree");
+    if(inaccurate)
+    {
+        printf("Accuracy below %.2f%%\n", min_accuracy);
+    }
+
+    free(first);
+    free(predicted);
+    free(set.images);
+    free(set.labels);
+    onnx__model_proto__free_unpacked(model, NULL);
+    return failed || inaccurate;
+}
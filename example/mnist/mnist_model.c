@@ -18,20 +18,34 @@ int main(int argc, char const *argv[])
         return -1;
     }
 
-    // 1. Initialize input
-    int64_t* shapeInput = (int64_t*) malloc(sizeof(int64_t)*3);
-    shapeInput[0] = 28; shapeInput[1] = 28; shapeInput[2] =  1;
+    // Fold constant subgraphs and drop dead nodes before compiling
+    if(onnx_model_optimize(model) < 0)
+    {
+        printf("Failed to optimize model %s\n", ONNX_MODEL_NAME);
+        return -1;
+    }
+
+    // 1. Compile the execution plan once
+    onnx_plan* plan = onnx_plan_compile(model);
+    if(plan == NULL)
+    {
+        printf("Failed to compile model %s\n", ONNX_MODEL_NAME);
+        return -1;
+    }
+    onnx_plan_info(plan);
+    printf("\n");
 
+    // 2. Initialize input
     float* input = (float*) malloc(sizeof(int64_t)*28*28);
     memcpy(input, img[MNIST_TEST_IMAGE], sizeof(float)*28*28);
 
     print_img(input);
     printf("\n");
 
-    // 2. Run Model
-    float* output = onnx_model_run(model, input, shapeInput);
+    // 3. Run Model
+    float* output = onnx_plan_run(plan, input);
 
-    // 3. Print Result
+    // 4. Print Result
     float max = 0;
     int max_index = 0;
     printf("\nPredictions: \n");
@@ -47,9 +61,9 @@ int main(int argc, char const *argv[])
     printf("\n");
     printf("\nThe number is %d\n", max_index);
 
-    // 4. Free model
-    free(shapeInput);
-    free(output);
+    // 5. Free model
+    free(input);
+    onnx_plan_free(plan);
     onnx__model_proto__free_unpacked(model, NULL);
 
     return 0;
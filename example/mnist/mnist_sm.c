@@ -17,7 +17,15 @@ int main(int argc, char const *argv[])
         return -1;
     }
 
-    // Set input image: NWHC
+    // Build name lookup tables once
+    onnx_graph_index* index = onnx_graph_index_create(model->graph);
+    if(index == NULL)
+    {
+        printf("Failed to index model %s\n", ONNX_MODEL_NAME);
+        return -1;
+    }
+
+    // Set input image: NHWC
     int img_index = 0;
     if(argc == 2)
     {
@@ -29,85 +37,82 @@ int main(int argc, char const *argv[])
     }
     print_img(img[img_index]);
 
-    // 0. Initialize input shape
-    int64_t* shapeInput = (int64_t*) malloc(sizeof(int64_t)*3);
-    int64_t* shapeOutput = (int64_t*) malloc(sizeof(int64_t)*3);
-    shapeInput[0] = 28;
-    shapeInput[1] = 28;
-    shapeInput[2] =  1;
+    // 0. Input: one 28x28 image with a single channel
+    int64_t dims[4] = { 1, 28, 28, 1 };
+    onnx_tensor input;
+    onnx_tensor_init(&input, ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT, 4, dims, (void*) img[img_index]);
 
     // 1. Transpose
-    // float* input = transpose_layer(model->graph, img[img_index], shapeInput, shapeOutput, "Transpose6");
-    // memcpy(shapeInput, shapeOutput, sizeof(int64_t)*3);
+    // onnx_tensor input_t;
+    // transpose_layer(index, &input, &input_t, "Transpose6");
 
     // 2. Conv2D
-    float* conv1 = conv2D_layer(model->graph, img[img_index], shapeInput, shapeOutput, "conv2d_5");
-    memcpy(shapeInput, shapeOutput, sizeof(int64_t)*3);
-    // free(input);
+    onnx_tensor conv1;
+    conv2D_layer(index, &input, &conv1, "conv2d_5");
 
     // 3. Relu
-    float* relu1 = relu_layer(model->graph, conv1, shapeInput, shapeOutput, "Relu1");
-    memcpy(shapeInput, shapeOutput, sizeof(int64_t)*3);
-    free(conv1);
+    onnx_tensor relu1;
+    relu_layer(index, &conv1, &relu1, "Relu1");
+    onnx_tensor_release(&conv1);
 
     // 4. Maxpool
-    float* maxpool1 = maxpool_layer(model->graph, relu1, shapeInput, shapeOutput, "max_pooling2d_5");
-    memcpy(shapeInput, shapeOutput, sizeof(int64_t)*3);
-    free(relu1);
+    onnx_tensor maxpool1;
+    maxpool_layer(index, &relu1, &maxpool1, "max_pooling2d_5");
+    onnx_tensor_release(&relu1);
 
     // 5. Conv2D
-    float* conv2 = conv2D_layer(model->graph, maxpool1, shapeInput, shapeOutput, "conv2d_6");
-    memcpy(shapeInput, shapeOutput, sizeof(int64_t)*3);
-    free(maxpool1);
+    onnx_tensor conv2;
+    conv2D_layer(index, &maxpool1, &conv2, "conv2d_6");
+    onnx_tensor_release(&maxpool1);
 
     // 6. Relu
-    float* relu2 = relu_layer(model->graph, conv2, shapeInput, shapeOutput, "Relu");
-    memcpy(shapeInput, shapeOutput, sizeof(int64_t)*3);
-    free(conv2);
+    onnx_tensor relu2;
+    relu_layer(index, &conv2, &relu2, "Relu");
+    onnx_tensor_release(&conv2);
 
     // 7. Maxpool
-    float* maxpool2 = maxpool_layer(model->graph, relu2, shapeInput, shapeOutput, "max_pooling2d_6");
-    memcpy(shapeInput, shapeOutput, sizeof(int64_t)*3);
-    free(relu2);
+    onnx_tensor maxpool2;
+    maxpool_layer(index, &relu2, &maxpool2, "max_pooling2d_6");
+    onnx_tensor_release(&relu2);
 
     // 8. Transpose
-    // float* maxpool2_t = transpose_layer(model->graph, maxpool2, shapeInput, shapeOutput, "Transpose1");
-    // memcpy(shapeInput, shapeOutput, sizeof(int64_t)*3);
-    // free(maxpool2);
+    // onnx_tensor maxpool2_t;
+    // transpose_layer(index, &maxpool2, &maxpool2_t, "Transpose1");
 
-    // 9. Flatten
-    shapeInput[1] = shapeInput[0] * shapeInput[1] * shapeInput[2]; 
-    shapeInput[2] = 1; 
-    shapeInput[0] = 1; 
+    // 9. Flatten: a view, nothing is copied
+    onnx_tensor flatten;
+    onnx_tensor_flatten(&maxpool2, 1, &flatten);
 
     // 10. Dense
-    float* matmul1 = matmul_layer(model->graph, maxpool2, shapeInput, shapeOutput, "dense_5");
-    memcpy(shapeInput, shapeOutput, sizeof(int64_t)*3);
-    free(maxpool2);
+    onnx_tensor matmul1;
+    matmul_layer(index, &flatten, &matmul1, "dense_5");
+    onnx_tensor_release(&maxpool2);
 
     // 11. Add
-    float* dense1 = add_layer(model->graph, matmul1, shapeInput, shapeOutput, "Add1");
-    memcpy(shapeInput, shapeOutput, sizeof(int64_t)*3);
-    free(matmul1);
+    onnx_tensor dense1;
+    add_layer(index, &matmul1, &dense1, "Add1");
+    onnx_tensor_release(&matmul1);
 
     // 12. Dense
-    float* matmul2 = matmul_layer(model->graph, dense1, shapeInput, shapeOutput, "dense_6");
-    memcpy(shapeInput, shapeOutput, sizeof(int64_t)*3);
-    free(dense1);
+    onnx_tensor matmul2;
+    matmul_layer(index, &dense1, &matmul2, "dense_6");
+    onnx_tensor_release(&dense1);
 
     // 13. Add
-    float* dense2 = add_layer(model->graph, matmul2, shapeInput, shapeOutput, "Add");
-    memcpy(shapeInput, shapeOutput, sizeof(int64_t)*3);
-    free(matmul2);
+    onnx_tensor dense2;
+    add_layer(index, &matmul2, &dense2, "Add");
+    onnx_tensor_release(&matmul2);
 
     // 14. Softmax
-    float* output = softmax_layer(model->graph, dense2, shapeInput, shapeOutput, "Softmax");
-    free(dense2);
+    onnx_tensor softmax;
+    softmax_layer(index, &dense2, &softmax, "Softmax");
+    onnx_tensor_release(&dense2);
 
     // 15. Identity
     // Do Nothing Here
 
     // Result
+    const float* output = (const float*) softmax.data;
     float max = 0;
     int max_index = 0;
     printf("\nPredictions: \n");
@@ -124,9 +129,8 @@ int main(int argc, char const *argv[])
     printf("\nThe number is %d\n", max_index);
 
     // Free model
-    free(shapeInput);
-    free(shapeOutput);
-    free(output);
+    onnx_tensor_release(&softmax);
+    onnx_graph_index_free(index);
     onnx__model_proto__free_unpacked(model, NULL);
 
     return 0;
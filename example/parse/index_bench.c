@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench/bench.h"
+#include "onnx-parser.h"
+#include "test/graph.h"
+
+// Name lookups on synthetic chain graphs: node i reads the output of node
+// i - 1 and a weight initializer of its own. For each size, times building
+// the index, then looking up every node name plus its weight tensor through
+// the index and, on a sample, through the linear scans.
+//
+//   usage: onnx-index-bench [sizes] [linear lookups]
+//
+//   e.g.   onnx-index-bench 10000,20000,50000 2000
+
+#define BENCH_MAX_SIZES 16
+// names holds the node, weight and output name of each node
+static test_graph* bench_chain_create(int n, const char** names)
+{
+    static const int64_t one[] = { 1 };
+    test_graph* g = test_graph_create("chain", NULL, 0);
+    for(int i = 0; i < n; i++)
+    {
+        const char* name = names[3 * i] = test_graph_name(g, "MatMul_%d", i);
+        const char* weight = names[3 * i + 1] = test_graph_name(g, "MatMul_%d_W", i);
+        const char* output = names[3 * i + 2] = test_graph_name(g, "MatMul_%d_out", i);
+        test_graph_weights(g, weight, one, 1);
+        test_graph_node(g, "MatMul", name, i == 0 ? "x" : names[3 * (i - 1) + 2], weight, NULL, output);
+    }
+    return g;
+}
+
+int main(int argc, char const *argv[])
+{
+    int sizes[BENCH_MAX_SIZES] = { 10000, 20000, 50000 };
+    int n_sizes = argc > 1 ? bench_list(argv[1], sizes, BENCH_MAX_SIZES) : 3;
+    int n_linear = argc > 2 ? atoi(argv[2]) : 2000;
+    if(n_sizes <= 0 || n_linear <= 0)
+    {
+        printf("Sizes are a list of positive numbers, e.g. 10000,20000,50000\n");
+        return 1;
+    }
+
+    printf("%8s %10s %14s %14s %10s\n", "nodes", "build ms", "index ns/op", "linear ns/op", "speedup");
+    int failed = 0;
+    for(int s = 0; s < n_sizes; s++)
+    {
+        int n = sizes[s];
+        const char** names = (const char**) malloc(sizeof(char*) * 3 * n);
+        test_graph* g = bench_chain_create(n, names);
+        Onnx__GraphProto* graph = &g->graph;
+
+        double start = bench_now_ms();
+        onnx_graph_index* index = onnx_graph_index_create(graph);
+        double build_ms = bench_now_ms() - start;
+        if(index == NULL)
+        {
+            printf("Failed to index %d nodes\n", n);
+            test_graph_free(g);
+            free(names);
+            return 1;
+        }
+
+        // Every node and its weight through the index
+        int found = 0;
+        start = bench_now_ms();
+        for(int i = 0; i < n; i++)
+        {
+            found += onnx_graph_index_get_node_by_name(index, names[3 * i]) == graph->node[i];
+            found += onnx_graph_index_get_weights_by_name(index, names[3 * i + 1]) == graph->initializer[i]->float_data;
+        }
+        double index_ns = (bench_now_ms() - start) * 1e6 / n;
+
+        // A spread sample through the linear scans, which cost O(n) each
+        int samples = n_linear < n ? n_linear : n;
+        int found_linear = 0;
+        start = bench_now_ms();
+        for(int k = 0; k < samples; k++)
+        {
+            int i = (int) ((int64_t) k * n / samples);
+            found_linear += onnx_graph_get_node_by_name(graph, names[3 * i]) == graph->node[i];
+            found_linear += onnx_graph_get_weights_by_name(graph, names[3 * i + 1]) == graph->initializer[i]->float_data;
+        }
+        double linear_ns = (bench_now_ms() - start) * 1e6 / samples;
+
+        failed |= found != 2 * n || found_linear != 2 * samples;
+        printf("%8d %10.2f %14.1f %14.1f %9.0fx\n", n, build_ms, index_ns, linear_ns, linear_ns / index_ns);
+        onnx_graph_index_free(index);
+        test_graph_free(g);
+        free(names);
+    }
+    if(failed)
+    {
+        printf("Lookups returned the wrong node or weight\n");
+    }
+    return failed;
+}
@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "onnx-parser.h"
+#include "test/graph.h"
+
+// onnx_graph_index lookups on graphs built in memory: duplicated node and
+// initializer names resolve to the first one, like the linear lookups;
+// names missing from the graph, empty or differing only in case are not
+// found; and on a chain big enough for collisions every lookup agrees with
+// the linear scan. onnx_graph_index_toposort on a diamond, a graph that is
+// already sorted, a cycle, a node reading the same tensor twice and a node
+// reading its own output.
+//
+//   usage: onnx-index
+//
+// Exits with 1 when a check fails.
+
+#define TEST_MAX_NODES 4096
+#define TEST_CHAIN 3000
+
+// One element float initializer holding value
+static void test_init(test_graph* g, const char* name, float value)
+{
+    static const int64_t one[] = { 1 };
+    *test_graph_weights(g, name, one, 1) = value;
+}
+
+// Every lookup of name through the index agrees with the linear scan
+static int test_agrees(onnx_graph_index* index, const char* name)
+{
+    Onnx__GraphProto* graph = index->graph;
+    return onnx_graph_index_get_node_by_name(index, name) == onnx_graph_get_node_by_name(graph, name) &&
+           onnx_graph_index_get_initializer_by_name(index, name) == onnx_graph_get_initializer_by_name(graph, name) &&
+           onnx_graph_index_get_weights_by_name(index, name) == onnx_graph_get_weights_by_name(graph, name) &&
+           onnx_graph_index_get_dims_by_name(index, name) == onnx_graph_get_dims_by_name(graph, name) &&
+           onnx_graph_index_get_dim_by_name(index, name) == onnx_graph_get_dim_by_name(graph, name);
+}
+
+static int test_duplicates(void)
+{
+    int failed = 0;
+    test_graph* g = test_graph_create("test", NULL, 0);
+    test_init(g, "w", 1.0f);
+    test_init(g, "v", 2.0f);
+    test_init(g, "w", 3.0f);
+    test_graph_node(g, "Add", "a", "x", "w", NULL, "y0");
+    test_graph_node(g, "Add", "b", "y0", "v", NULL, "y1");
+    test_graph_node(g, "Add", "a", "y1", "w", NULL, "y2");
+
+    onnx_graph_index* index = onnx_graph_index_create(&g->graph);
+    if(index == NULL)
+    {
+        return test_check(0, "index of a graph with duplicates");
+    }
+    float* w = onnx_graph_index_get_weights_by_name(index, "w");
+    failed |= test_check(onnx_graph_index_get_node_by_name(index, "a") == g->graph.node[0] && test_agrees(index, "a"),
+                         "duplicated node name resolves to the first");
+    failed |= test_check(onnx_graph_index_get_initializer_by_name(index, "w") == g->graph.initializer[0] &&
+                         w != NULL && *w == 1.0f && test_agrees(index, "w"),
+                         "duplicated initializer resolves to the first");
+
+    int32_t t = onnx_graph_index_get_tensor_id(index, "w");
+    int32_t n_consumers;
+    const int32_t* consumers = onnx_graph_index_get_consumers(index, t, &n_consumers);
+    failed |= test_check(t >= 0 && index->initializer_ids[t] == 0 && n_consumers == 2 && consumers[0] == 0 && consumers[1] == 2,
+                         "duplicated initializer is one tensor");
+    onnx_graph_index_free(index);
+    test_graph_free(g);
+    return failed;
+}
+
+static int test_missing(void)
+{
+    int failed = 0;
+    test_graph* g = test_graph_create("test", NULL, 0);
+    test_init(g, "w", 1.0f);
+    test_graph_node(g, "Add", "a", "x", "w", NULL, "y");
+
+    onnx_graph_index* index = onnx_graph_index_create(&g->graph);
+    if(index == NULL)
+    {
+        return test_check(0, "index of a small graph");
+    }
+    static const char* missing[] = { "missing", "", "W", "A", "w ", "y0" };
+    int ok = 1;
+    for(size_t i = 0; i < sizeof(missing) / sizeof(missing[0]); i++)
+    {
+        const char* name = missing[i];
+        ok &= onnx_graph_index_get_node_by_name(index, name) == NULL &&
+              onnx_graph_index_get_initializer_by_name(index, name) == NULL &&
+              onnx_graph_index_get_view_by_name(index, name) == NULL &&
+              onnx_graph_index_get_weights_by_name(index, name) == NULL &&
+              onnx_graph_index_get_dims_by_name(index, name) == NULL &&
+              onnx_graph_index_get_dim_by_name(index, name) == -1 &&
+              onnx_graph_index_get_tensor_id(index, name) == -1 && test_agrees(index, name);
+    }
+    failed |= test_check(ok, "missing, empty and other-case names not found");
+
+    int32_t n_consumers = 1;
+    ok = onnx_graph_index_get_producer(index, -1) == -1 && onnx_graph_index_get_producer(index, index->n_tensors) == -1 &&
+         onnx_graph_index_get_consumers(index, -1, &n_consumers) == NULL && n_consumers == 0;
+    n_consumers = 1;
+    ok &= onnx_graph_index_get_consumers(index, index->n_tensors, &n_consumers) == NULL && n_consumers == 0;
+    failed |= test_check(ok, "out of range tensor ids have no edges");
+    onnx_graph_index_free(index);
+    test_graph_free(g);
+    return failed;
+}
+
+// A chain of TEST_CHAIN nodes with a weight each, every name looked up
+static int test_chain(void)
+{
+    static char* names[3 * TEST_CHAIN];
+    test_graph* g = test_graph_create("test", NULL, 0);
+    const char* previous = "x";
+    for(int i = 0; i < TEST_CHAIN; i++)
+    {
+        char* weight = names[3 * i] = test_graph_name(g, "w%d", i);
+        char* output = names[3 * i + 1] = test_graph_name(g, "t%d", i);
+        char* name = names[3 * i + 2] = test_graph_name(g, "n%d", i);
+        test_init(g, weight, (float) i);
+        test_graph_node(g, "Add", name, previous, weight, NULL, output);
+        previous = output;
+    }
+
+    onnx_graph_index* index = onnx_graph_index_create(&g->graph);
+    int ok = index != NULL && index->n_order == TEST_CHAIN;
+    for(int i = 0; ok && i < 3 * TEST_CHAIN; i++)
+    {
+        ok &= test_agrees(index, names[i]);
+    }
+    char probe[32];
+    for(int i = 0; ok && i < TEST_CHAIN; i++)
+    {
+        snprintf(probe, sizeof(probe), "n%d_", i);
+        ok &= onnx_graph_index_get_node_by_name(index, probe) == NULL && test_agrees(index, probe);
+    }
+    onnx_graph_index_free(index);
+    test_graph_free(g);
+
+    char what[64];
+    snprintf(what, sizeof(what), "%d node chain agrees with the linear scan", TEST_CHAIN);
+    return test_check(ok, what);
+}
+
+// Sorts the graph and compares with expected, which holds the n sortable
+// nodes in the order they must come out
+static int test_sorted(test_graph* g, const int32_t* expected, int32_t n, const char* what)
+{
+    onnx_graph_index* index = onnx_graph_index_create(&g->graph);
+    int32_t order[TEST_MAX_NODES];
+    int32_t n_order = index != NULL ? onnx_graph_index_toposort(index, order) : -1;
+    int ok = index != NULL && n_order == n && index->n_order == n && memcmp(order, expected, sizeof(int32_t) * n) == 0 &&
+             memcmp(index->order, expected, sizeof(int32_t) * n) == 0;
+    onnx_graph_index_free(index);
+    test_graph_free(g);
+    return test_check(ok, what);
+}
+
+static int test_toposort(void)
+{
+    int failed = 0;
+
+    // x -> a -> (b, c) -> d, listed as d, c, a, b
+    test_graph* g = test_graph_create("test", NULL, 0);
+    test_graph_node(g, "Add", "d", "q", "r", NULL, "y");
+    test_graph_node(g, "Add", "c", "p", NULL, NULL, "r");
+    test_graph_node(g, "Add", "a", "x", NULL, NULL, "p");
+    test_graph_node(g, "Add", "b", "p", NULL, NULL, "q");
+    static const int32_t diamond[] = { 2, 1, 3, 0 };
+    failed |= test_sorted(g, diamond, 4, "diamond");
+
+    // Edges 0 -> 3 and 1 -> 2 keep the graph order
+    g = test_graph_create("test", NULL, 0);
+    test_graph_node(g, "Add", "n0", "x", NULL, NULL, "t0");
+    test_graph_node(g, "Add", "n1", "x", NULL, NULL, "t1");
+    test_graph_node(g, "Add", "n2", "t1", NULL, NULL, "y2");
+    test_graph_node(g, "Add", "n3", "t0", NULL, NULL, "y3");
+    static const int32_t sorted[] = { 0, 1, 2, 3 };
+    failed |= test_sorted(g, sorted, 4, "sorted graph keeps its order");
+
+    // a and b feed each other; c is outside the cycle
+    g = test_graph_create("test", NULL, 0);
+    test_graph_node(g, "Add", "a", "x", "q", NULL, "p");
+    test_graph_node(g, "Add", "b", "p", NULL, NULL, "q");
+    test_graph_node(g, "Add", "c", "x", NULL, NULL, "z");
+    static const int32_t cycle[] = { 2 };
+    failed |= test_sorted(g, cycle, 1, "cycle left out");
+
+    // b reads p twice, c comes after it
+    g = test_graph_create("test", NULL, 0);
+    test_graph_node(g, "Add", "c", "y", NULL, NULL, "z");
+    test_graph_node(g, "Add", "a", "x", NULL, NULL, "p");
+    test_graph_node(g, "Add", "b", "p", "p", NULL, "y");
+    static const int32_t twice[] = { 1, 2, 0 };
+    failed |= test_sorted(g, twice, 3, "same tensor read twice");
+
+    // b reads its own output, and c reads b's
+    g = test_graph_create("test", NULL, 0);
+    test_graph_node(g, "Add", "a", "x", NULL, NULL, "p");
+    test_graph_node(g, "Add", "b", "p", "y", NULL, "y");
+    test_graph_node(g, "Add", "c", "y", NULL, NULL, "z");
+    static const int32_t self[] = { 0 };
+    failed |= test_sorted(g, self, 1, "node reading its own output left out");
+
+    return failed;
+}
+
+int main(int argc, char const *argv[])
+{
+    int failed = 0;
+    failed |= test_duplicates();
+    failed |= test_missing();
+    failed |= test_chain();
+    failed |= test_toposort();
+    return failed;
+}
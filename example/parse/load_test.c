@@ -0,0 +1,239 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "onnx-parser.h"
+
+// Loads the same model with onnx_load_model, onnx_load_model_arena and
+// onnx_load_model_mmap and compares every initializer: type, dims, each
+// storage field and the viewed payload, byte for byte. raw_data of the mmap
+// load must point into the file mapping, the others must be copies. The
+// MNIST models store their weights in float_data, so each is also repacked
+// to a temporary file with the weights moved to raw_data. Last, several
+// threads load and unload models at once, as a service swapping models does.
+//
+//   usage: onnx-load [model ...]
+//
+// Exits with 1 on any mismatch.
+
+#define TEST_THREADS 4
+#define TEST_SWAPS 200
+
+static const char* test_models[] = { "mnist-lg.onnx", "mnist-sm.onnx" };
+
+static int test_same(const void* a, const void* b, size_t bytes)
+{
+    return bytes == 0 || memcmp(a, b, bytes) == 0;
+}
+
+static int test_inside(const void* p, const unsigned char* map, size_t map_size)
+{
+    return map != NULL && (const unsigned char*) p >= map && (const unsigned char*) p < map + map_size;
+}
+
+// Storage fields and viewed payload of two initializers
+static int test_same_tensor(Onnx__TensorProto* a, Onnx__TensorProto* b)
+{
+    if(strcmp(a->name, b->name) != 0 || a->data_type != b->data_type || a->n_dims != b->n_dims ||
+       !test_same(a->dims, b->dims, sizeof(int64_t) * a->n_dims) ||
+       a->raw_data.len != b->raw_data.len || !test_same(a->raw_data.data, b->raw_data.data, a->raw_data.len) ||
+       a->n_float_data != b->n_float_data || !test_same(a->float_data, b->float_data, sizeof(float) * a->n_float_data) ||
+       a->n_double_data != b->n_double_data || !test_same(a->double_data, b->double_data, sizeof(double) * a->n_double_data) ||
+       a->n_int32_data != b->n_int32_data || !test_same(a->int32_data, b->int32_data, sizeof(int32_t) * a->n_int32_data) ||
+       a->n_int64_data != b->n_int64_data || !test_same(a->int64_data, b->int64_data, sizeof(int64_t) * a->n_int64_data) ||
+       a->n_uint64_data != b->n_uint64_data || !test_same(a->uint64_data, b->uint64_data, sizeof(uint64_t) * a->n_uint64_data))
+    {
+        return 0;
+    }
+
+    onnx_tensor_view va, vb;
+    int ok_a = onnx_tensor_view_init(a, &va) == 0;
+    int ok_b = onnx_tensor_view_init(b, &vb) == 0;
+    int same = ok_a == ok_b && (!ok_a || (va.n_elem == vb.n_elem && test_same(va.data, vb.data, va.n_elem * va.elem_size)));
+    if(ok_a)
+    {
+        onnx_tensor_view_release(&va);
+    }
+    if(ok_b)
+    {
+        onnx_tensor_view_release(&vb);
+    }
+    return same;
+}
+
+static int test_model(const char* name)
+{
+    Onnx__ModelProto* models[3] = { onnx_load_model(name), onnx_load_model_arena(name), onnx_load_model_mmap(name) };
+    const char* loaders[3] = { "onnx_load_model", "onnx_load_model_arena", "onnx_load_model_mmap" };
+    int failed = 0;
+    for(int l = 0; l < 3; l++)
+    {
+        if(models[l] == NULL || models[l]->graph == NULL)
+        {
+            printf("%s: %s failed\n", name, loaders[l]);
+            failed = 1;
+        }
+    }
+
+    size_t map_size = 0, other_size;
+    const unsigned char* map = failed ? NULL : onnx_model_mapping(models[2], &map_size);
+    if(!failed && (map == NULL || onnx_model_mapping(models[0], &other_size) != NULL ||
+                   onnx_model_mapping(models[1], &other_size) != NULL))
+    {
+        printf("%s: only the mmap load should keep a mapping\n", name);
+        failed = 1;
+    }
+
+    int64_t n_raw = 0, n_aliased = 0;
+    for(int i = 0; !failed && i < models[0]->graph->n_initializer; i++)
+    {
+        if(models[1]->graph->n_initializer != models[0]->graph->n_initializer ||
+           models[2]->graph->n_initializer != models[0]->graph->n_initializer)
+        {
+            printf("%s: loaders disagree on the number of initializers\n", name);
+            failed = 1;
+            break;
+        }
+        Onnx__TensorProto* tensors[3] = { models[0]->graph->initializer[i], models[1]->graph->initializer[i], models[2]->graph->initializer[i] };
+        for(int l = 1; l < 3; l++)
+        {
+            if(!test_same_tensor(tensors[0], tensors[l]))
+            {
+                printf("%s: initializer %s differs with %s\n", name, tensors[0]->name, loaders[l]);
+                failed = 1;
+            }
+        }
+
+        if(tensors[0]->raw_data.len > 0)
+        {
+            n_raw++;
+            n_aliased += test_inside(tensors[2]->raw_data.data, map, map_size);
+            if(!test_inside(tensors[2]->raw_data.data, map, map_size) ||
+               test_inside(tensors[0]->raw_data.data, map, map_size) || test_inside(tensors[1]->raw_data.data, map, map_size))
+            {
+                printf("%s: raw_data of %s not where expected\n", name, tensors[0]->name);
+                failed = 1;
+            }
+        }
+    }
+    if(!failed)
+    {
+        printf("%s: %ld initializers match, raw_data of %ld of %ld in the mapping\n", name,
+               (long) models[0]->graph->n_initializer, (long) n_aliased, (long) n_raw);
+    }
+
+    for(int l = 0; l < 3; l++)
+    {
+        onnx_unload_model(models[l]);
+    }
+    return failed;
+}
+
+// name with float_data weights moved to raw_data, packed to path
+static int test_write_raw(const char* name, const char* path, int fd)
+{
+    Onnx__ModelProto* model = onnx_load_model(name);
+    if(fd < 0 || model == NULL)
+    {
+        return -1;
+    }
+    Onnx__GraphProto* graph = model->graph;
+    size_t* n_floats = (size_t*) calloc(graph->n_initializer + 1, sizeof(size_t));
+    for(int i = 0; i < graph->n_initializer; i++)
+    {
+        Onnx__TensorProto* tensor = graph->initializer[i];
+        n_floats[i] = tensor->n_float_data;
+        if(n_floats[i] == 0)
+        {
+            continue;
+        }
+        tensor->raw_data.data = (uint8_t*) tensor->float_data;
+        tensor->raw_data.len = sizeof(float) * tensor->n_float_data;
+        tensor->has_raw_data = 1;
+        tensor->n_float_data = 0;
+    }
+
+    size_t size = onnx__model_proto__get_packed_size(model);
+    uint8_t* buffer = (uint8_t*) malloc(size);
+    onnx__model_proto__pack(model, buffer);
+    int status = write(fd, buffer, size) == (ssize_t) size ? 0 : -1;
+    close(fd);
+    free(buffer);
+
+    // Back to what free_unpacked expects
+    for(int i = 0; i < graph->n_initializer; i++)
+    {
+        graph->initializer[i]->raw_data.data = NULL;
+        graph->initializer[i]->raw_data.len = 0;
+        graph->initializer[i]->has_raw_data = 0;
+        graph->initializer[i]->n_float_data = n_floats[i];
+    }
+    free(n_floats);
+    onnx__model_proto__free_unpacked(model, NULL);
+    if(status != 0)
+    {
+        printf("Failed to write %s\n", path);
+    }
+    return status;
+}
+
+// Loads and unloads in a loop, each model checked against its own allocator
+static void* test_swap(void* arg)
+{
+    const char* name = (const char*) arg;
+    intptr_t failed = 0;
+    for(int i = 0; i < TEST_SWAPS; i++)
+    {
+        Onnx__ModelProto* model = i % 2 == 0 ? onnx_load_model_mmap(name) : onnx_load_model_arena(name);
+        size_t map_size;
+        failed |= model == NULL || onnx_model_allocator(model) == NULL ||
+                  (onnx_model_mapping(model, &map_size) != NULL) != (i % 2 == 0);
+        onnx_unload_model(model);
+    }
+    return (void*) failed;
+}
+
+static int test_threads(void)
+{
+    pthread_t threads[TEST_THREADS];
+    int failed = 0;
+    for(int t = 0; t < TEST_THREADS; t++)
+    {
+        failed |= pthread_create(&threads[t], NULL, test_swap, (void*) test_models[t % 2]) != 0;
+    }
+    for(int t = 0; t < TEST_THREADS; t++)
+    {
+        void* result;
+        pthread_join(threads[t], &result);
+        failed |= result != NULL;
+    }
+    printf("%d threads, %d loads and unloads each: %s\n", TEST_THREADS, TEST_SWAPS, failed ? "FAIL" : "ok");
+    return failed;
+}
+
+int main(int argc, char const *argv[])
+{
+    int failed = 0;
+    if(argc > 1)
+    {
+        for(int i = 1; i < argc; i++)
+        {
+            failed |= test_model(argv[i]);
+        }
+    }
+    else
+    {
+        for(size_t i = 0; i < sizeof(test_models) / sizeof(test_models[0]); i++)
+        {
+            failed |= test_model(test_models[i]);
+
+            char path[] = "/tmp/onnx-load-XXXXXX";
+            failed |= test_write_raw(test_models[i], path, mkstemp(path)) != 0 || test_model(path);
+            unlink(path);
+        }
+        failed |= test_threads();
+    }
+    printf("%s\n", failed ? "FAIL" : "All loaders agree");
+    return failed;
+}
@@ -0,0 +1,198 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "onnx.h"
+#include "test/graph.h"
+
+// onnx_model_optimize on a small model holding the usual exporter leftovers:
+// a Reshape target computed by Shape/Gather/Constant/Concat, a transposed
+// MatMul weight, a bias behind an Identity chain and a Mul, and a branch no
+// output reads. The model is packed to a file and loaded both ways, so folded
+// initializers are allocated from the system and from the load arena. Checks
+// what is left of the graph and that plan and interpreter outputs match a
+// plain reference afterwards; the backend has no Shape or Gather kernels, so
+// the graph only runs once folded.
+//
+//   usage: onnx-optimize
+//
+// Exits with 1 on any mismatch.
+
+#define TEST_K 12
+#define TEST_N 5
+#define TEST_TOLERANCE 1e-5
+
+// y = Relu(Reshape(x) @ Transpose(wt) + Identity(Identity(b)) * 2)
+static test_graph* test_build(float** wt, float** b)
+{
+    static const int64_t zero[] = { 0 };
+    static const int64_t k[] = { TEST_K };
+    static const int64_t perm[] = { 1, 0 };
+    static const int64_t dims_x[] = { 1, TEST_K };
+    static const int64_t dims_c[] = { 1, 3 };
+    static const int64_t dims_wt[] = { TEST_N, TEST_K };
+    static const int64_t dims_b[] = { TEST_N };
+    static const int64_t dims_dead[] = { 4 };
+
+    test_graph* g = test_graph_create("optimize", dims_x, 2);
+    test_graph_output(g, "y");
+
+    // Listed out of order on purpose
+    test_graph_node(g, "Relu", NULL, "biased", NULL, NULL, "y");
+
+    // Reshape target [1, K]: batch from Shape(c)[0], K from a Constant
+    test_graph_weights(g, "c", dims_c, 2);
+    test_graph_node(g, "Shape", NULL, "c", NULL, NULL, "c_shape");
+    test_graph_ints(g, test_graph_node(g, "Constant", NULL, NULL, NULL, NULL, "zero"), "value_ints", zero, 1);
+    test_graph_node(g, "Gather", NULL, "c_shape", "zero", NULL, "batch");
+    test_graph_ints(g, test_graph_node(g, "Constant", NULL, NULL, NULL, NULL, "k"), "value_ints", k, 1);
+    test_graph_int(g, test_graph_node(g, "Concat", NULL, "batch", "k", NULL, "target"), "axis", 0);
+    test_graph_node(g, "Reshape", NULL, "x", "target", NULL, "flat");
+
+    // Weights stored [N, K], transposed for MatMul
+    *wt = test_graph_weights(g, "wt", dims_wt, 2);
+    test_graph_ints(g, test_graph_node(g, "Transpose", NULL, "wt", NULL, NULL, "w"), "perm", perm, 2);
+    test_graph_node(g, "MatMul", NULL, "flat", "w", NULL, "product");
+
+    // Bias through an Identity chain, doubled by a scalar Constant
+    *b = test_graph_weights(g, "b", dims_b, 1);
+    test_graph_node(g, "Identity", NULL, "b", NULL, NULL, "b1");
+    test_graph_node(g, "Identity", NULL, "b1", NULL, NULL, "b2");
+    test_graph_float(g, test_graph_node(g, "Constant", NULL, NULL, NULL, NULL, "two"), "value_float", 2);
+    test_graph_node(g, "Mul", NULL, "b2", "two", NULL, "bias");
+    test_graph_node(g, "Add", NULL, "product", "bias", NULL, "biased");
+
+    // Nothing reads these
+    test_graph_node(g, "Softmax", NULL, "product", NULL, NULL, "unused");
+    test_graph_weights(g, "dead", dims_dead, 1);
+    test_graph_node(g, "Sub", NULL, "dead", "b", NULL, "dead_diff");
+    return g;
+}
+
+static double test_error(const float* output, const float* expected)
+{
+    double worst = output == NULL ? INFINITY : 0;
+    for(int j = 0; output != NULL && j < TEST_N; j++)
+    {
+        double err = fabs(output[j] - expected[j]);
+        worst = err > worst ? err : worst;
+    }
+    return worst;
+}
+
+// Worst error of the plan and of onnx_model_run
+static double test_run(Onnx__ModelProto* model, const float* x, const float* expected)
+{
+    double worst = INFINITY;
+    onnx_plan* plan = onnx_plan_compile(model);
+    if(plan != NULL)
+    {
+        worst = test_error(onnx_plan_run(plan, x), expected);
+        onnx_plan_free(plan);
+    }
+
+    int64_t dims[] = { 1, TEST_K };
+    onnx_tensor input, output;
+    onnx_tensor_init(&input, ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT, 2, dims, (void*) x);
+    double err = INFINITY;
+    if(onnx_model_run(model, &input, &output) == 0)
+    {
+        err = test_error((const float*) output.data, expected);
+        onnx_tensor_release(&output);
+    }
+    return err > worst ? err : worst;
+}
+
+static int test_has(Onnx__GraphProto* graph, const char* name)
+{
+    for(size_t i = 0; i < graph->n_node; i++)
+    {
+        if(strcmp(graph->node[i]->output[0], name) == 0)
+        {
+            return 1;
+        }
+    }
+    for(size_t i = 0; i < graph->n_initializer; i++)
+    {
+        if(strcmp(graph->initializer[i]->name, name) == 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char const *argv[])
+{
+    float *wt, *b;
+    test_graph* g = test_build(&wt, &b);
+
+    float x[TEST_K], expected[TEST_N];
+    for(int i = 0; i < TEST_K; i++)
+    {
+        x[i] = (float) rand() / RAND_MAX - 0.5f;
+    }
+    for(int j = 0; j < TEST_N; j++)
+    {
+        double acc = 2.0 * b[j];
+        for(int i = 0; i < TEST_K; i++)
+        {
+            acc += x[i] * wt[j * TEST_K + i];
+        }
+        expected[j] = acc < 0 ? 0 : (float) acc;
+    }
+
+    char path[] = "/tmp/onnx-optimize-XXXXXX";
+    int fd = mkstemp(path);
+    size_t size = onnx__model_proto__get_packed_size(&g->model);
+    uint8_t* buffer = (uint8_t*) malloc(size);
+    onnx__model_proto__pack(&g->model, buffer);
+    if(fd < 0 || write(fd, buffer, size) != (ssize_t) size)
+    {
+        printf("Failed to write %s\n", path);
+        return 1;
+    }
+    close(fd);
+    free(buffer);
+    test_graph_free(g);
+
+    // Kept: Reshape, MatMul, Add, Relu reading x, target, w and bias
+    static const char* kept[] = { "flat", "product", "biased", "y", "target", "w", "bias" };
+    static const char* gone[] = { "c", "c_shape", "zero", "batch", "k", "wt", "b", "b1", "b2", "two", "unused", "dead", "dead_diff" };
+    const char* loaders[] = { "onnx_load_model", "onnx_load_model_mmap" };
+    int failed = 0;
+
+    for(int l = 0; l < 2; l++)
+    {
+        Onnx__ModelProto* model = l == 0 ? onnx_load_model(path) : onnx_load_model_mmap(path);
+        if(model == NULL)
+        {
+            failed = 1;
+            continue;
+        }
+        int32_t n_nodes = model->graph->n_node;
+        int32_t n_initializers = model->graph->n_initializer;
+        int removed = onnx_model_optimize(model);
+        int again = onnx_model_optimize(model);
+        double after = test_run(model, x, expected);
+
+        int ok = removed == n_nodes - 4 && again == 0 && model->graph->n_node == 4 && model->graph->n_initializer == 3 &&
+                 after <= TEST_TOLERANCE;
+        for(size_t i = 0; i < sizeof(kept) / sizeof(kept[0]); i++)
+        {
+            ok &= test_has(model->graph, kept[i]);
+        }
+        for(size_t i = 0; i < sizeof(gone) / sizeof(gone[0]); i++)
+        {
+            ok &= !test_has(model->graph, gone[i]);
+        }
+        failed |= !ok;
+
+        printf("%-22s nodes %2d -> %2zu  initializers %d -> %zu  error %.2e  %s\n", loaders[l], n_nodes,
+               model->graph->n_node, n_initializers, model->graph->n_initializer, after, ok ? "ok" : "FAIL");
+        onnx_unload_model(model);
+    }
+    unlink(path);
+
+    return failed;
+}
@@ -11,7 +11,7 @@ int main(int argc, char const *argv[])
     printf("\n");
 
     // Load Model
-    Onnx__ModelProto* model = onnx_load_model(argv[1]);
+    Onnx__ModelProto* model = onnx_load_model_mmap(argv[1]);
 
     // Print Model Info
     if( model != NULL)
@@ -40,7 +40,7 @@ int main(int argc, char const *argv[])
     // printf("\n");
 
     // Free Model
-    onnx__model_proto__free_unpacked(model, NULL);
+    onnx_unload_model(model);
 
     return 0;
 }
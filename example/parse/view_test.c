@@ -0,0 +1,167 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "onnx-parser.h"
+#include "test/graph.h"
+
+// onnx_tensor_view_init and onnx_tensor_view_to_float on TensorProtos built
+// in memory: raw_data in place and through the copy taken when it is
+// misaligned, float16 including subnormals, infinities and NaN, int32_data
+// narrowed to int8/int16/uint16, uint64_data narrowed to uint32, and payloads
+// whose size does not match their dims, which must be refused.
+//
+//   usage: onnx-tensor-view
+//
+// Exits with 1 when a check fails.
+
+static void test_tensor(Onnx__TensorProto* tensor, Onnx__TensorProto__DataType type, int64_t* dims, size_t n_dims)
+{
+    onnx__tensor_proto__init(tensor);
+    tensor->name = (char*) "t";
+    tensor->data_type = type;
+    tensor->dims = dims;
+    tensor->n_dims = n_dims;
+}
+
+// Views tensor and converts it; values NULL when it must be refused
+static int test_view(Onnx__TensorProto* tensor, const float* values, size_t n, int in_place)
+{
+    onnx_tensor_view view;
+    int status = onnx_tensor_view_init(tensor, &view);
+    if(values == NULL)
+    {
+        if(status == 0)
+        {
+            onnx_tensor_view_release(&view);
+        }
+        return status != 0;
+    }
+    if(status != 0 || view.n_elem != n || (view.owned == NULL) != in_place)
+    {
+        return 0;
+    }
+
+    float* output = onnx_tensor_view_to_float(&view);
+    int ok = output != NULL;
+    for(size_t i = 0; ok && i < n; i++)
+    {
+        // Bits, so that -0 and NaN are told apart too
+        ok = memcmp(&output[i], &values[i], sizeof(float)) == 0;
+    }
+    free(output);
+    onnx_tensor_view_release(&view);
+    return ok;
+}
+
+int main(int argc, char const *argv[])
+{
+    int failed = 0;
+    Onnx__TensorProto tensor;
+    int64_t dims[2] = { 2, 3 };
+
+    // 1. raw_data: aligned in place, misaligned copied
+    static const float floats[6] = { 1.5f, -2.0f, 0.0f, 3.25f, -0.5f, 1e-3f };
+    unsigned char* buffer = (unsigned char*) malloc(sizeof(floats) + sizeof(float));
+    test_tensor(&tensor, ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT, dims, 2);
+    tensor.raw_data.len = sizeof(floats);
+    tensor.raw_data.data = buffer;
+    memcpy(buffer, floats, sizeof(floats));
+    failed |= test_check(test_view(&tensor, floats, 6, 1), "aligned raw_data viewed in place");
+    tensor.raw_data.data = buffer + 1;
+    memcpy(buffer + 1, floats, sizeof(floats));
+    failed |= test_check(test_view(&tensor, floats, 6, 0), "misaligned raw_data copied");
+
+    // 2. float16, in int32_data and in raw_data
+    static const uint16_t halves[6] = { 0x3c00, 0x8000, 0x0001, 0x03ff, 0x7c00, 0xfc00 };
+    const float expected_halves[6] = { 1.0f, -0.0f, ldexpf(1.0f, -24), ldexpf(1023.0f, -24), INFINITY, -INFINITY };
+    int32_t half_words[6];
+    for(int i = 0; i < 6; i++)
+    {
+        half_words[i] = halves[i];
+    }
+    test_tensor(&tensor, ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT16, dims, 2);
+    tensor.int32_data = half_words;
+    tensor.n_int32_data = 6;
+    failed |= test_check(test_view(&tensor, expected_halves, 6, 0), "float16 in int32_data: one, -0, subnormals, inf");
+    test_tensor(&tensor, ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT16, dims, 2);
+    tensor.raw_data.len = sizeof(halves);
+    tensor.raw_data.data = (uint8_t*) halves;
+    failed |= test_check(test_view(&tensor, expected_halves, 6, 1), "float16 in raw_data");
+
+    static const uint16_t more_halves[2] = { 0x7bff, 0xc000 };
+    const float expected_more[2] = { 65504.0f, -2.0f };
+    int64_t two = 2;
+    test_tensor(&tensor, ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT16, &two, 1);
+    tensor.raw_data.len = sizeof(more_halves);
+    tensor.raw_data.data = (uint8_t*) more_halves;
+    failed |= test_check(test_view(&tensor, expected_more, 2, 1), "float16 largest normal and negative");
+
+    uint16_t nan_half = 0x7e00;
+    int64_t one = 1;
+    onnx_tensor_view view;
+    test_tensor(&tensor, ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT16, &one, 1);
+    tensor.raw_data.len = sizeof(nan_half);
+    tensor.raw_data.data = (uint8_t*) &nan_half;
+    float* nan_float = onnx_tensor_view_init(&tensor, &view) == 0 ? onnx_tensor_view_to_float(&view) : NULL;
+    failed |= test_check(nan_float != NULL && isnan(nan_float[0]), "float16 NaN");
+    free(nan_float);
+    onnx_tensor_view_release(&view);
+
+    // 3. int32_data narrowed to the element size
+    int32_t words[6] = { -128, 127, -1, 0, 5, -7 };
+    const float expected_int8[6] = { -128, 127, -1, 0, 5, -7 };
+    test_tensor(&tensor, ONNX__TENSOR_PROTO__DATA_TYPE__INT8, dims, 2);
+    tensor.int32_data = words;
+    tensor.n_int32_data = 6;
+    failed |= test_check(test_view(&tensor, expected_int8, 6, 0), "int32_data narrowed to int8");
+
+    int32_t shorts[6] = { -32768, 32767, -1, 0, 300, -300 };
+    const float expected_int16[6] = { -32768, 32767, -1, 0, 300, -300 };
+    test_tensor(&tensor, ONNX__TENSOR_PROTO__DATA_TYPE__INT16, dims, 2);
+    tensor.int32_data = shorts;
+    tensor.n_int32_data = 6;
+    failed |= test_check(test_view(&tensor, expected_int16, 6, 0), "int32_data narrowed to int16");
+
+    int32_t ushorts[6] = { 65535, 0, 1, 32768, 40000, 12 };
+    const float expected_uint16[6] = { 65535, 0, 1, 32768, 40000, 12 };
+    test_tensor(&tensor, ONNX__TENSOR_PROTO__DATA_TYPE__UINT16, dims, 2);
+    tensor.int32_data = ushorts;
+    tensor.n_int32_data = 6;
+    failed |= test_check(test_view(&tensor, expected_uint16, 6, 0), "int32_data narrowed to uint16");
+
+    // 4. uint64_data narrowed to uint32
+    uint64_t longs[6] = { 4294967295ull, 0, 1, 2147483648ull, 65536, 7 };
+    const float expected_uint32[6] = { 4294967295.0f, 0, 1, 2147483648.0f, 65536, 7 };
+    test_tensor(&tensor, ONNX__TENSOR_PROTO__DATA_TYPE__UINT32, dims, 2);
+    tensor.uint64_data = longs;
+    tensor.n_uint64_data = 6;
+    failed |= test_check(test_view(&tensor, expected_uint32, 6, 0), "uint64_data narrowed to uint32");
+    onnx_tensor_view_init(&tensor, &view);
+    failed |= test_check(view.elem_size == 4 && ((const uint32_t*) view.data)[0] == 4294967295u, "uint32 elements are 4 bytes");
+    onnx_tensor_view_release(&view);
+
+    // 5. Payloads that do not match their dims
+    test_tensor(&tensor, ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT, dims, 2);
+    tensor.raw_data.len = sizeof(floats) - sizeof(float);
+    tensor.raw_data.data = buffer;
+    failed |= test_check(test_view(&tensor, NULL, 0, 0), "short raw_data refused");
+    tensor.raw_data.len = sizeof(floats) + 1;
+    failed |= test_check(test_view(&tensor, NULL, 0, 0), "long raw_data refused");
+    test_tensor(&tensor, ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT, dims, 2);
+    tensor.float_data = (float*) floats;
+    tensor.n_float_data = 5;
+    failed |= test_check(test_view(&tensor, NULL, 0, 0), "float_data count refused");
+    test_tensor(&tensor, ONNX__TENSOR_PROTO__DATA_TYPE__INT8, dims, 2);
+    tensor.int32_data = words;
+    tensor.n_int32_data = 7;
+    failed |= test_check(test_view(&tensor, NULL, 0, 0), "int32_data count refused");
+    int64_t negative[2] = { 2, -3 };
+    test_tensor(&tensor, ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT, negative, 2);
+    tensor.float_data = (float*) floats;
+    tensor.n_float_data = 6;
+    failed |= test_check(test_view(&tensor, NULL, 0, 0), "negative dim refused");
+
+    free(buffer);
+    return failed;
+}
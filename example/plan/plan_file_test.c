@@ -0,0 +1,248 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "bench/bench.h"
+#include "mnist/mnist.h"
+#include "onnx.h"
+#include "test/graph.h"
+
+// Saves the optimized, compiled plan of a model as a plan file and loads it
+// back. Checks that the loaded plan gives the same outputs bit for bit,
+// serially and on a pool, that its weights are used in place in the file
+// mapping, aligned, and that stale, truncated, foreign and corrupt files are
+// refused.
+// Compares cold start from the .onnx (parse, optimize, compile) with loading
+// the plan file. The plan file is kept when a path is given, otherwise it is
+// written to a temporary file.
+//
+//   usage: onnx-plan-file [model] [plan file] [runs]
+//
+// Exits with 1 when a check fails.
+
+#define ONNX_MODEL_NAME "mnist-lg.onnx"
+#define ONNX_OTHER_MODEL "mnist-sm.onnx"
+
+static onnx_plan* test_compile(const char* name, Onnx__ModelProto** model)
+{
+    *model = onnx_load_model(name);
+    if(*model == NULL || onnx_model_optimize(*model) < 0)
+    {
+        return NULL;
+    }
+    return onnx_plan_compile(*model);
+}
+
+// Every weight in the mapping, aligned
+static int test_in_place(const onnx_plan* plan)
+{
+    const char* begin = (const char*) plan->map;
+    const char* end = begin + plan->map_bytes;
+    for(int32_t s = 0; s < plan->n_steps; s++)
+    {
+        const char* pointers[] = { (const char*) plan->steps[s].weight, (const char*) plan->steps[s].bias };
+        for(int k = 0; k < 2; k++)
+        {
+            if(pointers[k] != NULL && (pointers[k] < begin || pointers[k] >= end))
+            {
+                return 0;
+            }
+        }
+        if(plan->steps[s].weight != NULL && (uintptr_t) plan->steps[s].weight % ONNX_PLAN_ALIGN != 0)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Writes the first bytes of src to dst, with the 32-bit word at patch
+// replaced when patch >= 0
+static int test_copy(const char* src, const char* dst, long bytes, long patch, uint32_t value)
+{
+    FILE* in = fopen(src, "rb");
+    FILE* out = fopen(dst, "wb");
+    int status = in != NULL && out != NULL ? 0 : -1;
+    for(long i = 0; status == 0 && i < bytes; i++)
+    {
+        int c = fgetc(in);
+        if(c == EOF)
+        {
+            break;
+        }
+        if(patch >= 0 && i >= patch && i < patch + 4)
+        {
+            c = ((const unsigned char*) &value)[i - patch];
+        }
+        fputc(c, out);
+    }
+    if(in != NULL)
+    {
+        fclose(in);
+    }
+    if(out != NULL)
+    {
+        fclose(out);
+    }
+    return status;
+}
+
+// Offset of the first copy of data in the plan's file mapping, -1 if none
+static long test_offset(const onnx_plan* plan, const void* data, size_t len)
+{
+    for(size_t i = 0; i + len <= plan->map_bytes; i++)
+    {
+        if(memcmp((const char*) plan->map + i, data, len) == 0)
+        {
+            return (long) i;
+        }
+    }
+    return -1;
+}
+
+int main(int argc, char const *argv[])
+{
+    const char* name = argc > 1 ? argv[1] : ONNX_MODEL_NAME;
+    char temp[] = "/tmp/onnx-plan-file-XXXXXX";
+    const char* path = argc > 2 ? argv[2] : temp;
+    int runs = argc > 3 ? atoi(argv[3]) : 20;
+    int failed = 0;
+
+    // 1. Compile and save
+    Onnx__ModelProto* model;
+    onnx_plan* plan = test_compile(name, &model);
+    if(plan == NULL)
+    {
+        printf("Failed to compile model %s\n", name);
+        return 1;
+    }
+    int fd = path == temp ? mkstemp(temp) : -1;
+    failed |= test_check((path != temp || fd >= 0) && onnx_plan_save(plan, path, name) == 0, "plan saved");
+    if(fd >= 0)
+    {
+        close(fd);
+    }
+
+    // 2. Load, checked against the model
+    onnx_plan* loaded = onnx_plan_load(path, name);
+    if(loaded == NULL)
+    {
+        test_check(0, "plan loaded");
+        if(path == temp)
+        {
+            unlink(temp);
+        }
+        return 1;
+    }
+    onnx_plan_info(loaded);
+    printf("\n");
+    failed |= test_check(loaded->n_steps == plan->n_steps && loaded->arena_bytes == plan->arena_bytes,
+                         "same steps and arena as the compiled plan");
+    failed |= test_check(test_in_place(loaded), "weights used in place, aligned");
+
+    int64_t out_len = onnx_tensor_numel(&plan->output);
+    int same = 1;
+    for(int i = 0; i < TOTAL_IMAGE; i++)
+    {
+        float* expected = (float*) malloc(sizeof(float) * out_len);
+        memcpy(expected, onnx_plan_run(plan, img[i]), sizeof(float) * out_len);
+        same &= memcmp(onnx_plan_run(loaded, img[i]), expected, sizeof(float) * out_len) == 0;
+        free(expected);
+    }
+    failed |= test_check(same, "serial outputs match the compiled plan");
+
+    onnx_pool* pool = onnx_pool_create(2, NULL);
+    same = pool != NULL && onnx_plan_set_pool(plan, pool) == 0 && onnx_plan_set_pool(loaded, pool) == 0;
+    for(int i = 0; same && i < TOTAL_IMAGE; i++)
+    {
+        float* expected = (float*) malloc(sizeof(float) * out_len);
+        memcpy(expected, onnx_plan_run(plan, img[i]), sizeof(float) * out_len);
+        same &= memcmp(onnx_plan_run(loaded, img[i]), expected, sizeof(float) * out_len) == 0;
+        free(expected);
+    }
+    failed |= test_check(same, "pool outputs match the compiled plan");
+    onnx_plan_set_pool(plan, NULL);
+    onnx_plan_set_pool(loaded, NULL);
+    onnx_pool_destroy(pool);
+
+    // 3. Refused files
+    char bad[1024];
+    snprintf(bad, sizeof(bad), "%s.bad", path);
+    onnx_plan* refused = onnx_plan_load(path, strcmp(name, ONNX_OTHER_MODEL) != 0 ? ONNX_OTHER_MODEL : ONNX_MODEL_NAME);
+    failed |= test_check(refused == NULL, "refused for another model");
+    onnx_plan_free(refused);
+    refused = test_copy(path, bad, (long) loaded->map_bytes - 1, -1, 0) == 0 ? onnx_plan_load(bad, NULL) : NULL;
+    failed |= test_check(refused == NULL, "refused when truncated");
+    onnx_plan_free(refused);
+    refused = test_copy(path, bad, (long) loaded->map_bytes, 8, ONNX_PLAN_FILE_VERSION + 1) == 0 ? onnx_plan_load(bad, NULL) : NULL;
+    failed |= test_check(refused == NULL, "refused with another version");
+    onnx_plan_free(refused);
+    long deps = (long) ((const char*) loaded->step_deps - (const char*) loaded->map);
+    long last = deps + (long) sizeof(int32_t) * (loaded->n_steps - 1);
+    refused = test_copy(path, bad, (long) loaded->map_bytes, last, loaded->step_deps[loaded->n_steps - 1] + 1) == 0 ?
+              onnx_plan_load(bad, NULL) : NULL;
+    failed |= test_check(refused == NULL, "refused with a step waiting on too many deps");
+    onnx_plan_free(refused);
+    refused = test_copy(path, bad, (long) loaded->map_bytes, last, 0) == 0 ? onnx_plan_load(bad, NULL) : NULL;
+    failed |= test_check(loaded->step_deps[loaded->n_steps - 1] == 0 || refused == NULL,
+                         "refused with a step started before its inputs");
+    onnx_plan_free(refused);
+
+    // A step writing past its slot, and a window its shapes do not match
+    long slot = (long) ((const char*) &loaded->slot_size[loaded->steps[0].output] - (const char*) loaded->map);
+    refused = test_copy(path, bad, (long) loaded->map_bytes, slot, 1) == 0 ? onnx_plan_load(bad, NULL) : NULL;
+    failed |= test_check(refused == NULL, "refused with a slot smaller than its step");
+    onnx_plan_free(refused);
+    const onnx_plan_attr* window = NULL;
+    for(int32_t i = 0; window == NULL && i < loaded->n_steps; i++)
+    {
+        window = loaded->steps[i].attr.kernel_x > 0 ? &loaded->steps[i].attr : NULL;
+    }
+    long stride = window != NULL ? test_offset(loaded, window, sizeof(*window)) : -1;
+    stride += stride >= 0 ? (long) offsetof(onnx_plan_attr, stride_x) : 0;
+    refused = stride >= 0 && test_copy(path, bad, (long) loaded->map_bytes, stride, 0) == 0 ? onnx_plan_load(bad, NULL) : NULL;
+    failed |= test_check(stride >= 0 && refused == NULL, "refused with a zero stride");
+    onnx_plan_free(refused);
+    refused = stride >= 0 && test_copy(path, bad, (long) loaded->map_bytes, stride, 2 * window->stride_x) == 0 ?
+              onnx_plan_load(bad, NULL) : NULL;
+    failed |= test_check(stride >= 0 && refused == NULL, "refused with a stride its output does not match");
+    onnx_plan_free(refused);
+
+    refused = onnx_plan_load(name, NULL);
+    failed |= test_check(refused == NULL, "refused for a .onnx");
+    onnx_plan_free(refused);
+    remove(bad);
+
+    // 4. Cold start, best of runs
+    double onnx_ms = 1e30, plan_ms = 1e30;
+    for(int r = 0; r < runs; r++)
+    {
+        Onnx__ModelProto* m;
+        double start = bench_now_ms();
+        onnx_plan* p = test_compile(name, &m);
+        onnx_plan_run(p, img[0]);
+        double t = bench_now_ms() - start;
+        onnx_ms = t < onnx_ms ? t : onnx_ms;
+        onnx_plan_free(p);
+        onnx__model_proto__free_unpacked(m, NULL);
+
+        start = bench_now_ms();
+        p = onnx_plan_load(path, NULL);
+        onnx_plan_run(p, img[0]);
+        t = bench_now_ms() - start;
+        plan_ms = t < plan_ms ? t : plan_ms;
+        onnx_plan_free(p);
+    }
+    printf("\nFirst output from %s: %.3f ms, from %s: %.3f ms (%zu bytes)\n", name, onnx_ms, path, plan_ms,
+           loaded->map_bytes);
+
+    onnx_plan_free(loaded);
+    onnx_plan_free(plan);
+    onnx__model_proto__free_unpacked(model, NULL);
+    if(path == temp)
+    {
+        unlink(temp);
+    }
+    return failed;
+}
@@ -0,0 +1,171 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mnist/mnist.h"
+#include "onnx.h"
+#include "test/graph.h"
+
+// Profiles a model through the plan, serially and on a pool, and through
+// onnx_model_run. Checks that profiling leaves the outputs alone, records one
+// event per step and run and nothing once detached, and that the trace file
+// holds every event. Prints the per node report of the plan. The Chrome trace
+// is kept when a path is given, otherwise it goes to a temporary file.
+//
+//   usage: onnx-profile [model] [trace.json] [runs]
+//
+// Exits with 1 when a check fails.
+
+#define ONNX_MODEL_NAME "mnist-lg.onnx"
+
+// Every node seen by the profile ran count times
+static int test_counts(const onnx_profile* profile, int64_t count)
+{
+    onnx_profile_stats stats;
+    for(int32_t i = ONNX_PROFILE_RUN; i < profile->n_nodes; i++)
+    {
+        if(onnx_profile_summary(profile, i, &stats) != 0 || stats.count != count ||
+           stats.p50_us > stats.p99_us || stats.mean_us <= 0)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Complete events in the trace file
+static int64_t test_trace_events(const char* path)
+{
+    FILE* file = fopen(path, "r");
+    if(file == NULL)
+    {
+        return -1;
+    }
+    char line[1024];
+    int64_t events = 0;
+    int header = fgets(line, sizeof(line), file) != NULL && strncmp(line, "{\"traceEvents\":[", 16) == 0;
+    while(fgets(line, sizeof(line), file) != NULL)
+    {
+        events += strstr(line, "\"ph\":\"X\"") != NULL;
+    }
+    fclose(file);
+    return header ? events : -1;
+}
+
+static int test_same(const float* a, const float* b, int64_t len)
+{
+    return memcmp(a, b, sizeof(float) * len) == 0;
+}
+
+int main(int argc, char const *argv[])
+{
+    const char* name = argc > 1 ? argv[1] : ONNX_MODEL_NAME;
+    const char* trace = argc > 2 ? argv[2] : NULL;
+    int runs = argc > 3 ? atoi(argv[3]) : 200;
+    int failed = 0;
+
+    Onnx__ModelProto* model = onnx_load_model(name);
+    if(model == NULL)
+    {
+        printf("Failed to load model %s\n", name);
+        return 1;
+    }
+    onnx_plan* plan = onnx_plan_compile(model);
+    onnx_profile* profile = onnx_profile_create();
+    if(plan == NULL || profile == NULL)
+    {
+        printf("Failed to compile model %s\n", name);
+        return 1;
+    }
+
+    // 1. Reference outputs, not profiled
+    int64_t out_len = onnx_tensor_numel(&plan->output);
+    float* reference = (float*) malloc(sizeof(float) * out_len * TOTAL_IMAGE);
+    for(int i = 0; i < TOTAL_IMAGE; i++)
+    {
+        memcpy(&reference[i * out_len], onnx_plan_run(plan, img[i]), sizeof(float) * out_len);
+    }
+
+    // 2. Serial plan runs
+    int same = 1;
+    onnx_plan_set_profile(plan, profile);
+    for(int r = 0; r < runs; r++)
+    {
+        same &= test_same(onnx_plan_run(plan, img[r % TOTAL_IMAGE]), &reference[(r % TOTAL_IMAGE) * out_len], out_len);
+    }
+    failed |= test_check(same, "serial outputs match the unprofiled plan");
+    failed |= test_check(profile->n_events == (int64_t) runs * (plan->n_steps + 1), "serial: one event per step and run");
+    failed |= test_check(profile->n_nodes == plan->n_steps && test_counts(profile, runs), "serial: every step counted");
+
+    printf("\n");
+    onnx_plan_info(plan);
+    printf("\n");
+    onnx_profile_report(profile);
+    printf("\n");
+
+    int64_t events = profile->n_events;
+    char temp[] = "/tmp/onnx-profile-XXXXXX";
+    int fd = trace == NULL ? mkstemp(temp) : -1;
+    const char* path = trace != NULL ? trace : temp;
+    failed |= test_check((trace != NULL || fd >= 0) && onnx_profile_write_trace(profile, path) == 0 &&
+                         test_trace_events(path) == events, "trace holds every event");
+    if(fd >= 0)
+    {
+        close(fd);
+        unlink(temp);
+    }
+
+    // 3. The same plan on a pool: the profile moves to the new session
+    onnx_pool* pool = onnx_pool_create(2, NULL);
+    onnx_profile_reset(profile);
+    same = pool != NULL && onnx_plan_set_pool(plan, pool) == 0;
+    for(int r = 0; same && r < runs; r++)
+    {
+        same &= test_same(onnx_plan_run(plan, img[r % TOTAL_IMAGE]), &reference[(r % TOTAL_IMAGE) * out_len], out_len);
+    }
+    failed |= test_check(same, "pool outputs match the unprofiled plan");
+    failed |= test_check(profile->n_nodes == plan->n_steps && test_counts(profile, runs), "pool: every step counted");
+    onnx_plan_set_pool(plan, NULL);
+    onnx_pool_destroy(pool);
+
+    // 4. Detached, runs record nothing
+    onnx_profile_reset(profile);
+    onnx_plan_set_profile(plan, NULL);
+    onnx_plan_run(plan, img[0]);
+    failed |= test_check(profile->n_events == 0, "detached: no events");
+
+    // 5. The interpreter, on a profile of its own
+    onnx_profile* graph = onnx_profile_create();
+    onnx_model_set_profile(graph);
+    int64_t dims[] = { 1, 28, 28, 1 };
+    onnx_tensor input, output;
+    onnx_tensor_init(&input, ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT, 4, dims, (void*) img[0]);
+    same = 1;
+    for(int r = 0; r < 4; r++)
+    {
+        int status = onnx_model_run(model, &input, &output);
+        double diff = 0;
+        for(int64_t i = 0; status == 0 && i < out_len; i++)
+        {
+            double d = fabs(((const float*) output.data)[i] - reference[i]);
+            diff = d > diff ? d : diff;
+        }
+        same &= status == 0 && diff < 1e-5;
+        onnx_tensor_release(&output);
+    }
+    onnx_model_set_profile(NULL);
+    onnx_profile_stats stats;
+    onnx_profile_summary(graph, ONNX_PROFILE_RUN, &stats);
+    failed |= test_check(same, "onnx_model_run outputs match the plan");
+    failed |= test_check(test_counts(graph, 4) && stats.allocs > 0, "onnx_model_run: every node counted, allocations seen");
+    printf("\n");
+    onnx_profile_report(graph);
+
+    onnx_profile_free(graph);
+    onnx_profile_free(profile);
+    free(reference);
+    onnx_plan_free(plan);
+    onnx__model_proto__free_unpacked(model, NULL);
+    return failed;
+}
@@ -0,0 +1,331 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench/bench.h"
+#include "onnx.h"
+
+// SIMD kernels against the scalar reference, for every ISA level this CPU
+// supports. First every table entry is checked on all tail lengths up to a
+// few vectors, then every plan step runs on a realistic layer with each level
+// active: output compared to the scalar run, time and speedup reported.
+//
+//   usage: onnx-simd [min ms per kernel]
+//
+// Exits with 1 when any level disagrees with the scalar code.
+
+#define BENCH_TOLERANCE 1e-4    // largest difference, relative to the largest reference value
+
+typedef struct bench_layer
+{
+    const char* name;
+    onnx_plan_step step;
+    int64_t in_len;
+    int64_t out_len;
+    double flops;
+    double bytes;               // weights, plus activations in and out
+} bench_layer;
+
+static double bench_diff(const float* reference, const float* output, int64_t len)
+{
+    double diff = 0;
+    double scale = 1e-30;
+    for(int64_t i = 0; i < len; i++)
+    {
+        double d = fabs(reference[i] - output[i]);
+        diff = d > diff ? d : diff;
+        scale = fabs(reference[i]) > scale ? fabs(reference[i]) : scale;
+    }
+    return diff / scale;
+}
+
+// One NHWC sample; the batch goes in dims[0]
+static void bench_shape(onnx_tensor* t, int64_t w, int64_t h, int64_t c)
+{
+    int64_t dims[] = { 1, h, w, c };
+    onnx_tensor_init(t, ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT, 4, dims, NULL);
+}
+
+static void bench_rows(onnx_tensor* t, int64_t n, int64_t k)
+{
+    int64_t dims[] = { n, k };
+    onnx_tensor_init(t, ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT, 2, dims, NULL);
+}
+
+static void bench_window(onnx_plan_attr* attr, uint16_t kernel, uint16_t padding, uint16_t stride)
+{
+    attr->kernel_x = attr->kernel_y = kernel;
+    attr->padding_x = attr->padding_y = padding;
+    attr->stride_x = attr->stride_y = stride;
+}
+
+// Every entry of kernels on lengths 1 .. 3 vectors plus tails, and the
+// microkernel on every edge tile, against the scalar table
+static int bench_check_table(const onnx_kernels* kernels)
+{
+    const onnx_kernels* ref = onnx_kernels_get(ONNX_ISA_SCALAR);
+    int64_t max_len = 53;
+    int64_t k = 37;
+    float* a = bench_random(max_len * k);
+    float* b = bench_random(max_len * k);
+    float* y0 = (float*) malloc(sizeof(float) * max_len * ONNX_GEMM_NR);
+    float* y1 = (float*) malloc(sizeof(float) * max_len * ONNX_GEMM_NR);
+    const char* failed = NULL;
+
+    for(int64_t n = 1; n <= max_len && failed == NULL; n++)
+    {
+        ref->relu(a, n, y0);
+        kernels->relu(a, n, y1);
+        failed = bench_diff(y0, y1, n) > 0 ? "relu" : failed;
+
+        ref->add(a, b, n, y0);
+        kernels->add(a, b, n, y1);
+        failed = bench_diff(y0, y1, n) > 0 ? "add" : failed;
+
+        ref->max(a, b, n, y0);
+        kernels->max(a, b, n, y1);
+        failed = bench_diff(y0, y1, n) > 0 ? "max" : failed;
+
+        memcpy(y0, b, sizeof(float) * n);
+        memcpy(y1, b, sizeof(float) * n);
+        ref->axpy(0.75f, a, n, y0);
+        kernels->axpy(0.75f, a, n, y1);
+        failed = bench_diff(y0, y1, n) > BENCH_TOLERANCE ? "axpy" : failed;
+
+        y0[0] = ref->dot(a, b, n);
+        y1[0] = kernels->dot(a, b, n);
+        failed = bench_diff(y0, y1, 1) > BENCH_TOLERANCE ? "dot" : failed;
+
+        ref->softmax(a, n, y0);
+        kernels->softmax(a, n, y1);
+        failed = bench_diff(y0, y1, n) > BENCH_TOLERANCE ? "softmax" : failed;
+
+        // n rows of k weights
+        ref->gemv(b, a, k, n, y0);
+        kernels->gemv(b, a, k, n, y1);
+        failed = bench_diff(y0, y1, n) > BENCH_TOLERANCE ? "gemv" : failed;
+    }
+
+    // a: MR x k panel, b: k x NR panel; every m x n edge, with and without bias and relu
+    for(int m = 1; m <= ONNX_GEMM_MR && failed == NULL; m++)
+    {
+        for(int n = 1; n <= ONNX_GEMM_NR; n++)
+        {
+            for(int variant = 0; variant < 4; variant++)
+            {
+                const float* bias = variant & 1 ? b : NULL;
+                int relu = variant >> 1;
+                memcpy(y0, a, sizeof(float) * ONNX_GEMM_MR * ONNX_GEMM_NR);
+                memcpy(y1, a, sizeof(float) * ONNX_GEMM_MR * ONNX_GEMM_NR);
+                ref->sgemm_micro(k, a, b, y0, ONNX_GEMM_NR, m, n, bias, relu);
+                kernels->sgemm_micro(k, a, b, y1, ONNX_GEMM_NR, m, n, bias, relu);
+                failed = bench_diff(y0, y1, ONNX_GEMM_MR * ONNX_GEMM_NR) > BENCH_TOLERANCE ? "sgemm_micro" : failed;
+            }
+        }
+    }
+
+    if(failed != NULL)
+    {
+        printf("%s: %s differs from the scalar kernel\n", kernels->name, failed);
+    }
+    free(a);
+    free(b);
+    free(y0);
+    free(y1);
+    return failed != NULL;
+}
+
+static int bench_layers(bench_layer* layers)
+{
+    int n = 0;
+    bench_layer* l;
+
+    // Direct conv 5x5 on mnist-lg-like channels
+    l = &layers[n++];
+    l->name = "conv2D";
+    l->step.kernel = conv2D_step;
+    bench_shape(&l->step.in, 28, 28, 8);
+    bench_shape(&l->step.out, 28, 28, 16);
+    bench_window(&l->step.attr, 5, 2, 1);
+    l->step.weight = bench_random(16 * 5 * 5 * 8);
+    l->step.bias = bench_random(16);
+    l->flops = 2.0 * 28 * 28 * 16 * 5 * 5 * 8;
+
+    // im2col GEMM 3x3, 28x28x128 --> 28x28x128, strided so Winograd does not apply
+    l = &layers[n++];
+    l->name = "conv gemm";
+    l->step.kernel = conv2D_gemm_step;
+    bench_shape(&l->step.in, 56, 56, 128);
+    bench_shape(&l->step.out, 28, 28, 128);
+    bench_window(&l->step.attr, 3, 1, 2);
+    {
+        float* ohwi = bench_random(128 * 3 * 3 * 128);
+        float* panels = (float*) malloc(sizeof(float) * sgemm_pack_size(128, 3 * 3 * 128));
+        sgemm_pack_b(ohwi, 128, 3 * 3 * 128, panels);
+        free(ohwi);
+        l->step.weight = panels;
+    }
+    l->step.bias = bench_random(128);
+    l->flops = 2.0 * 28 * 28 * 128 * 3 * 3 * 128;
+
+    // Winograd F(4x4) 3x3, 28x28x128 --> 28x28x128
+    l = &layers[n++];
+    l->name = "winograd";
+    l->step.kernel = conv2D_winograd_step;
+    bench_shape(&l->step.in, 28, 28, 128);
+    bench_shape(&l->step.out, 28, 28, 128);
+    bench_window(&l->step.attr, 3, 1, 1);
+    l->step.attr.tile = 4;
+    {
+        float* oihw = bench_random(128 * 128 * 3 * 3);
+        float* u = (float*) malloc(sizeof(float) * winograd_pack_size(128, 128, 4));
+        winograd_pack_filters(oihw, 128, 128, 4, u);
+        free(oihw);
+        l->step.weight = u;
+    }
+    l->step.bias = bench_random(128);
+    l->flops = 2.0 * 28 * 28 * 128 * 3 * 3 * 128;
+
+    // MaxPool 2x2/2, 56x56x64 --> 28x28x64, batch 4
+    l = &layers[n++];
+    l->name = "maxpool";
+    l->step.kernel = maxpool_step;
+    bench_shape(&l->step.in, 56, 56, 64);
+    bench_shape(&l->step.out, 28, 28, 64);
+    l->step.in.dims[0] = l->step.out.dims[0] = 4;
+    bench_window(&l->step.attr, 2, 0, 2);
+    l->flops = 4.0 * 56 * 56 * 64;
+
+    // GEMV and batched GEMM over a 1024 x 1024 weight matrix
+    for(int batch = 1; batch <= 16; batch *= 16)
+    {
+        l = &layers[n++];
+        l->name = batch == 1 ? "matmul 1" : "matmul 16";
+        l->step.kernel = matmul_step;
+        l->step.shapeW[0] = 1024;
+        l->step.shapeW[1] = 1024;
+        bench_rows(&l->step.in, batch, 1024);
+        bench_rows(&l->step.out, batch, 1024);
+        l->step.weight = bench_random(1024 * 1024);
+        l->flops = 2.0 * batch * 1024 * 1024;
+        l->bytes = sizeof(float) * 1024 * 1024;
+    }
+
+    // Element-wise over 1M elements (with an odd tail)
+    l = &layers[n++];
+    l->name = "relu";
+    l->step.kernel = relu_step;
+    bench_shape(&l->step.in, 127, 129, 64);
+    bench_shape(&l->step.out, 127, 129, 64);
+    l->flops = 127.0 * 129 * 64;
+
+    l = &layers[n++];
+    l->name = "add";
+    l->step.kernel = add_step;
+    bench_shape(&l->step.in, 127, 129, 64);
+    bench_shape(&l->step.out, 127, 129, 64);
+    l->step.bias = bench_random(127 * 129 * 64);
+    l->flops = 127.0 * 129 * 64;
+    l->bytes = sizeof(float) * 127 * 129 * 64;
+
+    // Softmax over 1000 classes, batch 256
+    l = &layers[n++];
+    l->name = "softmax";
+    l->step.kernel = softmax_step;
+    bench_rows(&l->step.in, 256, 1000);
+    bench_rows(&l->step.out, 256, 1000);
+    l->flops = 256.0 * 1000;
+
+    for(int i = 0; i < n; i++)
+    {
+        l = &layers[i];
+        l->step.input[0] = 0;
+        l->step.input[1] = -1;
+        l->step.output = 1;
+        l->in_len = onnx_tensor_numel(&l->step.in);
+        l->out_len = onnx_tensor_numel(&l->step.out);
+        l->bytes += sizeof(float) * (l->in_len + l->out_len);
+    }
+    return n;
+}
+
+int main(int argc, char const *argv[])
+{
+    double min_ms = argc > 1 ? atof(argv[1]) : 200.0;
+    const onnx_kernels* start = onnx_kernels_active;
+    int failed = 0;
+
+    // 0. Levels this CPU runs; the active one was picked at startup
+    printf("ISA levels:");
+    for(int isa = 0; isa < ONNX_ISA_COUNT; isa++)
+    {
+        const onnx_kernels* kernels = onnx_kernels_get((onnx_isa) isa);
+        if(kernels != NULL)
+        {
+            printf(" %s%s", kernels->name, kernels == start ? " (active)" : "");
+            failed |= bench_check_table(kernels);
+        }
+    }
+    printf("\n");
+
+    bench_layer layers[16] = { 0 };
+    int n_layers = bench_layers(layers);
+
+    printf("%-10s %-7s %12s %10s %10s %8s %10s\n", "kernel", "isa", "ms/run", "GFLOP/s", "GB/s", "speedup", "rel diff");
+    for(int i = 0; i < n_layers; i++)
+    {
+        bench_layer* l = &layers[i];
+        float* slots[2] = { bench_random(l->in_len), (float*) malloc(sizeof(float) * l->out_len) };
+        float* reference = (float*) malloc(sizeof(float) * l->out_len);
+        double base = 0;
+
+        for(int isa = 0; isa < ONNX_ISA_COUNT; isa++)
+        {
+            if(onnx_kernels_use((onnx_isa) isa) != 0)
+            {
+                continue;
+            }
+
+            // 1. Warm up, and check against the scalar output
+            l->step.kernel(&l->step, slots, NULL);
+            double diff = 0;
+            if(isa == ONNX_ISA_SCALAR)
+            {
+                memcpy(reference, slots[1], sizeof(float) * l->out_len);
+            }
+            else
+            {
+                diff = bench_diff(reference, slots[1], l->out_len);
+                failed |= !(diff <= BENCH_TOLERANCE);
+            }
+
+            // 2. Time enough runs to cover min_ms
+            int runs = 0;
+            double begin = bench_now_ms();
+            double elapsed = 0;
+            while(elapsed < min_ms)
+            {
+                l->step.kernel(&l->step, slots, NULL);
+                runs++;
+                elapsed = bench_now_ms() - begin;
+            }
+            double ms = elapsed / runs;
+            base = isa == ONNX_ISA_SCALAR ? ms : base;
+            printf("%-10s %-7s %12.4f %10.2f %10.2f %8.2f %10.2e%s\n", l->name, onnx_kernels_active->name, ms,
+                   l->flops / ms / 1e6, l->bytes / ms / 1e6, base / ms, diff, diff <= BENCH_TOLERANCE ? "" : "  FAIL");
+        }
+
+        free(slots[0]);
+        free(slots[1]);
+        free(reference);
+    }
+
+    for(int i = 0; i < n_layers; i++)
+    {
+        free((float*) layers[i].step.weight);
+        free((float*) layers[i].step.bias);
+    }
+    onnx_kernels_active = start;
+
+    printf(failed ? "FAILED\n" : "All levels match the scalar kernels\n");
+    return failed;
+}
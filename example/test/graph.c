@@ -0,0 +1,215 @@
+#include <assert.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test/graph.h"
+
+#define TEST_GRAPH_NAME_LEN 32
+
+int test_check(int ok, const char* what)
+{
+    printf("%-52s %s\n", what, ok ? "ok" : "FAIL");
+    return !ok;
+}
+
+test_graph* test_graph_create(const char* name, const int64_t* dims, int32_t rank)
+{
+    assert(rank >= 0 && rank <= TEST_GRAPH_MAX_DIM);
+    test_graph* g = (test_graph*) calloc(1, sizeof(test_graph));
+    assert(g != NULL);
+    onnx__model_proto__init(&g->model);
+    onnx__graph_proto__init(&g->graph);
+    onnx__value_info_proto__init(&g->input);
+    onnx__value_info_proto__init(&g->output);
+    onnx__type_proto__init(&g->type);
+    onnx__type_proto__tensor__init(&g->tensor_type);
+    onnx__tensor_shape_proto__init(&g->shape);
+    onnx__operator_set_id_proto__init(&g->opset);
+
+    for(int32_t d = 0; d < rank; d++)
+    {
+        onnx__tensor_shape_proto__dimension__init(&g->dims[d]);
+        g->dims[d].value_case = ONNX__TENSOR_SHAPE_PROTO__DIMENSION__VALUE_DIM_VALUE;
+        g->dims[d].dim_value = dims[d];
+        g->dim_ptrs[d] = &g->dims[d];
+    }
+    g->shape.n_dim = rank;
+    g->shape.dim = g->dim_ptrs;
+    g->tensor_type.has_elem_type = 1;
+    g->tensor_type.elem_type = ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT;
+    g->tensor_type.shape = &g->shape;
+    g->type.value_case = ONNX__TYPE_PROTO__VALUE_TENSOR_TYPE;
+    g->type.tensor_type = &g->tensor_type;
+    g->input.name = (char*) "x";
+    g->input.type = rank > 0 ? &g->type : NULL;
+
+    g->opset.has_version = 1;
+    g->opset.version = 11;
+    g->opsets[0] = &g->opset;
+    g->model.n_opset_import = 1;
+    g->model.opset_import = g->opsets;
+    g->model.has_ir_version = 1;
+    g->model.ir_version = 6;
+
+    g->inputs[0] = &g->input;
+    g->outputs[0] = &g->output;
+    g->graph.name = (char*) name;
+    g->graph.n_input = 1;
+    g->graph.input = g->inputs;
+    g->graph.output = g->outputs;
+    g->model.graph = &g->graph;
+    return g;
+}
+
+void test_graph_free(test_graph* g)
+{
+    for(int64_t i = 0; i < g->n_allocs; i++)
+    {
+        free(g->allocs[i]);
+    }
+    free(g->allocs);
+    free(g->graph.node);
+    free(g->graph.initializer);
+    free(g);
+}
+
+void test_graph_output(test_graph* g, const char* name)
+{
+    g->output.name = (char*) name;
+    g->graph.n_output = 1;
+}
+
+void* test_graph_alloc(test_graph* g, size_t bytes)
+{
+    if(g->n_allocs == g->cap_allocs)
+    {
+        g->cap_allocs = g->cap_allocs > 0 ? 2 * g->cap_allocs : 64;
+        g->allocs = (void**) realloc(g->allocs, sizeof(void*) * g->cap_allocs);
+        assert(g->allocs != NULL);
+    }
+    void* p = calloc(1, bytes > 0 ? bytes : 1);
+    assert(p != NULL);
+    g->allocs[g->n_allocs++] = p;
+    return p;
+}
+
+char* test_graph_name(test_graph* g, const char* format, ...)
+{
+    char* name = (char*) test_graph_alloc(g, TEST_GRAPH_NAME_LEN);
+    va_list args;
+    va_start(args, format);
+    vsnprintf(name, TEST_GRAPH_NAME_LEN, format, args);
+    va_end(args);
+    return name;
+}
+
+float* test_graph_random(test_graph* g, int64_t len)
+{
+    float* data = (float*) test_graph_alloc(g, sizeof(float) * len);
+    for(int64_t i = 0; i < len; i++)
+    {
+        data[i] = (float) rand() / RAND_MAX - 0.5f;
+    }
+    return data;
+}
+
+float* test_graph_weights(test_graph* g, const char* name, const int64_t* dims, size_t n_dims)
+{
+    Onnx__TensorProto* tensor = (Onnx__TensorProto*) test_graph_alloc(g, sizeof(Onnx__TensorProto));
+    onnx__tensor_proto__init(tensor);
+    tensor->name = (char*) name;
+    tensor->has_data_type = 1;
+    tensor->data_type = ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT;
+    tensor->n_dims = n_dims;
+    tensor->dims = (int64_t*) test_graph_alloc(g, sizeof(int64_t) * n_dims);
+    memcpy(tensor->dims, dims, sizeof(int64_t) * n_dims);
+    tensor->n_float_data = 1;
+    for(size_t d = 0; d < n_dims; d++)
+    {
+        tensor->n_float_data *= dims[d];
+    }
+    tensor->float_data = test_graph_random(g, tensor->n_float_data);
+
+    if(g->graph.n_initializer == g->cap_inits)
+    {
+        g->cap_inits = g->cap_inits > 0 ? 2 * g->cap_inits : 16;
+        g->graph.initializer = (Onnx__TensorProto**) realloc(g->graph.initializer, sizeof(Onnx__TensorProto*) * g->cap_inits);
+        assert(g->graph.initializer != NULL);
+    }
+    g->graph.initializer[g->graph.n_initializer++] = tensor;
+    return tensor->float_data;
+}
+
+Onnx__NodeProto* test_graph_node(test_graph* g, const char* op_type, const char* name, const char* in0, const char* in1,
+                                 const char* in2, const char* out)
+{
+    const char* inputs[] = { in0, in1, in2 };
+    Onnx__NodeProto* node = (Onnx__NodeProto*) test_graph_alloc(g, sizeof(Onnx__NodeProto));
+    onnx__node_proto__init(node);
+    node->op_type = (char*) op_type;
+    node->name = (char*) (name != NULL ? name : out);
+    node->input = (char**) test_graph_alloc(g, sizeof(char*) * 3);
+    for(int i = 0; i < 3; i++)
+    {
+        if(inputs[i] != NULL)
+        {
+            node->input[node->n_input++] = (char*) inputs[i];
+        }
+    }
+    node->n_output = 1;
+    node->output = (char**) test_graph_alloc(g, sizeof(char*));
+    node->output[0] = (char*) out;
+
+    if(g->graph.n_node == g->cap_nodes)
+    {
+        g->cap_nodes = g->cap_nodes > 0 ? 2 * g->cap_nodes : 16;
+        g->graph.node = (Onnx__NodeProto**) realloc(g->graph.node, sizeof(Onnx__NodeProto*) * g->cap_nodes);
+        assert(g->graph.node != NULL);
+    }
+    g->graph.node[g->graph.n_node++] = node;
+    return node;
+}
+
+// Appended after the node's other attributes
+static Onnx__AttributeProto* test_graph_attribute(test_graph* g, Onnx__NodeProto* node, const char* name,
+                                                  Onnx__AttributeProto__AttributeType type)
+{
+    Onnx__AttributeProto* attribute = (Onnx__AttributeProto*) test_graph_alloc(g, sizeof(Onnx__AttributeProto));
+    onnx__attribute_proto__init(attribute);
+    attribute->name = (char*) name;
+    attribute->has_type = 1;
+    attribute->type = type;
+
+    Onnx__AttributeProto** attributes = (Onnx__AttributeProto**) test_graph_alloc(g, sizeof(Onnx__AttributeProto*) * (node->n_attribute + 1));
+    for(size_t i = 0; i < node->n_attribute; i++)
+    {
+        attributes[i] = node->attribute[i];
+    }
+    attributes[node->n_attribute++] = attribute;
+    node->attribute = attributes;
+    return attribute;
+}
+
+void test_graph_ints(test_graph* g, Onnx__NodeProto* node, const char* name, const int64_t* ints, size_t n)
+{
+    Onnx__AttributeProto* attribute = test_graph_attribute(g, node, name, ONNX__ATTRIBUTE_PROTO__ATTRIBUTE_TYPE__INTS);
+    attribute->n_ints = n;
+    attribute->ints = (int64_t*) test_graph_alloc(g, sizeof(int64_t) * n);
+    memcpy(attribute->ints, ints, sizeof(int64_t) * n);
+}
+
+void test_graph_int(test_graph* g, Onnx__NodeProto* node, const char* name, int64_t value)
+{
+    Onnx__AttributeProto* attribute = test_graph_attribute(g, node, name, ONNX__ATTRIBUTE_PROTO__ATTRIBUTE_TYPE__INT);
+    attribute->has_i = 1;
+    attribute->i = value;
+}
+
+void test_graph_float(test_graph* g, Onnx__NodeProto* node, const char* name, float value)
+{
+    Onnx__AttributeProto* attribute = test_graph_attribute(g, node, name, ONNX__ATTRIBUTE_PROTO__ATTRIBUTE_TYPE__FLOAT);
+    attribute->has_f = 1;
+    attribute->f = value;
+}
@@ -0,0 +1,54 @@
+#ifndef __TEST_GRAPH_H__
+#define __TEST_GRAPH_H__
+
+#include <stdint.h>
+
+#include "onnx-parser.h"
+
+// Models built in memory for the tests and benchmarks. The graph reads one
+// input, x, and writes the output named by test_graph_output, if any. Nodes,
+// initializers, attributes and names are allocated from the graph and released
+// with it by test_graph_free; nodes and initializers are kept in the order
+// they were added.
+#define TEST_GRAPH_MAX_DIM 4
+
+typedef struct test_graph
+{
+    Onnx__ModelProto model;
+    Onnx__GraphProto graph;
+    Onnx__ValueInfoProto input;
+    Onnx__ValueInfoProto output;
+    Onnx__ValueInfoProto* inputs[1];
+    Onnx__ValueInfoProto* outputs[1];
+    Onnx__TypeProto type;
+    Onnx__TypeProto__Tensor tensor_type;
+    Onnx__TensorShapeProto shape;
+    Onnx__TensorShapeProto__Dimension dims[TEST_GRAPH_MAX_DIM];
+    Onnx__TensorShapeProto__Dimension* dim_ptrs[TEST_GRAPH_MAX_DIM];
+    Onnx__OperatorSetIdProto opset;
+    Onnx__OperatorSetIdProto* opsets[1];
+    size_t cap_nodes;
+    size_t cap_inits;
+    void** allocs;
+    int64_t n_allocs;
+    int64_t cap_allocs;
+} test_graph;
+
+int test_check(int ok, const char* what);       // prints what with ok or FAIL, 1 if failed
+
+test_graph* test_graph_create(const char* name, const int64_t* dims, int32_t rank);     // rank 0: x is untyped
+void   test_graph_free(test_graph* g);
+void   test_graph_output(test_graph* g, const char* name);
+void*  test_graph_alloc(test_graph* g, size_t bytes);                   // zeroed
+char*  test_graph_name(test_graph* g, const char* format, ...);         // printf into a new name
+float* test_graph_random(test_graph* g, int64_t len);                   // uniform in [-0.5, 0.5)
+float* test_graph_weights(test_graph* g, const char* name, const int64_t* dims, size_t n_dims);  // random float initializer
+
+// NULL inputs are left out, so a node may have none; a NULL name is out's
+Onnx__NodeProto* test_graph_node(test_graph* g, const char* op_type, const char* name, const char* in0, const char* in1,
+                                 const char* in2, const char* out);
+void test_graph_ints(test_graph* g, Onnx__NodeProto* node, const char* name, const int64_t* ints, size_t n);
+void test_graph_int(test_graph* g, Onnx__NodeProto* node, const char* name, int64_t value);
+void test_graph_float(test_graph* g, Onnx__NodeProto* node, const char* name, float value);
+
+#endif
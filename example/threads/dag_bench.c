@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench/bench.h"
+#include "onnx.h"
+#include "test/graph.h"
+
+// Inter-op scaling on a synthetic wide graph: B independent towers of D
+// MatMul + Relu layers on the same input, summed by a chain of Adds. The
+// critical path is one tower, so the ideal speedup approaches B.
+//
+//   usage: onnx-dag [branches] [depth] [width] [batch] [max threads]
+
+#define BENCH_MIN_MS 300.0
+
+static test_graph* bench_build(int branches, int depth, int width, int batch)
+{
+    int64_t dims[] = { batch, width };
+    int64_t dims_w[] = { width, width };
+    test_graph* g = test_graph_create("wide", dims, 2);
+
+    const char* sum = NULL;
+    for(int b = 0; b < branches; b++)
+    {
+        const char* x = "x";
+        for(int d = 0; d < depth; d++)
+        {
+            char* w = test_graph_name(g, "w_%d_%d", b, d);
+            char* mm = test_graph_name(g, "mm_%d_%d", b, d);
+            char* act = test_graph_name(g, "relu_%d_%d", b, d);
+            float* data = test_graph_weights(g, w, dims_w, 2);
+            for(int64_t i = 0; i < (int64_t) width * width; i++)
+            {
+                data[i] *= 2.0f / width;
+            }
+            test_graph_node(g, "MatMul", test_graph_name(g, "MatMul_%d_%d", b, d), x, w, NULL, mm);
+            test_graph_node(g, "Relu", test_graph_name(g, "Relu_%d_%d", b, d), mm, NULL, NULL, act);
+            x = act;
+        }
+        if(sum == NULL)
+        {
+            sum = x;
+        }
+        else
+        {
+            char* out = test_graph_name(g, "sum_%d_0", b);
+            test_graph_node(g, "Add", test_graph_name(g, "Add_%d_0", b), sum, x, NULL, out);
+            sum = out;
+        }
+    }
+    test_graph_output(g, sum);
+    return g;
+}
+
+// Longest chain of steps through the step DAG
+static int32_t bench_critical_path(onnx_plan* plan)
+{
+    int32_t* length = (int32_t*) calloc(plan->n_steps, sizeof(int32_t));
+    int32_t longest = 0;
+    for(int32_t i = 0; i < plan->n_steps; i++)
+    {
+        length[i] += 1;
+        longest = length[i] > longest ? length[i] : longest;
+        for(int32_t e = plan->succ_offsets[i]; e < plan->succ_offsets[i + 1]; e++)
+        {
+            int32_t next = plan->succ[e];
+            length[next] = length[i] > length[next] ? length[i] : length[next];
+        }
+    }
+    free(length);
+    return longest;
+}
+
+static double bench_run(onnx_plan* plan, const float* input)
+{
+    int runs = 0;
+    double start = bench_now_ms();
+    double elapsed = 0;
+    while(elapsed < BENCH_MIN_MS)
+    {
+        onnx_plan_run(plan, input);
+        runs++;
+        elapsed = bench_now_ms() - start;
+    }
+    return elapsed / runs;
+}
+
+int main(int argc, char const *argv[])
+{
+    int branches = argc > 1 ? atoi(argv[1]) : 8;
+    int depth    = argc > 2 ? atoi(argv[2]) : 4;
+    int width    = argc > 3 ? atoi(argv[3]) : 256;
+    int batch    = argc > 4 ? atoi(argv[4]) : 4;
+    int max_threads = argc > 5 ? atoi(argv[5]) : onnx_pool_default_workers() + 1;
+
+    // 0. Build and compile the graph
+    test_graph* g = bench_build(branches, depth, width, batch);
+    onnx_plan* plan = onnx_plan_compile(&g->model);
+    if(plan == NULL)
+    {
+        printf("Failed to compile the graph\n");
+        return -1;
+    }
+    int32_t critical = bench_critical_path(plan);
+    printf("%d branches x %d layers, %dx%d weights, batch %d: %d steps, %d edges\n",
+           branches, depth, width, width, batch, plan->n_steps, plan->succ_offsets[plan->n_steps]);
+    printf("Activations: %zu bytes serial, %zu bytes for the scheduler\n", plan->arena_bytes, plan->arena_bytes_dag);
+    printf("Critical path %d steps, ideal speedup %.2f\n", critical, (double) plan->n_steps / critical);
+
+    float* input = (float*) malloc(sizeof(float) * batch * width);
+    for(int i = 0; i < batch * width; i++)
+    {
+        input[i] = (float) rand() / RAND_MAX;
+    }
+    int64_t out_len = onnx_tensor_numel(&plan->output);
+    float* reference = (float*) malloc(sizeof(float) * out_len);
+
+    // 1. Serial reference
+    memcpy(reference, onnx_plan_run(plan, input), sizeof(float) * out_len);
+    double base = bench_run(plan, input);
+    printf("%8s %12s %8s\n", "threads", "ms/run", "speedup");
+    printf("%8d %12.3f %8.2f\n", 1, base, 1.0);
+
+    // 2. Scheduler on pools of growing size
+    for(int threads = 2; threads <= max_threads; threads *= 2)
+    {
+        onnx_pool* pool = onnx_pool_create(threads - 1, NULL);
+        onnx_plan_set_pool(plan, pool);
+        if(memcmp(reference, onnx_plan_run(plan, input), sizeof(float) * out_len) != 0)
+        {
+            printf("Output with %d threads differs from the serial run\n", threads);
+        }
+        double ms = bench_run(plan, input);
+        printf("%8d %12.3f %8.2f\n", threads, ms, base / ms);
+        onnx_plan_set_pool(plan, NULL);
+        onnx_pool_destroy(pool);
+    }
+
+    free(input);
+    free(reference);
+    onnx_plan_free(plan);
+    test_graph_free(g);
+
+    return 0;
+}
@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "bench/bench.h"
+#include "mnist/mnist.h"
+#include "onnx.h"
+
+// Concurrent inference on one compiled model: every thread owns a session
+// (arena and slots) on the shared plan and runs the test images in a loop.
+// Outputs are checked against a single session run; weights are not copied.
+//
+//   usage: onnx-sessions [model] [threads] [runs per thread]
+
+#define ONNX_MODEL_NAME "mnist-lg.onnx"
+
+typedef struct bench_worker
+{
+    pthread_t thread;
+    const onnx_plan* plan;
+    const float* reference;     // expected output per test image
+    int64_t out_len;
+    int runs;
+    int mismatches;
+} bench_worker;
+
+static void* bench_worker_run(void* arg)
+{
+    bench_worker* w = (bench_worker*) arg;
+    onnx_session* session = onnx_session_create(w->plan, NULL);
+    if(session == NULL)
+    {
+        w->mismatches = -1;
+        return NULL;
+    }
+
+    int n_img = TOTAL_IMAGE;
+    for(int r = 0; r < w->runs; r++)
+    {
+        int i = r % n_img;
+        const float* output = onnx_session_run(session, img[i]);
+        if(memcmp(output, &w->reference[i * w->out_len], sizeof(float) * w->out_len) != 0)
+        {
+            w->mismatches++;
+        }
+    }
+    onnx_session_free(session);
+    return NULL;
+}
+
+int main(int argc, char const *argv[])
+{
+    const char* name = argc > 1 ? argv[1] : ONNX_MODEL_NAME;
+    int threads = argc > 2 ? atoi(argv[2]) : onnx_pool_default_workers() + 1;
+    int runs    = argc > 3 ? atoi(argv[3]) : 200;
+
+    // 0. Load and compile the model once
+    Onnx__ModelProto* model = onnx_load_model(name);
+    if(model == NULL)
+    {
+        printf("Failed to load model %s\n", name);
+        return -1;
+    }
+    onnx_plan* plan = onnx_plan_compile(model);
+    if(plan == NULL)
+    {
+        printf("Failed to compile model %s\n", name);
+        return -1;
+    }
+
+    // 1. Reference outputs from the plan's own session
+    int n_img = TOTAL_IMAGE;
+    int64_t out_len = onnx_tensor_numel(&plan->output);
+    float* reference = (float*) malloc(sizeof(float) * out_len * n_img);
+    for(int i = 0; i < n_img; i++)
+    {
+        memcpy(&reference[i * out_len], onnx_plan_run(plan, img[i]), sizeof(float) * out_len);
+    }
+
+    // 2. N threads, one session each, on the same plan
+    bench_worker* workers = (bench_worker*) calloc(threads, sizeof(bench_worker));
+    double start = bench_now_ms();
+    for(int t = 0; t < threads; t++)
+    {
+        workers[t].plan = plan;
+        workers[t].reference = reference;
+        workers[t].out_len = out_len;
+        workers[t].runs = runs;
+        pthread_create(&workers[t].thread, NULL, bench_worker_run, &workers[t]);
+    }
+    int mismatches = 0;
+    for(int t = 0; t < threads; t++)
+    {
+        pthread_join(workers[t].thread, NULL);
+        mismatches += workers[t].mismatches;
+    }
+    double elapsed = bench_now_ms() - start;
+
+    printf("%s: %d threads x %d runs, %.1f inferences/s\n", name, threads, runs, threads * runs / elapsed * 1e3);
+    printf("Shared weights: %zu bytes packed, per session: %zu bytes of activations\n",
+           plan->packed_bytes, plan->arena_bytes);
+    printf("%s\n", mismatches == 0 ? "All outputs match" : "Outputs differ from the reference");
+
+    free(workers);
+    free(reference);
+    onnx_plan_free(plan);
+    onnx__model_proto__free_unpacked(model, NULL);
+
+    return mismatches == 0 ? 0 : -1;
+}
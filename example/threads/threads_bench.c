@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench/bench.h"
+#include "onnx.h"
+
+// Intra-op scaling: every kernel step on a synthetic layer, run with
+// 1, 2, 4, ... threads. Outputs are checked against the single thread run.
+
+#define BENCH_MIN_MS 200.0
+
+typedef struct bench_layer
+{
+    const char* name;
+    onnx_plan_step step;
+    int64_t in_len;
+    int64_t out_len;
+    double flops;
+} bench_layer;
+
+static void bench_shape(onnx_tensor* t, int64_t n, int64_t w, int64_t h, int64_t c)
+{
+    int64_t dims[] = { n, h, w, c };
+    onnx_tensor_init(t, ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT, 4, dims, NULL);
+}
+
+static void bench_rows(onnx_tensor* t, int64_t n, int64_t k)
+{
+    int64_t dims[] = { n, k };
+    onnx_tensor_init(t, ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT, 2, dims, NULL);
+}
+
+static void bench_window(onnx_plan_attr* attr, uint16_t kernel, uint16_t padding, uint16_t stride)
+{
+    attr->kernel_x = attr->kernel_y = kernel;
+    attr->padding_x = attr->padding_y = padding;
+    attr->stride_x = attr->stride_y = stride;
+}
+
+static int bench_layers(bench_layer* layers)
+{
+    int n = 0;
+    bench_layer* l;
+
+    // Conv 3x3, 56x56x64 --> 56x56x64
+    l = &layers[n++];
+    l->name = "conv2D";
+    l->step.kernel = conv2D_step;
+    bench_shape(&l->step.in, 1, 56, 56, 64);
+    bench_shape(&l->step.out, 1, 56, 56, 64);
+    bench_window(&l->step.attr, 3, 1, 1);
+    l->step.weight = bench_random(64 * 3 * 3 * 64);
+    l->step.bias = bench_random(64);
+    l->flops = 2.0 * 56 * 56 * 64 * 3 * 3 * 64;
+
+    // MaxPool 2x2/2, 112x112x64 --> 56x56x64, batch 4
+    l = &layers[n++];
+    l->name = "maxpool";
+    l->step.kernel = maxpool_step;
+    bench_shape(&l->step.in, 4, 112, 112, 64);
+    bench_shape(&l->step.out, 4, 56, 56, 64);
+    bench_window(&l->step.attr, 2, 0, 2);
+    l->flops = 4.0 * 112 * 112 * 64;
+
+    // MatMul 1024 --> 1024, batch 32
+    l = &layers[n++];
+    l->name = "matmul";
+    l->step.kernel = matmul_step;
+    l->step.shapeW[0] = 1024;
+    l->step.shapeW[1] = 1024;
+    bench_rows(&l->step.in, 32, 1024);
+    bench_rows(&l->step.out, 32, 1024);
+    l->step.weight = bench_random(1024 * 1024);
+    l->flops = 2.0 * 32 * 1024 * 1024;
+
+    // Relu and bias Add over 4M elements
+    l = &layers[n++];
+    l->name = "relu";
+    l->step.kernel = relu_step;
+    bench_shape(&l->step.in, 16, 128, 128, 16);
+    bench_shape(&l->step.out, 16, 128, 128, 16);
+    l->flops = 16.0 * 128 * 128 * 16;
+
+    l = &layers[n++];
+    l->name = "add";
+    l->step.kernel = add_step;
+    bench_shape(&l->step.in, 16, 128, 128, 16);
+    bench_shape(&l->step.out, 16, 128, 128, 16);
+    l->step.bias = bench_random(128 * 128 * 16);
+    l->flops = 16.0 * 128 * 128 * 16;
+
+    for(int i = 0; i < n; i++)
+    {
+        l = &layers[i];
+        l->step.input[0] = 0;
+        l->step.input[1] = -1;
+        l->step.output = 1;
+        l->in_len = onnx_tensor_numel(&l->step.in);
+        l->out_len = onnx_tensor_numel(&l->step.out);
+    }
+    return n;
+}
+
+int main(int argc, char const *argv[])
+{
+    // 0. Thread counts up to the number of cores, or argv[1]
+    int max_threads = onnx_pool_default_workers() + 1;
+    if(argc > 1)
+    {
+        max_threads = atoi(argv[1]);
+    }
+
+    bench_layer layers[8] = { 0 };
+    int n_layers = bench_layers(layers);
+
+    printf("%-8s %8s %12s %10s %8s\n", "kernel", "threads", "ms/run", "GFLOP/s", "speedup");
+    for(int i = 0; i < n_layers; i++)
+    {
+        bench_layer* l = &layers[i];
+        float* slots[2] = { bench_random(l->in_len), (float*) malloc(sizeof(float) * l->out_len) };
+        float* reference = (float*) malloc(sizeof(float) * l->out_len);
+        double base = 0;
+
+        for(int threads = 1; threads <= max_threads; threads *= 2)
+        {
+            onnx_pool* pool = threads > 1 ? onnx_pool_create(threads - 1, NULL) : NULL;
+
+            // 1. Warm up, and check against the single thread output
+            l->step.kernel(&l->step, slots, pool);
+            if(threads == 1)
+            {
+                memcpy(reference, slots[1], sizeof(float) * l->out_len);
+            }
+            else if(memcmp(reference, slots[1], sizeof(float) * l->out_len) != 0)
+            {
+                printf("%s: output with %d threads differs from 1 thread\n", l->name, threads);
+            }
+
+            // 2. Time enough runs to cover BENCH_MIN_MS
+            int runs = 0;
+            double start = bench_now_ms();
+            double elapsed = 0;
+            while(elapsed < BENCH_MIN_MS)
+            {
+                l->step.kernel(&l->step, slots, pool);
+                runs++;
+                elapsed = bench_now_ms() - start;
+            }
+            double ms = elapsed / runs;
+            base = threads == 1 ? ms : base;
+            printf("%-8s %8d %12.3f %10.2f %8.2f\n", l->name, threads, ms, l->flops / ms / 1e6, base / ms);
+
+            onnx_pool_destroy(pool);
+        }
+
+        free(slots[0]);
+        free(slots[1]);
+        free(reference);
+    }
+
+    for(int i = 0; i < n_layers; i++)
+    {
+        free((float*) layers[i].step.weight);
+        free((float*) layers[i].step.bias);
+    }
+
+    return 0;
+}
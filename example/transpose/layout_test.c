@@ -0,0 +1,409 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "onnx.h"
+#include "test/graph.h"
+
+// Layout propagation on small synthetic graphs. Each graph is compiled with
+// and without fusion and also run through onnx_graph_run, and every output is
+// checked against a plain NCHW reference. The number of layout copies in the
+// plan is checked as well: inverse Transpose pairs must cancel, a flatten
+// feeding a MatMul must fold into its weights, and a tensor is copied at most
+// once per layout. onnx_graph_run must also refuse graphs it cannot run: a
+// Constant node, an output left unnamed and a graph without an output.
+//
+//   usage: onnx-layout
+//
+// Exits with 1 on any mismatch.
+
+#define TEST_TOLERANCE 1e-4
+
+static void test_transpose_node(test_graph* g, const char* in, const char* out, const int64_t* perm)
+{
+    test_graph_ints(g, test_graph_node(g, "Transpose", NULL, in, NULL, NULL, out), "perm", perm, 4);
+}
+
+// 3x3, pad 1, stride 1, the one shape the legacy conv2D_layer runs
+static void test_conv_node(test_graph* g, const char* in, const char* out, int64_t ch_in, int64_t ch_out,
+                           float** w, float** b)
+{
+    static const int64_t kernel[] = { 3, 3 };
+    static const int64_t pads[] = { 1, 1, 1, 1 };
+    char* name_w = test_graph_name(g, "%s_w", out);
+    char* name_b = test_graph_name(g, "%s_b", out);
+    int64_t dims_w[] = { ch_out, ch_in, 3, 3 };
+    *w = test_graph_weights(g, name_w, dims_w, 4);
+    *b = test_graph_weights(g, name_b, &ch_out, 1);
+
+    Onnx__NodeProto* node = test_graph_node(g, "Conv", NULL, in, name_w, name_b, out);
+    test_graph_ints(g, node, "kernel_shape", kernel, 2);
+    test_graph_ints(g, node, "pads", pads, 4);
+}
+
+static void test_matmul_node(test_graph* g, const char* in, const char* out, int64_t k, int64_t n, float** w)
+{
+    char* name_w = test_graph_name(g, "%s_w", out);
+    int64_t dims_w[] = { k, n };
+    *w = test_graph_weights(g, name_w, dims_w, 2);
+    test_graph_node(g, "MatMul", NULL, in, name_w, NULL, out);
+}
+
+// Reference kernels on dense logical tensors of one sample
+
+static void ref_transpose(const float* x, const int64_t* dims, const int64_t* perm, float* y)
+{
+    // dims and perm of the three axes after N
+    int64_t out[3] = { dims[perm[0]], dims[perm[1]], dims[perm[2]] };
+    int64_t stride[3] = { dims[1] * dims[2], dims[2], 1 };
+    for(int64_t i = 0; i < out[0]; i++)
+    {
+        for(int64_t j = 0; j < out[1]; j++)
+        {
+            for(int64_t k = 0; k < out[2]; k++)
+            {
+                *y++ = x[i * stride[perm[0]] + j * stride[perm[1]] + k * stride[perm[2]]];
+            }
+        }
+    }
+}
+
+static void ref_conv(const float* x, int64_t c, int64_t h, int64_t w, const float* wt, const float* b, int64_t o, float* y)
+{
+    for(int64_t f = 0; f < o; f++)
+    {
+        for(int64_t r = 0; r < h; r++)
+        {
+            for(int64_t q = 0; q < w; q++)
+            {
+                double acc = b[f];
+                for(int64_t ch = 0; ch < c; ch++)
+                {
+                    for(int64_t ky = 0; ky < 3; ky++)
+                    {
+                        for(int64_t kx = 0; kx < 3; kx++)
+                        {
+                            int64_t row = r + ky - 1;
+                            int64_t col = q + kx - 1;
+                            if(row >= 0 && row < h && col >= 0 && col < w)
+                            {
+                                acc += x[(ch * h + row) * w + col] * wt[((f * c + ch) * 3 + ky) * 3 + kx];
+                            }
+                        }
+                    }
+                }
+                y[(f * h + r) * w + q] = (float) acc;
+            }
+        }
+    }
+}
+
+static void ref_relu(float* x, int64_t len)
+{
+    for(int64_t i = 0; i < len; i++)
+    {
+        x[i] = x[i] < 0 ? 0 : x[i];
+    }
+}
+
+static void ref_matmul(const float* x, const float* w, int64_t k, int64_t n, float* y)
+{
+    for(int64_t j = 0; j < n; j++)
+    {
+        double acc = 0;
+        for(int64_t p = 0; p < k; p++)
+        {
+            acc += x[p] * w[p * n + j];
+        }
+        y[j] = (float) acc;
+    }
+}
+
+typedef struct test_case
+{
+    const char* name;
+    int32_t copies;             // layout copies the plan may contain
+    int64_t in_len;
+    int64_t out_len;
+    float* input;
+    float* expected;
+} test_case;
+
+// NHWC input wrapped the way keras2onnx does: Transpose to NCHW, Conv, Relu,
+// Transpose back and flatten. Nothing needs to move.
+static test_graph* test_keras(test_case* c)
+{
+    static const int64_t to_nchw[] = { 0, 3, 1, 2 };
+    static const int64_t to_nhwc[] = { 0, 2, 3, 1 };
+    int64_t h = 6, w = 5, ch = 3, o = 4, n = 7;
+    float *wc, *bc, *wm;
+
+    int64_t dims[] = { 1, h, w, ch };
+    test_graph* g = test_graph_create("layout", dims, 4);
+    test_transpose_node(g, "x", "x_nchw", to_nchw);
+    test_conv_node(g, "x_nchw", "conv", ch, o, &wc, &bc);
+    test_graph_node(g, "Relu", NULL, "conv", NULL, NULL, "relu");
+    test_transpose_node(g, "relu", "relu_nhwc", to_nhwc);
+    test_graph_node(g, "Reshape", NULL, "relu_nhwc", NULL, NULL, "flat");
+    test_matmul_node(g, "flat", "y", h * w * o, n, &wm);
+    test_graph_output(g, "y");
+
+    c->name = "keras NHWC wrap";
+    c->copies = 0;
+    c->in_len = h * w * ch;
+    c->out_len = n;
+    c->input = test_graph_random(g, c->in_len);
+    c->expected = (float*) test_graph_alloc(g, sizeof(float) * n);
+
+    float* x = (float*) test_graph_alloc(g, sizeof(float) * c->in_len);
+    float* conv = (float*) test_graph_alloc(g, sizeof(float) * h * w * o);
+    float* nhwc = (float*) test_graph_alloc(g, sizeof(float) * h * w * o);
+    int64_t dims_in[] = { h, w, ch };
+    int64_t dims_conv[] = { o, h, w };
+    int64_t nchw[] = { 2, 0, 1 };
+    int64_t nhwc_perm[] = { 1, 2, 0 };
+    ref_transpose(c->input, dims_in, nchw, x);
+    ref_conv(x, ch, h, w, wc, bc, o, conv);
+    ref_relu(conv, h * w * o);
+    ref_transpose(conv, dims_conv, nhwc_perm, nhwc);
+    ref_matmul(nhwc, wm, h * w * o, n, c->expected);
+    return g;
+}
+
+// NCHW input flattened straight into a MatMul: one copy in front of the Conv,
+// the flatten folds into the weights
+static test_graph* test_nchw_flatten(test_case* c)
+{
+    int64_t h = 5, w = 7, ch = 2, o = 3, n = 6;
+    float *wc, *bc, *wm;
+
+    int64_t dims[] = { 1, ch, h, w };
+    test_graph* g = test_graph_create("layout", dims, 4);
+    test_conv_node(g, "x", "conv", ch, o, &wc, &bc);
+    test_graph_node(g, "Relu", NULL, "conv", NULL, NULL, "relu");
+    test_graph_node(g, "Reshape", NULL, "relu", NULL, NULL, "flat");
+    test_matmul_node(g, "flat", "y", o * h * w, n, &wm);
+    test_graph_output(g, "y");
+
+    c->name = "NCHW flatten";
+    c->copies = 1;
+    c->in_len = ch * h * w;
+    c->out_len = n;
+    c->input = test_graph_random(g, c->in_len);
+    c->expected = (float*) test_graph_alloc(g, sizeof(float) * n);
+
+    float* conv = (float*) test_graph_alloc(g, sizeof(float) * o * h * w);
+    ref_conv(c->input, ch, h, w, wc, bc, o, conv);
+    ref_relu(conv, o * h * w);
+    ref_matmul(conv, wm, o * h * w, n, c->expected);
+    return g;
+}
+
+// NCHW in and out: the input and the conv output are both copied
+static test_graph* test_nchw_output(test_case* c)
+{
+    int64_t h = 4, w = 6, ch = 3, o = 5;
+    float *wc, *bc;
+
+    int64_t dims[] = { 1, ch, h, w };
+    test_graph* g = test_graph_create("layout", dims, 4);
+    test_conv_node(g, "x", "y", ch, o, &wc, &bc);
+    test_graph_output(g, "y");
+
+    c->name = "NCHW output";
+    c->copies = 2;
+    c->in_len = ch * h * w;
+    c->out_len = o * h * w;
+    c->input = test_graph_random(g, c->in_len);
+    c->expected = (float*) test_graph_alloc(g, sizeof(float) * c->out_len);
+    ref_conv(c->input, ch, h, w, wc, bc, o, c->expected);
+    return g;
+}
+
+// A residual Add of a conv output and the NCHW input: the input is copied
+// once, for both the Conv and the Add
+static test_graph* test_residual(test_case* c)
+{
+    int64_t h = 5, w = 5, ch = 4, n = 3;
+    float *wc, *bc, *wm;
+
+    int64_t dims[] = { 1, ch, h, w };
+    test_graph* g = test_graph_create("layout", dims, 4);
+    test_conv_node(g, "x", "conv", ch, ch, &wc, &bc);
+    test_graph_node(g, "Add", NULL, "conv", "x", NULL, "sum");
+    test_graph_node(g, "Relu", NULL, "sum", NULL, NULL, "relu");
+    test_graph_node(g, "Reshape", NULL, "relu", NULL, NULL, "flat");
+    test_matmul_node(g, "flat", "y", ch * h * w, n, &wm);
+    test_graph_output(g, "y");
+
+    c->name = "residual NCHW";
+    c->copies = 1;
+    c->in_len = ch * h * w;
+    c->out_len = n;
+    c->input = test_graph_random(g, c->in_len);
+    c->expected = (float*) test_graph_alloc(g, sizeof(float) * n);
+
+    float* conv = (float*) test_graph_alloc(g, sizeof(float) * c->in_len);
+    ref_conv(c->input, ch, h, w, wc, bc, ch, conv);
+    for(int64_t i = 0; i < c->in_len; i++)
+    {
+        conv[i] += c->input[i];
+    }
+    ref_relu(conv, c->in_len);
+    ref_matmul(conv, wm, c->in_len, n, c->expected);
+    return g;
+}
+
+// Two inverse Transposes around an elementwise op cancel
+static test_graph* test_inverse_pair(test_case* c)
+{
+    static const int64_t to_nchw[] = { 0, 3, 1, 2 };
+    static const int64_t to_nhwc[] = { 0, 2, 3, 1 };
+    int64_t h = 3, w = 4, ch = 5;
+
+    int64_t dims[] = { 1, h, w, ch };
+    test_graph* g = test_graph_create("layout", dims, 4);
+    test_transpose_node(g, "x", "a", to_nchw);
+    test_graph_node(g, "Relu", NULL, "a", NULL, NULL, "b");
+    test_transpose_node(g, "b", "y", to_nhwc);
+    test_graph_output(g, "y");
+
+    c->name = "inverse pair";
+    c->copies = 0;
+    c->in_len = h * w * ch;
+    c->out_len = c->in_len;
+    c->input = test_graph_random(g, c->in_len);
+    c->expected = (float*) test_graph_alloc(g, sizeof(float) * c->out_len);
+    memcpy(c->expected, c->input, sizeof(float) * c->in_len);
+    ref_relu(c->expected, c->out_len);
+    return g;
+}
+
+static double test_error(const float* output, const float* expected, int64_t len)
+{
+    double worst = 0;
+    for(int64_t i = 0; i < len; i++)
+    {
+        double err = fabs(output[i] - expected[i]);
+        worst = err > worst ? err : worst;
+    }
+    return output == NULL ? INFINITY : worst;
+}
+
+static int32_t test_copies(const onnx_plan* plan)
+{
+    int32_t copies = 0;
+    for(int32_t i = 0; i < plan->n_steps; i++)
+    {
+        copies += plan->steps[i].kernel == transpose_step;
+    }
+    return copies;
+}
+
+// Runs g through onnx_graph_run, which must fail
+static int test_refused(test_graph* g, const char* what)
+{
+    int64_t dims[] = { 1, g->dims[1].dim_value, g->dims[2].dim_value, g->dims[3].dim_value };
+    float* data = test_graph_random(g, dims[1] * dims[2] * dims[3]);
+    onnx_graph_index* index = onnx_graph_index_create(&g->graph);
+    onnx_tensor input, output;
+    onnx_tensor_init(&input, ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT, 4, dims, data);
+    int status = index != NULL ? onnx_graph_run(index, &input, &output) : 0;
+    onnx_graph_index_free(index);
+    test_graph_free(g);
+    return test_check(status != 0, what);
+}
+
+static int test_malformed(void)
+{
+    static const int64_t dims[] = { 1, 2, 3, 4 };
+    int failed = 0;
+
+    test_graph* g = test_graph_create("layout", dims, 4);
+    test_graph_float(g, test_graph_node(g, "Constant", NULL, NULL, NULL, NULL, "c"), "value_float", 1);
+    test_graph_node(g, "Add", NULL, "x", "c", NULL, "y");
+    test_graph_output(g, "y");
+    failed |= test_refused(g, "graph run refuses a Constant");
+
+    g = test_graph_create("layout", dims, 4);
+    test_graph_node(g, "Relu", "unnamed", "x", NULL, NULL, "");
+    test_graph_node(g, "Relu", NULL, "x", NULL, NULL, "y");
+    test_graph_output(g, "y");
+    failed |= test_refused(g, "graph run refuses an unnamed output");
+
+    g = test_graph_create("layout", dims, 4);
+    test_graph_node(g, "Relu", NULL, "x", NULL, NULL, "y");
+    failed |= test_refused(g, "graph run refuses a graph without output");
+
+    g = test_graph_create("layout", dims, 4);
+    test_graph_node(g, "Relu", NULL, "x", NULL, NULL, "y");
+    test_graph_output(g, "");
+    failed |= test_refused(g, "graph run refuses an empty output name");
+
+    // Dilations of the wrong length, or with a value past the first two
+    static const int64_t dilations[][3] = { { 1 }, { 1, 1, 2 } };
+    static const size_t n_dilations[] = { 1, 3 };
+    for(int k = 0; k < 2; k++)
+    {
+        float *wc, *bc;
+        g = test_graph_create("layout", dims, 4);
+        test_conv_node(g, "x", "y", dims[1], 2, &wc, &bc);
+        test_graph_ints(g, g->graph.node[0], "dilations", dilations[k], n_dilations[k]);
+        test_graph_output(g, "y");
+        onnx_plan* plan = onnx_plan_compile(&g->model);
+        failed |= test_check(plan == NULL, k == 0 ? "plan refuses one dilation" : "plan refuses three dilations");
+        onnx_plan_free(plan);
+        failed |= test_refused(g, k == 0 ? "graph run refuses one dilation" : "graph run refuses three dilations");
+    }
+    return failed;
+}
+
+int main(int argc, char const *argv[])
+{
+    test_graph* (*builders[])(test_case*) = { test_keras, test_nchw_flatten, test_nchw_output, test_residual, test_inverse_pair };
+    int failed = 0;
+
+    printf("%-18s %8s %8s %12s %12s %12s %6s\n", "graph", "copies", "steps", "plan", "unfused", "graph run", "");
+    for(size_t t = 0; t < sizeof(builders) / sizeof(builders[0]); t++)
+    {
+        test_case c;
+        test_graph* g = builders[t](&c);
+
+        double err[3];
+        int32_t copies = 0, steps = 0;
+        for(int fused = 1; fused >= 0; fused--)
+        {
+            onnx_plan_set_fusion(fused);
+            onnx_plan* plan = onnx_plan_compile(&g->model);
+            err[1 - fused] = plan != NULL ? test_error(onnx_plan_run(plan, c.input), c.expected, c.out_len) : INFINITY;
+            if(plan != NULL && fused)
+            {
+                copies = test_copies(plan);
+                steps = plan->n_steps;
+            }
+            onnx_plan_free(plan);
+        }
+        onnx_plan_set_fusion(1);
+
+        // The interpreter takes the NHWC sample the plan was given
+        onnx_graph_index* index = onnx_graph_index_create(&g->graph);
+        int64_t dims[] = { 1, g->dims[1].dim_value, g->dims[2].dim_value, g->dims[3].dim_value };
+        onnx_tensor input, output;
+        onnx_tensor_init(&input, ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT, 4, dims, c.input);
+        int status = onnx_graph_run(index, &input, &output);
+        err[2] = status == 0 ? test_error((const float*) output.data, c.expected, c.out_len) : INFINITY;
+        onnx_tensor_release(&output);
+        onnx_graph_index_free(index);
+
+        int ok = copies == c.copies && err[0] <= TEST_TOLERANCE && err[1] <= TEST_TOLERANCE && err[2] <= TEST_TOLERANCE;
+        failed |= !ok;
+        printf("%-18s %4d / %d %8d %12.2e %12.2e %12.2e %6s\n", c.name, copies, c.copies, steps, err[0], err[1], err[2],
+               ok ? "ok" : "FAIL");
+        test_graph_free(g);
+    }
+    printf("(layout copies in the fused plan / expected; max abs error of the plan, the plan without fusion and onnx_graph_run)\n");
+
+    failed |= test_malformed();
+
+    return failed;
+}
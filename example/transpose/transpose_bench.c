@@ -0,0 +1,176 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench/bench.h"
+#include "onnx.h"
+
+// The stride-based transpose against the per-element implementation it
+// replaced, on 2-D and 4-D permutations and one 5-D shape for the generic
+// path. Every ISA level is checked element for element against the old code,
+// and so is a strided view read back through its strides.
+//
+//   usage: onnx-transpose-bench [min ms per kernel]
+//
+// Exits with 1 when any result differs.
+
+typedef struct bench_transpose
+{
+    const char* name;
+    int64_t dim;
+    int64_t shape[5];
+    int64_t perm[5];
+} bench_transpose;
+
+static const bench_transpose bench_shapes[] = {
+    { "2d 1024x1024",      2, { 1024, 1024 },          { 1, 0 } },
+    { "2d 4096x256",       2, { 4096, 256 },           { 1, 0 } },
+    { "2d 37x53",          2, { 37, 53 },              { 1, 0 } },
+    { "4d nchw>nhwc",      4, { 1, 64, 56, 56 },       { 0, 2, 3, 1 } },
+    { "4d nhwc>nchw",      4, { 1, 56, 56, 64 },       { 0, 3, 1, 2 } },
+    { "4d nchw>nhwc c3",   4, { 8, 3, 64, 64 },        { 0, 2, 3, 1 } },
+    { "4d oihw>ohwi",      4, { 256, 128, 3, 3 },      { 0, 2, 3, 1 } },
+    { "4d oihw>hwio",      4, { 128, 64, 5, 5 },       { 2, 3, 1, 0 } },
+    { "4d swap 1,2",       4, { 16, 32, 48, 24 },      { 0, 2, 1, 3 } },
+    { "5d generic",        5, { 6, 10, 12, 14, 9 },    { 4, 2, 0, 3, 1 } },
+};
+
+// The previous implementation, kept as the reference: two index arrays
+// allocated per element and div/mod to unravel every source index
+static float* bench_transpose_reference(const float* A, const int64_t* shape, int64_t dim, const int64_t* perm)
+{
+    int elem = 1;
+    for(int i = 0; i < dim; i++)
+    {
+        elem = elem * shape[i];
+    }
+    float* B = malloc(sizeof(float) * elem);
+    int* shapeB = malloc(sizeof(int) * dim);
+    for(int i = 0; i < dim; i++)
+    {
+        shapeB[i] = shape[perm[i]];
+    }
+    for(int src = 0; src < elem; src++)
+    {
+        int temp = src;
+        int* indexA = malloc(sizeof(int) * dim);
+        int* indexB = malloc(sizeof(int) * dim);
+        for(int i = dim-1; i >= 0; i--)
+        {
+            indexA[i] = temp % shape[i];
+            temp = temp / shape[i];
+        }
+        for(int i = 0; i < dim; i++)
+        {
+            indexB[i] = indexA[perm[i]];
+        }
+        int dst = 0;
+        temp = 1;
+        for(int i = dim - 1; i >= 0; i--)
+        {
+            dst = dst + indexB[i] * temp;
+            temp = temp * shapeB[i];
+        }
+        B[dst] = A[src];
+        free(indexA);
+        free(indexB);
+    }
+    free(shapeB);
+    return B;
+}
+
+// Reads a view element by element in row-major order of its shape
+static int64_t bench_view_mismatches(const onnx_tensor* view, const float* expected, int64_t elem)
+{
+    int64_t index[ONNX_TRANSPOSE_MAX_DIM] = { 0 };
+    int64_t bad = 0;
+    for(int64_t e = 0; e < elem; e++)
+    {
+        int64_t offset = 0;
+        for(int32_t i = 0; i < view->rank; i++)
+        {
+            offset += index[i] * view->strides[i];
+        }
+        bad += ((const float*) view->data)[offset] != expected[e];
+        for(int32_t i = view->rank - 1; i >= 0 && ++index[i] == view->dims[i]; i--)
+        {
+            index[i] = 0;
+        }
+    }
+    return bad;
+}
+
+int main(int argc, char const *argv[])
+{
+    double min_ms = argc > 1 ? atof(argv[1]) : 200.0;
+    const onnx_kernels* active = onnx_kernels_active;
+    int failed = 0;
+
+    printf("%-18s %10s", "permutation", "old ms");
+    for(int isa = 0; isa < ONNX_ISA_COUNT; isa++)
+    {
+        if(onnx_kernels_get((onnx_isa) isa) != NULL)
+        {
+            printf(" %10s %8s", onnx_kernels_get((onnx_isa) isa)->name, "speedup");
+        }
+    }
+    printf(" %6s\n", "");
+
+    for(size_t s = 0; s < sizeof(bench_shapes) / sizeof(bench_shapes[0]); s++)
+    {
+        const bench_transpose* c = &bench_shapes[s];
+        int64_t elem = 1;
+        for(int64_t i = 0; i < c->dim; i++)
+        {
+            elem *= c->shape[i];
+        }
+        float* A = (float*) malloc(sizeof(float) * elem);
+        float* B = (float*) malloc(sizeof(float) * elem);
+        for(int64_t i = 0; i < elem; i++)
+        {
+            A[i] = (float) i;
+        }
+
+        // The old code is slow enough that one run is a fair sample
+        double start = bench_now_ms();
+        float* expected = bench_transpose_reference(A, c->shape, c->dim, c->perm);
+        double ms_old = bench_now_ms() - start;
+        printf("%-18s %10.3f", c->name, ms_old);
+
+        int ok = 1;
+        for(int isa = 0; isa < ONNX_ISA_COUNT; isa++)
+        {
+            if(onnx_kernels_use((onnx_isa) isa) != 0)
+            {
+                continue;
+            }
+            memset(B, 0, sizeof(float) * elem);
+            ok &= transpose_into(A, c->shape, c->dim, c->perm, B) == 0 &&
+                  memcmp(B, expected, sizeof(float) * elem) == 0;
+
+            int runs = 0;
+            double elapsed = 0;
+            start = bench_now_ms();
+            while(elapsed < min_ms)
+            {
+                transpose_into(A, c->shape, c->dim, c->perm, B);
+                runs++;
+                elapsed = bench_now_ms() - start;
+            }
+            printf(" %10.3f %7.0fx", elapsed / runs, ms_old / (elapsed / runs));
+        }
+        onnx_kernels_active = active;
+
+        onnx_tensor view;
+        ok &= transpose_view(A, c->shape, c->dim, c->perm, &view) == 0 &&
+              bench_view_mismatches(&view, expected, elem) == 0;
+        printf(" %6s\n", ok ? "ok" : "FAIL");
+        failed |= !ok;
+
+        free(A);
+        free(B);
+        free(expected);
+    }
+    printf("(ms per call; a strided view costs no copy and is checked in place)\n");
+
+    return failed;
+}
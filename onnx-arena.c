@@ -0,0 +1,128 @@
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "onnx-arena.h"
+
+#define ONNX_ARENA_ALIGN      16
+#define ONNX_ARENA_MIN_BLOCK  (64 * 1024)
+#define ONNX_ARENA_MAX_BLOCK  (64 * 1024 * 1024)
+
+static size_t onnx_arena_align(size_t size)
+{
+    return (size + ONNX_ARENA_ALIGN - 1) & ~((size_t) ONNX_ARENA_ALIGN - 1);
+}
+
+static void* onnx_arena_protobuf_alloc(void* allocator_data, size_t size)
+{
+    return onnx_arena_alloc((onnx_arena*) allocator_data, size);
+}
+
+static void onnx_arena_protobuf_free(void* allocator_data, void* pointer)
+{
+    // Released together with the arena
+}
+
+static onnx_arena_block* onnx_arena_add_block(onnx_arena* arena, size_t size)
+{
+    size_t header = onnx_arena_align(sizeof(onnx_arena_block));
+    onnx_arena_block* block = (onnx_arena_block*) malloc(header + size);
+    if(block == NULL)
+    {
+        return NULL;
+    }
+    block->size = header + size;
+    block->used = header;
+
+    arena->n_blocks++;
+    arena->bytes_reserved += block->size;
+
+    return block;
+}
+
+onnx_arena* onnx_arena_create(size_t block_size)
+{
+    onnx_arena* arena = (onnx_arena*) malloc(sizeof(onnx_arena));
+    if(arena == NULL)
+    {
+        return NULL;
+    }
+
+    arena->allocator.alloc = onnx_arena_protobuf_alloc;
+    arena->allocator.free = onnx_arena_protobuf_free;
+    arena->allocator.allocator_data = arena;
+    arena->blocks = NULL;
+    arena->block_size = block_size < ONNX_ARENA_MIN_BLOCK ? ONNX_ARENA_MIN_BLOCK : onnx_arena_align(block_size);
+    arena->n_blocks = 0;
+    arena->bytes_reserved = 0;
+    arena->bytes_used = 0;
+
+    return arena;
+}
+
+void onnx_arena_destroy(onnx_arena* arena)
+{
+    if(arena == NULL)
+    {
+        return;
+    }
+
+    onnx_arena_block* block = arena->blocks;
+    while(block != NULL)
+    {
+        onnx_arena_block* next = block->next;
+        free(block);
+        block = next;
+    }
+    free(arena);
+}
+
+void* onnx_arena_alloc(onnx_arena* arena, size_t size)
+{
+    size = onnx_arena_align(size == 0 ? 1 : size);
+
+    onnx_arena_block* block = arena->blocks;
+    if(block == NULL || block->size - block->used < size)
+    {
+        if(size > arena->block_size / 2)
+        {
+            // Large request: give it a block of its own behind the current
+            // one, so the space left in the current block is not wasted
+            block = onnx_arena_add_block(arena, size);
+            if(block == NULL)
+            {
+                return NULL;
+            }
+            if(arena->blocks == NULL)
+            {
+                block->next = NULL;
+                arena->blocks = block;
+            }
+            else
+            {
+                block->next = arena->blocks->next;
+                arena->blocks->next = block;
+            }
+        }
+        else
+        {
+            block = onnx_arena_add_block(arena, arena->block_size);
+            if(block == NULL)
+            {
+                return NULL;
+            }
+            block->next = arena->blocks;
+            arena->blocks = block;
+
+            if(arena->block_size < ONNX_ARENA_MAX_BLOCK)
+            {
+                arena->block_size *= 2;
+            }
+        }
+    }
+
+    void* pointer = (unsigned char*) block + block->used;
+    block->used += size;
+    arena->bytes_used += size;
+
+    return pointer;
+}
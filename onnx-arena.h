@@ -0,0 +1,31 @@
+#ifndef __ONNX_ARENA_H__
+#define __ONNX_ARENA_H__
+
+#include <stddef.h>
+
+#include "protobuf-c.h"
+
+// Bump-pointer arena. Memory is carved out of a few large blocks and
+// released all at once by onnx_arena_destroy; individual frees are no-ops.
+typedef struct onnx_arena_block
+{
+    struct onnx_arena_block* next;
+    size_t size;
+    size_t used;
+} onnx_arena_block;
+
+typedef struct onnx_arena
+{
+    ProtobufCAllocator allocator;   // allocator_data points back to the arena
+    onnx_arena_block* blocks;       // current block first
+    size_t block_size;              // size of the next block to be allocated
+    size_t n_blocks;
+    size_t bytes_reserved;
+    size_t bytes_used;
+} onnx_arena;
+
+onnx_arena* onnx_arena_create(size_t block_size);
+void onnx_arena_destroy(onnx_arena* arena);
+void* onnx_arena_alloc(onnx_arena* arena, size_t size);
+
+#endif //__ONNX_ARENA_H__
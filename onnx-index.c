@@ -0,0 +1,499 @@
+#include "onnx-parser.h"
+
+typedef const char* (*onnx_index_name)(const onnx_graph_index* index, int32_t i);
+
+static const char* onnx_index_node_name(const onnx_graph_index* index, int32_t i)
+{
+    return index->graph->node[i]->name;
+}
+
+static const char* onnx_index_initializer_name(const onnx_graph_index* index, int32_t i)
+{
+    return index->graph->initializer[i]->name;
+}
+
+static const char* onnx_index_tensor_name(const onnx_graph_index* index, int32_t i)
+{
+    return index->tensor_names[i];
+}
+
+// FNV-1a
+static uint32_t onnx_index_hash(const char* name)
+{
+    uint32_t hash = 2166136261u;
+    while(*name)
+    {
+        hash ^= (unsigned char) *name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static int onnx_index_table_init(onnx_index_table* table, size_t n)
+{
+    size_t capacity = 16;
+    while(capacity < 2 * n)
+    {
+        capacity *= 2;
+    }
+
+    table->slots = (onnx_index_slot*) malloc(sizeof(onnx_index_slot) * capacity);
+    if(table->slots == NULL)
+    {
+        return -1;
+    }
+    for(size_t i = 0; i < capacity; i++)
+    {
+        table->slots[i].index = -1;
+    }
+    table->mask = capacity - 1;
+
+    return 0;
+}
+
+static int32_t onnx_index_table_find(const onnx_index_table* table, const onnx_graph_index* index, onnx_index_name name_of, const char* name)
+{
+    uint32_t hash = onnx_index_hash(name);
+    uint32_t i = hash & table->mask;
+
+    while(table->slots[i].index >= 0)
+    {
+        if(table->slots[i].hash == hash && strcmp(name_of(index, table->slots[i].index), name) == 0)
+        {
+            return table->slots[i].index;
+        }
+        i = (i + 1) & table->mask;
+    }
+
+    return -1;
+}
+
+// Keeps the first entry for duplicated names, like the linear lookups do.
+// Returns the index stored for the name.
+static int32_t onnx_index_table_insert(onnx_index_table* table, const onnx_graph_index* index, onnx_index_name name_of, const char* name, int32_t i_new)
+{
+    uint32_t hash = onnx_index_hash(name);
+    uint32_t i = hash & table->mask;
+
+    while(table->slots[i].index >= 0)
+    {
+        if(table->slots[i].hash == hash && strcmp(name_of(index, table->slots[i].index), name) == 0)
+        {
+            return table->slots[i].index;
+        }
+        i = (i + 1) & table->mask;
+    }
+    table->slots[i].hash = hash;
+    table->slots[i].index = i_new;
+
+    return i_new;
+}
+
+static int32_t onnx_index_add_tensor(onnx_graph_index* index, const char* name)
+{
+    if(name == NULL || name[0] == '\0')
+    {
+        return -1;
+    }
+
+    int32_t id = onnx_index_table_insert(&index->tensors, index, onnx_index_tensor_name, name, index->n_tensors);
+    if(id == index->n_tensors)
+    {
+        index->tensor_names[index->n_tensors++] = name;
+    }
+
+    return id;
+}
+
+// Exclusive prefix sum of counts[0..n) into offsets[0..n]
+static void onnx_index_prefix_sum(const int32_t* counts, int32_t* offsets, int32_t n)
+{
+    offsets[0] = 0;
+    for(int32_t i = 0; i < n; i++)
+    {
+        offsets[i + 1] = offsets[i] + counts[i];
+    }
+}
+
+static int onnx_graph_index_build_edges(onnx_graph_index* index)
+{
+    Onnx__GraphProto* graph = index->graph;
+    int32_t n_node = graph->n_node;
+
+    // Upper bound on the number of distinct tensor names
+    size_t n_names = graph->n_input + graph->n_output + graph->n_initializer;
+    size_t n_in_edges = 0;
+    size_t n_out_edges = 0;
+    for(int i = 0; i < n_node; i++)
+    {
+        n_in_edges += graph->node[i]->n_input;
+        n_out_edges += graph->node[i]->n_output;
+    }
+    n_names += n_in_edges + n_out_edges;
+
+    if(onnx_index_table_init(&index->tensors, n_names) != 0)
+    {
+        return -1;
+    }
+    index->tensor_names = (const char**) malloc(sizeof(char*) * (n_names + 1));
+    index->node_input_offsets = (int32_t*) malloc(sizeof(int32_t) * (n_node + 1));
+    index->node_inputs = (int32_t*) malloc(sizeof(int32_t) * (n_in_edges + 1));
+    index->node_output_offsets = (int32_t*) malloc(sizeof(int32_t) * (n_node + 1));
+    index->node_outputs = (int32_t*) malloc(sizeof(int32_t) * (n_out_edges + 1));
+    index->order = (int32_t*) malloc(sizeof(int32_t) * (n_node + 1));
+    if(index->tensor_names == NULL || index->node_input_offsets == NULL || index->node_inputs == NULL ||
+       index->node_output_offsets == NULL || index->node_outputs == NULL || index->order == NULL)
+    {
+        return -1;
+    }
+
+    // Assign tensor ids: graph inputs and initializers first, then node edges
+    for(int i = 0; i < graph->n_input; i++)
+    {
+        onnx_index_add_tensor(index, graph->input[i]->name);
+    }
+    for(int i = 0; i < graph->n_initializer; i++)
+    {
+        onnx_index_add_tensor(index, graph->initializer[i]->name);
+    }
+    index->node_input_offsets[0] = 0;
+    index->node_output_offsets[0] = 0;
+    for(int i = 0; i < n_node; i++)
+    {
+        Onnx__NodeProto* node = graph->node[i];
+        int32_t in = index->node_input_offsets[i];
+        int32_t out = index->node_output_offsets[i];
+        for(int j = 0; j < node->n_input; j++)
+        {
+            index->node_inputs[in++] = onnx_index_add_tensor(index, node->input[j]);
+        }
+        for(int j = 0; j < node->n_output; j++)
+        {
+            index->node_outputs[out++] = onnx_index_add_tensor(index, node->output[j]);
+        }
+        index->node_input_offsets[i + 1] = in;
+        index->node_output_offsets[i + 1] = out;
+    }
+    for(int i = 0; i < graph->n_output; i++)
+    {
+        onnx_index_add_tensor(index, graph->output[i]->name);
+    }
+
+    int32_t n_tensors = index->n_tensors;
+    index->producers = (int32_t*) malloc(sizeof(int32_t) * (n_tensors + 1));
+    index->initializer_ids = (int32_t*) malloc(sizeof(int32_t) * (n_tensors + 1));
+    index->consumer_offsets = (int32_t*) calloc(n_tensors + 1, sizeof(int32_t));
+    index->consumers = (int32_t*) malloc(sizeof(int32_t) * (n_in_edges + 1));
+    int32_t* fill = (int32_t*) calloc(n_tensors + 1, sizeof(int32_t));
+    if(index->producers == NULL || index->initializer_ids == NULL || index->consumer_offsets == NULL ||
+       index->consumers == NULL || fill == NULL)
+    {
+        free(fill);
+        return -1;
+    }
+
+    for(int32_t t = 0; t < n_tensors; t++)
+    {
+        index->producers[t] = -1;
+        index->initializer_ids[t] = -1;
+    }
+    for(int i = graph->n_initializer - 1; i >= 0; i--)
+    {
+        index->initializer_ids[onnx_index_add_tensor(index, graph->initializer[i]->name)] = i;
+    }
+
+    // Producers, and consumer counts per tensor
+    for(int32_t n = 0; n < n_node; n++)
+    {
+        for(int32_t e = index->node_output_offsets[n]; e < index->node_output_offsets[n + 1]; e++)
+        {
+            if(index->node_outputs[e] >= 0)
+            {
+                index->producers[index->node_outputs[e]] = n;
+            }
+        }
+        for(int32_t e = index->node_input_offsets[n]; e < index->node_input_offsets[n + 1]; e++)
+        {
+            if(index->node_inputs[e] >= 0)
+            {
+                fill[index->node_inputs[e]]++;
+            }
+        }
+    }
+    onnx_index_prefix_sum(fill, index->consumer_offsets, n_tensors);
+
+    // Consumers, in node order
+    memset(fill, 0, sizeof(int32_t) * n_tensors);
+    for(int32_t n = 0; n < n_node; n++)
+    {
+        for(int32_t e = index->node_input_offsets[n]; e < index->node_input_offsets[n + 1]; e++)
+        {
+            int32_t t = index->node_inputs[e];
+            if(t >= 0)
+            {
+                index->consumers[index->consumer_offsets[t] + fill[t]++] = n;
+            }
+        }
+    }
+    free(fill);
+
+    index->n_order = onnx_graph_index_toposort(index, index->order);
+    if(index->n_order < 0)
+    {
+        return -1;
+    }
+    if(index->n_order < n_node)
+    {
+        printf("Graph %s has a cycle, %d of %d nodes sorted\n", graph->name, index->n_order, n_node);
+    }
+
+    return 0;
+}
+
+onnx_graph_index* onnx_graph_index_create(Onnx__GraphProto* graph)
+{
+    assert(graph != NULL);
+
+    onnx_graph_index* index = (onnx_graph_index*) calloc(1, sizeof(onnx_graph_index));
+    if(index == NULL)
+    {
+        return NULL;
+    }
+    index->graph = graph;
+
+    index->views = (onnx_tensor_view*) calloc(graph->n_initializer + 1, sizeof(onnx_tensor_view));
+    if(index->views == NULL ||
+       onnx_index_table_init(&index->nodes, graph->n_node) != 0 ||
+       onnx_index_table_init(&index->initializers, graph->n_initializer) != 0)
+    {
+        onnx_graph_index_free(index);
+        return NULL;
+    }
+
+    for(int i = 0; i < graph->n_node; i++)
+    {
+        onnx_index_table_insert(&index->nodes, index, onnx_index_node_name, graph->node[i]->name, i);
+    }
+
+    for(int i = 0; i < graph->n_initializer; i++)
+    {
+        onnx_index_table_insert(&index->initializers, index, onnx_index_initializer_name, graph->initializer[i]->name, i);
+
+        // Tensors that cannot be viewed (e.g. strings) keep an empty view
+        if(onnx_tensor_view_init(graph->initializer[i], &index->views[i]) != 0)
+        {
+            memset(&index->views[i], 0, sizeof(onnx_tensor_view));
+        }
+    }
+
+    if(onnx_graph_index_build_edges(index) != 0)
+    {
+        onnx_graph_index_free(index);
+        return NULL;
+    }
+
+    return index;
+}
+
+void onnx_graph_index_free(onnx_graph_index* index)
+{
+    if(index == NULL)
+    {
+        return;
+    }
+
+    if(index->views != NULL)
+    {
+        for(int i = 0; i < index->graph->n_initializer; i++)
+        {
+            onnx_tensor_view_release(&index->views[i]);
+        }
+        free(index->views);
+    }
+    free(index->nodes.slots);
+    free(index->initializers.slots);
+    free(index->tensors.slots);
+    free(index->tensor_names);
+    free(index->producers);
+    free(index->initializer_ids);
+    free(index->consumer_offsets);
+    free(index->consumers);
+    free(index->node_input_offsets);
+    free(index->node_inputs);
+    free(index->node_output_offsets);
+    free(index->node_outputs);
+    free(index->order);
+    free(index);
+}
+
+Onnx__NodeProto* onnx_graph_index_get_node_by_name(onnx_graph_index* index, const char* node_name)
+{
+    int32_t i = onnx_index_table_find(&index->nodes, index, onnx_index_node_name, node_name);
+
+    return i < 0 ? NULL : index->graph->node[i];
+}
+
+Onnx__TensorProto* onnx_graph_index_get_initializer_by_name(onnx_graph_index* index, const char* name)
+{
+    int32_t i = onnx_index_table_find(&index->initializers, index, onnx_index_initializer_name, name);
+
+    return i < 0 ? NULL : index->graph->initializer[i];
+}
+
+const onnx_tensor_view* onnx_graph_index_get_view_by_name(onnx_graph_index* index, const char* name)
+{
+    int32_t i = onnx_index_table_find(&index->initializers, index, onnx_index_initializer_name, name);
+    if(i < 0 || index->views[i].elem_size == 0)
+    {
+        return NULL;
+    }
+
+    return &index->views[i];
+}
+
+float* onnx_graph_index_get_weights_by_name(onnx_graph_index* index, const char* name)
+{
+    const onnx_tensor_view* view = onnx_graph_index_get_view_by_name(index, name);
+    if(view == NULL || view->data_type != ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT)
+    {
+        return NULL;
+    }
+
+    return (float*) view->data;
+}
+
+int64_t* onnx_graph_index_get_dims_by_name(onnx_graph_index* index, const char* name)
+{
+    Onnx__TensorProto* initializer = onnx_graph_index_get_initializer_by_name(index, name);
+
+    return initializer == NULL ? NULL : initializer->dims;
+}
+
+int64_t onnx_graph_index_get_dim_by_name(onnx_graph_index* index, const char* name)
+{
+    Onnx__TensorProto* initializer = onnx_graph_index_get_initializer_by_name(index, name);
+
+    return initializer == NULL ? -1 : initializer->n_dims;
+}
+
+int32_t onnx_graph_index_get_tensor_id(onnx_graph_index* index, const char* name)
+{
+    if(name == NULL || name[0] == '\0')
+    {
+        return -1;
+    }
+
+    return onnx_index_table_find(&index->tensors, index, onnx_index_tensor_name, name);
+}
+
+int32_t onnx_graph_index_get_producer(onnx_graph_index* index, int32_t tensor)
+{
+    if(tensor < 0 || tensor >= index->n_tensors)
+    {
+        return -1;
+    }
+
+    return index->producers[tensor];
+}
+
+const int32_t* onnx_graph_index_get_consumers(onnx_graph_index* index, int32_t tensor, int32_t* n_consumers)
+{
+    if(tensor < 0 || tensor >= index->n_tensors)
+    {
+        *n_consumers = 0;
+        return NULL;
+    }
+
+    *n_consumers = index->consumer_offsets[tensor + 1] - index->consumer_offsets[tensor];
+    return index->consumers + index->consumer_offsets[tensor];
+}
+
+// Binary min-heap of ready nodes
+static void onnx_index_heap_push(int32_t* heap, int32_t* n, int32_t node)
+{
+    int32_t i = (*n)++;
+    while(i > 0 && heap[(i - 1) / 2] > node)
+    {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = node;
+}
+
+static int32_t onnx_index_heap_pop(int32_t* heap, int32_t* n)
+{
+    int32_t top = heap[0];
+    int32_t last = heap[--(*n)];
+    int32_t i = 0;
+    for(int32_t c = 1; c < *n; c = 2 * i + 1)
+    {
+        c += c + 1 < *n && heap[c + 1] < heap[c];
+        if(heap[c] >= last)
+        {
+            break;
+        }
+        heap[i] = heap[c];
+        i = c;
+    }
+    heap[i] = last;
+    return top;
+}
+
+// Kahn's algorithm. Writes up to n_node node indices to order and returns how
+// many were written; fewer than n_node means the remaining nodes are on a cycle,
+// a node reading its own output included. The lowest ready node index is
+// emitted first, so an already sorted graph keeps its order.
+int32_t onnx_graph_index_toposort(onnx_graph_index* index, int32_t* order)
+{
+    int32_t n_node = index->graph->n_node;
+    int32_t* pending = (int32_t*) calloc(2 * (n_node + 1), sizeof(int32_t));
+    if(pending == NULL)
+    {
+        return -1;
+    }
+    int32_t* ready = pending + n_node + 1;
+    int32_t n_ready = 0;
+
+    for(int32_t n = 0; n < n_node; n++)
+    {
+        for(int32_t e = index->node_input_offsets[n]; e < index->node_input_offsets[n + 1]; e++)
+        {
+            int32_t t = index->node_inputs[e];
+            if(t >= 0 && index->producers[t] >= 0)
+            {
+                pending[n]++;
+            }
+        }
+        if(pending[n] == 0)
+        {
+            onnx_index_heap_push(ready, &n_ready, n);
+        }
+    }
+
+    int32_t n_order = 0;
+    while(n_ready > 0)
+    {
+        int32_t n = onnx_index_heap_pop(ready, &n_ready);
+        order[n_order++] = n;
+        for(int32_t e = index->node_output_offsets[n]; e < index->node_output_offsets[n + 1]; e++)
+        {
+            int32_t t = index->node_outputs[e];
+            if(t < 0 || index->producers[t] != n)
+            {
+                continue;
+            }
+            for(int32_t c = index->consumer_offsets[t]; c < index->consumer_offsets[t + 1]; c++)
+            {
+                int32_t consumer = index->consumers[c];
+                if(--pending[consumer] == 0)
+                {
+                    onnx_index_heap_push(ready, &n_ready, consumer);
+                }
+            }
+        }
+    }
+
+    free(pending);
+
+    return n_order;
+}
@@ -0,0 +1,1108 @@
+#include "onnx-parser.h"
+
+#define ONNX_FOLD_MAX_DIM 8
+
+// A folded value: dense row-major FLOAT or INT64 data, owned
+typedef struct onnx_constant
+{
+    Onnx__TensorProto__DataType data_type;
+    size_t n_dims;
+    int64_t dims[ONNX_FOLD_MAX_DIM];
+    size_t n_elem;
+    size_t elem_size;
+    void* data;
+} onnx_constant;
+
+// Evaluates node into output; inputs[i] is NULL for an omitted optional input.
+// Returns -1 when the node cannot be folded, which is not an error.
+typedef int (*onnx_fold_fn)(Onnx__NodeProto* node, onnx_constant** inputs, int32_t n_inputs, onnx_constant* output);
+
+typedef struct onnx_fold_op
+{
+    const char* op_type;
+    onnx_fold_fn fold;
+} onnx_fold_op;
+
+static int onnx_constant_init(onnx_constant* value, Onnx__TensorProto__DataType data_type, size_t n_dims, const int64_t* dims)
+{
+    if((data_type != ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT && data_type != ONNX__TENSOR_PROTO__DATA_TYPE__INT64) ||
+       n_dims > ONNX_FOLD_MAX_DIM)
+    {
+        return -1;
+    }
+
+    value->data_type = data_type;
+    value->n_dims = n_dims;
+    value->n_elem = 1;
+    for(size_t i = 0; i < n_dims; i++)
+    {
+        if(dims[i] < 0)
+        {
+            return -1;
+        }
+        value->dims[i] = dims[i];
+        value->n_elem *= dims[i];
+    }
+    value->elem_size = onnx_tensor_data_type_size(data_type);
+    value->data = malloc(value->n_elem * value->elem_size + 1);
+
+    return value->data != NULL ? 0 : -1;
+}
+
+static void onnx_constant_release(onnx_constant* value)
+{
+    free(value->data);
+    value->data = NULL;
+}
+
+// Same data under new dims: Identity, Reshape, Flatten, Squeeze, Unsqueeze
+static int onnx_constant_reshaped(const onnx_constant* input, size_t n_dims, const int64_t* dims, onnx_constant* output)
+{
+    if(onnx_constant_init(output, input->data_type, n_dims, dims) != 0)
+    {
+        return -1;
+    }
+    if(output->n_elem != input->n_elem)
+    {
+        onnx_constant_release(output);
+        return -1;
+    }
+    memcpy(output->data, input->data, input->n_elem * input->elem_size);
+    return 0;
+}
+
+static int onnx_constant_from_view(const onnx_tensor_view* view, onnx_constant* value)
+{
+    if(view->data == NULL || onnx_constant_init(value, view->data_type, view->n_dims, view->dims) != 0)
+    {
+        return -1;
+    }
+    memcpy(value->data, view->data, value->n_elem * value->elem_size);
+    return 0;
+}
+
+static const int64_t* onnx_constant_ints(const onnx_constant* value)
+{
+    return value != NULL && value->data_type == ONNX__TENSOR_PROTO__DATA_TYPE__INT64 ? (const int64_t*) value->data : NULL;
+}
+
+static Onnx__AttributeProto* onnx_fold_attribute(Onnx__NodeProto* node, const char* name)
+{
+    for(size_t i = 0; i < node->n_attribute; i++)
+    {
+        if(strcmp(node->attribute[i]->name, name) == 0)
+        {
+            return node->attribute[i];
+        }
+    }
+    return NULL;
+}
+
+static int64_t onnx_fold_int(Onnx__NodeProto* node, const char* name, int64_t value)
+{
+    Onnx__AttributeProto* attribute = onnx_fold_attribute(node, name);
+    return attribute != NULL ? attribute->i : value;
+}
+
+// Axes come from an attribute up to opset 12 and from an input after
+static const int64_t* onnx_fold_axes(Onnx__NodeProto* node, const char* name, onnx_constant** inputs, int32_t n_inputs,
+                                     int32_t input, size_t* n_axes)
+{
+    Onnx__AttributeProto* attribute = onnx_fold_attribute(node, name);
+    if(attribute != NULL)
+    {
+        *n_axes = attribute->n_ints;
+        return attribute->ints;
+    }
+    if(input < n_inputs && inputs[input] != NULL)
+    {
+        *n_axes = inputs[input]->n_elem;
+        return onnx_constant_ints(inputs[input]);
+    }
+    *n_axes = 0;
+    return NULL;
+}
+
+static int onnx_fold_constant(Onnx__NodeProto* node, onnx_constant** inputs, int32_t n_inputs, onnx_constant* output)
+{
+    Onnx__AttributeProto* attribute = onnx_fold_attribute(node, "value");
+    if(attribute != NULL && attribute->t != NULL)
+    {
+        onnx_tensor_view view;
+        if(onnx_tensor_view_init(attribute->t, &view) != 0)
+        {
+            return -1;
+        }
+        int result = onnx_constant_from_view(&view, output);
+        onnx_tensor_view_release(&view);
+        return result;
+    }
+
+    // value_float and value_int are scalars, the lists 1-D
+    int64_t n = 0;
+    size_t n_dims = 0;
+    const void* data = NULL;
+    Onnx__TensorProto__DataType data_type = ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT;
+    if((attribute = onnx_fold_attribute(node, "value_float")) != NULL)
+    {
+        data = &attribute->f;
+    }
+    else if((attribute = onnx_fold_attribute(node, "value_floats")) != NULL)
+    {
+        n = attribute->n_floats;
+        n_dims = 1;
+        data = attribute->floats;
+    }
+    else if((attribute = onnx_fold_attribute(node, "value_int")) != NULL)
+    {
+        data = &attribute->i;
+        data_type = ONNX__TENSOR_PROTO__DATA_TYPE__INT64;
+    }
+    else if((attribute = onnx_fold_attribute(node, "value_ints")) != NULL)
+    {
+        n = attribute->n_ints;
+        n_dims = 1;
+        data = attribute->ints;
+        data_type = ONNX__TENSOR_PROTO__DATA_TYPE__INT64;
+    }
+    if(attribute == NULL || onnx_constant_init(output, data_type, n_dims, &n) != 0)
+    {
+        return -1;
+    }
+    memcpy(output->data, data, output->n_elem * output->elem_size);
+    return 0;
+}
+
+static int onnx_fold_identity(Onnx__NodeProto* node, onnx_constant** inputs, int32_t n_inputs, onnx_constant* output)
+{
+    return onnx_constant_reshaped(inputs[0], inputs[0]->n_dims, inputs[0]->dims, output);
+}
+
+static int onnx_fold_cast(Onnx__NodeProto* node, onnx_constant** inputs, int32_t n_inputs, onnx_constant* output)
+{
+    const onnx_constant* input = inputs[0];
+    Onnx__TensorProto__DataType to = (Onnx__TensorProto__DataType) onnx_fold_int(node, "to", 0);
+    if(onnx_constant_init(output, to, input->n_dims, input->dims) != 0)
+    {
+        return -1;
+    }
+    if(to == input->data_type)
+    {
+        memcpy(output->data, input->data, input->n_elem * input->elem_size);
+        return 0;
+    }
+    for(size_t i = 0; i < input->n_elem; i++)
+    {
+        if(to == ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT)
+        {
+            ((float*) output->data)[i] = (float) ((const int64_t*) input->data)[i];
+        }
+        else
+        {
+            ((int64_t*) output->data)[i] = (int64_t) ((const float*) input->data)[i];
+        }
+    }
+    return 0;
+}
+
+static int onnx_fold_shape(Onnx__NodeProto* node, onnx_constant** inputs, int32_t n_inputs, onnx_constant* output)
+{
+    int64_t rank = inputs[0]->n_dims;
+    int64_t start = onnx_fold_int(node, "start", 0);
+    int64_t end = onnx_fold_int(node, "end", rank);
+    start = start < 0 ? start + rank : start;
+    end = end < 0 ? end + rank : end;
+    start = start < 0 ? 0 : start > rank ? rank : start;
+    end = end < start ? start : end > rank ? rank : end;
+
+    int64_t n = end - start;
+    if(onnx_constant_init(output, ONNX__TENSOR_PROTO__DATA_TYPE__INT64, 1, &n) != 0)
+    {
+        return -1;
+    }
+    memcpy(output->data, inputs[0]->dims + start, sizeof(int64_t) * n);
+    return 0;
+}
+
+static int onnx_fold_reshape(Onnx__NodeProto* node, onnx_constant** inputs, int32_t n_inputs, onnx_constant* output)
+{
+    const onnx_constant* input = inputs[0];
+    const int64_t* shape = n_inputs > 1 ? onnx_constant_ints(inputs[1]) : NULL;
+    if(shape == NULL || inputs[1]->n_elem > ONNX_FOLD_MAX_DIM)
+    {
+        return -1;
+    }
+
+    // 0 copies the input dim unless allowzero is set, -1 takes what is left
+    int64_t dims[ONNX_FOLD_MAX_DIM];
+    int64_t known = 1;
+    int32_t infer = -1;
+    int64_t allowzero = onnx_fold_int(node, "allowzero", 0);
+    for(size_t i = 0; i < inputs[1]->n_elem; i++)
+    {
+        dims[i] = shape[i];
+        if(dims[i] == 0 && !allowzero)
+        {
+            if(i >= input->n_dims)
+            {
+                return -1;
+            }
+            dims[i] = input->dims[i];
+        }
+        if(dims[i] == -1 && infer < 0)
+        {
+            infer = i;
+            continue;
+        }
+        if(dims[i] < 0)
+        {
+            return -1;
+        }
+        known *= dims[i];
+    }
+    if(infer >= 0)
+    {
+        if(known == 0 || input->n_elem % known != 0)
+        {
+            return -1;
+        }
+        dims[infer] = input->n_elem / known;
+    }
+    return onnx_constant_reshaped(input, inputs[1]->n_elem, dims, output);
+}
+
+static int onnx_fold_flatten(Onnx__NodeProto* node, onnx_constant** inputs, int32_t n_inputs, onnx_constant* output)
+{
+    const onnx_constant* input = inputs[0];
+    int64_t axis = onnx_fold_int(node, "axis", 1);
+    axis = axis < 0 ? axis + (int64_t) input->n_dims : axis;
+    if(axis < 0 || axis > (int64_t) input->n_dims)
+    {
+        return -1;
+    }
+
+    int64_t dims[2] = { 1, 1 };
+    for(int64_t i = 0; i < (int64_t) input->n_dims; i++)
+    {
+        dims[i >= axis] *= input->dims[i];
+    }
+    return onnx_constant_reshaped(input, 2, dims, output);
+}
+
+static int onnx_fold_squeeze(Onnx__NodeProto* node, onnx_constant** inputs, int32_t n_inputs, onnx_constant* output)
+{
+    const onnx_constant* input = inputs[0];
+    size_t n_axes;
+    const int64_t* axes = onnx_fold_axes(node, "axes", inputs, n_inputs, 1, &n_axes);
+    if(n_axes > 0 && axes == NULL)
+    {
+        return -1;
+    }
+
+    // Without axes every unit dim goes
+    uint8_t drop[ONNX_FOLD_MAX_DIM] = { 0 };
+    for(size_t i = 0; i < input->n_dims; i++)
+    {
+        drop[i] = n_axes == 0 && input->dims[i] == 1;
+    }
+    for(size_t i = 0; i < n_axes; i++)
+    {
+        int64_t axis = axes[i] < 0 ? axes[i] + (int64_t) input->n_dims : axes[i];
+        if(axis < 0 || axis >= (int64_t) input->n_dims || input->dims[axis] != 1)
+        {
+            return -1;
+        }
+        drop[axis] = 1;
+    }
+
+    int64_t dims[ONNX_FOLD_MAX_DIM];
+    size_t n_dims = 0;
+    for(size_t i = 0; i < input->n_dims; i++)
+    {
+        if(!drop[i])
+        {
+            dims[n_dims++] = input->dims[i];
+        }
+    }
+    return onnx_constant_reshaped(input, n_dims, dims, output);
+}
+
+static int onnx_fold_unsqueeze(Onnx__NodeProto* node, onnx_constant** inputs, int32_t n_inputs, onnx_constant* output)
+{
+    const onnx_constant* input = inputs[0];
+    size_t n_axes;
+    const int64_t* axes = onnx_fold_axes(node, "axes", inputs, n_inputs, 1, &n_axes);
+    size_t n_dims = input->n_dims + n_axes;
+    if(axes == NULL || n_dims > ONNX_FOLD_MAX_DIM)
+    {
+        return -1;
+    }
+
+    // Axes count in the output
+    uint8_t insert[ONNX_FOLD_MAX_DIM] = { 0 };
+    for(size_t i = 0; i < n_axes; i++)
+    {
+        int64_t axis = axes[i] < 0 ? axes[i] + (int64_t) n_dims : axes[i];
+        if(axis < 0 || axis >= (int64_t) n_dims || insert[axis])
+        {
+            return -1;
+        }
+        insert[axis] = 1;
+    }
+
+    int64_t dims[ONNX_FOLD_MAX_DIM];
+    for(size_t i = 0, j = 0; i < n_dims; i++)
+    {
+        dims[i] = insert[i] ? 1 : input->dims[j++];
+    }
+    return onnx_constant_reshaped(input, n_dims, dims, output);
+}
+
+static int onnx_fold_transpose(Onnx__NodeProto* node, onnx_constant** inputs, int32_t n_inputs, onnx_constant* output)
+{
+    const onnx_constant* input = inputs[0];
+    int64_t rank = input->n_dims;
+
+    // Without perm the axes are reversed
+    int64_t perm[ONNX_FOLD_MAX_DIM];
+    uint8_t seen[ONNX_FOLD_MAX_DIM] = { 0 };
+    Onnx__AttributeProto* attribute = onnx_fold_attribute(node, "perm");
+    if(attribute != NULL && attribute->n_ints != (size_t) rank)
+    {
+        return -1;
+    }
+    for(int64_t i = 0; i < rank; i++)
+    {
+        perm[i] = attribute != NULL ? attribute->ints[i] : rank - 1 - i;
+        if(perm[i] < 0 || perm[i] >= rank || seen[perm[i]]++)
+        {
+            return -1;
+        }
+    }
+
+    int64_t dims[ONNX_FOLD_MAX_DIM];
+    int64_t stride[ONNX_FOLD_MAX_DIM];
+    int64_t len = 1;
+    for(int64_t i = rank - 1; i >= 0; i--)
+    {
+        stride[i] = len;
+        len *= input->dims[i];
+    }
+    for(int64_t i = 0; i < rank; i++)
+    {
+        dims[i] = input->dims[perm[i]];
+    }
+    if(onnx_constant_init(output, input->data_type, rank, dims) != 0)
+    {
+        return -1;
+    }
+
+    // Odometer over the output, any element size
+    size_t size = input->elem_size;
+    const char* src = (const char*) input->data;
+    char* dst = (char*) output->data;
+    int64_t index[ONNX_FOLD_MAX_DIM] = { 0 };
+    int64_t offset = 0;
+    for(size_t p = 0; p < output->n_elem; p++)
+    {
+        memcpy(dst + p * size, src + offset * size, size);
+        for(int64_t a = rank - 1; a >= 0; a--)
+        {
+            offset += stride[perm[a]];
+            if(++index[a] < dims[a])
+            {
+                break;
+            }
+            offset -= stride[perm[a]] * dims[a];
+            index[a] = 0;
+        }
+    }
+    return 0;
+}
+
+static int onnx_fold_gather(Onnx__NodeProto* node, onnx_constant** inputs, int32_t n_inputs, onnx_constant* output)
+{
+    const onnx_constant* data = inputs[0];
+    const int64_t* indices = n_inputs > 1 ? onnx_constant_ints(inputs[1]) : NULL;
+    int64_t axis = onnx_fold_int(node, "axis", 0);
+    axis = axis < 0 ? axis + (int64_t) data->n_dims : axis;
+    if(indices == NULL || axis < 0 || axis >= (int64_t) data->n_dims ||
+       data->n_dims - 1 + inputs[1]->n_dims > ONNX_FOLD_MAX_DIM)
+    {
+        return -1;
+    }
+
+    // data[:axis] + indices + data[axis+1:]
+    int64_t dims[ONNX_FOLD_MAX_DIM];
+    size_t n_dims = 0;
+    int64_t outer = 1, inner = 1;
+    for(int64_t i = 0; i < (int64_t) data->n_dims; i++)
+    {
+        if(i == axis)
+        {
+            for(size_t j = 0; j < inputs[1]->n_dims; j++)
+            {
+                dims[n_dims++] = inputs[1]->dims[j];
+            }
+            continue;
+        }
+        dims[n_dims++] = data->dims[i];
+        if(i < axis)
+        {
+            outer *= data->dims[i];
+        }
+        else
+        {
+            inner *= data->dims[i];
+        }
+    }
+    if(onnx_constant_init(output, data->data_type, n_dims, dims) != 0)
+    {
+        return -1;
+    }
+
+    size_t chunk = inner * data->elem_size;
+    char* dst = (char*) output->data;
+    for(int64_t o = 0; o < outer; o++)
+    {
+        for(size_t i = 0; i < inputs[1]->n_elem; i++)
+        {
+            int64_t k = indices[i] < 0 ? indices[i] + data->dims[axis] : indices[i];
+            if(k < 0 || k >= data->dims[axis])
+            {
+                onnx_constant_release(output);
+                return -1;
+            }
+            memcpy(dst, (const char*) data->data + (o * data->dims[axis] + k) * chunk, chunk);
+            dst += chunk;
+        }
+    }
+    return 0;
+}
+
+static int onnx_fold_concat(Onnx__NodeProto* node, onnx_constant** inputs, int32_t n_inputs, onnx_constant* output)
+{
+    const onnx_constant* first = inputs[0];
+    int64_t axis = onnx_fold_int(node, "axis", 0);
+    axis = axis < 0 ? axis + (int64_t) first->n_dims : axis;
+    if(axis < 0 || axis >= (int64_t) first->n_dims)
+    {
+        return -1;
+    }
+
+    int64_t dims[ONNX_FOLD_MAX_DIM];
+    memcpy(dims, first->dims, sizeof(int64_t) * first->n_dims);
+    dims[axis] = 0;
+    for(int32_t i = 0; i < n_inputs; i++)
+    {
+        if(inputs[i] == NULL || inputs[i]->data_type != first->data_type || inputs[i]->n_dims != first->n_dims)
+        {
+            return -1;
+        }
+        for(int64_t d = 0; d < (int64_t) first->n_dims; d++)
+        {
+            if(d != axis && inputs[i]->dims[d] != first->dims[d])
+            {
+                return -1;
+            }
+        }
+        dims[axis] += inputs[i]->dims[axis];
+    }
+    if(onnx_constant_init(output, first->data_type, first->n_dims, dims) != 0)
+    {
+        return -1;
+    }
+
+    int64_t outer = 1, inner = first->elem_size;
+    for(int64_t d = 0; d < (int64_t) first->n_dims; d++)
+    {
+        if(d < axis)
+        {
+            outer *= dims[d];
+        }
+        else if(d > axis)
+        {
+            inner *= dims[d];
+        }
+    }
+    char* dst = (char*) output->data;
+    for(int64_t o = 0; o < outer; o++)
+    {
+        for(int32_t i = 0; i < n_inputs; i++)
+        {
+            size_t chunk = inputs[i]->dims[axis] * inner;
+            memcpy(dst, (const char*) inputs[i]->data + o * chunk, chunk);
+            dst += chunk;
+        }
+    }
+    return 0;
+}
+
+static int onnx_fold_slice(Onnx__NodeProto* node, onnx_constant** inputs, int32_t n_inputs, onnx_constant* output)
+{
+    const onnx_constant* data = inputs[0];
+    int64_t rank = data->n_dims;
+
+    // Attributes up to opset 9, inputs after
+    size_t n_starts, n_ends, n_axes, n_steps;
+    const int64_t* starts = onnx_fold_axes(node, "starts", inputs, n_inputs, 1, &n_starts);
+    const int64_t* ends = onnx_fold_axes(node, "ends", inputs, n_inputs, 2, &n_ends);
+    const int64_t* axes = onnx_fold_axes(node, "axes", inputs, n_inputs, 3, &n_axes);
+    const int64_t* steps = onnx_fold_axes(node, "steps", inputs, n_inputs, 4, &n_steps);
+    if(starts == NULL || ends == NULL || n_starts != n_ends || (axes != NULL && n_axes != n_starts) ||
+       (steps != NULL && n_steps != n_starts))
+    {
+        return -1;
+    }
+
+    int64_t start[ONNX_FOLD_MAX_DIM], step[ONNX_FOLD_MAX_DIM], dims[ONNX_FOLD_MAX_DIM];
+    for(int64_t a = 0; a < rank; a++)
+    {
+        start[a] = 0;
+        step[a] = 1;
+        dims[a] = data->dims[a];
+    }
+    for(size_t i = 0; i < n_starts; i++)
+    {
+        int64_t a = axes != NULL ? axes[i] : (int64_t) i;
+        a = a < 0 ? a + rank : a;
+        if(a < 0 || a >= rank || (steps != NULL && steps[i] == 0))
+        {
+            return -1;
+        }
+
+        // Clamped as in the spec, which differs by the sign of step
+        int64_t dim = data->dims[a];
+        int64_t s = steps != NULL ? steps[i] : 1;
+        int64_t b = starts[i] < 0 ? starts[i] + dim : starts[i];
+        int64_t e = ends[i] < 0 ? ends[i] + dim : ends[i];
+        if(s > 0)
+        {
+            b = b < 0 ? 0 : b > dim ? dim : b;
+            e = e < 0 ? 0 : e > dim ? dim : e;
+            dims[a] = e > b ? (e - b + s - 1) / s : 0;
+        }
+        else
+        {
+            b = b < 0 ? 0 : b > dim - 1 ? dim - 1 : b;
+            e = e < -1 ? -1 : e > dim - 1 ? dim - 1 : e;
+            dims[a] = b > e ? (b - e - s - 1) / -s : 0;
+        }
+        start[a] = b;
+        step[a] = s;
+    }
+    if(onnx_constant_init(output, data->data_type, rank, dims) != 0)
+    {
+        return -1;
+    }
+
+    int64_t stride[ONNX_FOLD_MAX_DIM];
+    int64_t len = 1;
+    for(int64_t a = rank - 1; a >= 0; a--)
+    {
+        stride[a] = len;
+        len *= data->dims[a];
+    }
+    int64_t index[ONNX_FOLD_MAX_DIM] = { 0 };
+    for(size_t p = 0; p < output->n_elem; p++)
+    {
+        int64_t offset = 0;
+        for(int64_t a = 0; a < rank; a++)
+        {
+            offset += (start[a] + index[a] * step[a]) * stride[a];
+        }
+        memcpy((char*) output->data + p * data->elem_size, (const char*) data->data + offset * data->elem_size, data->elem_size);
+        for(int64_t a = rank - 1; a >= 0 && ++index[a] == dims[a]; a--)
+        {
+            index[a] = 0;
+        }
+    }
+    return 0;
+}
+
+static int onnx_fold_constant_of_shape(Onnx__NodeProto* node, onnx_constant** inputs, int32_t n_inputs, onnx_constant* output)
+{
+    const int64_t* shape = onnx_constant_ints(inputs[0]);
+    if(shape == NULL)
+    {
+        return -1;
+    }
+
+    // One element of value, float 0 by default
+    onnx_constant fill = { ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT };
+    float zero = 0;
+    Onnx__AttributeProto* attribute = onnx_fold_attribute(node, "value");
+    if(attribute != NULL && attribute->t != NULL)
+    {
+        onnx_tensor_view view;
+        if(onnx_tensor_view_init(attribute->t, &view) != 0)
+        {
+            return -1;
+        }
+        int result = view.n_elem == 1 ? onnx_constant_from_view(&view, &fill) : -1;
+        onnx_tensor_view_release(&view);
+        if(result != 0)
+        {
+            return -1;
+        }
+    }
+
+    int result = onnx_constant_init(output, fill.data_type, inputs[0]->n_elem, shape);
+    for(size_t i = 0; result == 0 && i < output->n_elem; i++)
+    {
+        memcpy((char*) output->data + i * output->elem_size, fill.data != NULL ? fill.data : &zero, output->elem_size);
+    }
+    free(fill.data);
+    return result;
+}
+
+// Add, Sub, Mul and Div with multidirectional broadcasting
+static int onnx_fold_binary(onnx_constant** inputs, int32_t n_inputs, char op, onnx_constant* output)
+{
+    const onnx_constant* a = inputs[0];
+    const onnx_constant* b = n_inputs > 1 ? inputs[1] : NULL;
+    if(b == NULL || a->data_type != b->data_type)
+    {
+        return -1;
+    }
+
+    // Dims aligned from the right; a unit dim gets stride 0
+    size_t rank = a->n_dims > b->n_dims ? a->n_dims : b->n_dims;
+    int64_t dims[ONNX_FOLD_MAX_DIM], stride_a[ONNX_FOLD_MAX_DIM], stride_b[ONNX_FOLD_MAX_DIM];
+    int64_t len_a = 1, len_b = 1;
+    for(int64_t i = rank - 1; i >= 0; i--)
+    {
+        int64_t ia = i - (int64_t)(rank - a->n_dims);
+        int64_t ib = i - (int64_t)(rank - b->n_dims);
+        int64_t da = ia >= 0 ? a->dims[ia] : 1;
+        int64_t db = ib >= 0 ? b->dims[ib] : 1;
+        if(da != db && da != 1 && db != 1)
+        {
+            return -1;
+        }
+        dims[i] = da > db ? da : db;
+        stride_a[i] = da == 1 ? 0 : len_a;
+        stride_b[i] = db == 1 ? 0 : len_b;
+        len_a *= da;
+        len_b *= db;
+    }
+    if(onnx_constant_init(output, a->data_type, rank, dims) != 0)
+    {
+        return -1;
+    }
+
+    int64_t index[ONNX_FOLD_MAX_DIM] = { 0 };
+    for(size_t p = 0; p < output->n_elem; p++)
+    {
+        int64_t offset_a = 0, offset_b = 0;
+        for(size_t i = 0; i < rank; i++)
+        {
+            offset_a += index[i] * stride_a[i];
+            offset_b += index[i] * stride_b[i];
+        }
+        if(a->data_type == ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT)
+        {
+            float x = ((const float*) a->data)[offset_a];
+            float y = ((const float*) b->data)[offset_b];
+            ((float*) output->data)[p] = op == '+' ? x + y : op == '-' ? x - y : op == '*' ? x * y : x / y;
+        }
+        else
+        {
+            int64_t x = ((const int64_t*) a->data)[offset_a];
+            int64_t y = ((const int64_t*) b->data)[offset_b];
+            if(op == '/' && y == 0)
+            {
+                onnx_constant_release(output);
+                return -1;
+            }
+            ((int64_t*) output->data)[p] = op == '+' ? x + y : op == '-' ? x - y : op == '*' ? x * y : x / y;
+        }
+        for(int64_t i = rank - 1; i >= 0 && ++index[i] == dims[i]; i--)
+        {
+            index[i] = 0;
+        }
+    }
+    return 0;
+}
+
+static int onnx_fold_add(Onnx__NodeProto* node, onnx_constant** inputs, int32_t n_inputs, onnx_constant* output)
+{
+    return onnx_fold_binary(inputs, n_inputs, '+', output);
+}
+
+static int onnx_fold_sub(Onnx__NodeProto* node, onnx_constant** inputs, int32_t n_inputs, onnx_constant* output)
+{
+    return onnx_fold_binary(inputs, n_inputs, '-', output);
+}
+
+static int onnx_fold_mul(Onnx__NodeProto* node, onnx_constant** inputs, int32_t n_inputs, onnx_constant* output)
+{
+    return onnx_fold_binary(inputs, n_inputs, '*', output);
+}
+
+static int onnx_fold_div(Onnx__NodeProto* node, onnx_constant** inputs, int32_t n_inputs, onnx_constant* output)
+{
+    return onnx_fold_binary(inputs, n_inputs, '/', output);
+}
+
+static const onnx_fold_op onnx_fold_ops[] =
+{
+    { "Constant",           onnx_fold_constant },
+    { "ConstantOfShape",    onnx_fold_constant_of_shape },
+    { "Identity",           onnx_fold_identity },
+    { "Cast",               onnx_fold_cast },
+    { "Shape",              onnx_fold_shape },
+    { "Reshape",            onnx_fold_reshape },
+    { "Flatten",            onnx_fold_flatten },
+    { "Squeeze",            onnx_fold_squeeze },
+    { "Unsqueeze",          onnx_fold_unsqueeze },
+    { "Transpose",          onnx_fold_transpose },
+    { "Gather",             onnx_fold_gather },
+    { "Concat",             onnx_fold_concat },
+    { "Slice",              onnx_fold_slice },
+    { "Add",                onnx_fold_add },
+    { "Sub",                onnx_fold_sub },
+    { "Mul",                onnx_fold_mul },
+    { "Div",                onnx_fold_div },
+};
+
+static onnx_fold_fn onnx_fold_find(const char* op_type)
+{
+    for(size_t i = 0; i < sizeof(onnx_fold_ops) / sizeof(onnx_fold_ops[0]); i++)
+    {
+        if(strcmp(onnx_fold_ops[i].op_type, op_type) == 0)
+        {
+            return onnx_fold_ops[i].fold;
+        }
+    }
+    return NULL;
+}
+
+static void* onnx_optimize_alloc(ProtobufCAllocator* allocator, size_t size)
+{
+    return allocator != NULL ? allocator->alloc(allocator->allocator_data, size) : malloc(size);
+}
+
+static void onnx_optimize_free(ProtobufCAllocator* allocator, void* data)
+{
+    if(allocator != NULL)
+    {
+        allocator->free(allocator->allocator_data, data);
+    }
+    else
+    {
+        free(data);
+    }
+}
+
+// An initializer owned by the model, so onnx_unload_model releases it
+static Onnx__TensorProto* onnx_optimize_initializer(ProtobufCAllocator* allocator, const char* name, const onnx_constant* value)
+{
+    Onnx__TensorProto* tensor = (Onnx__TensorProto*) onnx_optimize_alloc(allocator, sizeof(Onnx__TensorProto));
+    char* copy = (char*) onnx_optimize_alloc(allocator, strlen(name) + 1);
+    int64_t* dims = (int64_t*) onnx_optimize_alloc(allocator, sizeof(int64_t) * value->n_dims + 1);
+    void* data = onnx_optimize_alloc(allocator, value->n_elem * value->elem_size + 1);
+    if(tensor == NULL || copy == NULL || dims == NULL || data == NULL)
+    {
+        onnx_optimize_free(allocator, tensor);
+        onnx_optimize_free(allocator, copy);
+        onnx_optimize_free(allocator, dims);
+        onnx_optimize_free(allocator, data);
+        return NULL;
+    }
+
+    onnx__tensor_proto__init(tensor);
+    tensor->name = strcpy(copy, name);
+    tensor->has_data_type = 1;
+    tensor->data_type = value->data_type;
+    tensor->n_dims = value->n_dims;
+    tensor->dims = (int64_t*) memcpy(dims, value->dims, sizeof(int64_t) * value->n_dims);
+    memcpy(data, value->data, value->n_elem * value->elem_size);
+    if(value->data_type == ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT)
+    {
+        tensor->n_float_data = value->n_elem;
+        tensor->float_data = (float*) data;
+    }
+    else
+    {
+        tensor->n_int64_data = value->n_elem;
+        tensor->int64_data = (int64_t*) data;
+    }
+    return tensor;
+}
+
+// Evaluates every node whose inputs are all constant. constant[t] is set for
+// initializers on entry and for folded outputs on return.
+static void onnx_optimize_fold(onnx_graph_index* index, uint8_t* constant, onnx_constant* values, uint8_t* folded)
+{
+    // Room for the inputs of any node
+    Onnx__GraphProto* graph = index->graph;
+    onnx_constant** args = (onnx_constant**) malloc(sizeof(onnx_constant*) * (index->node_input_offsets[graph->n_node] + 1));
+    if(args == NULL)
+    {
+        return;
+    }
+
+    for(int32_t k = 0; k < index->n_order; k++)
+    {
+        int32_t n = index->order[k];
+        Onnx__NodeProto* node = graph->node[n];
+        const int32_t* inputs = &index->node_inputs[index->node_input_offsets[n]];
+        int32_t n_inputs = index->node_input_offsets[n + 1] - index->node_input_offsets[n];
+        onnx_fold_fn fold = onnx_fold_find(node->op_type);
+        if(fold == NULL || node->n_output != 1 || index->node_outputs[index->node_output_offsets[n]] < 0 ||
+           (n_inputs == 0 && strcmp(node->op_type, "Constant") != 0))
+        {
+            continue;
+        }
+        int32_t out = index->node_outputs[index->node_output_offsets[n]];
+
+        int all_constant = 1;
+        for(int32_t i = 0; i < n_inputs; i++)
+        {
+            all_constant &= inputs[i] < 0 || constant[inputs[i]];
+        }
+        if(!all_constant)
+        {
+            continue;
+        }
+
+        // Initializers are copied in on first use
+        int loaded = 1;
+        for(int32_t i = 0; i < n_inputs; i++)
+        {
+            int32_t t = inputs[i];
+            args[i] = t >= 0 ? &values[t] : NULL;
+            if(t >= 0 && values[t].data == NULL)
+            {
+                loaded &= onnx_constant_from_view(&index->views[index->initializer_ids[t]], &values[t]) == 0;
+            }
+        }
+        if(loaded && (n_inputs == 0 || args[0] != NULL) && fold(node, args, n_inputs, &values[out]) == 0)
+        {
+            constant[out] = 1;
+            folded[n] = 1;
+        }
+        else
+        {
+            onnx_constant_release(&values[out]);
+        }
+    }
+
+    free(args);
+}
+
+static int onnx_optimize_live(onnx_graph_index* index, const uint8_t* live, const char* name)
+{
+    int32_t t = onnx_graph_index_get_tensor_id(index, name);
+    return t >= 0 && live[t];
+}
+
+int onnx_model_optimize(Onnx__ModelProto* model)
+{
+    assert(model != NULL && model->graph != NULL);
+
+    Onnx__GraphProto* graph = model->graph;
+    onnx_graph_index* index = onnx_graph_index_create(graph);
+    if(index == NULL)
+    {
+        return -1;
+    }
+    if(index->n_order < (int32_t) graph->n_node)
+    {
+        printf("Graph %s has a cycle, not optimized\n", graph->name);
+        onnx_graph_index_free(index);
+        return -1;
+    }
+
+    int32_t n_tensors = index->n_tensors;
+    int32_t n_nodes = graph->n_node;
+    onnx_constant* values = (onnx_constant*) calloc(n_tensors + 1, sizeof(onnx_constant));
+    uint8_t* constant = (uint8_t*) calloc(n_tensors + 1, 1);
+    uint8_t* live = (uint8_t*) calloc(n_tensors + 1, 1);
+    uint8_t* folded = (uint8_t*) calloc(n_nodes + 1, 1);
+    uint8_t* keep = (uint8_t*) calloc(n_nodes + 1, 1);
+    Onnx__NodeProto** removed_nodes = (Onnx__NodeProto**) malloc(sizeof(Onnx__NodeProto*) * (n_nodes + 1));
+    Onnx__TensorProto** removed_initializers = (Onnx__TensorProto**) malloc(sizeof(Onnx__TensorProto*) * (graph->n_initializer + 1));
+    Onnx__ValueInfoProto** removed_inputs = (Onnx__ValueInfoProto**) malloc(sizeof(Onnx__ValueInfoProto*) * (graph->n_input + 1));
+    Onnx__TensorProto** initializer = NULL;
+    int32_t n_removed = -1;
+    if(values == NULL || constant == NULL || live == NULL || folded == NULL || keep == NULL ||
+       removed_nodes == NULL || removed_initializers == NULL || removed_inputs == NULL)
+    {
+        goto done;
+    }
+
+    // Initializers are constant, except one fed at run time: the first graph
+    // input is always the model input, even when it has a default
+    for(int32_t t = 0; t < n_tensors; t++)
+    {
+        constant[t] = index->initializer_ids[t] >= 0;
+    }
+    for(size_t i = 0; i < graph->n_input; i++)
+    {
+        int32_t t = onnx_graph_index_get_tensor_id(index, graph->input[i]->name);
+        if(t >= 0 && (i == 0 || index->initializer_ids[t] < 0))
+        {
+            constant[t] = 0;
+        }
+    }
+    onnx_optimize_fold(index, constant, values, folded);
+
+    // Live tensors: graph outputs and whatever a kept node reads
+    for(size_t i = 0; i < graph->n_output; i++)
+    {
+        int32_t t = onnx_graph_index_get_tensor_id(index, graph->output[i]->name);
+        if(t >= 0)
+        {
+            live[t] = 1;
+        }
+    }
+    for(int32_t k = index->n_order - 1; k >= 0; k--)
+    {
+        int32_t n = index->order[k];
+        for(int32_t i = index->node_output_offsets[n]; !folded[n] && i < index->node_output_offsets[n + 1]; i++)
+        {
+            keep[n] |= index->node_outputs[i] >= 0 && live[index->node_outputs[i]];
+        }
+        for(int32_t i = index->node_input_offsets[n]; keep[n] && i < index->node_input_offsets[n + 1]; i++)
+        {
+            if(index->node_inputs[i] >= 0)
+            {
+                live[index->node_inputs[i]] = 1;
+            }
+        }
+    }
+
+    // Folded outputs something still reads become initializers
+    int32_t n_new = 0, n_kept = 0;
+    for(int32_t n = 0; n < n_nodes; n++)
+    {
+        n_new += folded[n] && live[index->node_outputs[index->node_output_offsets[n]]];
+    }
+    for(size_t i = 0; i < graph->n_initializer; i++)
+    {
+        n_kept += onnx_optimize_live(index, live, graph->initializer[i]->name);
+    }
+    int32_t n_kept_nodes = 0;
+    for(int32_t n = 0; n < n_nodes; n++)
+    {
+        n_kept_nodes += keep[n];
+    }
+    if(n_kept_nodes == n_nodes && n_kept == (int32_t) graph->n_initializer)
+    {
+        n_removed = 0;
+        goto done;
+    }
+
+    ProtobufCAllocator* allocator = onnx_model_allocator(model);
+    initializer = (Onnx__TensorProto**) onnx_optimize_alloc(allocator, sizeof(Onnx__TensorProto*) * (n_kept + n_new) + 1);
+    if(initializer == NULL)
+    {
+        goto done;
+    }
+    int32_t n_initializer = 0;
+    for(size_t i = 0; i < graph->n_initializer; i++)
+    {
+        if(onnx_optimize_live(index, live, graph->initializer[i]->name))
+        {
+            initializer[n_initializer++] = graph->initializer[i];
+        }
+    }
+    for(int32_t n = 0; n < n_nodes; n++)
+    {
+        int32_t out = index->node_outputs[index->node_output_offsets[n]];
+        if(!folded[n] || !live[out])
+        {
+            continue;
+        }
+        initializer[n_initializer] = onnx_optimize_initializer(allocator, graph->node[n]->output[0], &values[out]);
+        if(initializer[n_initializer] == NULL)
+        {
+            // Nothing changed yet, the graph is left as it was
+            for(int32_t i = n_kept; i < n_initializer; i++)
+            {
+                onnx__tensor_proto__free_unpacked(initializer[i], allocator);
+            }
+            onnx_optimize_free(allocator, initializer);
+            initializer = NULL;
+            goto done;
+        }
+        n_initializer++;
+    }
+
+    // Rewrite the graph in place, keeping the order of what stays
+    int32_t n_removed_initializers = 0, n_removed_inputs = 0, n_inputs = 0;
+    for(size_t i = 0; i < graph->n_initializer; i++)
+    {
+        if(!onnx_optimize_live(index, live, graph->initializer[i]->name))
+        {
+            removed_initializers[n_removed_initializers++] = graph->initializer[i];
+        }
+    }
+    onnx_optimize_free(allocator, graph->initializer);
+    graph->initializer = initializer;
+    graph->n_initializer = n_initializer;
+    initializer = NULL;
+
+    // Graph inputs that only carried a dropped initializer go as well
+    for(size_t i = 0; i < graph->n_input; i++)
+    {
+        int32_t t = onnx_graph_index_get_tensor_id(index, graph->input[i]->name);
+        if(i > 0 && t >= 0 && index->initializer_ids[t] >= 0 && !live[t])
+        {
+            removed_inputs[n_removed_inputs++] = graph->input[i];
+            continue;
+        }
+        graph->input[n_inputs++] = graph->input[i];
+    }
+    graph->n_input = n_inputs;
+
+    n_removed = 0;
+    for(int32_t n = 0; n < n_nodes; n++)
+    {
+        if(!keep[n])
+        {
+            removed_nodes[n_removed++] = graph->node[n];
+            continue;
+        }
+        graph->node[n - n_removed] = graph->node[n];
+    }
+    graph->n_node = n_nodes - n_removed;
+
+    // The index holds names and views of what is about to be freed
+    onnx_graph_index_free(index);
+    index = NULL;
+    for(int32_t i = 0; i < n_removed; i++)
+    {
+        onnx__node_proto__free_unpacked(removed_nodes[i], allocator);
+    }
+    for(int32_t i = 0; i < n_removed_initializers; i++)
+    {
+        onnx__tensor_proto__free_unpacked(removed_initializers[i], allocator);
+    }
+    for(int32_t i = 0; i < n_removed_inputs; i++)
+    {
+        onnx__value_info_proto__free_unpacked(removed_inputs[i], allocator);
+    }
+
+done:
+    for(int32_t t = 0; values != NULL && t < n_tensors; t++)
+    {
+        onnx_constant_release(&values[t]);
+    }
+    free(values);
+    free(constant);
+    free(live);
+    free(folded);
+    free(keep);
+    free(removed_nodes);
+    free(removed_initializers);
+    free(removed_inputs);
+    if(index != NULL)
+    {
+        onnx_graph_index_free(index);
+    }
+
+    return n_removed;
+}
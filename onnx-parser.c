@@ -1,5 +1,17 @@
 #include "onnx-parser.h"
 
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    #define ONNX_BIG_ENDIAN 1
+#else
+    #define ONNX_BIG_ENDIAN 0
+#endif
+
 const char* onnx_tensor_proto_data_type[] = {
     "Undefined", 
     "FLOAT",
@@ -26,6 +38,11 @@ Onnx__ModelProto* onnx_load_model(const char* onnx_file_name)
 
     // Get File Size
     fp = fopen(onnx_file_name,"rb"); 
+    if(fp == NULL)
+    {
+        printf("Failed to open %s\n", onnx_file_name);
+        return NULL;
+    }
     fseek(fp, 0L, SEEK_END);
     int sz = ftell(fp);
     fseek(fp, 0L, SEEK_SET);
@@ -36,6 +53,7 @@ Onnx__ModelProto* onnx_load_model(const char* onnx_file_name)
     if(buffer == NULL)
     {
         printf("Failed to malloc %d bytes memory for %s\n", sz, onnx_file_name);
+        fclose(fp);
         return NULL;
     }
     fread(buffer, sz, 1, fp);
@@ -47,6 +65,192 @@ Onnx__ModelProto* onnx_load_model(const char* onnx_file_name)
     return model;
 }
 
+// Models loaded by onnx_load_model_mmap and onnx_load_model_arena live in an
+// arena (and possibly reference a file mapping), so remember both until
+// onnx_unload_model is called. Models are loaded and unloaded from any
+// thread, so the list is only touched under onnx_model_records_lock.
+typedef struct onnx_model_record
+{
+    Onnx__ModelProto* model;
+    onnx_arena* arena;
+    unsigned char* map;
+    size_t map_size;
+    struct onnx_model_record* next;
+} onnx_model_record;
+
+static onnx_model_record* onnx_model_records = NULL;
+static pthread_mutex_t onnx_model_records_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Record of a model, NULL for models from onnx_load_model. Called with the lock held.
+static onnx_model_record* onnx_model_record_find(Onnx__ModelProto* model)
+{
+    onnx_model_record* record = onnx_model_records;
+    while(record != NULL && record->model != model)
+    {
+        record = record->next;
+    }
+    return record;
+}
+
+static unsigned char* onnx_map_file(const char* onnx_file_name, size_t* size)
+{
+    struct stat st;
+
+    int fd = open(onnx_file_name, O_RDONLY);
+    if(fd < 0)
+    {
+        printf("Failed to open %s\n", onnx_file_name);
+        return NULL;
+    }
+    if(fstat(fd, &st) != 0 || st.st_size <= 0)
+    {
+        printf("Failed to stat %s\n", onnx_file_name);
+        close(fd);
+        return NULL;
+    }
+
+    // The mapping is read-only: tensor payloads pointing into it must not be written
+    unsigned char* map = (unsigned char*) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+    {
+        printf("Failed to mmap %ld bytes for %s\n", (long) st.st_size, onnx_file_name);
+        return NULL;
+    }
+
+    *size = st.st_size;
+    return map;
+}
+
+static Onnx__ModelProto* onnx_load_model_record(const char* onnx_file_name, int keep_mapping)
+{
+    size_t map_size;
+    unsigned char* map = onnx_map_file(onnx_file_name, &map_size);
+    if(map == NULL)
+    {
+        return NULL;
+    }
+
+    onnx_model_record* record = (onnx_model_record*) malloc(sizeof(onnx_model_record));
+    if(record == NULL)
+    {
+        munmap(map, map_size);
+        return NULL;
+    }
+
+    // A copying load needs roughly the file size for payloads plus the tree;
+    // an aliased one only needs the tree
+    record->arena = onnx_arena_create(keep_mapping ? 0 : map_size + map_size / 4);
+    if(record->arena == NULL)
+    {
+        munmap(map, map_size);
+        free(record);
+        return NULL;
+    }
+
+    if(keep_mapping)
+    {
+        // raw_data and packed float_data point into the mapping instead of being copied
+        record->model = (Onnx__ModelProto*) protobuf_c_message_unpack_aliased(&onnx__model_proto__descriptor, &record->arena->allocator, map_size, map);
+        record->map = map;
+        record->map_size = map_size;
+    }
+    else
+    {
+        record->model = onnx__model_proto__unpack(&record->arena->allocator, map_size, map);
+        munmap(map, map_size);
+        record->map = NULL;
+        record->map_size = 0;
+    }
+
+    if(record->model == NULL)
+    {
+        printf("Failed to unpack %s\n", onnx_file_name);
+        if(record->map != NULL)
+        {
+            munmap(record->map, record->map_size);
+        }
+        onnx_arena_destroy(record->arena);
+        free(record);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&onnx_model_records_lock);
+    record->next = onnx_model_records;
+    onnx_model_records = record;
+    pthread_mutex_unlock(&onnx_model_records_lock);
+
+    return record->model;
+}
+
+Onnx__ModelProto* onnx_load_model_mmap(const char* onnx_file_name)
+{
+    return onnx_load_model_record(onnx_file_name, 1);
+}
+
+Onnx__ModelProto* onnx_load_model_arena(const char* onnx_file_name)
+{
+    return onnx_load_model_record(onnx_file_name, 0);
+}
+
+void onnx_unload_model(Onnx__ModelProto* model)
+{
+    if(model == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&onnx_model_records_lock);
+    onnx_model_record** link = &onnx_model_records;
+    while(*link != NULL && (*link)->model != model)
+    {
+        link = &(*link)->next;
+    }
+    onnx_model_record* record = *link;
+    if(record != NULL)
+    {
+        *link = record->next;
+    }
+    pthread_mutex_unlock(&onnx_model_records_lock);
+
+    if(record == NULL)
+    {
+        // Loaded by onnx_load_model
+        onnx__model_proto__free_unpacked(model, NULL);
+        return;
+    }
+
+    // The whole tree lives in the arena, no need to walk it
+    onnx_arena_destroy(record->arena);
+    if(record->map != NULL)
+    {
+        munmap(record->map, record->map_size);
+    }
+    free(record);
+}
+
+// File mapping the payloads of a model from onnx_load_model_mmap point into,
+// NULL for the other loaders
+const unsigned char* onnx_model_mapping(Onnx__ModelProto* model, size_t* size)
+{
+    pthread_mutex_lock(&onnx_model_records_lock);
+    onnx_model_record* record = onnx_model_record_find(model);
+    const unsigned char* map = record != NULL ? record->map : NULL;
+    *size = record != NULL ? record->map_size : 0;
+    pthread_mutex_unlock(&onnx_model_records_lock);
+    return map;
+}
+
+// Allocator the model was unpacked with, NULL for the system one
+ProtobufCAllocator* onnx_model_allocator(Onnx__ModelProto* model)
+{
+    pthread_mutex_lock(&onnx_model_records_lock);
+    onnx_model_record* record = onnx_model_record_find(model);
+    ProtobufCAllocator* allocator = record != NULL ? &record->arena->allocator : NULL;
+    pthread_mutex_unlock(&onnx_model_records_lock);
+    return allocator;
+}
+
 void onnx_model_info(Onnx__ModelProto* model)
 {
     printf("---- Model info ----\n");
@@ -108,14 +312,16 @@ void onnx_graph_info_sorted(Onnx__GraphProto* graph)
     // Nodes
     printf("---- Graph Node Info ----\n");
     printf("Graph nodes number: %ld\n", graph->n_node);
-    Onnx__NodeProto* node = onnx_graph_get_node_by_input(graph, graph->input[0]->name);
-
-    while(node != NULL)
+    onnx_graph_index* index = onnx_graph_index_create(graph);
+    if(index == NULL)
     {
-        onnx_graph_node_info(node);
-        node = onnx_graph_get_node_by_input(graph, node->output[0]);
+        return;
     }
-
+    for(int i = 0; i < index->n_order; i++)
+    {
+        onnx_graph_node_info(graph->node[index->order[i]]);
+    }
+    onnx_graph_index_free(index);
 }
 
 void onnx_graph_input_info(Onnx__ValueInfoProto* input)
@@ -190,13 +396,24 @@ void onnx_graph_initializer_info(Onnx__TensorProto* initializer)
         printf("%ld, ", initializer->dims[i]);
     }
     printf("]\n");
-    
-    printf("%s: [", initializer->name);    
-    for(int i = 0; i < initializer->n_float_data; i++)
+
+    onnx_tensor_view view;
+    if(onnx_tensor_view_init(initializer, &view) != 0)
     {
-        printf("%f, ", initializer->float_data[i]);
+        return;
     }
-    printf("]\n");
+    float* values = onnx_tensor_view_to_float(&view);
+    if(values != NULL)
+    {
+        printf("%s: [", initializer->name);    
+        for(int i = 0; i < view.n_elem; i++)
+        {
+            printf("%f, ", values[i]);
+        }
+        printf("]\n");
+        free(values);
+    }
+    onnx_tensor_view_release(&view);
 }
 
 Onnx__NodeProto* onnx_graph_get_node_by_name(Onnx__GraphProto* graph, const char* node_name)
@@ -233,21 +450,46 @@ Onnx__NodeProto* onnx_graph_get_node_by_input(Onnx__GraphProto* graph, const cha
     return NULL;
 }
 
-float* onnx_graph_get_weights_by_name(Onnx__GraphProto* graph, const char* node_name)
+Onnx__TensorProto* onnx_graph_get_initializer_by_name(Onnx__GraphProto* graph, const char* name)
 {
-    Onnx__TensorProto** initializer =  graph->initializer;
-
     for(int i = 0; i < graph->n_initializer; i++)
     {
-        if( strcmp(graph->initializer[i]->name, node_name) == 0)
+        if( strcmp(graph->initializer[i]->name, name) == 0)
         {
-            return graph->initializer[i]->float_data;
+            return graph->initializer[i];
         }
     }
 
     return NULL;
 }
 
+float* onnx_graph_get_weights_by_name(Onnx__GraphProto* graph, const char* node_name)
+{
+    Onnx__TensorProto* initializer = onnx_graph_get_initializer_by_name(graph, node_name);
+    if(initializer == NULL)
+    {
+        return NULL;
+    }
+
+    if(initializer->n_float_data > 0)
+    {
+        return initializer->float_data;
+    }
+
+    // raw_data can only be handed out as float* if it needs neither byte
+    // swapping nor realignment; use onnx_tensor_view_init otherwise
+#if !ONNX_BIG_ENDIAN
+    if(initializer->data_type == ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT &&
+       initializer->raw_data.data != NULL &&
+       ((uintptr_t) initializer->raw_data.data) % sizeof(float) == 0)
+    {
+        return (float*) initializer->raw_data.data;
+    }
+#endif
+
+    return NULL;
+}
+
 long* onnx_graph_get_dims_by_name(Onnx__GraphProto* graph, const char* node_name)
 {
     Onnx__TensorProto** initializer =  graph->initializer;
@@ -282,3 +524,262 @@ void onnx_graph_node_info(Onnx__NodeProto* node)
 {
     printf("%-12s: %-30s ->    %-30s [%s]\n", node->op_type, node->input[0], node->output[0], node->name);
 }
+
+size_t onnx_tensor_data_type_size(int data_type)
+{
+    switch(data_type)
+    {
+        case ONNX__TENSOR_PROTO__DATA_TYPE__BOOL:
+        case ONNX__TENSOR_PROTO__DATA_TYPE__INT8:
+        case ONNX__TENSOR_PROTO__DATA_TYPE__UINT8:
+            return 1;
+        case ONNX__TENSOR_PROTO__DATA_TYPE__INT16:
+        case ONNX__TENSOR_PROTO__DATA_TYPE__UINT16:
+        case ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT16:
+            return 2;
+        case ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT:
+        case ONNX__TENSOR_PROTO__DATA_TYPE__INT32:
+        case ONNX__TENSOR_PROTO__DATA_TYPE__UINT32:
+            return 4;
+        case ONNX__TENSOR_PROTO__DATA_TYPE__INT64:
+        case ONNX__TENSOR_PROTO__DATA_TYPE__UINT64:
+        case ONNX__TENSOR_PROTO__DATA_TYPE__DOUBLE:
+        case ONNX__TENSOR_PROTO__DATA_TYPE__COMPLEX64:
+            return 8;
+        case ONNX__TENSOR_PROTO__DATA_TYPE__COMPLEX128:
+            return 16;
+        default:
+            return 0;
+    }
+}
+
+// Narrow int32_data (int8/uint8/int16/uint16/bool/float16) or uint64_data
+// (uint32) into a freshly allocated array of the tensor's element size
+static void* onnx_tensor_narrow(const void* src, size_t src_size, size_t n_elem, size_t elem_size)
+{
+    unsigned char* dst = (unsigned char*) malloc(n_elem * elem_size + 1);
+    if(dst == NULL)
+    {
+        return NULL;
+    }
+
+    for(size_t i = 0; i < n_elem; i++)
+    {
+        uint64_t value = src_size == 4 ? (uint64_t)(uint32_t) ((const int32_t*) src)[i] : ((const uint64_t*) src)[i];
+        switch(elem_size)
+        {
+            case 1: dst[i] = (uint8_t) value; break;
+            case 2: ((uint16_t*) dst)[i] = (uint16_t) value; break;
+            case 4: ((uint32_t*) dst)[i] = (uint32_t) value; break;
+        }
+    }
+
+    return dst;
+}
+
+int onnx_tensor_view_init(Onnx__TensorProto* tensor, onnx_tensor_view* view)
+{
+    assert(tensor != NULL && view != NULL);
+
+    memset(view, 0, sizeof(onnx_tensor_view));
+    view->data_type = tensor->data_type;
+    view->n_dims = tensor->n_dims;
+    view->dims = tensor->dims;
+    view->elem_size = onnx_tensor_data_type_size(tensor->data_type);
+    if(view->elem_size == 0)
+    {
+        printf("Unsupported tensor data type %d for %s\n", tensor->data_type, tensor->name);
+        return -1;
+    }
+
+    view->n_elem = 1;
+    for(int i = 0; i < tensor->n_dims; i++)
+    {
+        if(tensor->dims[i] < 0)
+        {
+            return -1;
+        }
+        view->n_elem *= tensor->dims[i];
+    }
+    size_t bytes = view->n_elem * view->elem_size;
+
+    if(tensor->raw_data.len > 0)
+    {
+        if(tensor->raw_data.len != bytes)
+        {
+            printf("Tensor %s has %zu bytes of raw_data, expected %zu\n", tensor->name, tensor->raw_data.len, bytes);
+            return -1;
+        }
+
+        // raw_data is little-endian and carries no alignment guarantee
+        size_t align = view->elem_size > 8 ? 8 : view->elem_size;
+        if(!ONNX_BIG_ENDIAN && ((uintptr_t) tensor->raw_data.data) % align == 0)
+        {
+            view->data = tensor->raw_data.data;
+            return 0;
+        }
+
+        unsigned char* copy = (unsigned char*) malloc(bytes);
+        if(copy == NULL)
+        {
+            return -1;
+        }
+        memcpy(copy, tensor->raw_data.data, bytes);
+#if ONNX_BIG_ENDIAN
+        size_t word = view->elem_size > 8 ? view->elem_size / 2 : view->elem_size;
+        for(size_t i = 0; i < bytes; i += word)
+        {
+            for(size_t j = 0; j < word / 2; j++)
+            {
+                unsigned char t = copy[i + j];
+                copy[i + j] = copy[i + word - 1 - j];
+                copy[i + word - 1 - j] = t;
+            }
+        }
+#endif
+        view->data = view->owned = copy;
+        return 0;
+    }
+
+    // Typed storage fields, see onnx.proto
+    const void* src = NULL;
+    size_t n_src = 0;
+    size_t src_size = view->elem_size;
+    switch(tensor->data_type)
+    {
+        case ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT:
+        case ONNX__TENSOR_PROTO__DATA_TYPE__COMPLEX64:
+            src = tensor->float_data;
+            n_src = tensor->n_float_data * sizeof(float) / view->elem_size;
+            break;
+        case ONNX__TENSOR_PROTO__DATA_TYPE__DOUBLE:
+        case ONNX__TENSOR_PROTO__DATA_TYPE__COMPLEX128:
+            src = tensor->double_data;
+            n_src = tensor->n_double_data * sizeof(double) / view->elem_size;
+            break;
+        case ONNX__TENSOR_PROTO__DATA_TYPE__INT64:
+            src = tensor->int64_data;
+            n_src = tensor->n_int64_data;
+            break;
+        case ONNX__TENSOR_PROTO__DATA_TYPE__UINT64:
+        case ONNX__TENSOR_PROTO__DATA_TYPE__UINT32:
+            src = tensor->uint64_data;
+            n_src = tensor->n_uint64_data;
+            src_size = sizeof(uint64_t);
+            break;
+        default:
+            src = tensor->int32_data;
+            n_src = tensor->n_int32_data;
+            src_size = sizeof(int32_t);
+            break;
+    }
+
+    if(n_src != view->n_elem)
+    {
+        printf("Tensor %s has %zu elements, expected %zu\n", tensor->name, n_src, view->n_elem);
+        return -1;
+    }
+
+    if(src_size == view->elem_size || view->n_elem == 0)
+    {
+        view->data = src;
+        return 0;
+    }
+
+    view->owned = onnx_tensor_narrow(src, src_size, view->n_elem, view->elem_size);
+    if(view->owned == NULL)
+    {
+        return -1;
+    }
+    view->data = view->owned;
+
+    return 0;
+}
+
+void onnx_tensor_view_release(onnx_tensor_view* view)
+{
+    if(view != NULL)
+    {
+        free(view->owned);
+        view->owned = NULL;
+        view->data = NULL;
+    }
+}
+
+static float onnx_half_to_float(uint16_t h)
+{
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exponent = (h >> 10) & 0x1f;
+    uint32_t mantissa = h & 0x3ff;
+    uint32_t bits;
+
+    if(exponent == 0x1f)
+    {
+        // Inf / NaN
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    }
+    else if(exponent != 0)
+    {
+        bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    }
+    else if(mantissa != 0)
+    {
+        // Subnormal half becomes a normal float
+        exponent = 113;
+        while((mantissa & 0x400) == 0)
+        {
+            mantissa <<= 1;
+            exponent--;
+        }
+        bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+    }
+    else
+    {
+        bits = sign;
+    }
+
+    float f;
+    memcpy(&f, &bits, sizeof(float));
+    return f;
+}
+
+float* onnx_tensor_view_to_float(const onnx_tensor_view* view)
+{
+    assert(view != NULL);
+
+    if(view->data_type == ONNX__TENSOR_PROTO__DATA_TYPE__COMPLEX64 ||
+       view->data_type == ONNX__TENSOR_PROTO__DATA_TYPE__COMPLEX128)
+    {
+        return NULL;
+    }
+
+    float* output = (float*) malloc(sizeof(float) * (view->n_elem + 1));
+    if(output == NULL)
+    {
+        return NULL;
+    }
+
+    for(size_t i = 0; i < view->n_elem; i++)
+    {
+        switch(view->data_type)
+        {
+            case ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT:   output[i] = ((const float*) view->data)[i]; break;
+            case ONNX__TENSOR_PROTO__DATA_TYPE__DOUBLE:  output[i] = ((const double*) view->data)[i]; break;
+            case ONNX__TENSOR_PROTO__DATA_TYPE__FLOAT16: output[i] = onnx_half_to_float(((const uint16_t*) view->data)[i]); break;
+            case ONNX__TENSOR_PROTO__DATA_TYPE__BOOL:
+            case ONNX__TENSOR_PROTO__DATA_TYPE__UINT8:   output[i] = ((const uint8_t*) view->data)[i]; break;
+            case ONNX__TENSOR_PROTO__DATA_TYPE__INT8:    output[i] = ((const int8_t*) view->data)[i]; break;
+            case ONNX__TENSOR_PROTO__DATA_TYPE__UINT16:  output[i] = ((const uint16_t*) view->data)[i]; break;
+            case ONNX__TENSOR_PROTO__DATA_TYPE__INT16:   output[i] = ((const int16_t*) view->data)[i]; break;
+            case ONNX__TENSOR_PROTO__DATA_TYPE__INT32:   output[i] = ((const int32_t*) view->data)[i]; break;
+            case ONNX__TENSOR_PROTO__DATA_TYPE__UINT32:  output[i] = ((const uint32_t*) view->data)[i]; break;
+            case ONNX__TENSOR_PROTO__DATA_TYPE__INT64:   output[i] = ((const int64_t*) view->data)[i]; break;
+            case ONNX__TENSOR_PROTO__DATA_TYPE__UINT64:  output[i] = ((const uint64_t*) view->data)[i]; break;
+            default:
+                free(output);
+                return NULL;
+        }
+    }
+
+    return output;
+}
@@ -4,10 +4,75 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <assert.h>
 
 #include "onnx.pb-c.h"
+#include "onnx-arena.h"
+
+// Typed, read-only view of a tensor's payload in its natural element layout.
+// data points into the model whenever possible; otherwise (misaligned
+// raw_data, narrowed int32_data/uint64_data, big-endian hosts) it points to
+// an aligned copy owned by the view and released by onnx_tensor_view_release.
+typedef struct onnx_tensor_view
+{
+    Onnx__TensorProto__DataType data_type;
+    size_t n_dims;
+    const int64_t* dims;
+    size_t n_elem;
+    size_t elem_size;
+    const void* data;
+    void* owned;
+} onnx_tensor_view;
+
+// Name lookup tables for a graph, built once after load. Open addressing with
+// linear probing; capacities are powers of two kept at most half full.
+typedef struct onnx_index_slot
+{
+    uint32_t hash;
+    int32_t  index;     // position in graph->node / graph->initializer, -1 if empty
+} onnx_index_slot;
+
+typedef struct onnx_index_table
+{
+    onnx_index_slot* slots;
+    uint32_t mask;
+} onnx_index_table;
+
+// Every tensor name in the graph (graph inputs, initializers, node inputs and
+// outputs) gets a dense integer id. Edges are stored as CSR arrays:
+// the inputs of node n are node_inputs[node_input_offsets[n] .. node_input_offsets[n+1]),
+// the consumers of tensor t are consumers[consumer_offsets[t] .. consumer_offsets[t+1]).
+// Missing optional inputs ("") map to tensor id -1.
+typedef struct onnx_graph_index
+{
+    Onnx__GraphProto* graph;
+    onnx_index_table nodes;
+    onnx_index_table initializers;
+    onnx_tensor_view* views;    // one per initializer
+
+    onnx_index_table tensors;
+    int32_t n_tensors;
+    const char** tensor_names;
+    int32_t* producers;         // producing node per tensor, -1 for inputs and initializers
+    int32_t* initializer_ids;   // initializer per tensor, -1 if not an initializer
+    int32_t* consumer_offsets;
+    int32_t* consumers;
+    int32_t* node_input_offsets;
+    int32_t* node_inputs;
+    int32_t* node_output_offsets;
+    int32_t* node_outputs;
+
+    int32_t n_order;            // < n_node if the graph has a cycle
+    int32_t* order;             // nodes in topological order
+} onnx_graph_index;
 
 Onnx__ModelProto* onnx_load_model(const char* onnx_file_name);
+Onnx__ModelProto* onnx_load_model_mmap(const char* onnx_file_name);
+Onnx__ModelProto* onnx_load_model_arena(const char* onnx_file_name);
+void onnx_unload_model(Onnx__ModelProto* model);
+ProtobufCAllocator* onnx_model_allocator(Onnx__ModelProto* model);
+const unsigned char* onnx_model_mapping(Onnx__ModelProto* model, size_t* size);
 void onnx_model_info(Onnx__ModelProto* model);
 void onnx_graph_info(Onnx__GraphProto* graph);
 void onnx_graph_info_sorted(Onnx__GraphProto* graph);
@@ -21,7 +86,39 @@ Onnx__NodeProto* onnx_graph_get_node_by_input(Onnx__GraphProto* graph, const cha
 long* onnx_graph_get_dims_by_name(Onnx__GraphProto* graph, const char* node_name);
 long onnx_graph_get_dim_by_name(Onnx__GraphProto* graph, const char* node_name);
 float* onnx_graph_get_weights_by_name(Onnx__GraphProto* graph, const char* node_name);
+Onnx__TensorProto* onnx_graph_get_initializer_by_name(Onnx__GraphProto* graph, const char* name);
+
+size_t onnx_tensor_data_type_size(int data_type);
+int    onnx_tensor_view_init(Onnx__TensorProto* tensor, onnx_tensor_view* view);
+void   onnx_tensor_view_release(onnx_tensor_view* view);
+float* onnx_tensor_view_to_float(const onnx_tensor_view* view);
 
 void onnx_graph_value_tensor_shape_dimension_info(Onnx__TensorShapeProto__Dimension* dim);
 
+onnx_graph_index* onnx_graph_index_create(Onnx__GraphProto* graph);
+void onnx_graph_index_free(onnx_graph_index* index);
+
+Onnx__NodeProto* onnx_graph_index_get_node_by_name(onnx_graph_index* index, const char* node_name);
+Onnx__TensorProto* onnx_graph_index_get_initializer_by_name(onnx_graph_index* index, const char* name);
+const onnx_tensor_view* onnx_graph_index_get_view_by_name(onnx_graph_index* index, const char* name);
+float* onnx_graph_index_get_weights_by_name(onnx_graph_index* index, const char* name);
+int64_t* onnx_graph_index_get_dims_by_name(onnx_graph_index* index, const char* name);
+int64_t onnx_graph_index_get_dim_by_name(onnx_graph_index* index, const char* name);
+
+int32_t onnx_graph_index_get_tensor_id(onnx_graph_index* index, const char* name);
+int32_t onnx_graph_index_get_producer(onnx_graph_index* index, int32_t tensor);
+const int32_t* onnx_graph_index_get_consumers(onnx_graph_index* index, int32_t tensor, int32_t* n_consumers);
+int32_t onnx_graph_index_toposort(onnx_graph_index* index, int32_t* order);
+
+// Load-time graph cleanup. Nodes whose inputs are all initializers (Constant,
+// shape arithmetic feeding a Reshape, weight Transposes, Identity chains) are
+// evaluated once and replaced by initializers holding their outputs; nodes and
+// initializers no graph output depends on are dropped. Only FLOAT and INT64
+// values are folded, anything else is left in the graph. The first graph input
+// is the model input even when it also has an initializer. The model must come
+// from one of the onnx_load_model functions, since removed parts are freed and
+// new ones allocated the way the model was. Returns the number of nodes
+// removed, or -1 when the graph is left untouched.
+int onnx_model_optimize(Onnx__ModelProto* model);
+
 #endif //__ONNX_PARSER_H__
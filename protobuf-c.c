@@ -2106,6 +2106,7 @@ struct _ScannedMember {
 	const ProtobufCFieldDescriptor *field; /**< Field descriptor. */
 	size_t len;                /**< Field length. */
 	const uint8_t *data;       /**< Pointer to field data. */
+	protobuf_c_boolean alias;  /**< Alias payloads instead of copying. */
 };
 
 static inline size_t
@@ -2496,6 +2497,12 @@ parse_boolean(unsigned len, const uint8_t *data)
 	return FALSE;
 }
 
+static ProtobufCMessage *
+message_unpack(const ProtobufCMessageDescriptor *desc,
+	       ProtobufCAllocator *allocator,
+	       size_t len, const uint8_t *data,
+	       protobuf_c_boolean alias);
+
 static protobuf_c_boolean
 parse_required_member(ScannedMember *scanned_member,
 		      void *member,
@@ -2585,7 +2592,9 @@ parse_required_member(ScannedMember *scanned_member,
 		{
 			do_free(allocator, bd->data);
 		}
-		if (len - pref_len > 0) {
+		if (len - pref_len > 0 && scanned_member->alias) {
+			bd->data = (uint8_t *) data + pref_len;
+		} else if (len - pref_len > 0) {
 			bd->data = do_alloc(allocator, len - pref_len);
 			if (bd->data == NULL)
 				return FALSE;
@@ -2607,10 +2616,11 @@ parse_required_member(ScannedMember *scanned_member,
 			return FALSE;
 
 		def_mess = scanned_member->field->default_value;
-		subm = protobuf_c_message_unpack(scanned_member->field->descriptor,
-						 allocator,
-						 len - pref_len,
-						 data + pref_len);
+		subm = message_unpack(scanned_member->field->descriptor,
+				      allocator,
+				      len - pref_len,
+				      data + pref_len,
+				      scanned_member->alias);
 
 		if (maybe_clear &&
 		    *pmessage != NULL &&
@@ -2863,7 +2873,9 @@ parse_packed_repeated_member(ScannedMember *scanned_member,
 
 #if !defined(WORDS_BIGENDIAN)
 no_unpacking_needed:
-	memcpy(array, at, count * siz);
+	/* the array may already alias the payload, see aliased_packed_array() */
+	if (array != (const void *) at)
+		memcpy(array, at, count * siz);
 	*p_n += count;
 	return TRUE;
 #endif
@@ -3021,10 +3033,85 @@ message_init_generic(const ProtobufCMessageDescriptor *desc,
 #define REQUIRED_FIELD_BITMAP_IS_SET(index)	\
 	(required_fields_bitmap[(index)/8] & (1UL<<((index)%8)))
 
+/*
+ * Returns the payload of a packed repeated fixed-width field if it can be
+ * used in place: the field must have been encoded as exactly one
+ * length-prefixed chunk, and the payload must be naturally aligned for the
+ * element type. Returns NULL if the field has to be copied.
+ */
+static const uint8_t *
+aliased_packed_array(const ProtobufCFieldDescriptor *field,
+		     ScannedMember **slabs,
+		     unsigned which_slab,
+		     unsigned in_slab_index)
+{
+#if !defined(WORDS_BIGENDIAN)
+	const ScannedMember *found = NULL;
+	size_t siz;
+	unsigned i_slab, j;
+
+	switch (field->type) {
+	case PROTOBUF_C_TYPE_SFIXED32:
+	case PROTOBUF_C_TYPE_FIXED32:
+	case PROTOBUF_C_TYPE_FLOAT:
+	case PROTOBUF_C_TYPE_SFIXED64:
+	case PROTOBUF_C_TYPE_FIXED64:
+	case PROTOBUF_C_TYPE_DOUBLE:
+		break;
+	default:
+		return NULL;
+	}
+
+	for (i_slab = 0; i_slab <= which_slab; i_slab++) {
+		unsigned max = (i_slab == which_slab) ?
+			in_slab_index : (1UL << (i_slab + 4));
+		for (j = 0; j < max; j++) {
+			if (slabs[i_slab][j].field != field)
+				continue;
+			if (found != NULL ||
+			    slabs[i_slab][j].wire_type !=
+			    PROTOBUF_C_WIRE_TYPE_LENGTH_PREFIXED)
+				return NULL;
+			found = &slabs[i_slab][j];
+		}
+	}
+	if (found == NULL)
+		return NULL;
+
+	siz = sizeof_elt_in_repeated_array(field->type);
+	if (((uintptr_t) (found->data + found->length_prefix_len)) % siz != 0)
+		return NULL;
+	return found->data + found->length_prefix_len;
+#else
+	(void) field;
+	(void) slabs;
+	(void) which_slab;
+	(void) in_slab_index;
+	return NULL;
+#endif
+}
+
 ProtobufCMessage *
 protobuf_c_message_unpack(const ProtobufCMessageDescriptor *desc,
 			  ProtobufCAllocator *allocator,
 			  size_t len, const uint8_t *data)
+{
+	return message_unpack(desc, allocator, len, data, FALSE);
+}
+
+ProtobufCMessage *
+protobuf_c_message_unpack_aliased(const ProtobufCMessageDescriptor *desc,
+				  ProtobufCAllocator *allocator,
+				  size_t len, const uint8_t *data)
+{
+	return message_unpack(desc, allocator, len, data, TRUE);
+}
+
+static ProtobufCMessage *
+message_unpack(const ProtobufCMessageDescriptor *desc,
+	       ProtobufCAllocator *allocator,
+	       size_t len, const uint8_t *data,
+	       protobuf_c_boolean alias)
 {
 	ProtobufCMessage *rv;
 	size_t rem = len;
@@ -3128,6 +3215,7 @@ protobuf_c_message_unpack(const ProtobufCMessageDescriptor *desc,
 		tmp.field = field;
 		tmp.data = at;
 		tmp.length_prefix_len = 0;
+		tmp.alias = alias;
 
 		switch (wire_type) {
 		case PROTOBUF_C_WIRE_TYPE_VARINT: {
@@ -3246,6 +3334,18 @@ protobuf_c_message_unpack(const ProtobufCMessageDescriptor *desc,
                   if (field->label == PROTOBUF_C_LABEL_REPEATED)              \
                     STRUCT_MEMBER (size_t, rv, field->quantifier_offset) = 0; \
                 }
+				if (alias) {
+					const uint8_t *in_place =
+						aliased_packed_array(field,
+							scanned_member_slabs,
+							which_slab,
+							in_slab_index);
+					if (in_place != NULL) {
+						STRUCT_MEMBER(void *, rv, field->offset) =
+							(void *) in_place;
+						continue;
+					}
+				}
 				a = do_alloc(allocator, siz * n);
 				if (!a) {
 					CLEAR_REMAINING_N_PTRS();
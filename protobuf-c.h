@@ -958,6 +958,45 @@ protobuf_c_message_unpack(
 	size_t len,
 	const uint8_t *data);
 
+/**
+ * Unpack a serialised message without copying large payloads.
+ *
+ * Behaves like protobuf_c_message_unpack(), except that `bytes` fields and
+ * packed repeated fixed-width fields (float, double, fixed32, fixed64) are
+ * not copied out of `data`: the unpacked message points directly into the
+ * serialised buffer instead. Packed fields are only aliased when they are
+ * encoded as a single chunk whose storage is naturally aligned for the
+ * element type (and never on big-endian hosts); otherwise they are copied as
+ * usual. Strings are always copied since they need a terminating NUL.
+ *
+ * The caller must keep `data` alive (and unmodified) for the lifetime of the
+ * message, and `allocator->free` must ignore pointers that fall inside
+ * `[data, data + len)` when the message is released with
+ * protobuf_c_message_free_unpacked().
+ *
+ * \param descriptor
+ *      The message descriptor.
+ * \param allocator
+ *      `ProtobufCAllocator` to use for memory allocation. May be NULL to
+ *      specify the default allocator, in which case the message must not be
+ *      released with protobuf_c_message_free_unpacked().
+ * \param len
+ *      Length in bytes of the serialised message.
+ * \param data
+ *      Pointer to the serialised message.
+ * \return
+ *      An unpacked message object.
+ * \retval NULL
+ *      If an error occurred during unpacking.
+ */
+PROTOBUF_C__API
+ProtobufCMessage *
+protobuf_c_message_unpack_aliased(
+	const ProtobufCMessageDescriptor *descriptor,
+	ProtobufCAllocator *allocator,
+	size_t len,
+	const uint8_t *data);
+
 /**
  * Free an unpacked message object.
  *